@@ -0,0 +1,293 @@
+// Copyright (c) 2021 Xeni Robotics
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* **********************************************************************
+ * Point cloud integration benchmark.  Replays clouds through the path of
+ * the map server (rosToUfo with the sensor transform, then
+ * insertPointCloudDiscrete) for every combination of the integration
+ * parameters, and reports points/s, latency percentiles per stage and
+ * the memory of the map built.
+ *
+ *   integration_benchmark [--bag <uri> [--topic <topic>]] [--frames <n>]
+ *                         [--resolution <m>] [--insert_depth 0,1,2]
+ *                         [--simple_ray_casting 0,1] [--early_stopping 0,4]
+ *                         [--max_range -1,20] [--csv]
+ *
+ * Without a bag, the clouds are synthetic: a lidar of 16 x 900 beams
+ * flying at 2 m over a forest of tree trunks, 1 m further every frame.
+ * Clouds from a bag are integrated at the origin, as the bag holds no
+ * poses the benchmark could rely on.  The ray casting cost of a cloud
+ * depends on its geometry, not on where it is put in the map.
+ * Reading bags needs rosbag2_cpp at build time.
+ * ***********************************************************************/
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <ufo/map/occupancy_map.h>
+#include <ufo/map/point_cloud.h>
+#include <ufo/math/pose6.h>
+
+#include "sensor_msgs/msg/point_cloud2.hpp"
+
+#include "navigation_lite/ufomap_ros_conversions.h"
+
+#ifdef NAVIGATION_LITE_HAVE_ROSBAG2
+#include "rclcpp/serialization.hpp"
+#include "rosbag2_cpp/reader.hpp"
+#include "rosbag2_storage/storage_options.hpp"
+#endif
+
+struct Frame
+{
+  sensor_msgs::msg::PointCloud2 cloud;    // In the sensor frame
+  ufo::math::Pose6 sensor;                // In the map frame
+};
+
+struct Settings
+{
+  int insert_depth;
+  bool simple_ray_casting;
+  int early_stopping;
+  double max_range;
+};
+
+static std::vector<double> parseList(const char *list)
+{
+  std::vector<double> values;
+  std::string s(list);
+  size_t start = 0;
+  while (start <= s.size()) {
+    size_t end = s.find(',', start);
+    if (end == std::string::npos) end = s.size();
+    values.push_back(std::atof(s.substr(start, end - start).c_str()));
+    start = end + 1;
+  }
+  return values;
+}
+
+// The p-th percentile of samples, with p in 0..100.  Sorts samples.
+static double percentile(std::vector<double> &samples, double p)
+{
+  if (samples.empty()) return 0.0;
+  std::sort(samples.begin(), samples.end());
+  size_t index = (size_t)std::round(p / 100.0 * (samples.size() - 1));
+  return samples[index];
+}
+
+/* *** SYNTHETIC CLOUDS *** */
+
+// Trunks of 0.2 to 0.5 m radius, on a jittered grid of 4 m, and the ground at z = 0.  Returns the
+// range along the beam from origin in direction, or max_range when it hits nothing.
+struct Forest
+{
+  struct Trunk { double x, y, radius; };
+  std::vector<Trunk> trunks;
+
+  explicit Forest(double length)
+  {
+    std::mt19937 random(42);
+    std::uniform_real_distribution<double> jitter(-1.5, 1.5), radius(0.2, 0.5);
+    for (double x = -20.0; x < length + 20.0; x += 4.0) {
+      for (double y = -20.0; y <= 20.0; y += 4.0) {
+        trunks.push_back(Trunk{x + jitter(random), y + jitter(random), radius(random)});
+      }
+    }
+  }
+
+  double cast(const double origin[3], const double direction[3], double max_range) const
+  {
+    double range = max_range;
+    if (direction[2] < 0) {
+      range = std::min(range, -origin[2] / direction[2]);
+    }
+    double a = direction[0] * direction[0] + direction[1] * direction[1];
+    if (a < 1e-9) return range;
+    for (auto &t : trunks) {
+      double dx = origin[0] - t.x, dy = origin[1] - t.y;
+      double b = dx * direction[0] + dy * direction[1];
+      double c = dx * dx + dy * dy - t.radius * t.radius;
+      double d = b * b - a * c;
+      if (d < 0) continue;
+      double hit = (-b - std::sqrt(d)) / a;
+      if ((hit > 0) && (hit < range)) range = hit;
+    }
+    return range;
+  }
+};
+
+static std::vector<Frame> syntheticFrames(int count)
+{
+  const int rings = 16, steps = 900;
+  const double max_range = 30.0;
+  Forest forest(count);
+
+  std::vector<Frame> frames(count);
+  for (int f = 0; f < count; f++) {
+    double origin[3] = { (double)f, 0.5, 2.0 };
+    ufo::map::PointCloud cloud;
+    cloud.reserve(rings * steps);
+    for (int r = 0; r < rings; r++) {
+      double elevation = (-15.0 + 2.0 * r) * M_PI / 180.0;
+      for (int s = 0; s < steps; s++) {
+        double azimuth = 2.0 * M_PI * s / steps;
+        double direction[3] = { std::cos(elevation) * std::cos(azimuth),
+                                std::cos(elevation) * std::sin(azimuth),
+                                std::sin(elevation) };
+        double range = forest.cast(origin, direction, max_range);
+        if (range >= max_range) continue;    // No return
+        cloud.push_back(ufo::map::Point3(range * direction[0], range * direction[1], range * direction[2]));
+      }
+    }
+    ufomap_ros::ufoToRos(cloud, frames[f].cloud);
+    frames[f].sensor = ufo::math::Pose6(origin[0], origin[1], origin[2], 1.0, 0.0, 0.0, 0.0);
+  }
+  return frames;
+}
+
+/* *** RECORDED CLOUDS *** */
+
+static bool bagFrames(const std::string &uri, const std::string &topic, int count, std::vector<Frame> &frames)
+{
+#ifdef NAVIGATION_LITE_HAVE_ROSBAG2
+  rosbag2_storage::StorageOptions storage_options;
+  storage_options.uri = uri;
+  rosbag2_cpp::Reader reader;
+  reader.open(storage_options);
+
+  rclcpp::Serialization<sensor_msgs::msg::PointCloud2> serialization;
+  while (reader.has_next() && ((int)frames.size() < count)) {
+    auto bag_message = reader.read_next();
+    if (bag_message->topic_name != topic) continue;
+    rclcpp::SerializedMessage serialized(*bag_message->serialized_data);
+    Frame frame;
+    serialization.deserialize_message(&serialized, &frame.cloud);
+    frame.sensor = ufo::math::Pose6(0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0);
+    frames.push_back(std::move(frame));
+  }
+  return !frames.empty();
+#else
+  (void)uri; (void)topic; (void)count; (void)frames;
+  std::fprintf(stderr, "Built without rosbag2_cpp.  Only synthetic clouds.\n");
+  return false;
+#endif
+}
+
+/* *** BENCHMARK *** */
+
+static void run(const std::vector<Frame> &frames, double resolution, const Settings &settings, bool csv)
+{
+  ufo::map::OccupancyMap map(resolution);
+  ufo::map::PointCloudColor cloud;
+  std::vector<double> convert_ms, insert_ms, total_ms;
+  size_t points = 0;
+
+  for (auto &frame : frames) {
+    auto t0 = std::chrono::steady_clock::now();
+    ufomap_ros::rosToUfo(frame.cloud, frame.sensor, cloud);
+    auto t1 = std::chrono::steady_clock::now();
+    map.insertPointCloudDiscrete(frame.sensor.translation(), cloud, settings.max_range,
+                                 (ufo::map::DepthType)settings.insert_depth, settings.simple_ray_casting,
+                                 (unsigned int)settings.early_stopping, false);
+    auto t2 = std::chrono::steady_clock::now();
+
+    points += cloud.size();
+    convert_ms.push_back(std::chrono::duration<double, std::milli>(t1 - t0).count());
+    insert_ms.push_back(std::chrono::duration<double, std::milli>(t2 - t1).count());
+    total_ms.push_back(std::chrono::duration<double, std::milli>(t2 - t0).count());
+  }
+
+  double seconds = 0;
+  for (double ms : total_ms) seconds += ms / 1000.0;
+  double points_per_second = (seconds > 0) ? points / seconds : 0.0;
+  double memory_mb = map.memoryUsage() / (1024.0 * 1024.0);
+
+  double c50 = percentile(convert_ms, 50), c99 = percentile(convert_ms, 99);
+  double i50 = percentile(insert_ms, 50), i90 = percentile(insert_ms, 90), i99 = percentile(insert_ms, 99);
+  double t50 = percentile(total_ms, 50), t99 = percentile(total_ms, 99), tmax = total_ms.empty() ? 0 : total_ms.back();
+
+  if (csv) {
+    std::printf("%d,%d,%d,%.1f,%.0f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.1f\n",
+      settings.insert_depth, (int)settings.simple_ray_casting, settings.early_stopping, settings.max_range,
+      points_per_second, c50, c99, i50, i90, i99, t50, t99, tmax, memory_mb);
+  } else {
+    std::printf("%5d %6d %6d %7.1f | %11.0f | %7.2f %7.2f | %7.2f %7.2f %7.2f | %7.2f %7.2f %7.2f | %8.1f\n",
+      settings.insert_depth, (int)settings.simple_ray_casting, settings.early_stopping, settings.max_range,
+      points_per_second, c50, c99, i50, i90, i99, t50, t99, tmax, memory_mb);
+  }
+  std::fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+  std::string bag, topic = "pointcloud";
+  int frame_count = 50;
+  double resolution = 0.1;
+  std::vector<double> insert_depths{0, 1, 2}, simple_ray_castings{0, 1}, early_stoppings{0}, max_ranges{-1};
+  bool csv = false;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    bool has_value = (i + 1 < argc);
+    if (arg == "--csv") csv = true;
+    else if (arg == "--bag" && has_value) bag = argv[++i];
+    else if (arg == "--topic" && has_value) topic = argv[++i];
+    else if (arg == "--frames" && has_value) frame_count = std::max(1, std::atoi(argv[++i]));
+    else if (arg == "--resolution" && has_value) resolution = std::atof(argv[++i]);
+    else if (arg == "--insert_depth" && has_value) insert_depths = parseList(argv[++i]);
+    else if (arg == "--simple_ray_casting" && has_value) simple_ray_castings = parseList(argv[++i]);
+    else if (arg == "--early_stopping" && has_value) early_stoppings = parseList(argv[++i]);
+    else if (arg == "--max_range" && has_value) max_ranges = parseList(argv[++i]);
+    else {
+      std::fprintf(stderr, "Unknown argument %s.  See the head of integration_benchmark.cpp\n", argv[i]);
+      return 1;
+    }
+  }
+
+  // Decode all clouds first, so reading the bag is not timed
+  std::vector<Frame> frames;
+  if (bag.empty()) {
+    frames = syntheticFrames(frame_count);
+  } else if (!bagFrames(bag, topic, frame_count, frames)) {
+    std::fprintf(stderr, "No clouds on %s in %s\n", topic.c_str(), bag.c_str());
+    return 1;
+  }
+  size_t cloud_points = 0;
+  for (auto &frame : frames) cloud_points += frame.cloud.width * frame.cloud.height;
+  std::fprintf(stderr, "%zu frames, %zu points, resolution %.3f m\n", frames.size(), cloud_points, resolution);
+
+  if (csv) {
+    std::printf("insert_depth,simple_ray_casting,early_stopping,max_range,points_per_s,"
+                "convert_p50_ms,convert_p99_ms,insert_p50_ms,insert_p90_ms,insert_p99_ms,"
+                "total_p50_ms,total_p99_ms,total_max_ms,map_mb\n");
+  } else {
+    std::printf("depth simple early  range |    points/s | convert p50/p99 |  insert p50/p90/p99 |   total p50/p99/max |  map MB\n");
+  }
+  for (double depth : insert_depths) {
+    for (double simple : simple_ray_castings) {
+      for (double early : early_stoppings) {
+        for (double range : max_ranges) {
+          run(frames, resolution, Settings{(int)depth, simple != 0, (int)early, range}, csv);
+        }
+      }
+    }
+  }
+  return 0;
+}
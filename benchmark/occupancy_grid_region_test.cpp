@@ -0,0 +1,149 @@
+// Copyright (c) 2021 Xeni Robotics
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* **********************************************************************
+ * Checks the region form of OccupancyGrid::update() against the full
+ * one.  Two grids start from the same random cells.  Each round the
+ * cells in a random box change; one grid is given all the cells, the
+ * other only those around the box, with the box.  Both must report the
+ * same changed points and end up with the same layers.  A last round
+ * gives a box around everything, so the rebuild path is checked too.
+ *
+ *   occupancy_grid_region_test [--seed <n>] [--rounds <n>]
+ *
+ * Exits with 0 when the grids always agree.
+ * ***********************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <array>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "navigation_lite/occupancy_grid.h"
+
+typedef std::array<int, 3> Cell;
+
+static const int EXTENT = 30;        // Cells are in -EXTENT..EXTENT in x and y
+static const int HEIGHT = 10;        // and 0..HEIGHT-1 in z
+static const Cell BOX_SIZE = {12, 12, 3};
+
+static bool inside(const Cell &cell, const Cell &min, const Cell &max)
+{
+  for (int i = 0; i < 3; i++) {
+    if ((cell[i] < min[i]) || (cell[i] > max[i])) return false;
+  }
+  return true;
+}
+
+// Update a with all the cells and b with the region, and compare what they did
+static bool compare(OccupancyGrid &a, OccupancyGrid &b, const Cell &min, const Cell &max,
+                    const std::vector<Cell> &cells, const std::vector<Cell> &region_cells, int round)
+{
+  std::vector<Cell> changed_a, changed_b;
+  a.update(cells, changed_a);
+  b.update(min, max, region_cells, changed_b);
+
+  std::set<Cell> set_a(changed_a.begin(), changed_a.end()), set_b(changed_b.begin(), changed_b.end());
+  if (set_a != set_b) {
+    std::printf("round %d: %zu points changed in the full update, %zu in the region update\n",
+      round, set_a.size(), set_b.size());
+    return false;
+  }
+
+  for (int x = -EXTENT - 5; x <= EXTENT + BOX_SIZE[0] + 5; x++) {
+    for (int y = -EXTENT - 5; y <= EXTENT + BOX_SIZE[1] + 5; y++) {
+      for (int z = -5; z <= HEIGHT + BOX_SIZE[2] + 5; z++) {
+        if ((a.isOccupied(x, y, z) != b.isOccupied(x, y, z)) ||
+            (a.isCellOccupied(x, y, z) != b.isCellOccupied(x, y, z))) {
+          std::printf("round %d: the grids differ at %d,%d,%d\n", round, x, y, z);
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+static bool run(double radius, unsigned seed, int rounds)
+{
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> xy(-EXTENT, EXTENT), z(0, HEIGHT - 1);
+
+  std::vector<Cell> cells;
+  for (int i = 0; i < 800; i++) cells.push_back({xy(rng), xy(rng), z(rng)});
+
+  OccupancyGrid a(radius), b(radius);
+  std::vector<Cell> unused;
+  a.update(cells, unused);
+  b.update(cells, unused);
+
+  for (int round = 0; round < rounds; round++) {
+    Cell min = {xy(rng), xy(rng), z(rng)};
+    Cell max = {min[0] + BOX_SIZE[0], min[1] + BOX_SIZE[1], min[2] + BOX_SIZE[2]};
+
+    // About half the cells in the box go, and some new ones come
+    std::vector<Cell> next;
+    for (auto &cell : cells) {
+      if (!inside(cell, min, max) || (rng() % 2)) next.push_back(cell);
+    }
+    for (int i = 0; i < 20; i++) {
+      next.push_back({min[0] + (int)(rng() % (BOX_SIZE[0] + 1)), min[1] + (int)(rng() % (BOX_SIZE[1] + 1)),
+                      min[2] + (int)(rng() % (BOX_SIZE[2] + 1))});
+    }
+    cells.swap(next);
+
+    // The region update may be given cells outside the box, as from the leaves of a map
+    // that overlap it.  They must be ignored.
+    Cell near_min = {min[0] - 2, min[1] - 2, min[2]}, near_max = {max[0] + 2, max[1] + 2, max[2]};
+    std::vector<Cell> region_cells;
+    for (auto &cell : cells) {
+      if (inside(cell, near_min, near_max)) region_cells.push_back(cell);
+    }
+
+    if (!compare(a, b, min, max, cells, region_cells, round)) return false;
+  }
+
+  // A box around everything, with half the cells gone: most of the map is new
+  cells.resize(cells.size() / 2);
+  return compare(a, b, {-1000, -1000, -1000}, {1000, 1000, 1000}, cells, cells, rounds);
+}
+
+int main(int argc, char **argv)
+{
+  unsigned seed = 3;
+  int rounds = 50;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (std::strcmp(argv[i], "--seed") == 0) {
+      seed = (unsigned)std::atoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--rounds") == 0) {
+      rounds = std::atoi(argv[i + 1]);
+    } else {
+      std::fprintf(stderr, "Unknown argument %s\n", argv[i]);
+      return 2;
+    }
+  }
+
+  // A radius of about the drone, and a wider one
+  for (double radius : {1.5, 3.0}) {
+    if (!run(radius, seed, rounds)) {
+      std::printf("radius %.1f: the region update does not match the full update\n", radius);
+      return 1;
+    }
+    std::printf("radius %.1f: %d rounds match\n", radius, rounds);
+  }
+  return 0;
+}
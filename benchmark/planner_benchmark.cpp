@@ -0,0 +1,416 @@
+// Copyright (c) 2021 Xeni Robotics
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* **********************************************************************
+ * Planner benchmark.  Runs the D* Lite search of the planner server on
+ * scenario maps, outside a ROS graph:
+ *  - plan:   initialize, computeShortestPath and extractPath
+ *  - replan: the drone moves along the path and an obstacle appears
+ *            ahead of it, replans times.  The grid is updated with the
+ *            new cells, the search repaired with moveStart and replan.
+ * and reports wall time, node expansions, path cost, the memory of the
+ * search graph and the peak resident memory of the process.
+ *
+ *   planner_benchmark [--maps <dir>] [--map <file> --start x,y,z --goal x,y,z]
+ *                     [--connectivity 6,18,26] [--weight 1,2.5] [--replans <n>]
+ *                     [--radius <cells>] [--margin <cells>] [--u_size <cells>] [--csv]
+ *
+ * The scenarios are UFO map files in the maps directory: forest.um,
+ * urban_canyon.um, indoor_maze.um and unreachable.um.  A missing one is
+ * generated and written there, so every later run plans on the same
+ * map.  --map adds a map of your own.  As in the planner server, the
+ * lattice is in 1 m cells, from the map at depth 2 of the 0.25 m
+ * resolution.
+ * ***********************************************************************/
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include <array>
+#include <functional>
+#include <algorithm>
+
+#include <ufo/map/occupancy_map.h>
+#include <ufo/geometry/bounding_volume.h>
+
+#include "geometry_msgs/msg/pose_stamped.hpp"
+
+#include "navigation_lite/d_star_lite.h"
+#include "navigation_lite/occupancy_grid.h"
+#include "navigation_lite/map_snapshot.h"
+
+typedef std::array<int, 3> Cell;
+
+static const double RESOLUTION = 0.25;
+static const ufo::map::DepthType CELL_DEPTH = 2;    // 1 m nodes at RESOLUTION
+
+struct Scenario
+{
+  std::string name;
+  std::string file;
+  std::array<float, 3> start;
+  std::array<float, 3> goal;
+  std::function<void(ufo::map::OccupancyMap &)> generate;   // Empty for a map of the user
+};
+
+static std::vector<double> parseList(const char *list)
+{
+  std::vector<double> values;
+  std::string s(list);
+  size_t start = 0;
+  while (start <= s.size()) {
+    size_t end = s.find(',', start);
+    if (end == std::string::npos) end = s.size();
+    values.push_back(std::atof(s.substr(start, end - start).c_str()));
+    start = end + 1;
+  }
+  return values;
+}
+
+static std::array<float, 3> parsePoint(const char *point)
+{
+  std::vector<double> v = parseList(point);
+  v.resize(3, 0.0);
+  return {(float)v[0], (float)v[1], (float)v[2]};
+}
+
+/* *** PEAK MEMORY *** */
+
+// Linux only.  Writing 5 to clear_refs resets the peak resident set (VmHWM) to the current one.
+static void resetPeakMemory()
+{
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  clear_refs << "5";
+}
+
+static double peakMemoryMB()
+{
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0) {
+      return std::atof(line.c_str() + 6) / 1024.0;   // In kB
+    }
+  }
+  return 0.0;
+}
+
+/* *** SCENARIO MAPS *** */
+
+// Every 1 m cell in min..max (inclusive) occupied
+static void fillBox(ufo::map::OccupancyMap &map, int x0, int y0, int z0, int x1, int y1, int z1)
+{
+  for (int z = z0; z <= z1; z++) {
+    for (int y = y0; y <= y1; y++) {
+      for (int x = x0; x <= x1; x++) {
+        map.setOccupancy(ufo::map::Point3(x + 0.5, y + 0.5, z + 0.5), 1.0, CELL_DEPTH);
+      }
+    }
+  }
+}
+
+// Trunks on a jittered grid of 5 m, 1 to 2 m across and 12 to 18 m tall
+static void forest(ufo::map::OccupancyMap &map)
+{
+  std::mt19937 random(1);
+  std::uniform_int_distribution<int> jitter(-1, 1), width(0, 1), height(12, 18);
+  for (int x = 5; x < 100; x += 5) {
+    for (int y = 0; y <= 40; y += 5) {
+      int cx = x + jitter(random), cy = y + jitter(random), w = width(random);
+      fillBox(map, cx, cy, 0, cx + w, cy + w, height(random));
+    }
+  }
+}
+
+// Blocks of 15 m, too tall to fly over, along a main street from y 17 to 23 and cross streets
+// of 5 m
+static void urbanCanyon(ufo::map::OccupancyMap &map)
+{
+  for (int x = 0; x < 100; x += 20) {
+    fillBox(map, x, -20, 0, x + 14, 16, 24);
+    fillBox(map, x, 24, 0, x + 14, 60, 24);
+  }
+}
+
+// A maze of 10 x 10 rooms of 7 m, walls of 1 m, 4 m high and under a roof.  Carved by a depth
+// first search, then a few more doors, so there is more than one way to most rooms.
+static void indoorMaze(ufo::map::OccupancyMap &map)
+{
+  const int rooms = 10, pitch = 8, size = rooms * pitch;
+  std::vector<char> open_east(rooms * rooms, 0), open_north(rooms * rooms, 0), visited(rooms * rooms, 0);
+  std::mt19937 random(7);
+  std::vector<int> stack{0};
+  visited[0] = 1;
+  while (!stack.empty()) {
+    int room = stack.back(), rx = room % rooms, ry = room / rooms;
+    std::vector<int> next;
+    if ((rx > 0) && !visited[room - 1]) next.push_back(room - 1);
+    if ((rx + 1 < rooms) && !visited[room + 1]) next.push_back(room + 1);
+    if ((ry > 0) && !visited[room - rooms]) next.push_back(room - rooms);
+    if ((ry + 1 < rooms) && !visited[room + rooms]) next.push_back(room + rooms);
+    if (next.empty()) {
+      stack.pop_back();
+      continue;
+    }
+    int to = next[random() % next.size()];
+    if (to == room - 1) open_east[to] = 1;
+    if (to == room + 1) open_east[room] = 1;
+    if (to == room - rooms) open_north[to] = 1;
+    if (to == room + rooms) open_north[room] = 1;
+    visited[to] = 1;
+    stack.push_back(to);
+  }
+  for (int i = 0; i < 15; i++) {
+    int room = random() % (rooms * rooms);
+    if (room % rooms + 1 < rooms) open_east[room] = 1;
+    if (room / rooms + 1 < rooms) open_north[room] = 1;
+  }
+
+  fillBox(map, 0, 0, 4, size, size, 4);          // The roof
+  fillBox(map, 0, 0, 0, size, 0, 3);             // The outer walls
+  fillBox(map, 0, 0, 0, 0, size, 3);
+  for (int ry = 0; ry < rooms; ry++) {
+    for (int rx = 0; rx < rooms; rx++) {
+      int x = (rx + 1) * pitch, y = (ry + 1) * pitch;
+      fillBox(map, x, y, 0, x, y, 3);              // The corner post
+      if (!open_east[ry * rooms + rx]) fillBox(map, x, y - pitch + 1, 0, x, y - 1, 3);
+      if (!open_north[ry * rooms + rx]) fillBox(map, x - pitch + 1, y, 0, x - 1, y, 3);
+    }
+  }
+}
+
+// The forest, with the start sealed in a box before it.  The search runs from the goal, so it
+// has to exhaust the search area to find there is no path.
+static void unreachable(ufo::map::OccupancyMap &map)
+{
+  forest(map);
+  fillBox(map, -6, 16, 0, 1, 16, 6);
+  fillBox(map, -6, 24, 0, 1, 24, 6);
+  fillBox(map, -6, 16, 0, -6, 24, 6);
+  fillBox(map, 1, 16, 0, 1, 24, 6);
+  fillBox(map, -6, 16, 6, 1, 24, 6);
+}
+
+static bool loadScenario(Scenario &scenario, ufo::map::OccupancyMap &map)
+{
+  if (navigation_lite::readMapSnapshot(scenario.file, map)) {
+    return true;
+  }
+  if (!scenario.generate) {
+    return false;
+  }
+  scenario.generate(map);
+  if (!map.write(scenario.file, ufo::geometry::BoundingVolume(), false, 0, 1, 0)) {
+    std::fprintf(stderr, "Could not write %s.  The map is generated again next time.\n", scenario.file.c_str());
+  }
+  return true;
+}
+
+// The cells holding an occupied node at CELL_DEPTH, as the planner server collects them
+static void occupiedCells(const ufo::map::OccupancyMap &map, std::vector<Cell> &cells)
+{
+  for (auto it = map.beginLeaves(true, false, false, false, CELL_DEPTH), it_end = map.endLeaves();
+       it != it_end; ++it) {
+    ufo::math::Vector3 center = it.getCenter();
+    double half_size = it.getHalfSize();
+    for (int z = (int)std::floor(center.z() - half_size); z < (int)std::ceil(center.z() + half_size); z++) {
+      for (int y = (int)std::floor(center.y() - half_size); y < (int)std::ceil(center.y() + half_size); y++) {
+        for (int x = (int)std::floor(center.x() - half_size); x < (int)std::ceil(center.x() + half_size); x++) {
+          cells.push_back({x, y, z});
+        }
+      }
+    }
+  }
+}
+
+/* *** BENCHMARK *** */
+
+struct Settings
+{
+  int connectivity;
+  float weight;
+  int replans;
+  int margin;
+  int u_size;
+  bool csv;
+};
+
+// The cost of the path from start, by the cost model of the search
+static double pathCost(const std::array<float, 3> &start, const std::vector<geometry_msgs::msg::PoseStamped> &path)
+{
+  double cost = 0;
+  Cell last = {(int)std::floor(start[0]), (int)std::floor(start[1]), (int)std::floor(start[2])};
+  for (auto &pose : path) {
+    Cell p = {(int)std::floor(pose.pose.position.x), (int)std::floor(pose.pose.position.y),
+              (int)std::floor(pose.pose.position.z)};
+    cost += DistanceCost::cost(Step{p[0] - last[0], p[1] - last[1], p[2] - last[2]});
+    last = p;
+  }
+  return cost;
+}
+
+static void report(const Settings &settings, const std::string &scenario, const char *phase, double ms,
+                   double max_ms, long expansions, size_t waypoints, double cost, const PathSearch &search)
+{
+  double search_mb = search.memoryUsage() / (1024.0 * 1024.0);
+  if (settings.csv) {
+    std::printf("%s,%d,%.2f,%s,%.3f,%.3f,%ld,%zu,%.2f,%.2f,%.1f\n", scenario.c_str(), settings.connectivity,
+      settings.weight, phase, ms, max_ms, expansions, waypoints, cost, search_mb, peakMemoryMB());
+  } else {
+    std::printf("%-16s %4d %6.2f %-8s | %9.2f %9.2f | %10ld | %6zu %9.2f | %8.2f %8.1f\n", scenario.c_str(),
+      settings.connectivity, settings.weight, phase, ms, max_ms, expansions, waypoints, cost, search_mb, peakMemoryMB());
+  }
+  std::fflush(stdout);
+}
+
+static void run(const Scenario &scenario, OccupancyGrid &grid, std::vector<Cell> occupied, const Settings &settings)
+{
+  resetPeakMemory();
+  auto search = makeDStarLite(settings.connectivity, settings.margin, 0, settings.u_size);
+  search->setOccupancyGrid(&grid);
+  search->setHeuristicWeight(settings.weight);
+  search->setStart(scenario.start[0], scenario.start[1], scenario.start[2]);
+  search->setGoal(scenario.goal[0], scenario.goal[1], scenario.goal[2]);
+
+  std::vector<geometry_msgs::msg::PoseStamped> path;
+  auto t0 = std::chrono::steady_clock::now();
+  search->initialize();
+  long expansions = search->computeShortestPath();
+  search->extractPath(path);
+  double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+  report(settings, scenario.name, "plan", ms, ms, expansions, path.size(),
+         path.empty() ? -1.0 : pathCost(scenario.start, path), *search);
+
+  // Fly part of the way, then block the path a few cells ahead of the drone
+  std::vector<Cell> changed;
+  std::array<float, 3> position = scenario.start;
+  double replan_ms = 0, replan_max_ms = 0;
+  long replan_expansions = 0;
+  int replans = 0;
+  for (int r = 0; r < settings.replans; r++) {
+    size_t advance = path.size() / (size_t)(settings.replans + 1 - r);
+    if ((path.size() < 12) || (advance + 6 >= path.size() - 3)) break;
+    auto &here = path[advance].pose.position;
+    auto &ahead = path[advance + 6].pose.position;
+    position = {(float)here.x, (float)here.y, (float)here.z};
+    for (int dz = -1; dz <= 1; dz++) {
+      for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+          occupied.push_back({(int)ahead.x + dx, (int)ahead.y + dy, (int)ahead.z + dz});
+        }
+      }
+    }
+
+    auto t1 = std::chrono::steady_clock::now();
+    changed.clear();
+    grid.update(occupied, changed);
+    search->moveStart(position[0], position[1], position[2]);
+    for (auto &cell : changed) {
+      search->replan(cell.at(0), cell.at(1), cell.at(2));
+    }
+    replan_expansions += search->computeShortestPath();
+    path.clear();
+    search->extractPath(path);
+    double step_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t1).count();
+    replan_ms += step_ms;
+    replan_max_ms = std::max(replan_max_ms, step_ms);
+    replans++;
+  }
+  if (replans > 0) {
+    report(settings, scenario.name, "replan", replan_ms / replans, replan_max_ms, replan_expansions / replans,
+           path.size(), path.empty() ? -1.0 : pathCost(position, path), *search);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  std::string maps = ".";
+  std::vector<Scenario> custom;
+  std::vector<double> connectivities{6, 18, 26}, weights{1.0, 2.5};
+  Settings settings{26, 1.0f, 5, 50, 20, false};
+  double radius = 0.4;   // Half the drone_diameter of the planner server
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    bool has_value = (i + 1 < argc);
+    if (arg == "--csv") settings.csv = true;
+    else if (arg == "--maps" && has_value) maps = argv[++i];
+    else if (arg == "--map" && has_value) {
+      custom.push_back(Scenario{argv[i + 1], argv[i + 1], {0, 0, 0}, {0, 0, 0}, nullptr});
+      i++;
+    }
+    else if (arg == "--start" && has_value && !custom.empty()) custom.back().start = parsePoint(argv[++i]);
+    else if (arg == "--goal" && has_value && !custom.empty()) custom.back().goal = parsePoint(argv[++i]);
+    else if (arg == "--connectivity" && has_value) connectivities = parseList(argv[++i]);
+    else if (arg == "--weight" && has_value) weights = parseList(argv[++i]);
+    else if (arg == "--replans" && has_value) settings.replans = std::max(0, std::atoi(argv[++i]));
+    else if (arg == "--radius" && has_value) radius = std::atof(argv[++i]);
+    else if (arg == "--margin" && has_value) settings.margin = std::atoi(argv[++i]);
+    else if (arg == "--u_size" && has_value) settings.u_size = std::atoi(argv[++i]);
+    else {
+      std::fprintf(stderr, "Unknown argument %s.  See the head of planner_benchmark.cpp\n", argv[i]);
+      return 1;
+    }
+  }
+
+  std::vector<Scenario> scenarios = {
+    {"forest",       maps + "/forest.um",       {1.5f, 20.5f, 2.5f}, {99.5f, 20.5f, 2.5f}, forest},
+    {"urban_canyon", maps + "/urban_canyon.um", {0.5f, 20.5f, 3.5f}, {77.5f, 40.5f, 3.5f}, urbanCanyon},
+    {"indoor_maze",  maps + "/indoor_maze.um",  {3.5f, 3.5f, 1.5f},  {76.5f, 76.5f, 1.5f}, indoorMaze},
+    {"unreachable",  maps + "/unreachable.um",  {-2.5f, 20.5f, 2.5f}, {99.5f, 20.5f, 2.5f}, unreachable},
+  };
+  if (!custom.empty()) {
+    scenarios = custom;
+  }
+
+  if (settings.csv) {
+    std::printf("scenario,connectivity,weight,phase,ms,max_ms,expansions,waypoints,path_cost,search_mb,peak_rss_mb\n");
+  } else {
+    std::printf("scenario         conn weight phase    |        ms    max ms | expansions | points      cost | searchMB   peakMB\n");
+  }
+  for (auto &scenario : scenarios) {
+    ufo::map::OccupancyMap map(RESOLUTION);
+    if (!loadScenario(scenario, map)) {
+      std::fprintf(stderr, "Could not load %s\n", scenario.file.c_str());
+      continue;
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<Cell> occupied, changed;
+    occupiedCells(map, occupied);
+    OccupancyGrid grid(radius);
+    grid.update(occupied, changed);
+    std::fprintf(stderr, "%s: %zu occupied cells, grid built in %.1f ms\n", scenario.name.c_str(), occupied.size(),
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+
+    for (double connectivity : connectivities) {
+      for (double weight : weights) {
+        settings.connectivity = (int)connectivity;
+        settings.weight = (float)weight;
+        if (!makeDStarLite(settings.connectivity, 1, 0, 1)) {
+          std::fprintf(stderr, "Connectivity must be 6, 18 or 26, not %d\n", settings.connectivity);
+          continue;
+        }
+        run(scenario, grid, occupied, settings);
+        grid.update(occupied, changed);   // Take out the obstacles of the replans
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,227 @@
+#ifndef ACTION_CLIENT_NODE_H
+#define ACTION_CLIENT_NODE_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "rclcpp/rclcpp.hpp"
+#include "rclcpp_action/rclcpp_action.hpp"
+
+#include "behaviortree_cpp_v3/action_node.h"
+
+#include "navigation_lite/navigation_server.h"
+#include "navigation_lite/navigation_context.h"
+
+namespace NavigationNodes
+{
+
+/* **********************************************************************
+ * Base of the tree nodes that call an action server of the stack.
+ * onStart() sends the goal and returns RUNNING at once.  The tree thread
+ * never waits on the server: the action client callbacks record what
+ * happened and wake the tree, and the next tick hands the result to the
+ * derived node in onSucceeded().  Halting the node cancels the goal.
+ *
+ * The derived nodes implement buildGoal() and onSucceeded(), and may
+ * implement onFeedback().  All three run on the thread ticking the tree.
+ *
+ * The callbacks only hold the shared state, never the node, so a late
+ * reply after the tree is destroyed is dropped.  Every goal is numbered,
+ * so a late reply to a halted goal is not taken for the next goal's.
+ *
+ * The client is created from the NavigationContext on the blackboard
+ * when the tree is built.
+ * ***********************************************************************/
+template<class ActionT>
+class ActionClientNode : public BT::StatefulActionNode
+{
+public:
+  using GoalHandle = rclcpp_action::ClientGoalHandle<ActionT>;
+  using Goal = typename ActionT::Goal;
+  using Feedback = typename ActionT::Feedback;
+  using WrappedResult = typename GoalHandle::WrappedResult;
+
+  ActionClientNode(const std::string& name, const BT::NodeConfiguration& config, const std::string& action_name)
+    : BT::StatefulActionNode(name, config), action_name_(action_name), state_(std::make_shared<State>())
+  {
+    auto context = getContext(config);
+    node_ = context->node;
+    state_->wake_up = context->wake_up;
+
+    this->client_ptr_ = rclcpp_action::create_client<ActionT>(node_, action_name_);
+  }
+
+  BT::NodeStatus onStart() override
+  {
+    Goal goal_msg;
+    if (!buildGoal(goal_msg)) {
+      return BT::NodeStatus::FAILURE;
+    }
+
+    if (!this->client_ptr_->wait_for_action_server()) {
+      RCLCPP_ERROR(node_->get_logger(), "Action server not available after waiting");
+      throw BT::RuntimeError("Action server [", action_name_, "] not available.  Failing.");
+    }
+
+    uint64_t goal_id;
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      goal_id = ++state_->goal_id;
+      state_->status = ActionStatus::VIRGIN;
+      state_->goal_handle.reset();
+      state_->feedback.reset();
+    }
+
+    // The callbacks run on the executor of the ROS node
+    auto state = state_;
+    std::weak_ptr<rclcpp_action::Client<ActionT>> client = client_ptr_;
+    auto send_goal_options = typename rclcpp_action::Client<ActionT>::SendGoalOptions();
+    send_goal_options.goal_response_callback =
+      [state, client, goal_id](std::shared_future<typename GoalHandle::SharedPtr> future)
+      {
+        auto goal_handle = future.get();
+        bool halted;
+        {
+          std::lock_guard<std::mutex> lock(state->mutex);
+          halted = (goal_id != state->goal_id);
+          if (!halted) {
+            state->goal_handle = goal_handle;
+            state->status = goal_handle ? ActionStatus::PROCESSING : ActionStatus::REJECTED;
+          }
+        }
+        if (halted) {
+          if (goal_handle) cancel(client, goal_handle);   // Halted before the server accepted the goal
+        } else if (!goal_handle && state->wake_up) {
+          state->wake_up->notify();
+        }
+      };
+    send_goal_options.feedback_callback =
+      [state, goal_id](typename GoalHandle::SharedPtr, const std::shared_ptr<const Feedback> feedback)
+      {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (goal_id == state->goal_id) state->feedback = feedback;   // Only the latest is kept
+      };
+    send_goal_options.result_callback =
+      [state, goal_id](const WrappedResult & result)
+      {
+        {
+          std::lock_guard<std::mutex> lock(state->mutex);
+          if (goal_id != state->goal_id) return;
+          state->result = result;
+          state->status = toStatus(result.code);
+        }
+        if (state->wake_up) state->wake_up->notify();
+      };
+
+    this->client_ptr_->async_send_goal(goal_msg, send_goal_options);
+    return BT::NodeStatus::RUNNING;
+  }
+
+  BT::NodeStatus onRunning() override
+  {
+    ActionStatus status;
+    WrappedResult result;
+    std::shared_ptr<const Feedback> feedback;
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      status = state_->status;
+      feedback.swap(state_->feedback);
+      if (status != ActionStatus::VIRGIN && status != ActionStatus::PROCESSING) {
+        result = state_->result;
+      }
+    }
+    if (feedback) {
+      onFeedback(*feedback);
+    }
+
+    switch (status) {
+      case ActionStatus::VIRGIN:
+      case ActionStatus::PROCESSING:
+        return BT::NodeStatus::RUNNING;
+      case ActionStatus::SUCCEEDED:
+        return onSucceeded(result);
+      case ActionStatus::REJECTED:
+        RCLCPP_ERROR(node_->get_logger(), "[%s] - Goal was rejected by server", name().c_str());
+        return BT::NodeStatus::FAILURE;
+      case ActionStatus::ABORTED:
+        RCLCPP_INFO(node_->get_logger(), "[%s] - Goal was aborted", name().c_str());
+        return BT::NodeStatus::FAILURE;
+      case ActionStatus::CANCELED:
+        RCLCPP_INFO(node_->get_logger(), "[%s] - Goal was canceled", name().c_str());
+        return BT::NodeStatus::FAILURE;
+      default:
+        RCLCPP_WARN(node_->get_logger(), "[%s] - Unknown result code", name().c_str());
+        return BT::NodeStatus::FAILURE;
+    }
+  }
+
+  void onHalted() override
+  {
+    typename GoalHandle::SharedPtr goal_handle;
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      state_->goal_id++;   // Ignore the replies still on their way
+      goal_handle.swap(state_->goal_handle);
+    }
+    // If the server has not accepted the goal yet, the response callback cancels it
+    if (goal_handle) {
+      RCLCPP_DEBUG(node_->get_logger(), "[%s] - Cancelling the goal after a halt()", name().c_str());
+      cancel(client_ptr_, goal_handle);
+    }
+  }
+
+protected:
+  // Fill in the goal from the input ports.  Returning false fails the node.
+  virtual bool buildGoal(Goal &goal) = 0;
+
+  // The server reported success.  Decide on the outcome, and write the output ports.
+  virtual BT::NodeStatus onSucceeded(const WrappedResult &result) = 0;
+
+  virtual void onFeedback(const Feedback &) { }
+
+  // Pointer to the ROS node
+  rclcpp::Node::SharedPtr node_;
+
+private:
+  struct State
+  {
+    std::mutex mutex;
+    uint64_t goal_id = 0;                          // The goal the callbacks may report on
+    ActionStatus status = ActionStatus::VIRGIN;
+    typename GoalHandle::SharedPtr goal_handle;
+    std::shared_ptr<const Feedback> feedback;
+    WrappedResult result;
+    std::shared_ptr<TreeWakeUp> wake_up;
+  };
+
+  std::string action_name_;
+  std::shared_ptr<State> state_;
+  typename rclcpp_action::Client<ActionT>::SharedPtr client_ptr_;
+
+  static ActionStatus toStatus(rclcpp_action::ResultCode code)
+  {
+    switch (code) {
+      case rclcpp_action::ResultCode::SUCCEEDED: return ActionStatus::SUCCEEDED;
+      case rclcpp_action::ResultCode::ABORTED:   return ActionStatus::ABORTED;
+      case rclcpp_action::ResultCode::CANCELED:  return ActionStatus::CANCELED;
+      default:                                   return ActionStatus::UNKNOWN;
+    }
+  }
+
+  static void cancel(std::weak_ptr<rclcpp_action::Client<ActionT>> client, typename GoalHandle::SharedPtr goal_handle)
+  {
+    auto client_ptr = client.lock();
+    if (!client_ptr) return;
+    try {
+      client_ptr->async_cancel_goal(goal_handle);   // Request a cancellation.
+    } catch (...) {
+      // The goal finished in the meantime
+    }
+  }
+};
+
+} // Namespace
+
+#endif // ACTION_CLIENT_NODE_H
@@ -11,18 +11,16 @@
 #include "rclcpp_action/rclcpp_action.hpp"
 
 #include <tf2/LinearMath/Quaternion.h>
-#include <tf2/exceptions.h>
-#include <tf2_ros/transform_listener.h>
-#include <tf2_ros/buffer.h>
 
 #include <nav_msgs/msg/path.hpp>
 
 #include "behaviortree_cpp_v3/behavior_tree.h"
 #include "behaviortree_cpp_v3/bt_factory.h"
 
-#include "navigation_interfaces/action/compute_path_to_pose.hpp"
+#include "navigation_lite/action/compute_path_to_pose.hpp"
 
 #include "navigation_lite/navigation_server.h"
+#include "navigation_lite/action_client_node.h"
 #include "navigation_lite/pose_3D.h"
 
 #include "rclcpp/rclcpp.hpp"
@@ -30,60 +28,32 @@
 namespace NavigationNodes
 {
 
-class NavLiteComputePathToPoseAction : public BT::AsyncActionNode
+class NavLiteComputePathToPoseAction : public ActionClientNode<navigation_lite::action::ComputePathToPose>
 {
   public:
-    using ComputePathToPose = navigation_interfaces::action::ComputePathToPose;
-    using GoalHandleComputePathToPose = rclcpp_action::ClientGoalHandle<ComputePathToPose>;
+    using ComputePathToPose = navigation_lite::action::ComputePathToPose;
 
     NavLiteComputePathToPoseAction(const std::string& name, const BT::NodeConfiguration& config)
-      : BT::AsyncActionNode(name, config)
+      : ActionClientNode<ComputePathToPose>(name, config, "nav_lite/compute_path_to_pose")
     { }
 
-    void init(rclcpp::Node::SharedPtr node) {
-      node_ = node;
-      
-       this->client_ptr_ = rclcpp_action::create_client<ComputePathToPose>(
-       node_,
-      "nav_lite/compute_path_to_pose");
-    }
-    
     static BT::PortsList providedPorts()
     {
         return{ BT::InputPort<Pose3D>("pose"), 
                 BT::InputPort<Pose3D>("start"), 
-                BT::OutputPort<std::vector<Pose3D>>("path")};
+                BT::OutputPort<PathPtr>("path")};
         
     }
-    
-    BT::NodeStatus tick() override;
-    void halt() override;
-    void cleanup();
-
-  private:
-    std::atomic_bool _halt_requested;
-    NavigationNodes::ActionStatus action_status;
-    
-    // Pointer to the ROS node
-    rclcpp::Node::SharedPtr node_;
-    rclcpp::CallbackGroup::SharedPtr callback_group_;
-    rclcpp::executors::SingleThreadedExecutor callback_group_executor_;
-    
-    rclcpp_action::Client<ComputePathToPose>::SharedPtr client_ptr_;
 
-    std::shared_ptr<std::shared_future<GoalHandleComputePathToPose::SharedPtr>> future_goal_handle_;
-    GoalHandleComputePathToPose::SharedPtr goal_handle_;
-    
-    void goal_response_callback(std::shared_future<GoalHandleComputePathToPose::SharedPtr> future);
-    void result_callback(const GoalHandleComputePathToPose::WrappedResult & result);
-    
-        
-    // Saved Results for feedback
-    std::stringstream returned_path;
+  protected:
+    bool buildGoal(ComputePathToPose::Goal &goal) override;
+    BT::NodeStatus onSucceeded(const WrappedResult &result) override;
+    void onFeedback(const Feedback &feedback) override;
 
+  private:
+    float suboptimality_bound_ = 0.0;   // From the feedback of the planner
 };
      
 } // Namespace
 
 #endif // ACTION_COMPUTE_PATH_TO_POSE_H
-
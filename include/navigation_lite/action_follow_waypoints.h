@@ -10,72 +10,39 @@
 #include "rclcpp/rclcpp.hpp"
 #include "rclcpp_action/rclcpp_action.hpp"
 
-#include <tf2/LinearMath/Quaternion.h>
-
 #include "behaviortree_cpp_v3/behavior_tree.h"
 #include "behaviortree_cpp_v3/bt_factory.h"
 
 #include "navigation_interfaces/action/follow_waypoints.hpp"
 
 #include "navigation_lite/navigation_server.h"
-#include "navigation_lite/pose_3D.h"
+#include "navigation_lite/action_client_node.h"
 
 #include "rclcpp/rclcpp.hpp"
 
 namespace NavigationNodes
 {
 
-class NavLiteFollowWaypointsAction : public BT::AsyncActionNode
+class NavLiteFollowWaypointsAction : public ActionClientNode<navigation_interfaces::action::FollowWaypoints>
 {
   public:
     using FollowWaypoints = navigation_interfaces::action::FollowWaypoints;
-    using GoalHandleFollowWaypoints = rclcpp_action::ClientGoalHandle<FollowWaypoints>;
 
     NavLiteFollowWaypointsAction(const std::string& name, const BT::NodeConfiguration& config)
-      : BT::AsyncActionNode(name, config)
+      : ActionClientNode<FollowWaypoints>(name, config, "nav_lite/follow_waypoints")
     { }
 
-    void init(rclcpp::Node::SharedPtr node) {
-      node_ = node;
-      
-       this->client_ptr_ = rclcpp_action::create_client<FollowWaypoints>(
-       node_,
-      "nav_lite/follow_waypoints");
-    }
-    
     static BT::PortsList providedPorts()
     {
-        return{ BT::InputPort<std::vector<Pose3D>>("path") };
+        return{ BT::InputPort<PathPtr>("path") };
     }
-    
-    BT::NodeStatus tick() override;
-    void halt() override;
-    void cleanup();
-
-  private:
-    std::atomic_bool _halt_requested;
-    NavigationNodes::ActionStatus action_status;
-    
-    // Pointer to the ROS node
-    rclcpp::Node::SharedPtr node_;
-    rclcpp::CallbackGroup::SharedPtr callback_group_;
-    rclcpp::executors::SingleThreadedExecutor callback_group_executor_;
-    
-    rclcpp_action::Client<FollowWaypoints>::SharedPtr client_ptr_;
-
-    std::shared_ptr<std::shared_future<GoalHandleFollowWaypoints::SharedPtr>> future_goal_handle_;
-    GoalHandleFollowWaypoints::SharedPtr goal_handle_;
-    
-    void goal_response_callback(std::shared_future<GoalHandleFollowWaypoints::SharedPtr> future);
-    void feedback_callback( 
-      GoalHandleFollowWaypoints::SharedPtr,
-      const std::shared_ptr<const FollowWaypoints::Feedback> feedback);
-    void result_callback(const GoalHandleFollowWaypoints::WrappedResult & result);
-
 
+  protected:
+    bool buildGoal(FollowWaypoints::Goal &goal) override;
+    BT::NodeStatus onSucceeded(const WrappedResult &result) override;
+    void onFeedback(const FollowWaypoints::Feedback &feedback) override;
 };
      
 } // Namespace
 
 #endif // ACTION_FollowWaypoints_H
-
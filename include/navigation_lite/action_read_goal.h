@@ -13,6 +13,7 @@
 #include "behaviortree_cpp_v3/bt_factory.h"
 
 #include "navigation_lite/navigation_server.h"
+#include "navigation_lite/navigation_context.h"
 #include "navigation_lite/pose_3D.h"
 
 #include "rclcpp/rclcpp.hpp"
@@ -26,6 +27,9 @@ class NavLiteReadGoalAction : public BT::SyncActionNode
     NavLiteReadGoalAction(const std::string& name, const BT::NodeConfiguration& config)
       : BT::SyncActionNode(name, config)
     {
+      auto context = getContext(config);
+      node_ = context->node;
+      goal_ = context->goal;
     }
 
     // A node having ports MUST implement this STATIC method
@@ -35,11 +39,6 @@ class NavLiteReadGoalAction : public BT::SyncActionNode
     }
     
     BT::NodeStatus tick() override;
-   
-    void init(rclcpp::Node::SharedPtr node, Pose3D goal) {
-      node_ = node;
-      goal_ = goal;
-    }
     
   private:
     // Pointer to the ROS node
@@ -0,0 +1,40 @@
+// Copyright 2021 Xeni Robotics
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Admits one action goal at a time to a resource, such as the drone.  The goal is claimed in the
+// goal callback on the executor, and released by the thread executing it.  A std::mutex can not be
+// used for this, as it must be unlocked by the thread that locked it.
+
+#pragma once
+
+#include <atomic>   // std::atomic_bool
+
+class BusyFlag {
+  std::atomic_bool busy{false};
+
+public:
+  // True when the resource was free, and is now claimed
+  bool tryClaim() { return !busy.exchange(true); }
+  bool isBusy() const { return busy.load(); }
+
+  // Held by the execution of a claimed goal.  Releases the claim on every way out.
+  class Release {
+    BusyFlag &flag;
+  public:
+    explicit Release(BusyFlag &flag): flag(flag) { }
+    ~Release() { flag.busy.store(false); }
+    Release(const Release &) = delete;
+    Release & operator=(const Release &) = delete;
+  };
+};
@@ -0,0 +1,117 @@
+#ifndef COLLISION_QUERY_H
+#define COLLISION_QUERY_H
+
+#include <cstdint>          // uint64_t, int32_t
+#include <array>            // std::array
+#include <vector>           // std::vector
+#include <mutex>            // std::mutex
+#include <unordered_map>    // std::unordered_map
+
+#include <ufo/map/occupancy_map.h>
+#include <ufo/math/vector3.h>
+
+/* **********************************************************************
+ * Batched collision queries on a map: spheres, oriented boxes and
+ * segments, and the corridors from the drone to candidate waypoints.
+ * Each call tests all its shapes in one traversal of the octree.  One
+ * instance may serve several threads.  The map server answers
+ * nav_lite/check_collision with it, the controller checks its corridors
+ * and the recovery server the space around the drone.
+ *
+ * Answers are cached until the map changes where the shape is.  Tell the
+ * cache about every change with update(), with the box that changed when
+ * known.  A query on a map version newer than the last update() clears
+ * the cache, one on an older version bypasses it.
+ *
+ * For the cache, shapes are snapped to a grid of cache_quantum (angles
+ * to ANGLE_QUANTUM), and grown by the snapping error, so a shape close to
+ * one asked before hits the cache and the test stays conservative.
+ * ***********************************************************************/
+class CollisionQuery
+{
+public:
+  struct Sphere
+  {
+    ufo::math::Vector3 center;
+    double radius;
+  };
+
+  struct Box           // Half sizes along the box axes, rotated by roll, pitch and yaw
+  {
+    ufo::math::Vector3 center;
+    ufo::math::Vector3 half_size;
+    double roll, pitch, yaw;
+  };
+
+  struct Segment       // The box around the line from..to, radius to every side
+  {
+    ufo::math::Vector3 from;
+    ufo::math::Vector3 to;
+    double radius;
+  };
+
+  CollisionQuery(ufo::map::DepthType depth, double cache_quantum = 0.1);
+
+  // The map is now at map_version, changed only within min..max.  The answers for shapes that
+  // touch the box are dropped.  Without a box, the whole map may have changed.
+  void update(const ufo::map::OccupancyMap &map, uint64_t map_version,
+              const ufo::math::Vector3 &min, const ufo::math::Vector3 &max);
+  void update(uint64_t map_version);
+
+  // The version of the last update().  Read it before the map, and pass it with the queries.
+  uint64_t version() const;
+
+  // collides[i] is set for shape i: an occupied leaf at depth intersects it
+  void spheres(const ufo::map::OccupancyMap &map, uint64_t map_version,
+               const std::vector<Sphere> &shapes, std::vector<bool> &collides);
+  void boxes(const ufo::map::OccupancyMap &map, uint64_t map_version,
+             const std::vector<Box> &shapes, std::vector<bool> &collides);
+  void segments(const ufo::map::OccupancyMap &map, uint64_t map_version,
+                const std::vector<Segment> &shapes, std::vector<bool> &collides);
+
+  // The number of leading segments that are clear, i.e. the index of the first one that collides,
+  // or shapes.size() when none does.  The segments after the first collision are not tested.
+  size_t clearPrefix(const ufo::map::OccupancyMap &map, uint64_t map_version,
+                     const std::vector<Segment> &shapes);
+
+  // Uncached test of one segment, without snapping.  For short lived volumes, like a lookahead.
+  // True when it collides.
+  bool probe(const ufo::map::OccupancyMap &map, const Segment &shape) const;
+
+  size_t cacheHits() const;
+
+private:
+  typedef std::array<int32_t, 10> Key;    // The shape type, then its snapped parameters
+  struct KeyHash {
+    size_t operator()(const Key &key) const;
+  };
+
+  struct Answer        // A cached answer, with the box around the grown shape
+  {
+    bool collides;
+    ufo::math::Vector3 min;
+    ufo::math::Vector3 max;
+  };
+
+  ufo::map::DepthType depth;
+  double quantum;
+
+  mutable std::mutex mutex;               // Guards the members below
+  uint64_t cached_version;
+  std::unordered_map<Key, Answer, KeyHash> cache;
+  size_t hits;
+
+  int32_t snap(double value) const;
+  int32_t snapUp(double value) const;
+
+  std::vector<Key> segmentKeys(const std::vector<Segment> &shapes) const;
+
+  // Answer from the cache, and test the rest in one traversal.  Shape converts a key to the
+  // grown ufo geometry.  With prefix, only up to the first shape that collides is answered, and
+  // its index returned.
+  template<class Shape>
+  size_t query(const ufo::map::OccupancyMap &map, uint64_t map_version,
+               const std::vector<Key> &keys, std::vector<bool> &collides, Shape shape, bool prefix);
+};
+
+#endif     //COLLISION_QUERY_H
@@ -5,108 +5,217 @@
 #include <string>
 #include <memory>
 #include <limits>       // std::numeric_limits
-#include <algorithm>    // std::sort
+#include <algorithm>    // std::min
 #include <vector>       // std::vector
 #include <array>        // std::array
-#include <functional>   // std::function
 #include <cmath>        // std::sqrt
+#include <functional>   // std::function
 
 #include "geometry_msgs/msg/pose_stamped.hpp"
 
-#include "cube.h"
+#include "node_pool.h"
+#include "occupancy_grid.h"
+#include "open_list.h"
 
 const float INF = std::numeric_limits<float>::max();
 
 using namespace std;
 
-class Node
+// A move from a node to one of its neighbors
+struct Step
 {
+  int dx, dy, dz;
+};
+
+/* **********************************************************************
+ * Neighborhoods of a node.  step(i), 0 <= i < SIZE, are the moves to the
+ * neighbors.  Every table holds the opposite of each of its moves, so the
+ * successors of a node are also its predecessors.
+ * ***********************************************************************/
+struct Connect6    // Through the faces of the cell.  Axis aligned paths only.
+{
+  static constexpr int SIZE = 6;
+  static constexpr Step step(int i)
+  {
+    constexpr Step steps[SIZE] = {
+      {-1,  0,  0}, { 1,  0,  0}, { 0, -1,  0}, { 0,  1,  0}, { 0,  0, -1}, { 0,  0,  1} };
+    return steps[i];
+  }
+};
+
+struct Connect18   // Through the faces and the edges.  Diagonals in a plane, not through space.
+{
+  static constexpr int SIZE = 18;
+  static constexpr Step step(int i)
+  {
+    constexpr Step steps[SIZE] = {
+      {-1,  0,  0}, { 1,  0,  0}, { 0, -1,  0}, { 0,  1,  0}, { 0,  0, -1}, { 0,  0,  1},
+      {-1, -1,  0}, {-1,  1,  0}, { 1, -1,  0}, { 1,  1,  0},
+      {-1,  0, -1}, {-1,  0,  1}, { 1,  0, -1}, { 1,  0,  1},
+      { 0, -1, -1}, { 0, -1,  1}, { 0,  1, -1}, { 0,  1,  1} };
+    return steps[i];
+  }
+};
+
+struct Connect26   // Every cell of the 3x3x3 cube around the node
+{
+  static constexpr int SIZE = 26;
+  static constexpr Step step(int i)
+  {
+    // Count through the cube, skipping the centre (13)
+    return Step{ (i + (i >= 13)) % 3 - 1, ((i + (i >= 13)) / 3) % 3 - 1, (i + (i >= 13)) / 9 - 1 };
+  }
+};
+
+/* **********************************************************************
+ * Cost model: cost(step) is the cost of a move, and heuristic(dx, dy, dz)
+ * a lower bound of the cost to cover that distance.  The heuristic must
+ * never exceed the cost of any path, for any neighborhood.
+ * ***********************************************************************/
+struct DistanceCost
+{
+  // Length of the step, plus a penalty for vertical movement.  Never less than the straight
+  // line distance, so the euclidean heuristic stays admissible.
+  static constexpr float cost(const Step &s)
+  {
+    constexpr float length[4] = { 0.0f, 1.0f, 1.41421356f, 1.73205081f };
+    return length[(s.dx != 0) + (s.dy != 0) + (s.dz != 0)] + ((s.dz != 0) ? 0.4f : 0.0f);
+  }
+
+  static float heuristic(int dx, int dy, int dz)
+  {
+    return std::sqrt((float)(dx*dx + dy*dy + dz*dz));
+  }
+};
+
+/* **********************************************************************
+ * What the planner server needs of a path search, whatever the
+ * neighborhood and the cost model.  Only the entry points are virtual;
+ * the search loops are compiled for each DStarLite specialization.
+ * ***********************************************************************/
+class PathSearch {
   public:
-    Node(int x, int y, int z) 
-      : g(INF)
-      , rhs(INF)
-      , rhs_from(NULL)
-    {
-      point.at(0) = x;
-      point.at(1) = y;
-      point.at(2) = z;   
-    }
-    
-    bool isOverConsistent() 
-    {
-      return (g > rhs);
-    }
-  
-    bool isConsistent() 
-    {
-      return (g == rhs);
-    } 
-
-    shared_ptr<Node> nextStep()
-    {
-      return rhs_from;
-    }
-        
-    void setRhsScore( float score, shared_ptr<Node> caller )
-    {
-      rhs = score;
-      rhs_from = caller;
-    }  
-
-    void setGScore( float score )
-    {
-      g = score;
-    }  
-
-    float gScore() {
-      return g;
-    }
-    
-    float rhsScore() {
-      return rhs;
-    }
-    
-    void getPoint(array<int, 3> &p) {
-      for(size_t i=0; i < p.size(); i++) {
-        p.at(i) = point.at(i);
-      } 
-    }  
-    
-  private:
-    array<int, 3> point;
-    float g, rhs;
-    shared_ptr<Node> rhs_from;
+    // Asked every check_interval expansions whether the search should stop early
+    typedef std::function<bool()> InterruptCheck;
+
+    virtual ~PathSearch() = default;
+
+    virtual void setGoal(float x, float y, float z) = 0;
+    virtual void setStart(float x, float y, float z) = 0;
+    virtual void setOccupancyGrid(const OccupancyGrid *occupancy_grid) = 0;
+    virtual void initialize() = 0;
+    virtual void moveStart(float x, float y, float z) = 0;
+    virtual bool isInitialized() const = 0;
+    virtual bool isGoal(float x, float y, float z) const = 0;
+    virtual bool inSearchArea(float x, float y, float z) const = 0;
+    // Only search the nodes in the coarse cells set in cells.  A coarse cell holds scale x scale x
+    // scale nodes, coarse cell c covers the nodes c * scale .. c * scale + scale - 1.  nullptr
+    // searches the whole box again.  The bitmap must stay as it is while in use.  Set it before
+    // initialize().
+    virtual void setCorridor(const SparseBitmap *cells, int scale) = 0;
+    // Returns the number of expansions.  When should_stop returns true, the search stops with the
+    // start node not yet settled: wasInterrupted() is then true and there is no path to extract.
+    // The search tree stays valid, and the next call carries on from where this one stopped.
+    virtual int computeShortestPath(const InterruptCheck &should_stop = nullptr, int check_interval = 256) = 0;
+    virtual bool wasInterrupted() const = 0;
+    // Inflate the heuristic by weight >= 1.  The search expands fewer nodes, and the path it finds
+    // costs at most weight times the optimal path.  Lowering the weight later refines the search
+    // tree, instead of repeating the search.
+    virtual void setHeuristicWeight(float weight) = 0;
+    virtual float heuristicWeight() const = 0;
+    virtual void clearCostmap() = 0;
+    virtual void replan(float x, float y, float z) = 0;
+    virtual int extractPath(vector<geometry_msgs::msg::PoseStamped> &waypoints) = 0;
+    // Bytes held by the nodes of the search graph.  Nodes are kept for the next search, so this is
+    // also the most the searches so far have used.
+    virtual size_t memoryUsage() const = 0;
 };
 
-class DStarLite {
+/* **********************************************************************
+ * D* Lite over the sparse node pool, for a neighborhood and a cost model
+ * fixed at compile time.  The step and cost tables are constants, so
+ * the neighbor loops unroll.  Nodes at least one cell inside the search
+ * box skip the bound test of their neighbors, unless the search is
+ * limited to a corridor.
+ * Instantiated in d_star_lite.cpp for DistanceCost with Connect6,
+ * Connect18 and Connect26.
+ * ***********************************************************************/
+template<class Connectivity, class CostModel = DistanceCost>
+class DStarLite : public PathSearch {
   public:
-    DStarLite(size_t x, size_t y, size_t z ) 
-      : dim_x(x)
-      , dim_y(y)
-      , dim_z(z)
-      , cost_map(x, y, z, NULL)
+    typedef NodePool::NodeId NodeId;
+
+    // The search is limited to the box around start and goal, grown by margin cells in x and y.
+    // Altitude is limited to min_z <= z < max_z.  Only cells the search visits take memory.
+    DStarLite(int margin, int min_z, int max_z)
+      : grid(nullptr)
+      , margin(margin)
+      , min_z(min_z)
+      , max_z(max_z)
+      , bound_min{{0, 0, 0}}
+      , bound_max{{-1, -1, -1}}   // Empty until initialize()
+      , inner_min{{0, 0, 0}}
+      , inner_max{{-1, -1, -1}}
+      , corridor(nullptr)
+      , corridor_scale(1)
+      , open_list(nodes)
+      , k_m(0.0)
+      , epsilon(1.0)
+      , initialized(false)
+      , interrupted(false)
     { }
-  
-    void setGoal(float x, float y, float z);
-    void setStart(float x, float y, float z);
-    void setTestFunction( function<bool(float, float, float)> func);
-    void initialize();
-    int computeShortestPath();
-    void clearCostmap();
-    void replan(float x, float y, float z);
-    void updateVertex(shared_ptr<Node> node);
-    int extractPath(vector<geometry_msgs::msg::PoseStamped> &waypoints); 
+
+    void setGoal(float x, float y, float z) override;
+    void setStart(float x, float y, float z) override;
+    void setOccupancyGrid(const OccupancyGrid *occupancy_grid) override;
+    void initialize() override;
+    void moveStart(float x, float y, float z) override;
+    bool isInitialized() const override { return initialized; }
+    bool isGoal(float x, float y, float z) const override;
+    bool inSearchArea(float x, float y, float z) const override;
+    void setCorridor(const SparseBitmap *cells, int scale) override;
+    int computeShortestPath(const InterruptCheck &should_stop = nullptr, int check_interval = 256) override;
+    bool wasInterrupted() const override { return interrupted; }
+    void setHeuristicWeight(float weight) override;
+    float heuristicWeight() const override { return epsilon; }
+    void clearCostmap() override;
+    void replan(float x, float y, float z) override;
+    int extractPath(vector<geometry_msgs::msg::PoseStamped> &waypoints) override;
+    size_t memoryUsage() const override { return nodes.memoryUsage(); }
   private:
-    function<bool(float, float, float)> testFunction;
-    size_t dim_x, dim_y, dim_z;
-    Cube< shared_ptr<Node> > cost_map;
-  
-    vector< shared_ptr<Node> > open_list;
+    const OccupancyGrid *grid;
+    int margin, min_z, max_z;
+    array<int, 3> bound_min;
+    array<int, 3> bound_max;
+    array<int, 3> inner_min;   // The box of the nodes with all neighbors inside the search box
+    array<int, 3> inner_max;
+    const SparseBitmap *corridor;   // nullptr when the whole box is searched
+    int corridor_scale;
+    NodePool nodes;
+
+    OpenList<NodePool> open_list;
     array<int, 3> goal;
     array<int, 3> start;
+    float k_m;
+    float epsilon;     // Heuristic weight
+    bool initialized;
+    bool interrupted;
+
+    bool isConsistent(NodeId node) { return nodes.gScore(node) == nodes.rhsScore(node); }
+    bool isOverConsistent(NodeId node) { return nodes.gScore(node) > nodes.rhsScore(node); }
 
-    void expand(shared_ptr<Node> node);    
-    bool isOccupied(int x, int y, int z);
+    Key calculateKey(NodeId node);
+    float heuristic(const array<int, 3> &point) const;
+    NodeId getNode(int x, int y, int z);
+    bool inMap(int x, int y, int z) const;
+    bool inInnerBox(const array<int, 3> &point) const;
+    void setBounds();
+    void updateVertex(NodeId node);
+    void expand(NodeId node);
+    bool isOccupied(int x, int y, int z) const { return grid->isOccupied(x, y, z); }
 };
 
+// A D* Lite search with 6, 18 or 26 connected nodes.  Returns nullptr for any other connectivity.
+std::unique_ptr<PathSearch> makeDStarLite(int connectivity, int margin, int min_z, int max_z);
+
 #endif     //D_STAR_LITE_H
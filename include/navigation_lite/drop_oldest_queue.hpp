@@ -0,0 +1,87 @@
+// Copyright 2021 Xeni Robotics
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A bounded queue that keeps the latest items.  When it is full, a push drops the oldest item, so
+// the producer never waits and the consumer always works on recent data.  The lock is only held
+// to move a pointer-sized item in or out.
+
+#pragma once
+
+#include <deque>                // std::deque
+#include <mutex>                // std::mutex
+#include <condition_variable>   // std::condition_variable
+#include <atomic>               // std::atomic
+#include <cstdint>              // uint64_t
+
+template<typename T>
+class DropOldestQueue {
+  std::deque<T> items;
+  size_t capacity;
+  mutable std::mutex queue_mutex;
+  std::condition_variable queue_cv;
+  bool stopping;
+
+  std::atomic<uint64_t> pushed_count;
+  std::atomic<uint64_t> dropped_count;
+
+public:
+  explicit DropOldestQueue(size_t capacity)
+  : capacity(capacity > 0 ? capacity : 1), stopping{false}, pushed_count{0}, dropped_count{0} { }
+
+  DropOldestQueue(const DropOldestQueue &) = delete;
+  DropOldestQueue & operator=(const DropOldestQueue &) = delete;
+
+  // False if an item was dropped to make room
+  bool push(T item) {
+    bool dropped = false;
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex);
+      if (items.size() >= capacity) {
+        items.pop_front();
+        dropped = true;
+      }
+      items.push_back(std::move(item));
+    }
+    pushed_count++;
+    if (dropped) dropped_count++;
+    queue_cv.notify_one();
+    return !dropped;
+  }
+
+  // Wait for the oldest item.  False once stop() was called.
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    queue_cv.wait(lock, [this] { return stopping || !items.empty(); });
+    if (stopping) return false;
+    item = std::move(items.front());
+    items.pop_front();
+    return true;
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex);
+      stopping = true;
+    }
+    queue_cv.notify_all();
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return items.size();
+  }
+
+  uint64_t pushed() const { return pushed_count.load(); }
+  uint64_t dropped() const { return dropped_count.load(); }
+};
@@ -0,0 +1,310 @@
+#ifndef MAP_BUFFER_H
+#define MAP_BUFFER_H
+
+#include <memory>               // std::shared_ptr
+#include <thread>               // std::thread
+#include <mutex>                // std::mutex
+#include <condition_variable>   // std::condition_variable
+#include <functional>           // std::function
+#include <atomic>               // std::atomic
+#include <deque>                // std::deque
+#include <vector>               // std::vector
+#include <chrono>               // std::chrono::milliseconds
+#include <algorithm>            // std::min, std::max
+#include <variant>              // std::get_if
+
+#include "rclcpp/rclcpp.hpp"
+#include "navigation_interfaces/msg/ufo_map_stamped.hpp"
+
+#include <ufo/map/occupancy_map.h>
+
+#include "navigation_lite/ufomap_ros_msgs_conversions.h"
+#include "navigation_lite/shared_map.h"
+
+namespace navigation_lite
+{
+
+/* **********************************************************************
+ * Double buffered UFO map, fed from the nav_lite/map topic.
+ * submit() hands a message to a background thread and returns at once, so
+ * the executor never waits for a decode.  The message is applied to the
+ * back buffer, which is then published with an atomic pointer swap.
+ *
+ * The map server sends two kinds of messages:
+ *  - keyframes, holding the whole map (empty bounding volume).  A keyframe
+ *    is decoded into a new map, and supersedes all messages still waiting.
+ *  - deltas, holding only the region that changed.  A delta is patched
+ *    into the back buffer, after the messages the back buffer missed while
+ *    it was the front buffer are replayed.  Deltas before the first
+ *    keyframe are dropped.  The deltas since the last keyframe are kept,
+ *    to rebuild the back buffer if a decode fails, or if a reader still
+ *    holds it.  The decoder never waits for a reader.
+ *
+ * get() returns a snapshot that stays valid and unchanged for as long as
+ * the caller holds it, without taking a lock (but see use_shared_map).
+ * An optional callback is run on the background thread after every swap.
+ * After a delta, its snapshot carries the box the delta covered, see
+ * MapSnapshot::changedRegion().
+ *
+ * With use_shared_map, the map server runs in the same process and the
+ * topic is not used: get() reads the SharedMap in place, and so waits
+ * while the map server integrates a cloud.  tryGet() never waits, and
+ * returns an empty snapshot instead, for the control loop.  The callback
+ * is run when the map server flags a new version, with the box around the
+ * changes since the last callback when the map server told it.
+ *
+ * seed() starts the buffer from a map read at startup, see map_snapshot.h.
+ * ***********************************************************************/
+class MapBuffer
+{
+public:
+  typedef MapSnapshot Snapshot;
+  typedef std::function<void(Snapshot)> Callback;
+
+  MapBuffer(double resolution, rclcpp::Logger logger, Callback on_update = nullptr, bool use_shared_map = false)
+  : resolution_(resolution), logger_(logger), on_update_(on_update), use_shared_map_(use_shared_map),
+    stopping_(false), version_(0)
+  {
+    front_ = std::make_shared<ufo::map::OccupancyMap>(resolution_);
+    std::atomic_store(&current_, std::shared_ptr<const ufo::map::OccupancyMap>(front_));
+    if (use_shared_map_) {
+      decoder_ = std::thread(&MapBuffer::watchSharedMap, this);
+    } else {
+      decoder_ = std::thread(&MapBuffer::run, this);
+    }
+  }
+
+  ~MapBuffer()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    cv_.notify_one();
+    decoder_.join();
+  }
+
+  MapBuffer(const MapBuffer &) = delete;
+  MapBuffer & operator=(const MapBuffer &) = delete;
+
+  void submit(const navigation_interfaces::msg::UfoMapStamped::SharedPtr msg)
+  {
+    if (use_shared_map_) return;   // The map is read in place
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (isKeyframe(*msg)) {
+        pending_.clear();   // Everything waiting is in the keyframe as well
+      }
+      pending_.push_back(msg);
+    }
+    cv_.notify_one();
+  }
+
+  // Start from map, e.g. one read from a map snapshot, instead of an empty map.  Call before the
+  // first submit().  The seed is kept until the first keyframe, see run().
+  void seed(std::shared_ptr<ufo::map::OccupancyMap> map)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    front_ = map;
+    std::atomic_store(&current_, std::shared_ptr<const ufo::map::OccupancyMap>(front_));
+    version_++;
+  }
+
+  static bool isKeyframe(const navigation_interfaces::msg::UfoMapStamped &msg)
+  {
+    ufo::geometry::BoundingVolume bv = ufomap_msgs::msgToUfo(msg.map.info.bounding_volume);
+    return bv.begin() == bv.end();
+  }
+
+  // The box around the region of a delta.  False for a keyframe, or a region of other shapes.
+  static bool deltaBox(const navigation_interfaces::msg::UfoMapStamped &msg,
+                       ufo::math::Vector3 &min, ufo::math::Vector3 &max)
+  {
+    ufo::geometry::BoundingVolume bv = ufomap_msgs::msgToUfo(msg.map.info.bounding_volume);
+    bool any = false;
+    for (auto &shape : bv) {
+      const ufo::geometry::AABB *box = std::get_if<ufo::geometry::AABB>(&shape);
+      if (box == nullptr) return false;
+      ufo::math::Vector3 box_min = box->center - box->half_size;
+      ufo::math::Vector3 box_max = box->center + box->half_size;
+      if (!any) {
+        min = box_min;
+        max = box_max;
+        any = true;
+      } else {
+        min = ufo::math::Vector3(std::min(min.x(), box_min.x()), std::min(min.y(), box_min.y()),
+                                 std::min(min.z(), box_min.z()));
+        max = ufo::math::Vector3(std::max(max.x(), box_max.x()), std::max(max.y(), box_max.y()),
+                                 std::max(max.z(), box_max.z()));
+      }
+    }
+    return any;
+  }
+
+  Snapshot get() const
+  {
+    if (use_shared_map_) {
+      Snapshot shared = SharedMap::instance().read();
+      if (shared) return shared;
+    }
+    return Snapshot(std::atomic_load(&current_));   // Empty until the first map arrives
+  }
+
+  // get() without waiting for the map server.  An empty snapshot while the shared map is written.
+  Snapshot tryGet() const
+  {
+    if (use_shared_map_) {
+      Snapshot shared = SharedMap::instance().tryRead();
+      if (shared) return shared;
+      if (SharedMap::instance().available()) return Snapshot();   // Busy
+    }
+    return Snapshot(std::atomic_load(&current_));
+  }
+
+  bool usesSharedMap() const { return use_shared_map_; }
+
+  // Incremented on every swap.  Lets users cache results per map.
+  uint64_t version() const { return version_.load(); }
+
+private:
+  double resolution_;
+  rclcpp::Logger logger_;
+  Callback on_update_;
+  bool use_shared_map_;
+
+  std::shared_ptr<const ufo::map::OccupancyMap> current_;    // Only accessed through std::atomic_load / std::atomic_store
+
+  // Only used by the decoder thread
+  std::shared_ptr<ufo::map::OccupancyMap> front_;   // The map current_ points to
+  std::shared_ptr<ufo::map::OccupancyMap> back_;    // The other buffer, or nullptr
+  std::vector<navigation_interfaces::msg::UfoMapStamped::SharedPtr> replay_;   // Applied to front_, not to back_
+  std::vector<navigation_interfaces::msg::UfoMapStamped::SharedPtr> history_;  // Last keyframe and deltas since, i.e. front_
+
+  std::thread decoder_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<navigation_interfaces::msg::UfoMapStamped::SharedPtr> pending_;
+  bool stopping_;
+  std::atomic<uint64_t> version_;
+
+  // Apply a message to a map.  A keyframe replaces the map.
+  bool apply(std::shared_ptr<ufo::map::OccupancyMap> &map,
+             const navigation_interfaces::msg::UfoMapStamped::SharedPtr &msg)
+  {
+    if (isKeyframe(*msg) || !map) {
+      map = std::make_shared<ufo::map::OccupancyMap>(resolution_);
+    }
+    return ufomap_msgs::msgToUfo(msg->map, map);
+  }
+
+  void run()
+  {
+    while (true) {
+      navigation_interfaces::msg::UfoMapStamped::SharedPtr msg;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+        if (stopping_) return;
+        msg = pending_.front();
+        pending_.pop_front();
+        if (history_.empty() && !isKeyframe(*msg)) {
+          // A delta holds only the region that changed.  Without a keyframe before it, it would be
+          // taken for the whole map.  Late subscribers get a keyframe of their own from the map server.
+          continue;
+        }
+      }
+
+      // The messages that make up the map with this message applied
+      std::vector<navigation_interfaces::msg::UfoMapStamped::SharedPtr> history;
+      if (!isKeyframe(*msg)) {
+        history = history_;
+      } else {
+        back_.reset();   // A new map.  The old back buffer is not needed to build it.
+      }
+      history.push_back(msg);
+
+      // Readers may still hold the back buffer, from when it was the front.  Leave it to them, and
+      // build a new one.  Nobody can take a new reference, as current_ no longer points to it, so
+      // once the count is down to one it stays there.  The fence orders the readers' last accesses
+      // before the patch below.
+      if (back_ && (back_.use_count() > 1)) {
+        back_.reset();
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+      // Bring the back buffer level with the front, then apply the new message.  Without a back
+      // buffer, build one from the last keyframe on.
+      std::vector<navigation_interfaces::msg::UfoMapStamped::SharedPtr> sources;
+      if (back_) {
+        sources = replay_;
+        sources.push_back(msg);
+      } else {
+        sources = history;
+      }
+
+      bool success = true;
+      for (auto &source : sources) {
+        success = success && apply(back_, source);
+      }
+      if (!success) {
+        RCLCPP_WARN(logger_, "UFO Map Conversion failed.");
+        back_.reset();   // Rebuilt from the history next time
+        continue;
+      }
+      RCLCPP_DEBUG(logger_, "UFO Map Conversion successfull.");
+
+      // Swap the buffers.  The old front has missed the message just applied.
+      std::swap(front_, back_);
+      history_.swap(history);
+      replay_.clear();
+      replay_.push_back(msg);
+
+      std::shared_ptr<const ufo::map::OccupancyMap> map(front_);
+      std::atomic_store(&current_, map);
+      version_++;
+
+      if (on_update_) {
+        Snapshot snapshot(map);
+        ufo::math::Vector3 min, max;
+        if (deltaBox(*msg, min, max)) {
+          snapshot.setChangedRegion(min, max);   // The front before had all but this message
+        }
+        on_update_(std::move(snapshot));
+      }
+    }
+  }
+
+  // Shared map mode: nothing to decode, only pass on the changes the map server flags
+  void watchSharedMap()
+  {
+    uint64_t seen = SharedMap::instance().version();
+    bool first = true;    // The callback has not seen the shared map yet, so all of it is new
+    while (true) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) return;
+      }
+      uint64_t latest = SharedMap::instance().waitForChange(seen, std::chrono::milliseconds(100));
+      if (latest == seen) continue;
+
+      Snapshot snapshot = SharedMap::instance().read();
+      ufo::math::Vector3 min, max;
+      bool region = !first && SharedMap::instance().changedSince(seen, min, max);
+      seen = latest;
+      if (!snapshot) continue;   // Withdrawn.  A new map comes with publish(), as a whole.
+      if (region) {
+        snapshot.setChangedRegion(min, max);
+      }
+      first = false;
+      version_++;
+
+      if (on_update_) {
+        on_update_(std::move(snapshot));   // The callback decides how long the read lock is held
+      }
+    }
+  }
+};
+
+}  // namespace navigation_lite
+
+#endif     //MAP_BUFFER_H
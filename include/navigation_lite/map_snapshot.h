@@ -0,0 +1,35 @@
+#ifndef MAP_SNAPSHOT_H
+#define MAP_SNAPSHOT_H
+
+#include <string>         // std::string
+
+#include <ufo/map/occupancy_map.h>
+
+namespace navigation_lite
+{
+
+/* **********************************************************************
+ * Map snapshots: a UFO map file, as written by the save_map service of
+ * the map server, that the servers open at startup with the
+ * map_snapshot_file parameter.  It is an ordinary UFO map file, parsed
+ * fully when read.  The planner caches its occupancy grids beside the
+ * snapshot, in plannerLayerFile() and plannerCoarseLayerFile(), as flat
+ * blocks of bits that are copied out of the mapped file as they are.  The
+ * next start reads those instead of parsing the snapshot.
+ * ***********************************************************************/
+bool readMapSnapshot(const std::string &filename, ufo::map::OccupancyMap &map);
+
+inline std::string plannerLayerFile(const std::string &snapshot)
+{
+  return snapshot + ".grid";
+}
+
+// The coarse grid of hierarchical planning, built from the map at depth
+inline std::string plannerCoarseLayerFile(const std::string &snapshot, int depth)
+{
+  return snapshot + ".coarse" + std::to_string(depth) + ".grid";
+}
+
+}  // namespace navigation_lite
+
+#endif     //MAP_SNAPSHOT_H
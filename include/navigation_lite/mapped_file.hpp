@@ -0,0 +1,80 @@
+// Copyright 2021 Xeni Robotics
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A file mapped read only into memory, for the planner layers stored beside a map snapshot.  The
+// layers are flat blocks of bits, copied straight out of the mapping; the pages are read in by the
+// kernel as they are touched, instead of copied through a stream buffer.
+
+#pragma once
+
+#include <string>        // std::string
+#include <cstddef>       // size_t
+#include <cstdint>       // uint64_t
+#include <initializer_list>
+
+#include <fcntl.h>       // open
+#include <unistd.h>      // close
+#include <sys/mman.h>    // mmap, munmap, madvise
+#include <sys/stat.h>    // fstat, stat
+
+class MappedFile {
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+
+public:
+  explicit MappedFile(const std::string &filename)
+  {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if ((::fstat(fd, &st) == 0) && (st.st_size > 0)) {
+      void *p = ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        // Read front to back, and start reading now.  The advice values are not flags, so one call each.
+        ::madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+        ::madvise(p, (size_t)st.st_size, MADV_WILLNEED);
+        data_ = static_cast<const char *>(p);
+        size_ = (size_t)st.st_size;
+      }
+    }
+    ::close(fd);   // The mapping stays valid
+  }
+
+  ~MappedFile()
+  {
+    if (data_) ::munmap(const_cast<char *>(data_), size_);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile & operator=(const MappedFile &) = delete;
+
+  explicit operator bool() const { return data_ != nullptr; }
+  const char * data() const { return data_; }
+  size_t size() const { return size_; }
+
+  // Inode, size and modification time (to the nanosecond) of a file, folded into one number.  0 when
+  // there is no such file.  Stored with data derived from the file, to tell when it is out of date;
+  // a file rewritten within the same second, or replaced by a rename, gets a different stamp.
+  static uint64_t stamp(const std::string &filename)
+  {
+    struct stat st;
+    if (::stat(filename.c_str(), &st) != 0) return 0;
+    uint64_t hash = 14695981039346656037ull;            // FNV-1a over the fields
+    for (uint64_t field : {(uint64_t)st.st_ino, (uint64_t)st.st_size,
+                           (uint64_t)st.st_mtim.tv_sec, (uint64_t)st.st_mtim.tv_nsec}) {
+      hash = (hash ^ field) * 1099511628211ull;
+    }
+    return hash ? hash : 1;
+  }
+};
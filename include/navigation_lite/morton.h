@@ -0,0 +1,53 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <cstdint>      // uint64_t
+#include <array>        // std::array
+
+/* **********************************************************************
+ * Morton (Z-order) codes for signed 3D integer coordinates.
+ * Each coordinate is offset by 2^20 and interleaved over 21 bits, hence
+ * coordinates in the range [-1048576, 1048575] map to a unique 63 bit key.
+ * Cells that are close in space get keys that are close, which keeps the
+ * chunks of the sparse grids together in memory.
+ * ***********************************************************************/
+
+const int MORTON_OFFSET = 1 << 20;
+
+inline uint64_t mortonSplit(uint32_t a)
+{
+  uint64_t x = a & 0x1fffff;
+  x = (x | x << 32) & 0x1f00000000ffff;
+  x = (x | x << 16) & 0x1f0000ff0000ff;
+  x = (x | x << 8)  & 0x100f00f00f00f00f;
+  x = (x | x << 4)  & 0x10c30c30c30c30c3;
+  x = (x | x << 2)  & 0x1249249249249249;
+  return x;
+}
+
+inline uint64_t mortonCode(int x, int y, int z)
+{
+  return mortonSplit((uint32_t)(x + MORTON_OFFSET))
+       | (mortonSplit((uint32_t)(y + MORTON_OFFSET)) << 1)
+       | (mortonSplit((uint32_t)(z + MORTON_OFFSET)) << 2);
+}
+
+inline uint32_t mortonCompact(uint64_t x)
+{
+  x &= 0x1249249249249249;
+  x = (x ^ (x >> 2))  & 0x10c30c30c30c30c3;
+  x = (x ^ (x >> 4))  & 0x100f00f00f00f00f;
+  x = (x ^ (x >> 8))  & 0x1f0000ff0000ff;
+  x = (x ^ (x >> 16)) & 0x1f00000000ffff;
+  x = (x ^ (x >> 32)) & 0x1fffff;
+  return (uint32_t)x;
+}
+
+inline void mortonDecode(uint64_t code, std::array<int, 3> &p)
+{
+  p.at(0) = (int)mortonCompact(code) - MORTON_OFFSET;
+  p.at(1) = (int)mortonCompact(code >> 1) - MORTON_OFFSET;
+  p.at(2) = (int)mortonCompact(code >> 2) - MORTON_OFFSET;
+}
+
+#endif     //MORTON_H
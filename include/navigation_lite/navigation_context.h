@@ -0,0 +1,41 @@
+#ifndef NAVIGATION_CONTEXT_H
+#define NAVIGATION_CONTEXT_H
+
+#include <memory>
+
+#include "rclcpp/rclcpp.hpp"
+
+#include "behaviortree_cpp_v3/behavior_tree.h"
+
+#include "navigation_lite/navigation_server.h"
+#include "navigation_lite/pose_3D.h"
+
+namespace NavigationNodes
+{
+
+/* **********************************************************************
+ * What the nodes of the tree for one NavigateToPose goal share.  The
+ * navigation server puts it on the blackboard of the tree as "context"
+ * before the tree is built, and the nodes take it in their constructor.
+ * ***********************************************************************/
+struct NavigationContext
+{
+  rclcpp::Node::SharedPtr node;          // The navigation server
+  std::shared_ptr<TreeWakeUp> wake_up;   // Wakes the thread ticking the tree
+  Pose3D goal;                           // The pose to navigate to
+};
+
+typedef std::shared_ptr<NavigationContext> NavigationContextPtr;
+
+inline NavigationContextPtr getContext(const BT::NodeConfiguration& config)
+{
+  NavigationContextPtr context;
+  if (!config.blackboard || !config.blackboard->get("context", context) || !context) {
+    throw BT::RuntimeError("No navigation context on the blackboard");
+  }
+  return context;
+}
+
+} // Namespace
+
+#endif // NAVIGATION_CONTEXT_H
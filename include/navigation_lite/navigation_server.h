@@ -1,9 +1,49 @@
 #ifndef NAVIGATION_SERVER_H
 #define NAVIGATION_SERVER_H
 
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+#include <nav_msgs/msg/path.hpp>
+
 namespace NavigationNodes
 {
   enum class ActionStatus {VIRGIN, REJECTED, PROCESSING, SUCCEEDED, FAILED, ABORTED, CANCELED, UNKNOWN};
-}  
+
+  // Type of the "path" ports.  Plans are passed between the tree nodes on the blackboard by
+  // pointer, never as text.  The path is not changed once it is on the blackboard.
+  typedef std::shared_ptr<const nav_msgs::msg::Path> PathPtr;
+
+  // Wakes the thread that ticks the tree when an action node has news, so the tree does not
+  // have to be polled to see a result as soon as it arrives.
+  class TreeWakeUp
+  {
+  public:
+    void notify()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_ = true;
+      }
+      cv_.notify_all();
+    }
+
+    // Wait for a notify() since the last wait, or the timeout.  Returns true when notified.
+    template<class Duration>
+    bool waitFor(Duration timeout)
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      bool notified = cv_.wait_for(lock, timeout, [this] { return pending_; });
+      pending_ = false;
+      return notified;
+    }
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool pending_ = false;
+  };
+}
 
 #endif  // NAVIGATION_SERVER_H
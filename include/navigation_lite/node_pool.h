@@ -0,0 +1,211 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <vector>         // std::vector
+#include <array>          // std::array
+#include <memory>         // std::unique_ptr
+#include <unordered_map>  // std::unordered_map
+#include <limits>         // std::numeric_limits
+#include <cstdint>        // uint32_t
+
+#include "morton.h"
+
+/* **********************************************************************
+ * Sparse, chunked structure-of-arrays storage for the D* Lite graph.
+ * Space is divided in chunks of 8x8x8 cells.  A chunk is allocated the
+ * first time the search touches one of its cells, and is found through a
+ * hash map keyed on the Morton code of the chunk coordinates.  Memory
+ * therefore follows the cells the search actually visits, not the size of
+ * the area that can be planned in.
+ *
+ * Inside a chunk the g and rhs scores, the id of the best successor
+ * (where rhs came from) and the position in the open list are contiguous
+ * arrays.  A node id is (chunk index << 9) | offset in the chunk.
+ *
+ * Every chunk carries the generation in which it was last written.  A
+ * chunk from an older generation reads as fresh nodes (g = rhs = INF),
+ * hence reset() only has to increment the generation counter.  Allocated
+ * chunks are kept for reuse by the next search, unless the pool has grown
+ * well past what the last search used: then reset() frees the chunks the
+ * last search did not touch, so one wide search does not pin its memory
+ * for the rest of the flight.  Node ids do not survive a reset().
+ * ***********************************************************************/
+class NodePool {
+  public:
+    typedef uint32_t NodeId;
+    static constexpr NodeId NONE = std::numeric_limits<uint32_t>::max();
+
+    static constexpr int CHUNK_BITS = 3;
+    static constexpr int CHUNK_SIZE = 1 << CHUNK_BITS;            // cells along an edge
+    static constexpr int CHUNK_CELLS = CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE;
+
+    // reset() frees the stale chunks when there are more than SHRINK_FACTOR times the chunks of the
+    // last search, plus MIN_CHUNKS
+    static constexpr size_t SHRINK_FACTOR = 4;
+    static constexpr size_t MIN_CHUNKS = 64;
+
+    NodePool()
+      : current_generation(1)
+      , live_chunks(0)
+      , last_key(0)
+      , last_chunk(NONE)
+    { }
+
+    // Id of the node at x, y, z.  Allocates (or revives) the chunk if needed.
+    NodeId id(int x, int y, int z)
+    {
+      uint32_t chunk = findChunk(x, y, z, true);
+      return (chunk << (3 * CHUNK_BITS)) | cellOffset(x, y, z);
+    }
+
+    // Id of the node at x, y, z if it exists in the current generation, NONE otherwise.
+    NodeId find(int x, int y, int z)
+    {
+      uint32_t chunk = findChunk(x, y, z, false);
+      if ((chunk == NONE) || (chunks[chunk]->generation != current_generation)) {
+        return NONE;
+      }
+      return (chunk << (3 * CHUNK_BITS)) | cellOffset(x, y, z);
+    }
+
+    void getPoint(NodeId node, std::array<int, 3> &p) const
+    {
+      const Chunk &c = chunkOf(node);
+      uint32_t offset = node & (CHUNK_CELLS - 1);
+      p.at(0) = c.origin.at(0) + (int)(offset & (CHUNK_SIZE - 1));
+      p.at(1) = c.origin.at(1) + (int)((offset >> CHUNK_BITS) & (CHUNK_SIZE - 1));
+      p.at(2) = c.origin.at(2) + (int)(offset >> (2 * CHUNK_BITS));
+    }
+
+    // Forget all nodes in O(1).  Only on the (very rare) wrap of the counter
+    // do the chunks have to be stamped again, and only when the pool is much
+    // larger than the last search are the chunks it did not touch freed.
+    void reset()
+    {
+      if (chunks.size() > SHRINK_FACTOR * live_chunks + MIN_CHUNKS) {
+        dropStaleChunks();
+      }
+      live_chunks = 0;
+      current_generation++;
+      if (current_generation == 0) {
+        for(auto &chunk : chunks) {
+          chunk->generation = 0;
+        }
+        current_generation = 1;
+      }
+    }
+
+    // Accessors assume the node was obtained through id() in the current generation
+    float & gScore(NodeId node) { return chunkOf(node).g[node & (CHUNK_CELLS - 1)]; }
+    float & rhsScore(NodeId node) { return chunkOf(node).rhs[node & (CHUNK_CELLS - 1)]; }
+    NodeId & nextStep(NodeId node) { return chunkOf(node).next[node & (CHUNK_CELLS - 1)]; }
+    uint32_t & heapIndex(NodeId node) { return chunkOf(node).heap_index[node & (CHUNK_CELLS - 1)]; }
+    uint32_t heapIndex(NodeId node) const { return chunkOf(node).heap_index[node & (CHUNK_CELLS - 1)]; }
+
+    // Number of cells held in memory
+    size_t size() const { return chunks.size() * CHUNK_CELLS; }
+
+    size_t memoryUsage() const
+    {
+      return chunks.size() * sizeof(Chunk) + chunk_index.size() * (sizeof(uint64_t) + sizeof(uint32_t));
+    }
+
+  private:
+    struct Chunk
+    {
+      std::array<int, 3> origin;
+      uint32_t generation;
+      float g[CHUNK_CELLS];
+      float rhs[CHUNK_CELLS];
+      NodeId next[CHUNK_CELLS];
+      uint32_t heap_index[CHUNK_CELLS];
+    };
+
+    std::vector< std::unique_ptr<Chunk> > chunks;
+    std::unordered_map<uint64_t, uint32_t> chunk_index;
+    uint32_t current_generation;
+    size_t live_chunks;            // Chunks stamped in the current generation
+
+    // Neighbouring cells mostly fall in the same chunk.  Remember the last one found.
+    uint64_t last_key;
+    uint32_t last_chunk;
+
+    Chunk & chunkOf(NodeId node) { return *chunks[node >> (3 * CHUNK_BITS)]; }
+    const Chunk & chunkOf(NodeId node) const { return *chunks[node >> (3 * CHUNK_BITS)]; }
+
+    static uint32_t cellOffset(int x, int y, int z)
+    {
+      return (x & (CHUNK_SIZE - 1))
+           | ((y & (CHUNK_SIZE - 1)) << CHUNK_BITS)
+           | ((z & (CHUNK_SIZE - 1)) << (2 * CHUNK_BITS));
+    }
+
+    void stamp(Chunk &chunk)
+    {
+      chunk.generation = current_generation;
+      live_chunks++;
+      for(int i = 0; i < CHUNK_CELLS; i++) {
+        chunk.g[i] = std::numeric_limits<float>::max();
+        chunk.rhs[i] = std::numeric_limits<float>::max();
+        chunk.next[i] = NONE;
+        chunk.heap_index[i] = std::numeric_limits<uint32_t>::max();
+      }
+    }
+
+    // Keep only the chunks of the current generation, renumbered from 0.  Invalidates all node ids.
+    void dropStaleChunks()
+    {
+      size_t kept = 0;
+      for (size_t i = 0; i < chunks.size(); i++) {
+        if (chunks[i]->generation == current_generation) {
+          chunks[kept++] = std::move(chunks[i]);
+        }
+      }
+      chunks.resize(kept);
+      chunks.shrink_to_fit();
+
+      chunk_index.clear();
+      for (size_t i = 0; i < chunks.size(); i++) {
+        const auto &origin = chunks[i]->origin;
+        chunk_index[mortonCode(origin.at(0) >> CHUNK_BITS, origin.at(1) >> CHUNK_BITS, origin.at(2) >> CHUNK_BITS)] = i;
+      }
+      chunk_index.rehash(0);
+      last_chunk = NONE;
+    }
+
+    uint32_t findChunk(int x, int y, int z, bool create)
+    {
+      // Arithmetic shift, so negative coordinates also round towards -inf
+      int cx = x >> CHUNK_BITS;
+      int cy = y >> CHUNK_BITS;
+      int cz = z >> CHUNK_BITS;
+      uint64_t key = mortonCode(cx, cy, cz);
+
+      uint32_t chunk;
+      if ((last_chunk != NONE) && (key == last_key)) {
+        chunk = last_chunk;
+      } else {
+        auto it = chunk_index.find(key);
+        if (it != chunk_index.end()) {
+          chunk = it->second;
+        } else if (create) {
+          chunk = chunks.size();
+          chunks.push_back( std::unique_ptr<Chunk>(new Chunk) );
+          chunks.back()->origin = { cx * CHUNK_SIZE, cy * CHUNK_SIZE, cz * CHUNK_SIZE };
+          chunks.back()->generation = 0;
+          chunk_index[key] = chunk;
+        } else {
+          return NONE;
+        }
+        last_key = key;
+        last_chunk = chunk;
+      }
+
+      if (create && (chunks[chunk]->generation != current_generation)) {
+        stamp(*chunks[chunk]);
+      }
+      return chunk;
+    }
+};
+
+#endif     //NODE_POOL_H
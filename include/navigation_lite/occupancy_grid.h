@@ -0,0 +1,147 @@
+#ifndef OCCUPANCY_GRID_H
+#define OCCUPANCY_GRID_H
+
+#include <vector>         // std::vector
+#include <array>          // std::array
+#include <unordered_map>  // std::unordered_map
+#include <cstdint>        // uint64_t
+#include <string>         // std::string
+#include <ostream>        // std::ostream
+
+#include "morton.h"
+#include "thread_pool.hpp"
+
+/* **********************************************************************
+ * Sparse bitmap over signed 3D integer coordinates.
+ * Bits are stored in blocks of 8x8x8 (eight 64 bit words).  A block is
+ * found through a hash map keyed on the Morton code of the block
+ * coordinates, and is only allocated when one of its bits is set.
+ * ***********************************************************************/
+class SparseBitmap {
+  public:
+    static constexpr int BLOCK_BITS = 3;
+    static constexpr int BLOCK_SIZE = 1 << BLOCK_BITS;      // bits along an edge
+    typedef std::array<uint64_t, BLOCK_SIZE> Block;          // one word per z layer
+
+    bool test(int x, int y, int z) const
+    {
+      auto it = blocks.find( blockKey(x, y, z) );
+      if (it == blocks.end()) return false;
+      return (it->second[z & (BLOCK_SIZE - 1)] >> bitIndex(x, y)) & 1;
+    }
+
+    void set(int x, int y, int z)
+    {
+      blocks[ blockKey(x, y, z) ][z & (BLOCK_SIZE - 1)] |= (uint64_t)1 << bitIndex(x, y);
+    }
+
+    void reset(int x, int y, int z)
+    {
+      auto it = blocks.find( blockKey(x, y, z) );
+      if (it == blocks.end()) return;
+      it->second[z & (BLOCK_SIZE - 1)] &= ~((uint64_t)1 << bitIndex(x, y));
+    }
+
+    // Block level access, for algorithms that work a block at a time
+    const Block * findBlock(int bx, int by, int bz) const
+    {
+      auto it = blocks.find( mortonCode(bx, by, bz) );
+      return (it == blocks.end()) ? nullptr : &it->second;
+    }
+    void setBlock(int bx, int by, int bz, const Block &block) { blocks[ mortonCode(bx, by, bz) ] = block; }
+    void getBlocks(std::vector< std::array<int, 3> > &block_coordinates) const;
+
+    // The blocks as stored: the count, then the Morton key and the words of every block.  read()
+    // takes the bitmap from memory written so, and moves data past it.  False when it runs short.
+    void write(std::ostream &out) const;
+    bool read(const char *&data, const char *end);
+
+    void clear() { blocks.clear(); }
+    bool empty() const { return blocks.empty(); }
+    void swap(SparseBitmap &other) { blocks.swap(other.blocks); }
+
+    size_t count() const;
+
+    // Append the coordinates of every set bit
+    void getPoints(std::vector< std::array<int, 3> > &points) const;
+
+    // Append the coordinates of every bit that differs between this and the other bitmap
+    void difference(const SparseBitmap &other, std::vector< std::array<int, 3> > &points) const;
+
+    // The same, for the bits in the box from min to max (inclusive) only
+    void difference(const SparseBitmap &other, const std::array<int, 3> &min, const std::array<int, 3> &max,
+                    std::vector< std::array<int, 3> > &points) const;
+
+  private:
+    std::unordered_map<uint64_t, Block> blocks;
+
+    static uint64_t blockKey(int x, int y, int z)
+    {
+      // Arithmetic shift, so negative coordinates also round towards -inf
+      return mortonCode(x >> BLOCK_BITS, y >> BLOCK_BITS, z >> BLOCK_BITS);
+    }
+    static int bitIndex(int x, int y) { return (x & (BLOCK_SIZE - 1)) | ((y & (BLOCK_SIZE - 1)) << BLOCK_BITS); }
+
+    static void appendBits(uint64_t key, int layer, uint64_t word, std::vector< std::array<int, 3> > &points);
+    void differenceInBlock(const SparseBitmap &other, const std::array<int, 3> &block,
+                           const std::array<int, 3> &min, const std::array<int, 3> &max,
+                           std::vector< std::array<int, 3> > &points) const;
+};
+
+/* **********************************************************************
+ * Occupancy of the D* Lite planning lattice, inflated by the robot radius.
+ * The raw layer holds the unit cells [x, x+1) x [y, y+1) x [z, z+1) that
+ * contain an occupied leaf of the map.  The inflated layer holds the
+ * lattice points where a sphere of the robot radius touches a raw cell,
+ * i.e. where the robot can not be.  Testing a point is a single bit test.
+ *
+ * update() takes the occupied cells of a new map.  It only recomputes the
+ * lattice points around cells that changed, and returns the points whose
+ * occupancy flipped so the planner can repair its search.  When only a
+ * region of the map changed, the region form of update() takes the
+ * occupied cells in that box, and leaves the cells outside it as they are.
+ *
+ * When most of the map is new, the inflated layer is rebuilt a block at a
+ * time with a separable (squared euclidean) distance transform, hence the
+ * cost grows linearly with the radius.  The blocks are shared out over the
+ * thread pool, if there is one.
+ * ***********************************************************************/
+class OccupancyGrid {
+  public:
+    // radius in cells.  pool may be nullptr, the rebuild then runs on the calling thread.
+    explicit OccupancyGrid(double radius, ThreadPool *pool = nullptr);
+
+    bool isOccupied(int x, int y, int z) const { return inflated.test(x, y, z); }
+    bool isCellOccupied(int x, int y, int z) const { return raw.test(x, y, z); }
+
+    void update(const std::vector< std::array<int, 3> > &occupied_cells,
+                std::vector< std::array<int, 3> > &changed_points);
+    // Cells from min to max (inclusive).  Cells of occupied_cells outside the box are ignored.
+    void update(const std::array<int, 3> &min_cell, const std::array<int, 3> &max_cell,
+                const std::vector< std::array<int, 3> > &occupied_cells,
+                std::vector< std::array<int, 3> > &changed_points);
+    void clear();
+
+    // Store both layers, tagged with stamp, the MappedFile::stamp() of the map they were built
+    // from.  load() only takes a file with the same stamp and radius, and leaves the grid as it
+    // was otherwise.  The file is memory mapped, so the layers are copied straight into the blocks.
+    bool save(const std::string &filename, uint64_t stamp) const;
+    bool load(const std::string &filename, uint64_t stamp);
+
+  private:
+    SparseBitmap raw;
+    SparseBitmap inflated;
+    double radius;
+    int reach;          // Furthest offset, along an axis, of a raw cell that can touch a point
+    ThreadPool *pool;
+
+    // Offsets o so that the raw cell at p + o touches the sphere around lattice point p
+    std::vector< std::array<int, 3> > stencil;
+
+    bool touchesOccupiedCell(int x, int y, int z) const;
+    void patch(const std::vector< std::array<int, 3> > &flipped, std::vector< std::array<int, 3> > &changed_points);
+    void dilate(SparseBitmap &result) const;
+    void dilateBlock(const std::array<int, 3> &block, SparseBitmap::Block &result) const;
+};
+
+#endif     //OCCUPANCY_GRID_H
@@ -0,0 +1,147 @@
+#ifndef OPEN_LIST_H
+#define OPEN_LIST_H
+
+#include <vector>       // std::vector
+#include <cstddef>      // size_t
+#include <limits>       // std::numeric_limits
+#include <utility>      // std::swap
+#include <cstdint>      // uint32_t
+
+// D* Lite priority of a node: [min(g, rhs) + e * h(start, s) + k_m ; min(g, rhs)]
+struct Key
+{
+  float k1;
+  float k2;
+
+  bool operator<(const Key &other) const
+  {
+    return (k1 < other.k1) || ((k1 == other.k1) && (k2 < other.k2));
+  }
+};
+
+/* **********************************************************************
+ * Indexed binary min-heap used as the D* Lite open list.
+ * The heap holds node ids.  The position of every node in the heap is
+ * kept by the node pool (queried through pool.heapIndex(id)), so that
+ * "is in queue", decrease-key, increase-key and remove are all possible
+ * without scanning the list.
+ *   push, update, remove, pop : O(log n)
+ *   contains, top, topKey     : O(1)
+ * ***********************************************************************/
+template<typename Pool>
+class OpenList {
+  public:
+    typedef typename Pool::NodeId NodeId;
+    static constexpr uint32_t NOT_QUEUED = std::numeric_limits<uint32_t>::max();
+
+    explicit OpenList(Pool &pool) : pool(pool) { }
+
+    bool empty() const { return heap.empty(); }
+    size_t size() const { return heap.size(); }
+
+    bool contains(NodeId id) const { return pool.heapIndex(id) != NOT_QUEUED; }
+
+    NodeId top() const { return heap.front().id; }
+    const Key & topKey() const { return heap.front().key; }
+
+    void push(NodeId id, Key key)
+    {
+      pool.heapIndex(id) = heap.size();
+      heap.push_back( Entry{key, id} );
+      siftUp(heap.size() - 1);
+    }
+
+    // Change the key of a node already on the list, in either direction
+    void update(NodeId id, Key key)
+    {
+      uint32_t i = pool.heapIndex(id);
+      heap[i].key = key;
+      siftUp(i);
+      siftDown(pool.heapIndex(id));
+    }
+
+    void remove(NodeId id)
+    {
+      uint32_t i = pool.heapIndex(id);
+      uint32_t last = heap.size() - 1;
+      if (i != last) {
+        swapEntries(i, last);
+      }
+      pool.heapIndex(id) = NOT_QUEUED;
+      heap.pop_back();
+      if (i < heap.size()) {
+        siftUp(i);
+        siftDown(pool.heapIndex(heap[i].id));
+      }
+    }
+
+    NodeId pop()
+    {
+      NodeId id = heap.front().id;
+      remove(id);
+      return id;
+    }
+
+    // Recompute the key of every node on the list with key_of(id), and restore the heap.  O(n).
+    template<typename KeyFunction>
+    void rekey(KeyFunction key_of)
+    {
+      for(auto &entry : heap) {
+        entry.key = key_of(entry.id);
+      }
+      for(uint32_t i = heap.size() / 2; i > 0; i--) {
+        siftDown(i - 1);
+      }
+    }
+
+    void clear()
+    {
+      for(auto &entry : heap) {
+        pool.heapIndex(entry.id) = NOT_QUEUED;
+      }
+      heap.clear();
+    }
+
+  private:
+    struct Entry
+    {
+      Key key;
+      NodeId id;
+    };
+    Pool &pool;
+    std::vector<Entry> heap;
+
+    void swapEntries(uint32_t a, uint32_t b)
+    {
+      std::swap(heap[a], heap[b]);
+      pool.heapIndex(heap[a].id) = a;
+      pool.heapIndex(heap[b].id) = b;
+    }
+
+    void siftUp(uint32_t i)
+    {
+      while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (!(heap[i].key < heap[parent].key)) break;
+        swapEntries(i, parent);
+        i = parent;
+      }
+    }
+
+    void siftDown(uint32_t i)
+    {
+      uint32_t n = heap.size();
+      while (true) {
+        uint32_t left = 2 * i + 1;
+        uint32_t right = left + 1;
+        uint32_t smallest = i;
+        if ((left < n) && (heap[left].key < heap[smallest].key)) smallest = left;
+        if ((right < n) && (heap[right].key < heap[smallest].key)) smallest = right;
+        if (smallest == i) break;
+        swapEntries(i, smallest);
+        i = smallest;
+      }
+    }
+};
+
+#endif     //OPEN_LIST_H
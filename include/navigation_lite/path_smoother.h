@@ -0,0 +1,44 @@
+#ifndef PATH_SMOOTHER_H
+#define PATH_SMOOTHER_H
+
+#include <vector>         // std::vector
+#include <array>          // std::array
+
+#include "occupancy_grid.h"
+
+/* **********************************************************************
+ * Post processing of the D* Lite path, which has one waypoint per grid
+ * step.  In turn:
+ *  - shortcutting: from every kept waypoint, skip to the furthest later
+ *    waypoint that is in line of sight on the inflated occupancy grid
+ *  - collinear pruning: drop waypoints on the straight line between
+ *    their neighbours
+ *  - optionally, resampling along a Catmull-Rom spline at a fixed
+ *    spacing.  A span of the spline that is not clear stays straight.
+ *
+ * Line of sight holds when every lattice point at a corner of a cell the
+ * segment passes through is free, and stays within min_z <= z < max_z.
+ * ***********************************************************************/
+class PathSmoother {
+  public:
+    typedef std::array<double, 3> Point;
+
+    PathSmoother(const OccupancyGrid *grid, int min_z, int max_z);
+
+    // path holds the waypoints after start.  spline_spacing <= 0 leaves out the resampling.
+    void smooth(const Point &start, std::vector<Point> &path, double spline_spacing) const;
+
+    bool lineOfSight(const Point &from, const Point &to) const;
+
+  private:
+    const OccupancyGrid *grid;
+    int min_z;
+    int max_z;
+
+    bool isCellFree(int x, int y, int z) const;
+    void shortcut(std::vector<Point> &points) const;
+    void pruneCollinear(std::vector<Point> &points) const;
+    void resample(std::vector<Point> &points, double spacing) const;
+};
+
+#endif     //PATH_SMOOTHER_H
@@ -18,58 +18,143 @@
 
 #include <iostream>
 #include <cmath>
+#include <array>      // std::array
+#include <cstddef>    // size_t
 
 using namespace std;
 
-class PID {
-    float _dt, _max, _min, _Kp, _Kd, _Ki, _pre_error, _integral;
+/* **********************************************************************
+ * N PID controllers, one per axis, updated together.  Gains, limits and
+ * state are kept per field in arrays of N (structure of arrays), and one
+ * call runs every axis through the same straight loop, so the compiler
+ * can vectorize it.  The stages of an axis are:
+ *   PID with the measured dt, and anti-windup on the integral
+ *   + feed-forward
+ *   clamp to min/max
+ * and, on the command that is finally sent, limitRate().
+ * ***********************************************************************/
+template<size_t N>
+class PIDVector {
   public:
-  
+    typedef std::array<float, N> Values;
+    typedef std::array<bool, N> Mask;
+
+    // dt - nominal loop interval time, used when no interval is measured
+    explicit PIDVector(float dt)
+      : _dt(dt)
+    {
+      for (size_t i = 0; i < N; i++) {
+        _max[i] = 0.0; _min[i] = 0.0;
+        _Kp[i] = 0.0; _Kd[i] = 0.0; _Ki[i] = 0.0;
+        _max_rate[i] = 0.0;
+      }
+      restart_control();
+    }
+
     // Kp - proportional gain
     // Ki - integral gain
     // Kd - derivative gain
-    // dt - loop interval time
     // max - maximum value of manipulated variable
     // min - minimum value of manipulated variable 
-    PID(float dt, float max, float min, float Kp, float Kd, float Ki)
-      : _dt(dt), _max(max), _min(min), _Kp(Kp), _Kd(Kd), _Ki(Ki), _pre_error(0.0), _integral(0.0)
-    { }
+    void setAxis(size_t axis, float max, float min, float Kp, float Kd, float Ki)
+    {
+      _max[axis] = max; _min[axis] = min;
+      _Kp[axis] = Kp; _Kd[axis] = Kd; _Ki[axis] = Ki;
+    }
 
-    float calculate(float setpoint, float pv)
+    // Largest change of the command per second, for limitRate().  0 for no limit.
+    void setRateLimit(size_t axis, float max_rate)
     {
-      // Calculate error
-      float error = setpoint - pv;
-  
-      // Proportional term
-      float Pout = _Kp * error;     
-  
-      // Integral Term
-      _integral += error * _dt;
-      float Iout = _Ki * _integral;  
-  
-      // Derivative Term
-      float derivative = (error - _pre_error) / _dt;
-      float Dout = _Kd * derivative;
-  
-      //Calculate total output
-      float output = Pout + Iout + Dout;
-  
-      // Restrict to max/min
-      if (output > _max)
-        output = _max;
-      else if ( output < _min )
-        output = _min;
-    
-      _pre_error = error;
-      
-      return output;
+      _max_rate[axis] = max_rate;
     }
-    
-    void restart_control() 
+
+    // Calculate the output of every axis in active.  An axis that is not active keeps its state,
+    // and outputs 0.  dt - measured time since the last call.
+    void calculate(const Values &setpoint, const Values &pv, const Values &feed_forward, float dt,
+                   Values &output, const Mask &active)
     {
-      _pre_error = 0.0;
-      _integral = 0.0;
+      if (dt <= 0.0) {
+        dt = _dt;
+      }
+
+      for (size_t i = 0; i < N; i++) {
+        // Calculate error
+        float error = setpoint[i] - pv[i];
+
+        // Proportional term
+        float Pout = _Kp[i] * error;
+
+        // Derivative Term.  There is no previous error on the first call after a restart.
+        float Dout = _first[i] ? 0.0f : _Kd[i] * (error - _pre_error[i]) / dt;
+
+        // Integral Term, with anti-windup.  The integral does not grow while the output is
+        // saturated in the direction it would grow, and its term alone stays within max/min.
+        float integral = _integral[i] + error * dt;
+        float unclamped = Pout + _Ki[i] * integral + Dout + feed_forward[i];
+        bool winding_up = ((unclamped > _max[i]) && (_Ki[i] * error > 0)) ||
+                          ((unclamped < _min[i]) && (_Ki[i] * error < 0));
+        integral = winding_up ? _integral[i] : integral;
+        float Iout = clamp(_Ki[i] * integral, _min[i], _max[i]);
+        integral = (_Ki[i] != 0.0f) ? Iout / _Ki[i] : integral;
+
+        // Calculate total output, and restrict to max/min
+        float out = clamp(Pout + Iout + Dout + feed_forward[i], _min[i], _max[i]);
+
+        output[i] = active[i] ? out : 0.0f;
+        _integral[i] = active[i] ? integral : _integral[i];
+        _pre_error[i] = active[i] ? error : _pre_error[i];
+        _first[i] = _first[i] && !active[i];
+      }
+    }
+
+    void calculate(const Values &setpoint, const Values &pv, float dt, Values &output, const Mask &active)
+    {
+      Values none;
+      none.fill(0.0);
+      calculate(setpoint, pv, none, dt, output, active);
+    }
+
+    // Limit the change of the command since the last command sent, to the rate limit of each axis
+    void limitRate(Values &command, float dt)
+    {
+      if (dt <= 0.0) {
+        dt = _dt;
+      }
+      for (size_t i = 0; i < N; i++) {
+        float step = _max_rate[i] * dt;
+        float limited = clamp(command[i], _last_command[i] - step, _last_command[i] + step);
+        command[i] = (_max_rate[i] > 0.0f) ? limited : command[i];
+        _last_command[i] = command[i];
+      }
+    }
+
+    void restart_control(size_t axis)
+    {
+      _pre_error[axis] = 0.0;
+      _integral[axis] = 0.0;
+      _last_command[axis] = 0.0;
+      _first[axis] = true;
     }
-};
 
+    void restart_control()
+    {
+      for (size_t i = 0; i < N; i++) {
+        restart_control(i);
+      }
+    }
+
+  private:
+    float _dt;
+    float _max[N], _min[N], _Kp[N], _Kd[N], _Ki[N], _max_rate[N];
+    float _pre_error[N], _integral[N], _last_command[N];
+    bool _first[N];
+
+    static float clamp(float value, float low, float high)
+    {
+      return (value > high) ? high : ((value < low) ? low : value);
+    }
+};
 
+// The axes of a drone velocity command
+enum FlightAxis : size_t { AXIS_X = 0, AXIS_Y, AXIS_Z, AXIS_YAW, FLIGHT_AXES };
+typedef PIDVector<FLIGHT_AXES> FlightPID;
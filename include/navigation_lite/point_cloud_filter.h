@@ -0,0 +1,56 @@
+#ifndef POINT_CLOUD_FILTER_H
+#define POINT_CLOUD_FILTER_H
+
+#include <cstdint>          // uint64_t
+#include <unordered_set>    // std::unordered_set
+
+#include <ufo/map/point_cloud.h>
+#include <ufo/math/pose6.h>
+
+/* **********************************************************************
+ * Voxel grid downsampling of a point cloud, before it is integrated in
+ * the map.  Points in the same voxel cast almost the same ray, so only
+ * the first point in every voxel is kept.  Voxels are keyed on the Morton
+ * code of their integer coordinates.
+ * The filter keeps its hash set and output cloud between calls, so a
+ * filter used for every frame does not allocate once it has warmed up.
+ * ***********************************************************************/
+class VoxelFilter
+{
+public:
+  explicit VoxelFilter(double voxel_size);
+
+  double voxelSize() const { return voxel_size; }
+
+  // The points of cloud_in, one per voxel.  Valid until the next call.
+  const ufo::map::PointCloudColor & filter(const ufo::map::PointCloudColor &cloud_in);
+
+private:
+  double voxel_size;
+  double inverse_size;
+  std::unordered_set<uint64_t> seen;
+  ufo::map::PointCloudColor cloud_out;
+};
+
+/* **********************************************************************
+ * Removes the points on the robot itself from a cloud in the map frame:
+ * the body, the props and what they blow up.  The robot is a cylinder
+ * of radius and height around its origin, along its own z axis.  Without
+ * these points nothing is marked occupied on the robot, so the map needs
+ * no clearing pass around it after integration.
+ * ***********************************************************************/
+class BodyFilter
+{
+public:
+  BodyFilter(double radius, double height);
+
+  // Removes the points of cloud inside the robot at robot, its pose in the map frame.  Returns
+  // the number removed.
+  size_t filter(ufo::map::PointCloudColor &cloud, const ufo::math::Pose6 &robot) const;
+
+private:
+  double radius_squared;
+  double half_height;
+};
+
+#endif     //POINT_CLOUD_FILTER_H
@@ -0,0 +1,66 @@
+#ifndef POSE_CACHE_H
+#define POSE_CACHE_H
+
+#include <array>        // std::array
+#include <atomic>       // std::atomic
+#include <string>       // std::string
+#include <cstdint>      // uint32_t, uint64_t
+
+#include "rclcpp/rclcpp.hpp"
+#include "geometry_msgs/msg/transform_stamped.hpp"
+
+#include <tf2_ros/buffer.h>
+
+/* **********************************************************************
+ * The pose of one frame in another (e.g. base_link_ned in map), looked
+ * up from TF once per tick of a timer, and kept in a short ring.
+ * Hot paths read the ring instead of walking the TF tree: latest() for
+ * the current pose, lookup() for the pose at a time stamp, interpolated
+ * between the two poses around it.
+ *
+ * One writer (the timer) and any number of readers, without a lock: every
+ * slot is a seqlock.  A reader retries when the slot changed under it.
+ * The timer may be put in its own callback group, so TF polling does
+ * not queue behind other callbacks on a multi-threaded executor.
+ * ***********************************************************************/
+class PoseCache
+{
+public:
+  static const size_t HISTORY = 64;
+
+  PoseCache(rclcpp::Node &node, tf2_ros::Buffer &buffer,
+            const std::string &target_frame, const std::string &source_frame, double rate = 50.0,
+            rclcpp::CallbackGroup::SharedPtr callback_group = nullptr);
+
+  // False until the first pose arrived
+  bool latest(geometry_msgs::msg::TransformStamped &pose) const;
+
+  // False when the stamp is older than the history.  A stamp past the last pose gets the last pose.
+  bool lookup(const rclcpp::Time &stamp, geometry_msgs::msg::TransformStamped &pose) const;
+
+  const std::string & targetFrame() const { return target_frame; }
+  const std::string & sourceFrame() const { return source_frame; }
+
+private:
+  enum { STAMP, X, Y, Z, QX, QY, QZ, QW, FIELDS };
+
+  struct Slot {
+    std::atomic<uint32_t> sequence{0};             // Odd while being written
+    std::array<std::atomic<double>, FIELDS> value;
+  };
+
+  tf2_ros::Buffer &buffer;
+  std::string target_frame;
+  std::string source_frame;
+  rclcpp::TimerBase::SharedPtr timer;
+
+  std::array<Slot, HISTORY> ring;
+  std::atomic<uint64_t> count{0};                  // Poses written so far
+
+  void poll();
+  void write(const std::array<double, FIELDS> &pose);
+  bool read(uint64_t index, std::array<double, FIELDS> &pose) const;
+  void toMsg(const std::array<double, FIELDS> &pose, geometry_msgs::msg::TransformStamped &msg) const;
+};
+
+#endif     //POSE_CACHE_H
@@ -0,0 +1,36 @@
+#ifndef RANGE_SENSORS_H
+#define RANGE_SENSORS_H
+
+#include <string>       // std::string
+#include <vector>       // std::vector
+
+#include "rclcpp/rclcpp.hpp"
+
+#include <ufo/math/vector3.h>
+
+/* **********************************************************************
+ * Single beam range sensors, as listed in config/sensors.yaml:
+ *   sensors: [ sensor0, ... ]
+ *   sensor0:
+ *     topic: lidar/range
+ *     transform: { frame, posX, posY, posZ, roll, pitch, yaw }
+ * The mounting transform is relative to the robot base.  Angles are in
+ * radians, or in degrees when written as deg(270).  The beam points
+ * along the x axis of the sensor frame.
+ * ***********************************************************************/
+struct RangeSensor
+{
+  std::string name;
+  std::string topic;
+  std::string frame;
+  ufo::math::Vector3 position;     // Of the sensor, in the robot base frame
+  ufo::math::Vector3 direction;    // Unit vector along the beam, in the robot base frame
+};
+
+// Read the sensors from the parameter overrides of the node.  Sensors without a topic are skipped.
+std::vector<RangeSensor> readRangeSensors(rclcpp::Node &node);
+
+// "deg(270)", "1.57" or a number parameter, in radians.  Throws std::invalid_argument.
+double parseAngle(const rclcpp::ParameterValue &value);
+
+#endif     //RANGE_SENSORS_H
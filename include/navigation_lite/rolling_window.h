@@ -0,0 +1,60 @@
+#ifndef ROLLING_WINDOW_H
+#define ROLLING_WINDOW_H
+
+#include <string>           // std::string
+#include <memory>           // std::shared_ptr
+#include <set>              // std::set
+#include <utility>          // std::pair
+
+#include <ufo/map/occupancy_map.h>
+#include <ufo/math/vector3.h>
+#include <ufo/geometry/aabb.h>
+
+/* **********************************************************************
+ * Keeps the map of a long flight bounded.  roll() builds a new map from
+ * the current one, around the robot:
+ *  - within window_radius (horizontally), the map at full resolution
+ *  - out to keep_radius, the map at far_depth.  Inner nodes hold the
+ *    highest occupancy of their children, so obstacles stay obstacles.
+ *  - further, the map is spilled to tiles of tile_size x tile_size in
+ *    tile_directory, one UFO map file per tile, and dropped.  A spilled
+ *    tile is read back when the robot comes within keep_radius again.
+ *    Without a tile_directory, the far map is only dropped.
+ * The window is aligned to the nodes at far_depth, so every coarse node
+ * is either in or out of it.
+ * ***********************************************************************/
+class RollingWindow
+{
+public:
+  struct Stats
+  {
+    size_t fine_leaves = 0;     // Copied at full resolution
+    size_t coarse_leaves = 0;   // Copied at far_depth, or coarser
+    size_t spilled_tiles = 0;
+    size_t loaded_tiles = 0;
+    size_t failed_tiles = 0;    // Spilled tiles that could not be read back, and stay on disk
+  };
+
+  RollingWindow(double window_radius, ufo::map::DepthType far_depth, double keep_radius,
+                double tile_size, const std::string &tile_directory);
+
+  std::shared_ptr<ufo::map::OccupancyMap> roll(const ufo::map::OccupancyMap &map,
+                                               const ufo::math::Vector3 &position, Stats &stats);
+
+private:
+  typedef std::pair<int, int> Tile;
+
+  double window_radius;
+  ufo::map::DepthType far_depth;
+  double keep_radius;
+  double tile_size;
+  std::string tile_directory;
+  std::set<Tile> spilled;       // The tiles on disk, and not in the map
+
+  Tile tileOf(double x, double y) const;
+  bool isFar(const Tile &tile, const ufo::math::Vector3 &position) const;
+  ufo::geometry::AABB tileBox(const Tile &tile) const;
+  std::string tileFile(const Tile &tile) const;
+};
+
+#endif     //ROLLING_WINDOW_H
@@ -0,0 +1,130 @@
+#ifndef SHARED_MAP_H
+#define SHARED_MAP_H
+
+#include <memory>               // std::shared_ptr
+#include <mutex>                // std::mutex, std::unique_lock
+#include <shared_mutex>         // std::shared_timed_mutex, std::shared_lock
+#include <condition_variable>   // std::condition_variable
+#include <chrono>               // std::chrono::milliseconds
+#include <cstdint>              // uint64_t
+#include <deque>                // std::deque
+
+#include <ufo/map/occupancy_map.h>
+#include <ufo/math/vector3.h>
+
+namespace navigation_lite
+{
+
+/* **********************************************************************
+ * Read access to a map.  While any copy of the snapshot is held, the map
+ * does not change: it is either an immutable decoded map, or the shared
+ * map with a read lock held.  The lock is released with the last copy.
+ *
+ * A snapshot handed on as an update may carry the box that holds every
+ * change since the snapshot before it, so users can limit their work to
+ * it.  Without one, the whole map may have changed.
+ * ***********************************************************************/
+class MapSnapshot
+{
+public:
+  MapSnapshot() = default;
+  explicit MapSnapshot(std::shared_ptr<const ufo::map::OccupancyMap> map, std::shared_ptr<void> lock = nullptr)
+  : map_(map), lock_(lock)
+  { }
+
+  const ufo::map::OccupancyMap * operator->() const { return map_.get(); }
+  const ufo::map::OccupancyMap & operator*() const { return *map_; }
+  const ufo::map::OccupancyMap * get() const { return map_.get(); }
+  explicit operator bool() const { return (bool)map_; }
+
+  void setChangedRegion(const ufo::math::Vector3 &min, const ufo::math::Vector3 &max)
+  {
+    has_region_ = true;
+    region_min_ = min;
+    region_max_ = max;
+  }
+
+  // False when the whole map may have changed
+  bool changedRegion(ufo::math::Vector3 &min, ufo::math::Vector3 &max) const
+  {
+    if (!has_region_) return false;
+    min = region_min_;
+    max = region_max_;
+    return true;
+  }
+
+private:
+  std::shared_ptr<const ufo::map::OccupancyMap> map_;
+  std::shared_ptr<void> lock_;
+  bool has_region_ = false;
+  ufo::math::Vector3 region_min_;
+  ufo::math::Vector3 region_max_;
+};
+
+/* **********************************************************************
+ * Process wide handle on the map of the map server.
+ * When the servers run as components in one container, the map server
+ * registers its map here, and the planner and controller read it in place
+ * instead of decoding the serialized map from the topic.  This lives in
+ * its own shared library, so all components see the same instance.
+ *
+ * The map server takes the write lock while it changes the map, readers
+ * hold a MapSnapshot.  notifyChanged() wakes the readers waiting for a
+ * new version, at the rate the map server would publish.  It is given the
+ * box that changed, when known, and changedSince() returns the box around
+ * the changes after a version the reader has seen.
+ * ***********************************************************************/
+class SharedMap
+{
+public:
+  static SharedMap & instance();
+
+  // Map server side
+  void publish(std::shared_ptr<ufo::map::OccupancyMap> map);
+  void withdraw();
+  std::unique_lock<std::shared_timed_mutex> lockForWriting() { return std::unique_lock<std::shared_timed_mutex>(map_mutex_); }
+  void notifyChanged();                         // Anything may have changed
+  void notifyChanged(const ufo::math::Vector3 &min, const ufo::math::Vector3 &max);
+
+  // Reader side
+  bool available() const;
+  MapSnapshot read() const;          // Empty snapshot when no map was published
+  MapSnapshot tryRead() const;       // Empty as well while the map server writes.  Never waits.
+  uint64_t version() const;
+
+  // The box holding every change after version.  False when the whole map may have changed since,
+  // or the version is too old to tell.
+  bool changedSince(uint64_t version, ufo::math::Vector3 &min, ufo::math::Vector3 &max) const;
+
+  // Wait until the version differs from last_version, or the timeout passes.  Returns the version.
+  uint64_t waitForChange(uint64_t last_version, std::chrono::milliseconds timeout) const;
+
+private:
+  SharedMap() = default;
+  SharedMap(const SharedMap &) = delete;
+  SharedMap & operator=(const SharedMap &) = delete;
+
+  mutable std::shared_timed_mutex map_mutex_;     // Guards the content of the map
+
+  mutable std::mutex handle_mutex_;                // Guards the members below
+  mutable std::condition_variable changed_cv_;
+  std::shared_ptr<ufo::map::OccupancyMap> map_;
+  uint64_t version_ = 0;
+
+  // The change that made each of the last versions.  whole for a new map, or an unknown change.
+  struct Change
+  {
+    uint64_t version;
+    bool whole;
+    ufo::math::Vector3 min;
+    ufo::math::Vector3 max;
+  };
+  static constexpr size_t CHANGE_HISTORY = 32;
+  std::deque<Change> changes_;
+
+  void addChange(bool whole, const ufo::math::Vector3 &min, const ufo::math::Vector3 &max);   // Under handle_mutex_
+};
+
+}  // namespace navigation_lite
+
+#endif     //SHARED_MAP_H
@@ -0,0 +1,111 @@
+// Copyright 2021 Xeni Robotics
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A fixed set of worker threads, sharing a queue of tasks.
+
+#pragma once
+
+#include <vector>               // std::vector
+#include <algorithm>            // std::min
+#include <queue>                // std::queue
+#include <thread>               // std::thread
+#include <mutex>                // std::mutex
+#include <condition_variable>   // std::condition_variable
+#include <functional>           // std::function
+#include <atomic>               // std::atomic
+
+class ThreadPool {
+  std::vector<std::thread> workers;
+  std::queue< std::function<void()> > tasks;
+  std::mutex queue_mutex;
+  std::condition_variable queue_cv;
+  bool stopping;
+
+  void run() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        queue_cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+        if (stopping && tasks.empty()) return;
+        task = std::move(tasks.front());
+        tasks.pop();
+      }
+      task();
+    }
+  }
+
+public:
+  // threads = 0 creates no workers.  All work is then done by the calling thread.
+  explicit ThreadPool(unsigned int threads): stopping{false} {
+    for (unsigned int i = 0; i < threads; i++) {
+      workers.emplace_back(&ThreadPool::run, this);
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex);
+      stopping = true;
+    }
+    queue_cv.notify_all();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool & operator=(const ThreadPool &) = delete;
+
+  size_t size() const { return workers.size(); }
+
+  void enqueue(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex);
+      tasks.push(std::move(task));
+    }
+    queue_cv.notify_one();
+  }
+
+  // Call f(i) for i = 0 .. count-1, spread over the workers and the calling thread.
+  // Returns when all calls are done.
+  template<typename F>
+  void parallelFor(size_t count, F f) {
+    std::atomic<size_t> next{0};
+    auto work = [&next, count, &f] {
+      for (size_t i = next++; i < count; i = next++) {
+        f(i);
+      }
+    };
+
+    size_t helpers = std::min(workers.size(), count > 0 ? count - 1 : 0);
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    size_t done = 0;
+    for (size_t i = 0; i < helpers; i++) {
+      enqueue([&] {
+        work();
+        std::lock_guard<std::mutex> lock(done_mutex);
+        done++;
+        done_cv.notify_one();
+      });
+    }
+
+    work();
+
+    // The helpers refer to this stack frame, so wait for every one of them
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done_cv.wait(lock, [&] { return done == helpers; });
+  }
+};
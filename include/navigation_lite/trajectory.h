@@ -0,0 +1,61 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <vector>         // std::vector
+#include <array>          // std::array
+#include <cstddef>        // size_t
+
+/* **********************************************************************
+ * Time parameterization of a path of waypoints, to fly it without
+ * stopping at every waypoint.  Along every straight span the speed
+ * follows a trapezoid: accelerate at max_accel, cruise, decelerate.
+ * The speed limits:
+ *  - on a span, max_speed_xy horizontally and max_speed_z vertically
+ *  - at a waypoint, the span speed times the cosine of the turn, so a
+ *    turn of 90 degrees or more is taken at rest
+ *  - at the end of the path, rest
+ * and the speed at every waypoint is reachable from its neighbours with
+ * max_accel (a forward and a backward pass).
+ * ***********************************************************************/
+class Trajectory {
+  public:
+    typedef std::array<double, 3> Point;
+
+    Trajectory(double max_speed_xy, double max_speed_z, double max_accel);
+
+    // From start, at start_speed, through points.  Returns the duration in seconds.
+    double plan(const Point &start, double start_speed, const std::vector<Point> &points);
+
+    double duration() const;
+    bool empty() const { return spans.empty(); }
+
+    // The reference position and velocity at t seconds from the start.  Before the start the
+    // start, after the end the last point at rest.
+    void sample(double t, Point &position, Point &velocity) const;
+
+    // The number of points the reference has passed at t seconds from the start
+    size_t passed(double t) const;
+
+  private:
+    struct Span
+    {
+      Point from;
+      Point direction;     // Unit vector
+      double length;
+      double v_start, v_peak, v_end;
+      double t_start;      // From the start of the trajectory
+      double t_accel, t_cruise, t_decel;
+      size_t point;        // The index in points of the end of the span
+    };
+
+    double max_speed_xy;
+    double max_speed_z;
+    double max_accel;
+    std::vector<Span> spans;
+    size_t point_count;
+
+    double spanSpeedLimit(const Point &direction) const;
+    void profile(Span &span) const;
+};
+
+#endif     //TRAJECTORY_H
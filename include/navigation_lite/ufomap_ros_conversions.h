@@ -63,6 +63,13 @@ void rosToUfo(sensor_msgs::msg::PointCloud2 const& cloud_in, ufo::map::PointClou
 void rosToUfo(sensor_msgs::msg::PointCloud2 const& cloud_in,
               ufo::map::PointCloudColor& cloud_out);
 
+// Convert and transform in one pass.  cloud_out is cleared first and keeps its capacity, so a
+// cloud reused across calls is not reallocated.  Points with a NaN coordinate are dropped, colour
+// is not read.  Dense little endian float32 x,y,z take a fast path, other layouts fall back to
+// rosToUfo and PointCloud::transform.
+void rosToUfo(sensor_msgs::msg::PointCloud2 const& cloud_in, ufo::math::Pose6 const& transform,
+              ufo::map::PointCloudColor& cloud_out);
+
 void ufoToRos(ufo::map::PointCloud const& cloud_in, sensor_msgs::msg::PointCloud2& cloud_out);
 
 void ufoToRos(ufo::map::PointCloudColor const& cloud_in,
@@ -32,7 +32,8 @@ def generate_launch_description():
             {'yaw_threshold'         : 0.087},
             {'pid_xy'                : [0.7, 0.0, 0.0]},
             {'pid_z'                 : [0.7, 0.0, 0.0]},
-            {'pid_yaw'               : [0.7, 0.0, 0.0]}
+            {'pid_yaw'               : [0.7, 0.0, 0.0]},
+            {'map_topic'             : 'nav_lite/map_depth_3'}
         ],
         output="screen",
         emulate_tty=True
@@ -50,6 +51,9 @@ def generate_launch_description():
         package = 'navigation_lite',
         name = 'planner_server',
         executable = 'planner_server',
+        parameters=[
+            {'map_topic'       : 'nav_lite/map_depth_2'}
+        ],
         output="screen",
         emulate_tty=True
     )
@@ -34,7 +34,8 @@ def generate_launch_description():
             {'pid_xy'                : [0.7, 0.0, 0.0]},
             {'pid_z'                 : [0.7, 0.0, 0.0]},
             {'pid_yaw'               : [0.7, 0.0, 0.0]},
-            {'holddown'              : 2}
+            {'holddown'              : 2},
+            {'map_topic'             : 'nav_lite/map_depth_3'}
         ],
         output="screen",
         emulate_tty=True
@@ -53,7 +54,8 @@ def generate_launch_description():
         name = 'planner_server',
         executable = 'planner_server',
         parameters=[
-            {'bypass_planning' : False}
+            {'bypass_planning' : False},
+            {'map_topic'       : 'nav_lite/map_depth_2'}
         ],    
         output="screen",
         emulate_tty=True
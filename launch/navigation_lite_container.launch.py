@@ -0,0 +1,96 @@
+import os
+from ament_index_python.packages import get_package_share_directory
+from launch import LaunchDescription
+from launch_ros.actions import ComposableNodeContainer
+from launch_ros.descriptions import ComposableNode
+def generate_launch_description():
+    ld = LaunchDescription()
+    config_map_server = os.path.join(
+        get_package_share_directory('navigation_lite'),
+        'config',
+        'sensors.yaml'
+        )
+
+    # All servers in one process, on a multi-threaded executor.  Each server puts its map, TF and
+    # action callbacks in separate callback groups, so they run side by side.  The planner, the
+    # controller and the recovery server read the map of the map server in place, instead of from
+    # the map topics.
+    map_server=ComposableNode(
+        package = 'navigation_lite',
+        plugin = 'navigation_lite::MapServer',
+        name = 'map_server',
+        parameters = [config_map_server, {'share_map' : True}]
+    )
+
+    controller_server=ComposableNode(
+        package = 'navigation_lite',
+        plugin = 'navigation_lite::ControllerServer',
+        name = 'controller_server',
+        parameters=[
+            {'max_speed_xy'          : 0.7},
+            {'max_accel_xy'          : 0.2},
+            {'max_speed_z'           : 0.33},
+            {'max_yaw_speed'         : 0.5},
+            {'waypoint_radius_error' : 0.3},
+            {'yaw_threshold'         : 0.087},
+            {'pid_xy'                : [0.7, 0.0, 0.0]},
+            {'pid_z'                 : [0.7, 0.0, 0.0]},
+            {'pid_yaw'               : [0.7, 0.0, 0.0]},
+            {'holddown'              : 2},
+            {'use_shared_map'        : True}
+        ]
+    )
+
+    navigation_server=ComposableNode(
+        package = 'navigation_lite',
+        plugin = 'navigation_lite::NavigationServer',
+        name = 'navigation_server'
+    )
+
+    planner_server=ComposableNode(
+        package = 'navigation_lite',
+        plugin = 'navigation_lite::PlannerServer',
+        name = 'planner_server',
+        parameters=[
+            {'bypass_planning' : False},
+            {'use_shared_map'  : True}
+        ]
+    )
+
+    recovery_server=ComposableNode(
+        package = 'navigation_lite',
+        plugin = 'navigation_lite::RecoveryServer',
+        name = 'recovery_server',
+        parameters=[
+            {'max_speed_xy'          : 0.7},
+            {'max_speed_z'           : 0.33},
+            {'max_yaw_speed'         : 0.5},
+            {'waypoint_radius_error' : 0.3},
+            {'yaw_threshold'         : 0.087},
+            {'pid_xy'                : [0.7, 0.0, 0.0]},
+            {'pid_z'                 : [0.7, 0.0, 0.0]},
+            {'pid_yaw'               : [0.7, 0.0, 0.0]},
+            {'holddown'              : 2},
+            {'use_shared_map'        : True}
+        ]
+    )
+
+    container=ComposableNodeContainer(
+        name = 'navigation_lite_container',
+        namespace = '',
+        package = 'rclcpp_components',
+        executable = 'component_container_mt',
+        composable_node_descriptions = [
+            map_server,
+            navigation_server,
+            recovery_server,
+            controller_server,
+            planner_server
+        ],
+        output="screen",
+        emulate_tty=True
+    )
+
+    ld.add_action(container)
+
+    return ld
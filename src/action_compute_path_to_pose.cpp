@@ -17,12 +17,8 @@
 namespace NavigationNodes
 {
  
-BT::NodeStatus NavLiteComputePathToPoseAction::tick()
+bool NavLiteComputePathToPoseAction::buildGoal(ComputePathToPose::Goal &goal)
 {
-  using namespace std::placeholders;
-  
-  action_status = ActionStatus::VIRGIN;
-   
   BT::Optional<Pose3D> msg = getInput<Pose3D>("pose");
   // Check if optional is valid. If not, throw its error
   if (!msg)
@@ -31,146 +27,47 @@ BT::NodeStatus NavLiteComputePathToPoseAction::tick()
                              msg.error() );
   }
 
-  if (!this->client_ptr_->wait_for_action_server()) {
-    RCLCPP_ERROR(node_->get_logger(), "Action server not available after waiting");
-    throw BT::RuntimeError("Action server not available. Cannot address the controller server.  Failing.");
-  }
-  
-  // Call the action server
-  auto goal_msg = ComputePathToPose::Goal();
-  goal_msg.goal.header.stamp = node_->now();
-  goal_msg.goal.header.frame_id = "base_link";
-  goal_msg.goal.pose.position.x = msg.value().x;
-  goal_msg.goal.pose.position.y = msg.value().y;
-  goal_msg.goal.pose.position.z = msg.value().z;
+  suboptimality_bound_ = 0.0;
+  goal.goal.header.stamp = node_->now();
+  goal.goal.header.frame_id = "base_link";
+  goal.goal.pose.position.x = msg.value().x;
+  goal.goal.pose.position.y = msg.value().y;
+  goal.goal.pose.position.z = msg.value().z;
   
   tf2::Quaternion q;
   q.setRPY( 0, 0, msg.value().theta );  // Create this quaternion from roll/pitch/yaw (in radians)
   q.normalize();
   
-  goal_msg.goal.pose.orientation.x = q[0];
-  goal_msg.goal.pose.orientation.y = q[1];
-  goal_msg.goal.pose.orientation.z = q[2];
-  goal_msg.goal.pose.orientation.w = q[3];
-  
-  auto send_goal_options = rclcpp_action::Client<ComputePathToPose>::SendGoalOptions();
-  send_goal_options.goal_response_callback =
-      std::bind(&NavLiteComputePathToPoseAction::goal_response_callback, this, _1);
-  send_goal_options.result_callback =
-      std::bind(&NavLiteComputePathToPoseAction::result_callback, this, _1);
-
-  future_goal_handle_ = std::make_shared<
-      std::shared_future<GoalHandleComputePathToPose::SharedPtr>>(
-      this->client_ptr_->async_send_goal(goal_msg, send_goal_options));
-  
-  _halt_requested.store(false);
-  while (!_halt_requested && ((action_status == ActionStatus::VIRGIN) || (action_status == ActionStatus::PROCESSING)))
-  {   
-    std::this_thread::sleep_for( std::chrono::milliseconds(10) );
-  }  
-  
-  // Formulate a result
-  setOutput("path", returned_path.str().c_str());
-    
-  cleanup();
-  return (action_status == ActionStatus::SUCCEEDED) ? BT::NodeStatus::SUCCESS : BT::NodeStatus::FAILURE;
+  goal.goal.pose.orientation.x = q[0];
+  goal.goal.pose.orientation.y = q[1];
+  goal.goal.pose.orientation.z = q[2];
+  goal.goal.pose.orientation.w = q[3];
+  return true;
 }
-    
-void NavLiteComputePathToPoseAction::cleanup() 
+
+BT::NodeStatus NavLiteComputePathToPoseAction::onSucceeded(const WrappedResult &result)
 {
+  if (result.result->path.poses.size() == 0)
+  { 
+    RCLCPP_ERROR(node_->get_logger(), "No valid path was returned");
+    return BT::NodeStatus::FAILURE;  // No path could be found.  SLAM is the only way out of this mess.
+  }
 
-  if( _halt_requested )
-  {
-    RCLCPP_INFO(node_->get_logger(), "[%s] - Cleaning up after a halt()", name().c_str());
-    try {
-      goal_handle_ = future_goal_handle_->get();
-      this->client_ptr_->async_cancel_goal(goal_handle_); // Request a cancellation.
-    } catch (...) {
-      RCLCPP_WARN(node_->get_logger(), "[%s] - Exception caught");
-    }
+  // Keep the path as the planner sent it.  It is copied once, here, and then shared.
+  // The last good path stays on the blackboard when planning fails.
+  setOutput("path", PathPtr(std::make_shared<const nav_msgs::msg::Path>(result.result->path)));
+  if (suboptimality_bound_ > 0.0) {
+    RCLCPP_INFO(node_->get_logger(), "Path planning completed successfully, at most %.2f times the optimal cost.",
+      suboptimality_bound_);
   } else {
-    RCLCPP_DEBUG(node_->get_logger(), "[%s] - Cleaning up after SUCCESS", name().c_str());
-    // The Action Server Request completed as per normal.  Nothng to do.
+    RCLCPP_INFO(node_->get_logger(), "Path planning completed successfully.");   // Not searched, e.g. bypass_planning
   }
+  return BT::NodeStatus::SUCCESS;
 }
-  
-void NavLiteComputePathToPoseAction::halt() 
+
+void NavLiteComputePathToPoseAction::onFeedback(const Feedback &feedback)
 {
-  _halt_requested.store(true); 
-  action_status = ActionStatus::CANCELED;
-  
+  suboptimality_bound_ = feedback.suboptimality_bound;
 }
   
-////  ROS2 Action Client Functions ////////////////////////////////////////////
-void NavLiteComputePathToPoseAction::goal_response_callback(std::shared_future<GoalHandleComputePathToPose::SharedPtr> future)
-  {  
-    auto goal_handle = future.get();
-    if (!goal_handle) {
-      RCLCPP_ERROR(node_->get_logger(), "Goal was rejected by server");
-      action_status = ActionStatus::REJECTED;
-    } else {
-      RCLCPP_INFO(node_->get_logger(), "Goal accepted by server, Waiting for result");
-      action_status = ActionStatus::PROCESSING;
-    }
-  }
-
-  void NavLiteComputePathToPoseAction::result_callback(const GoalHandleComputePathToPose::WrappedResult & result)
-  {
-    switch (result.code) {
-      case rclcpp_action::ResultCode::SUCCEEDED:
-        if (result.result->path.poses.size() == 0)
-        { 
-          RCLCPP_ERROR(node_->get_logger(), "No valid path was returned");
-          
-          action_status = ActionStatus::FAILED;  // No path could be found.  SLAM is the only way out of this mess.
-        } else {
-          
-          // Build out the response.  x;y;z;theta float combinations seperated by |
-          for(size_t i=0; i<result.result->path.poses.size(); i++) {
-            if( i > 0 )
-            {
-              returned_path << "|";
-            }
-            returned_path << result.result->path.poses[i].pose.position.x << ";";
-            returned_path << result.result->path.poses[i].pose.position.y << ";";  
-            returned_path << result.result->path.poses[i].pose.position.z << ";";             
-            
-            // Calculate yaw
-            // Orientation quaternion
-            tf2::Quaternion q(
-            result.result->path.poses[i].pose.orientation.x,
-            result.result->path.poses[i].pose.orientation.y,
-            result.result->path.poses[i].pose.orientation.z,
-            result.result->path.poses[i].pose.orientation.w);
-
-            // 3x3 Rotation matrix from quaternion
-            tf2::Matrix3x3 m(q);
-
-            // Roll Pitch and Yaw from rotation matrix
-            double roll, pitch, yaw;
-            m.getRPY(roll, pitch, yaw);
-            
-            returned_path << yaw;
-          }
-        }
-          
-        action_status = ActionStatus::SUCCEEDED;  
-        break;
-      case rclcpp_action::ResultCode::ABORTED:
-        RCLCPP_INFO(node_->get_logger(), "Goal was aborted");
-        action_status = ActionStatus::ABORTED;
-        return;
-      case rclcpp_action::ResultCode::CANCELED:
-        RCLCPP_INFO(node_->get_logger(), "Goal was canceled");
-        action_status = ActionStatus::CANCELED;
-        return;
-      default:
-        RCLCPP_WARN(node_->get_logger(), "Unknown result code");
-        action_status = ActionStatus::UNKNOWN;
-        return;
-    }
-    
-    RCLCPP_INFO(node_->get_logger(), "Navigation path completedsuccessfully.");
-  }  
-  
-}  // namespace
\ No newline at end of file
+}  // namespace
@@ -17,142 +17,42 @@
 namespace NavigationNodes
 {
  
-BT::NodeStatus NavLiteFollowWaypointsAction::tick()
+bool NavLiteFollowWaypointsAction::buildGoal(FollowWaypoints::Goal &goal)
 {
-  using namespace std::placeholders;
-  
-  action_status = ActionStatus::VIRGIN;
-   
-  BT::Optional<std::vector<Pose3D>> msg = getInput<std::vector<Pose3D>>("path");
+  BT::Optional<PathPtr> msg = getInput<PathPtr>("path");
   // Check if optional is valid. If not, throw its error
   if (!msg)
   {
-      throw BT::RuntimeError("missing required input [goal]: ", 
+      throw BT::RuntimeError("missing required input [path]: ", 
                              msg.error() );
   }
-
-  if (!this->client_ptr_->wait_for_action_server()) {
-    RCLCPP_ERROR(node_->get_logger(), "Action server not available after waiting");
-    throw BT::RuntimeError("Action server not available. Cannot address the controller server.  Failing.");
+  if (!msg.value())
+  {
+      RCLCPP_ERROR(node_->get_logger(), "[%s] - No path on the blackboard", name().c_str());
+      return false;
   }
-  
-  // Call the action server
-  auto goal_msg = FollowWaypoints::Goal();
-  
-  for(size_t i = 0; i < msg.value().size(); i++) {
-    geometry_msgs::msg::PoseStamped pose;
-    pose.header.stamp = node_->now();
-    pose.header.frame_id = "map";
-    pose.pose.position.x = msg.value()[i].x;
-    pose.pose.position.y = msg.value()[i].y;
-    pose.pose.position.z = msg.value()[i].z;
-  
-    tf2::Quaternion q;
-    q.setRPY( 0, 0, msg.value()[i].theta );  // Create this quaternion from roll/pitch/yaw (in radians)
-    q.normalize();
-  
-    pose.pose.orientation.x = q[0];
-    pose.pose.orientation.y = q[1];
-    pose.pose.orientation.z = q[2];
-    pose.pose.orientation.w = q[3];
-  
-    goal_msg.poses.push_back(pose);
-  }  
-  auto send_goal_options = rclcpp_action::Client<FollowWaypoints>::SendGoalOptions();
-  send_goal_options.goal_response_callback =
-      std::bind(&NavLiteFollowWaypointsAction::goal_response_callback, this, _1);
-  send_goal_options.feedback_callback =
-      std::bind(&NavLiteFollowWaypointsAction::feedback_callback, this, _1, _2);
-  send_goal_options.result_callback =
-      std::bind(&NavLiteFollowWaypointsAction::result_callback, this, _1);
 
-  future_goal_handle_ = std::make_shared<
-      std::shared_future<GoalHandleFollowWaypoints::SharedPtr>>(
-      this->client_ptr_->async_send_goal(goal_msg, send_goal_options));
-  
-  _halt_requested.store(false);
-  while (!_halt_requested && ((action_status == ActionStatus::VIRGIN) || (action_status == ActionStatus::PROCESSING)))
-  {   
-    std::this_thread::sleep_for( std::chrono::milliseconds(10) );
-  }  
-  
-  cleanup();
-  return (action_status == ActionStatus::SUCCEEDED) ? BT::NodeStatus::SUCCESS : BT::NodeStatus::FAILURE;
+  goal.poses = msg.value()->poses;   // The poses as planned, in the map frame
+  auto stamp = node_->now();
+  for (auto &pose : goal.poses) {
+    pose.header.stamp = stamp;
+  }
+  return true;
 }
-    
-void NavLiteFollowWaypointsAction::cleanup() 
-{
 
-  if( _halt_requested )
-  {
-    RCLCPP_INFO(node_->get_logger(), "[%s] - Cleaning up after a halt()", name().c_str());
-    try {
-      goal_handle_ = future_goal_handle_->get();
-      this->client_ptr_->async_cancel_goal(goal_handle_); // Request a cancellation.
-    } catch (...) {
-      RCLCPP_WARN(node_->get_logger(), "[%s] - Exception caught");
-    }
-  } else {
-    RCLCPP_DEBUG(node_->get_logger(), "[%s] - Cleaning up after SUCCESS", name().c_str());
-    // The Action Server Request completed as per normal.  Nothng to do.
+BT::NodeStatus NavLiteFollowWaypointsAction::onSucceeded(const WrappedResult &result)
+{
+  if (result.result->missed_waypoints.size() == 0)
+  {  
+    RCLCPP_DEBUG(node_->get_logger(), "Navigation path completed successfully.");
+    return BT::NodeStatus::SUCCESS;
   }
+  return BT::NodeStatus::FAILURE;
 }
-  
-void NavLiteFollowWaypointsAction::halt() 
+
+void NavLiteFollowWaypointsAction::onFeedback(const FollowWaypoints::Feedback &feedback)
 {
-  _halt_requested.store(true); 
-  action_status = ActionStatus::CANCELED;
-  
+  RCLCPP_DEBUG(node_->get_logger(), "Current waypoint: %d.", feedback.current_waypoint);
 }
   
-////  ROS2 Action Client Functions ////////////////////////////////////////////
-void NavLiteFollowWaypointsAction::goal_response_callback(std::shared_future<GoalHandleFollowWaypoints::SharedPtr> future)
-  {
-    //future_goal_handle_ = future;
-  
-    auto goal_handle = future.get();
-    if (!goal_handle) {
-      RCLCPP_ERROR(node_->get_logger(), "Goal was rejected by server");
-      action_status = ActionStatus::REJECTED;
-    } else {
-      RCLCPP_INFO(node_->get_logger(), "Goal accepted by server navigation, Waiting for result");
-      action_status = ActionStatus::PROCESSING;
-    }
-  }
-
-  void NavLiteFollowWaypointsAction::feedback_callback(
-    GoalHandleFollowWaypoints::SharedPtr,
-    const std::shared_ptr<const FollowWaypoints::Feedback> feedback)
-  {
-    RCLCPP_DEBUG(node_->get_logger(), "Current waypoint: %d.", feedback->current_waypoint);
-  }
-
-  void NavLiteFollowWaypointsAction::result_callback(const GoalHandleFollowWaypoints::WrappedResult & result)
-  {
-    switch (result.code) {
-      case rclcpp_action::ResultCode::SUCCEEDED:
-        if (result.result->missed_waypoints.size() == 0)
-        {  
-          action_status = ActionStatus::SUCCEEDED;
-          RCLCPP_DEBUG(node_->get_logger(), "Navigation path completed successfully.");
-        } else {
-          action_status = ActionStatus::FAILED;
-        }
-        break;
-      case rclcpp_action::ResultCode::ABORTED:
-        RCLCPP_INFO(node_->get_logger(), "Goal was aborted");
-        action_status = ActionStatus::ABORTED;
-        return;
-      case rclcpp_action::ResultCode::CANCELED:
-        RCLCPP_INFO(node_->get_logger(), "Goal was canceled");
-        action_status = ActionStatus::CANCELED;
-        return;
-      default:
-        RCLCPP_WARN(node_->get_logger(), "Unknown result code");
-        action_status = ActionStatus::UNKNOWN;
-        return;
-    }
-    
-  }  
-  
-}  // namespace
\ No newline at end of file
+}  // namespace
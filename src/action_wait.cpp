@@ -17,12 +17,8 @@
 namespace NavigationNodes
 {
  
-BT::NodeStatus NavLiteWaitAction::tick()
+bool NavLiteWaitAction::buildGoal(Wait::Goal &goal)
 {
-  using namespace std::placeholders;
-  
-  action_status = ActionStatus::VIRGIN;
-   
   BT::Optional<int> msg = getInput<int>("seconds");
   // Check if optional is valid. If not, throw its error
   if (!msg)
@@ -31,106 +27,21 @@ BT::NodeStatus NavLiteWaitAction::tick()
                              msg.error() );
   }
 
-  if (!this->client_ptr_->wait_for_action_server()) {
-    RCLCPP_ERROR(node_->get_logger(), "Action server not available after waiting");
-    throw BT::RuntimeError("Action server not available. Cannot Wait the drone.  Failing.");
-  }
-  
-  // Call the action server
-  auto goal_msg = Wait::Goal();
-  goal_msg.time.sec = msg.value();
-  goal_msg.time.nanosec = 0;
-    
-  auto send_goal_options = rclcpp_action::Client<Wait>::SendGoalOptions();
-  send_goal_options.goal_response_callback =
-      std::bind(&NavLiteWaitAction::goal_response_callback, this, _1);
-  send_goal_options.feedback_callback =
-      std::bind(&NavLiteWaitAction::feedback_callback, this, _1, _2);
-  send_goal_options.result_callback =
-      std::bind(&NavLiteWaitAction::result_callback, this, _1);
+  goal.time.sec = msg.value();
+  goal.time.nanosec = 0;
+  return true;
+}
 
-  future_goal_handle_ = std::make_shared<
-      std::shared_future<GoalHandleWait::SharedPtr>>(
-      this->client_ptr_->async_send_goal(goal_msg, send_goal_options));
-  
-  _halt_requested.store(false);
-  while (!_halt_requested && ((action_status == ActionStatus::VIRGIN) || (action_status == ActionStatus::PROCESSING)))
-  {   
-    std::this_thread::sleep_for( std::chrono::milliseconds(10) );
-  }    
-  
-  cleanup();
+BT::NodeStatus NavLiteWaitAction::onSucceeded(const WrappedResult &result)
+{
+  RCLCPP_DEBUG(node_->get_logger(), "Waiting completed in %d seconds", result.result->total_elapsed_time.sec);
   // node_->increment_recovery_count();
-  return (action_status == ActionStatus::SUCCEEDED) ? BT::NodeStatus::SUCCESS : BT::NodeStatus::FAILURE;
+  return BT::NodeStatus::SUCCESS;
 }
-    
-void NavLiteWaitAction::cleanup() 
-{
 
-  if( _halt_requested )
-  {
-    RCLCPP_DEBUG(node_->get_logger(), "[%s] - Cleaning up after a halt()", name().c_str());
-    try {
-      goal_handle_ = future_goal_handle_->get();
-      this->client_ptr_->async_cancel_goal(goal_handle_); // Request a cancellation.
-    } catch (...) {
-      RCLCPP_WARN(node_->get_logger(), "[%s] - Exception caught");
-    }
-  } else {
-    RCLCPP_DEBUG(node_->get_logger(), "[%s] - Cleaning up after SUCCESS", name().c_str());
-    // The Action Server Request completed as per normal.  Nothng to do.
-  }
-}
-  
-void NavLiteWaitAction::halt() 
+void NavLiteWaitAction::onFeedback(const Wait::Feedback &feedback)
 {
-  _halt_requested.store(true);  
-  action_status = ActionStatus::CANCELED;
+  RCLCPP_DEBUG(node_->get_logger(), "Waiting time left: %ds", feedback.time_left.sec);
 }
   
-////  ROS2 Action Client Functions ////////////////////////////////////////////
-void NavLiteWaitAction::goal_response_callback(std::shared_future<GoalHandleWait::SharedPtr> future)
-  {
-  
-    auto goal_handle = future.get();
-    if (!goal_handle) {
-      RCLCPP_ERROR(node_->get_logger(), "Goal was rejected by server");
-      action_status = ActionStatus::REJECTED;
-    } else {
-      RCLCPP_DEBUG(node_->get_logger(), "Goal accepted by server, waiting for result");
-      action_status = ActionStatus::PROCESSING;
-    }
-  }
-
-  void NavLiteWaitAction::feedback_callback(
-    GoalHandleWait::SharedPtr,
-    const std::shared_ptr<const Wait::Feedback> feedback)
-  {
-    RCLCPP_DEBUG(node_->get_logger(), "Waiting time left: %ds", feedback->time_left.sec);
-  }
-
-  void NavLiteWaitAction::result_callback(const GoalHandleWait::WrappedResult & result)
-  {
-    switch (result.code) {
-      case rclcpp_action::ResultCode::SUCCEEDED:
-        action_status = ActionStatus::SUCCEEDED;
-        RCLCPP_DEBUG(node_->get_logger(), "Waiting completed in %d seconds", result.result->total_elapsed_time.sec);
-        break;
-      case rclcpp_action::ResultCode::ABORTED:
-        RCLCPP_INFO(node_->get_logger(), "Waiting was aborted");
-        action_status = ActionStatus::ABORTED;
-        return;
-      case rclcpp_action::ResultCode::CANCELED:
-        RCLCPP_INFO(node_->get_logger(), "Waiting was canceled");
-        action_status = ActionStatus::CANCELED;
-        return;
-      default:
-        RCLCPP_WARN(node_->get_logger(), "Waiting returned an unknown result code");
-        action_status = ActionStatus::UNKNOWN;
-        return;
-    }
-    
-    
-  }  
-  
 }  // namespace
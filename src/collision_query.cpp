@@ -0,0 +1,295 @@
+// Copyright (c) 2021 Xeni Robotics
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* **********************************************************************
+ * Batched and cached collision queries.  See collision_query.h
+ * ***********************************************************************/
+
+#include <cmath>        // std::round, std::ceil, std::sqrt, std::atan2, std::asin
+#include <algorithm>    // std::min, std::max
+
+#include <ufo/geometry/aabb.h>
+#include <ufo/geometry/obb.h>
+#include <ufo/geometry/sphere.h>
+#include <ufo/geometry/bounding_volume.h>
+#include <ufo/geometry/collision_checks.h>
+
+#include "navigation_lite/collision_query.h"
+
+static const double ANGLE_QUANTUM = 0.001;   // In radians
+
+enum ShapeType { SPHERE = 1, BOX, SEGMENT };
+
+// The box around the line from..to, radius plus margin to every side, and margin past the ends
+static ufo::geometry::OBB segmentBox(const ufo::math::Vector3 &from, const ufo::math::Vector3 &to,
+                                     double radius, double margin)
+{
+  ufo::math::Vector3 direction = to - from;
+  ufo::math::Vector3 center = from + (direction / 2.0);
+  double distance = direction.norm();
+  double yaw = 0, pitch = 0;
+  if (distance > 0) {
+    direction /= distance;
+    yaw = -std::atan2(direction[1], direction[0]);
+    pitch = -std::asin(direction[2]);
+  }
+  return ufo::geometry::OBB(center, ufo::math::Vector3(distance / 2.0 + margin, radius + margin, radius + margin),
+                            ufo::math::Quaternion(0, pitch, yaw));
+}
+
+// Axis aligned bounds of a shape.  For a box, those of the sphere around it.
+static void bounds(const ufo::geometry::Sphere &sphere, ufo::math::Vector3 &min, ufo::math::Vector3 &max)
+{
+  ufo::math::Vector3 extent(sphere.radius, sphere.radius, sphere.radius);
+  min = sphere.center - extent;
+  max = sphere.center + extent;
+}
+
+static void bounds(const ufo::geometry::OBB &box, ufo::math::Vector3 &min, ufo::math::Vector3 &max)
+{
+  double radius = box.half_size.norm();
+  ufo::math::Vector3 extent(radius, radius, radius);
+  min = box.center - extent;
+  max = box.center + extent;
+}
+
+size_t CollisionQuery::KeyHash::operator()(const Key &key) const
+{
+  size_t h = 0;
+  for(int32_t v : key) {
+    h = h * 1000003u ^ (size_t)(uint32_t)v;
+  }
+  return h;
+}
+
+CollisionQuery::CollisionQuery(ufo::map::DepthType depth, double cache_quantum)
+  : depth(depth)
+  , quantum(cache_quantum)
+  , cached_version(0)
+  , hits(0)
+{ }
+
+int32_t CollisionQuery::snap(double value) const
+{
+  return (int32_t)std::round(value / quantum);
+}
+
+int32_t CollisionQuery::snapUp(double value) const
+{
+  return (int32_t)std::ceil(value / quantum);
+}
+
+size_t CollisionQuery::cacheHits() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return hits;
+}
+
+uint64_t CollisionQuery::version() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return cached_version;
+}
+
+void CollisionQuery::update(uint64_t map_version)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (map_version < cached_version) return;   // Already told of a newer map
+  cache.clear();
+  cached_version = map_version;
+}
+
+void CollisionQuery::update(const ufo::map::OccupancyMap &map, uint64_t map_version,
+                            const ufo::math::Vector3 &min, const ufo::math::Vector3 &max)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (map_version < cached_version) return;
+  if (map_version > cached_version + 1) {
+    cache.clear();   // Missed the versions between, and where they changed the map
+  } else {
+    // A changed leaf changes the node at depth around it.  Grow the box by one node.
+    double grow = map.getNodeSize(depth);
+    ufo::math::Vector3 lo = min - ufo::math::Vector3(grow, grow, grow);
+    ufo::math::Vector3 hi = max + ufo::math::Vector3(grow, grow, grow);
+    for (auto it = cache.begin(); it != cache.end(); ) {
+      const Answer &a = it->second;
+      if ((a.min.x() <= hi.x()) && (a.max.x() >= lo.x()) &&
+          (a.min.y() <= hi.y()) && (a.max.y() >= lo.y()) &&
+          (a.min.z() <= hi.z()) && (a.max.z() >= lo.z())) {
+        it = cache.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  cached_version = map_version;
+}
+
+void CollisionQuery::spheres(const ufo::map::OccupancyMap &map, uint64_t map_version,
+                             const std::vector<Sphere> &shapes, std::vector<bool> &collides)
+{
+  std::vector<Key> keys;
+  keys.reserve(shapes.size());
+  for(auto &s : shapes) {
+    keys.push_back(Key{{ SPHERE, snap(s.center.x()), snap(s.center.y()), snap(s.center.z()), snapUp(s.radius), 0, 0, 0, 0, 0 }});
+  }
+
+  // The centre moved at most half a quantum along each axis
+  double margin = quantum * std::sqrt(3.0) / 2.0;
+  query(map, map_version, keys, collides, [this, margin](const Key &key) {
+    return ufo::geometry::Sphere(ufo::math::Vector3(key[1] * quantum, key[2] * quantum, key[3] * quantum),
+                                 key[4] * quantum + margin);
+  }, false);
+}
+
+void CollisionQuery::boxes(const ufo::map::OccupancyMap &map, uint64_t map_version,
+                           const std::vector<Box> &shapes, std::vector<bool> &collides)
+{
+  std::vector<Key> keys;
+  keys.reserve(shapes.size());
+  for(auto &b : shapes) {
+    keys.push_back(Key{{ BOX, snap(b.center.x()), snap(b.center.y()), snap(b.center.z()),
+                         snapUp(b.half_size.x()), snapUp(b.half_size.y()), snapUp(b.half_size.z()),
+                         (int32_t)std::round(b.roll / ANGLE_QUANTUM), (int32_t)std::round(b.pitch / ANGLE_QUANTUM),
+                         (int32_t)std::round(b.yaw / ANGLE_QUANTUM) }});
+  }
+
+  query(map, map_version, keys, collides, [this](const Key &key) {
+    // The centre moved at most half a quantum along each axis, and every angle half an angle
+    // quantum, which moves a corner by at most its distance to the centre times the angle.
+    ufo::math::Vector3 half(key[4] * quantum, key[5] * quantum, key[6] * quantum);
+    double margin = quantum * std::sqrt(3.0) / 2.0 + half.norm() * 1.5 * ANGLE_QUANTUM;
+    return ufo::geometry::OBB(ufo::math::Vector3(key[1] * quantum, key[2] * quantum, key[3] * quantum),
+                              ufo::math::Vector3(half.x() + margin, half.y() + margin, half.z() + margin),
+                              ufo::math::Quaternion(key[7] * ANGLE_QUANTUM, key[8] * ANGLE_QUANTUM, key[9] * ANGLE_QUANTUM));
+  }, false);
+}
+
+std::vector<CollisionQuery::Key> CollisionQuery::segmentKeys(const std::vector<Segment> &shapes) const
+{
+  std::vector<Key> keys;
+  keys.reserve(shapes.size());
+  for(auto &s : shapes) {
+    keys.push_back(Key{{ SEGMENT, snap(s.from.x()), snap(s.from.y()), snap(s.from.z()),
+                         snap(s.to.x()), snap(s.to.y()), snap(s.to.z()), snapUp(s.radius), 0, 0 }});
+  }
+  return keys;
+}
+
+void CollisionQuery::segments(const ufo::map::OccupancyMap &map, uint64_t map_version,
+                              const std::vector<Segment> &shapes, std::vector<bool> &collides)
+{
+  // Every end moved at most half a quantum along each axis
+  double margin = quantum * std::sqrt(3.0) / 2.0;
+  query(map, map_version, segmentKeys(shapes), collides, [this, margin](const Key &key) {
+    return segmentBox(ufo::math::Vector3(key[1] * quantum, key[2] * quantum, key[3] * quantum),
+                      ufo::math::Vector3(key[4] * quantum, key[5] * quantum, key[6] * quantum),
+                      key[7] * quantum, margin);
+  }, false);
+}
+
+size_t CollisionQuery::clearPrefix(const ufo::map::OccupancyMap &map, uint64_t map_version,
+                                   const std::vector<Segment> &shapes)
+{
+  std::vector<bool> collides;
+  double margin = quantum * std::sqrt(3.0) / 2.0;
+  return query(map, map_version, segmentKeys(shapes), collides, [this, margin](const Key &key) {
+    return segmentBox(ufo::math::Vector3(key[1] * quantum, key[2] * quantum, key[3] * quantum),
+                      ufo::math::Vector3(key[4] * quantum, key[5] * quantum, key[6] * quantum),
+                      key[7] * quantum, margin);
+  }, true);
+}
+
+bool CollisionQuery::probe(const ufo::map::OccupancyMap &map, const Segment &shape) const
+{
+  ufo::geometry::OBB obb = segmentBox(shape.from, shape.to, shape.radius, 0.0);
+  // Any occupied leaf in the box is a collision.  Stop at the first.
+  return map.beginLeaves(obb, true, false, false, false, depth) != map.endLeaves();
+}
+
+template<class Shape>
+size_t CollisionQuery::query(const ufo::map::OccupancyMap &map, uint64_t map_version,
+                             const std::vector<Key> &keys, std::vector<bool> &collides, Shape shape, bool prefix)
+{
+  collides.assign(keys.size(), false);
+
+  // Answer what this map already answered.  The lock is not held while the map is traversed.
+  size_t first = keys.size();     // The first shape known to collide
+  std::vector<size_t> unknown;    // In increasing order
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (map_version > cached_version) {
+      cache.clear();   // A change nobody told of.  Start over at this version.
+      cached_version = map_version;
+    }
+    bool cached = (map_version == cached_version);   // Else an older map, that the cache no longer holds
+    for(size_t i = 0; i < keys.size(); i++) {
+      auto it = cached ? cache.find(keys[i]) : cache.end();
+      if (it == cache.end()) {
+        unknown.push_back(i);
+        continue;
+      }
+      hits++;
+      collides[i] = it->second.collides;
+      if (collides[i]) {
+        first = std::min(first, i);
+        if (prefix) break;   // The rest does not matter
+      }
+    }
+  }
+  if (unknown.empty()) return first;
+
+  // One traversal for the rest.  Every occupied leaf in their union is tested against the shapes
+  // not yet known to collide, and the traversal stops when all are.  With prefix, the shapes after
+  // the first that collides are dropped as well.
+  std::vector<decltype(shape(keys[0]))> volumes;
+  ufo::geometry::BoundingVolume union_volume;
+  for(size_t i : unknown) {
+    volumes.push_back(shape(keys[i]));
+    union_volume.add(volumes.back());
+  }
+
+  std::vector<size_t> open(unknown.size());    // Indices in volumes, of the shapes clear so far, in increasing order
+  for(size_t j = 0; j < open.size(); j++) {
+    open[j] = j;
+  }
+  for (auto it = map.beginLeaves(union_volume, true, false, false, false, depth), it_end = map.endLeaves();
+       it != it_end && !open.empty(); ++it) {
+    ufo::geometry::AABB leaf(it.getCenter(), it.getHalfSize());
+    for(size_t j = 0; j < open.size(); ) {
+      if (!ufo::geometry::intersects(leaf, volumes[open[j]])) {
+        j++;
+        continue;
+      }
+      collides[unknown[open[j]]] = true;
+      first = std::min(first, unknown[open[j]]);
+      if (prefix) {
+        open.resize(j);   // Those after it no longer matter
+        break;
+      }
+      open.erase(open.begin() + j);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (map_version != cached_version) return first;   // Another thread moved on to a newer map
+  for(size_t j = 0; j < unknown.size(); j++) {
+    size_t i = unknown[j];
+    if (prefix && (i > first)) break;   // Not fully tested
+    Answer &answer = cache[keys[i]];
+    answer.collides = collides[i];
+    bounds(volumes[j], answer.min, answer.max);
+  }
+  return first;
+}
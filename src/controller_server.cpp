@@ -26,6 +26,12 @@
  *   - If an obstacle is encountered, stop movement and return a list of
  *     waypoints that have not been reached.
  *
+ * The flight runs on a periodic control task.  See control_tick().
+ * With trajectory_mode, the drone does not stop at every waypoint: the
+ *   path is time parameterized, see trajectory.h, and the velocity of
+ *   the trajectory is fed forward, with the PIDs correcting the error to
+ *   the reference position.
+ *
  * A Mutex lock governs that only one action server can control the drone
  *  at a time.  Who knows what would happen if another node starts sending 
  *  out cmd_vel messages?
@@ -37,8 +43,10 @@
 #include <chrono>
 #include <string>
 #include <thread>
+#include <cmath>        // std::isfinite
 #include <limits>       // std::numeric_limits
 #include <mutex>
+#include <condition_variable>
 
 #include "builtin_interfaces/msg/duration.hpp"
 #include "geometry_msgs/msg/pose_stamped.hpp"
@@ -64,7 +72,14 @@
 #include "navigation_lite/visibility_control.h"
 #include "navigation_lite/pid.hpp"
 #include "navigation_lite/holddown_timer.hpp"
+#include "navigation_lite/busy_flag.hpp"
+#include "navigation_lite/thread_pool.hpp"
 #include "navigation_lite/ufomap_ros_msgs_conversions.h"
+#include "navigation_lite/map_buffer.h"
+#include "navigation_lite/pose_cache.h"
+#include "navigation_lite/collision_query.h"
+#include "navigation_lite/trajectory.h"
+#include "navigation_lite/map_snapshot.h"
 
 static const float DEFAULT_MAX_SPEED_XY = 2.0;          // Maximum horizontal speed, in m/s
 static const float DEFAULT_MAX_ACCEL_XY = 0.2;          // Maximum horizontal acceleration, in m/s/s
@@ -74,6 +89,7 @@ static const float DEFAULT_WAYPOINT_RADIUS_ERROR = 0.3; // Acceptable XY distanc
 static const float DEFAULT_YAW_THRESHOLD = 0.025;       // Acceptible YAW to start foreward acceleration
 static const float DEFAULT_ALTITUDE_THRESHOLD = 0.3;    // Acceptible Z distance to altitude deemed as close enough 
 static const int DEFAULT_HOLDDOWN = 2;                  // Time to ensure stability in flight is attained
+static const double LOOKAHEAD_PIECE = 0.5;              // Length of the pieces the lookahead is probed in, in m
 
 inline double getDiff2Angles(const double x, const double y, const double c)
 {
@@ -103,7 +119,7 @@ public:
   }
     
 private:    
-  std::mutex server_mutex;   // Only allow one Action Server to address the drone at a time
+  BusyFlag drone_busy_;   // Only allow one Action Server to address the drone at a time
   
   // Node Parameters
   float max_yaw_speed_;
@@ -116,27 +132,67 @@ private:
   int holddown_;
   double freq_;
   double yaw_control_limit_;
+  double lookahead_time_;
+  double min_lookahead_;
+  double lookahead_budget_;      // In seconds
+  bool trajectory_mode_;
   
   // Clock
   rclcpp::Clock steady_clock_{RCL_STEADY_TIME};
   rclcpp::TimerBase::SharedPtr one_off_timer_;
 
+  // On a multi-threaded executor, map messages, TF polling and goal handling do not wait on each other
+  rclcpp::CallbackGroup::SharedPtr map_group_;
+  rclcpp::CallbackGroup::SharedPtr tf_group_;
+  rclcpp::CallbackGroup::SharedPtr action_group_;
+
   rclcpp::Publisher<geometry_msgs::msg::Twist>::SharedPtr publisher_;
   std::shared_ptr<tf2_ros::TransformListener> transform_listener_{nullptr};
   std::unique_ptr<tf2_ros::Buffer> tf_buffer_;
+  std::unique_ptr<PoseCache> pose_cache_;
   std::string map_frame_;
   
-  // PID Controllers  
-  std::shared_ptr<PID> pid_x;
-  std::shared_ptr<PID> pid_y;
-  std::shared_ptr<PID> pid_z;
-  std::shared_ptr<PID> pid_yaw;
+  // PID Controllers, one per axis of the velocity command.  The acceleration in X and Y is
+  // governed by the rate limit of the axes.
+  std::unique_ptr<FlightPID> pid_;
   
   // Holddown Timer
   std::shared_ptr<HolddownTimer> holddown_timer;
   
+  // The flight is driven by one periodic task, control_tick(), on a timer of its own.  The goal
+  // thread hands it a segment (turn and fly to a waypoint, or turn to a final yaw) and waits for
+  // the outcome.  Every tick reads the cached pose, and runs the PIDs with the measured interval.
+  enum class Phase { IDLE, TURN, FLY, FINAL_YAW, TRACK };
+  enum class Outcome { RUNNING, REACHED, BLOCKED, STOPPED };
+
+  struct Segment
+  {
+    Phase phase = Phase::IDLE;
+    Outcome outcome = Outcome::STOPPED;
+    float target_x, target_y, target_z;
+    double target_yaw;
+    std::chrono::steady_clock::time_point track_start;   // TRACK: set on the first tick
+    size_t passed = 0;                                    // TRACK: the points of trajectory_ passed
+  };
+
+  // Control task, and the segment it flies.  All under control_mutex_.
+  rclcpp::CallbackGroup::SharedPtr control_group_;
+  rclcpp::TimerBase::SharedPtr control_timer_;
+  std::mutex control_mutex_;
+  std::condition_variable control_cv_;
+  Segment segment_;
+  std::chrono::steady_clock::time_point last_tick_;
+  size_t deadline_misses_ = 0;
+  ufo::math::Vector3 last_position_;
+  rclcpp::Time last_stamp_{0, 0, RCL_ROS_TIME};
+  ufo::math::Vector3 velocity_;
+  std::unique_ptr<Trajectory> trajectory_;   // Flown by Phase::TRACK
+  double lookahead_known_ = 0.0;              // The length known clear by the last lookahead probe
+  ufo::math::Vector3 lookahead_from_;         // and where it was probed from
+
   // UFO Map
-  std::shared_ptr<ufo::map::OccupancyMap> map_;
+  std::unique_ptr<CollisionQuery> collision_query_;   // Corridor checks.  Before map_, whose thread updates it.
+  std::unique_ptr<MapBuffer> map_;
   double drone_diameter_;
     
   void init() {
@@ -144,6 +200,11 @@ private:
     
     // Only run this once.  Stop the timer that triggered this.
     this->one_off_timer_->cancel();
+
+    map_group_ = this->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+    tf_group_ = this->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+    action_group_ = this->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+    control_group_ = this->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
        
     // Declare and get parameters    
     freq_ = this->declare_parameter("frequency", 10.0);     // Control frequency in Hz.  Must be bigger than 2 Hz
@@ -160,32 +221,54 @@ private:
     
     map_frame_ = this->declare_parameter<std::string>("map_frame", "map");
     drone_diameter_ = this->declare_parameter<double>("drone_diameter", 0.80);   // 800 mm for my current craft.   
+    collision_query_ = std::make_unique<CollisionQuery>(3);   // At depth 3 (16 cm)
     
     // The grid size of the map is still hard coded, thus this is treated as a constant
     yaw_control_limit_ = 1.0;   // Distance from waypoint where control moves to X and Y PID rather than Yaw and X 
+
+    // While flying, check the volume the drone will sweep in the next lookahead_time seconds (at least
+    // min_lookahead m) against the map, every tick.  The volume is probed in pieces, nearest first, for
+    // no longer than lookahead_budget_ms.  When the budget runs out first, the drone slows down to
+    // stay within the part known to be clear.  lookahead_time 0 disables the check.
+    lookahead_time_ = this->declare_parameter<double>("lookahead_time", 1.5);
+    min_lookahead_ = this->declare_parameter<double>("min_lookahead", 1.0);
+    lookahead_budget_ = this->declare_parameter<double>("lookahead_budget_ms", 2.0) / 1000.0;
+
+    // Fly the path as one trajectory, instead of stopping, turning and going at every waypoint.
+    // Only the first leg is checked before the flight, the lookahead check guards the rest.
+    trajectory_mode_ = this->declare_parameter<bool>("trajectory_mode", false);
+    if (trajectory_mode_ && (lookahead_time_ <= 0)) {
+      RCLCPP_WARN(this->get_logger(), "trajectory_mode without lookahead_time: obstacles on the path are not checked in flight");
+    }
+    trajectory_ = std::make_unique<Trajectory>(max_speed_xy_, max_speed_z_, max_accel_xy_);
         
     // Read the other parameters
     this->declare_parameter("pid_xy", std::vector<double>{0.7, 0.0, 0.0});
     rclcpp::Parameter pid_xy_settings_param = this->get_parameter("pid_xy");
     std::vector<double> pid_xy_settings = pid_xy_settings_param.as_double_array(); 
-    pid_x   = std::make_shared<PID>(1.0 / freq_ , max_speed_xy_, -max_speed_xy_, (float)pid_xy_settings[0], (float)pid_xy_settings[1], (float)pid_xy_settings[2]);
-    pid_y   = std::make_shared<PID>(1.0 / freq_ , max_speed_xy_, -max_speed_xy_, (float)pid_xy_settings[0], (float)pid_xy_settings[1], (float)pid_xy_settings[2]);
+    pid_ = std::make_unique<FlightPID>(1.0 / freq_);
+    pid_->setAxis(AXIS_X, max_speed_xy_, -max_speed_xy_, (float)pid_xy_settings[0], (float)pid_xy_settings[1], (float)pid_xy_settings[2]);
+    pid_->setAxis(AXIS_Y, max_speed_xy_, -max_speed_xy_, (float)pid_xy_settings[0], (float)pid_xy_settings[1], (float)pid_xy_settings[2]);
+    pid_->setRateLimit(AXIS_X, max_accel_xy_);
+    pid_->setRateLimit(AXIS_Y, max_accel_xy_);
 
     this->declare_parameter("pid_z", std::vector<double>{0.7, 0.0, 0.0});
     rclcpp::Parameter pid_z_settings_param = this->get_parameter("pid_z");
     std::vector<double> pid_z_settings = pid_z_settings_param.as_double_array(); 
-    pid_z   = std::make_shared<PID>(1.0 / freq_, max_speed_z_, -max_speed_z_, (float)pid_z_settings[0], (float)pid_z_settings[1], (float)pid_z_settings[2]);
+    pid_->setAxis(AXIS_Z, max_speed_z_, -max_speed_z_, (float)pid_z_settings[0], (float)pid_z_settings[1], (float)pid_z_settings[2]);
 
     this->declare_parameter("pid_yaw", std::vector<double>{0.7, 0.0, 0.0});  
     rclcpp::Parameter pid_yaw_settings_param = this->get_parameter("pid_yaw");
     std::vector<double> pid_yaw_settings = pid_yaw_settings_param.as_double_array(); 
-    pid_yaw   = std::make_shared<PID>(1.0 / freq_, max_yaw_speed_, -max_yaw_speed_, (float)pid_yaw_settings[0], (float)pid_yaw_settings[1], (float)pid_yaw_settings[2]);
+    pid_->setAxis(AXIS_YAW, max_yaw_speed_, -max_yaw_speed_, (float)pid_yaw_settings[0], (float)pid_yaw_settings[1], (float)pid_yaw_settings[2]);
 
     // Create a transform listener
     tf_buffer_ =
       std::make_unique<tf2_ros::Buffer>(this->get_clock());
     transform_listener_ =
       std::make_shared<tf2_ros::TransformListener>(*tf_buffer_);
+    // The robot pose, polled from TF once per tick instead of looked up on every read
+    pose_cache_ = std::make_unique<PoseCache>(*this, *tf_buffer_, "map", "base_link_ned", 50.0, tf_group_);
 
     // Set up the hoddown timer
     holddown_timer = std::make_shared<HolddownTimer>(holddown_);
@@ -194,154 +277,120 @@ private:
     publisher_ =
       this->create_publisher<geometry_msgs::msg::Twist>("drone/cmd_vel", 1);
 
+    // The control task.  Only runs while a segment is flown.
+    control_timer_ = this->create_wall_timer(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(1.0 / freq_)),
+      std::bind(&ControllerServer::control_tick, this), control_group_);
+    control_timer_->cancel();
+
     // Build a UFO map
     double resolution = 0.25;   
     resolution = this->declare_parameter<double>("map_resolution", 0.25);   // use resolution 0.25.  Can then query the map at 0.5 and 1.0
-    map_ = std::make_shared<ufo::map::OccupancyMap>(resolution); 
-
-    subscription_ = this->create_subscription<navigation_interfaces::msg::UfoMapStamped>(
-      "nav_lite/map", 10, std::bind(&ControllerServer::topic_callback, this, _1));
+    // With use_shared_map, the map server runs in the same component container and its map is
+    // read in place.  Otherwise subscribe to the map at the depth this node queries, see
+    // publish_depths of the map server, and decode it off the executor.
+    bool use_shared_map = this->declare_parameter<bool>("use_shared_map", false);
+    map_ = std::make_unique<MapBuffer>(resolution, this->get_logger(),
+      std::bind(&ControllerServer::map_updated, this, _1), use_shared_map);
+    // Fly on the map snapshot the map server starts from, until its map arrives.  A shared map is
+    // the map server's own, loaded from the same snapshot, so it is not read a second time.
+    std::string map_snapshot_file = this->declare_parameter<std::string>("map_snapshot_file", "");
+    if (!map_snapshot_file.empty() && !use_shared_map) {
+      auto snapshot = std::make_shared<ufo::map::OccupancyMap>(resolution);
+      if (readMapSnapshot(map_snapshot_file, *snapshot)) {
+        map_->seed(snapshot);
+        RCLCPP_INFO(this->get_logger(), "Starting on the map snapshot [%s]", map_snapshot_file.c_str());
+      } else {
+        RCLCPP_WARN(this->get_logger(), "Could not load the map snapshot [%s]", map_snapshot_file.c_str());
+      }
+    }
+    if (!use_shared_map) {
+      std::string map_topic = this->declare_parameter<std::string>("map_topic", "nav_lite/map");
+      rclcpp::SubscriptionOptions map_options;
+      map_options.callback_group = map_group_;
+      subscription_ = this->create_subscription<navigation_interfaces::msg::UfoMapStamped>(
+        map_topic, 10, std::bind(&ControllerServer::topic_callback, this, _1), map_options);
+    }
 
-    // Create the action server
+    // Create the action server.  The drone flies one goal at a time, so one worker executes them.
+    goal_pool_ = std::make_unique<ThreadPool>(1);
     this->action_server_ = rclcpp_action::create_server<FollowWaypoints>(
       this,
       "nav_lite/follow_waypoints",
       std::bind(&ControllerServer::handle_goal, this, _1, _2),
       std::bind(&ControllerServer::handle_cancel, this, _1),
-      std::bind(&ControllerServer::handle_accepted, this, _1));
+      std::bind(&ControllerServer::handle_accepted, this, _1),
+      rcl_action_server_get_default_options(),
+      action_group_);
     RCLCPP_INFO(this->get_logger(), "Action Server [nav_lite/follow_waypoints] started");    
   }   
   
 // MAP SUBSCRIPTION ///////////////////////////////////////////////////////////////////////////////////////////////
   void topic_callback(const navigation_interfaces::msg::UfoMapStamped::SharedPtr msg) const
   {
-    // Convert ROS message to a UFOmap
-    if (ufomap_msgs::msgToUfo(msg->map, map_)) {
-      RCLCPP_DEBUG(this->get_logger(), "UFO Map Conversion successfull.");
+    // Decoded into a UFOmap on the map buffer thread
+    map_->submit(msg);
+  }
+
+  // On the map buffer thread, after every new map.  Drops the corridor checks the change touched.
+  void map_updated(MapBuffer::Snapshot map)
+  {
+    ufo::math::Vector3 min, max;
+    if (map && map.changedRegion(min, max)) {
+      collision_query_->update(*map, collision_query_->version() + 1, min, max);
     } else {
-      RCLCPP_WARN(this->get_logger(), "UFO Map Conversion failed.");
+      collision_query_->update(collision_query_->version() + 1);
     }
   }
+
   rclcpp::Subscription<navigation_interfaces::msg::UfoMapStamped>::SharedPtr subscription_;
   
 
 // FLIGHT CONTROL ////////////////////////////////////////////////////////////////////////////////////////////////
   
-  bool fly_to_waypoint(geometry_msgs::msg::PoseStamped wp) {
-    rclcpp::Rate loop_rate( freq_ );
-
-    bool waypoint_is_close_, altitude_is_close_, pose_is_close_;
-    float target_x_, target_y_, target_z_;
-
-    target_x_ = wp.pose.position.x;
-    target_y_ = wp.pose.position.y;
-    target_z_ = wp.pose.position.z;
-   
-    geometry_msgs::msg::Twist setpoint = geometry_msgs::msg::Twist();
-    setpoint.linear.x = 0.0;
-    setpoint.linear.y = 0.0;
-    setpoint.linear.z = 0.0;
-    setpoint.angular.x = 0.0;
-    setpoint.angular.y = 0.0;
-    setpoint.angular.z = 0.0;
-
+  // Turn to the waypoint, then fly to it.  Returns false if stopped for an obstacle or a cancel.
+  bool fly_to_waypoint(geometry_msgs::msg::PoseStamped wp, const std::shared_ptr<GoalHandleFollowWaypoints> goal_handle) {
+    Segment segment;
+    segment.phase = Phase::TURN;
+    segment.target_x = wp.pose.position.x;
+    segment.target_y = wp.pose.position.y;
+    segment.target_z = wp.pose.position.z;
+    return run_segment(segment, goal_handle) == Outcome::REACHED;
+  }
+  
+  // Fly through poses first and on without stopping.  *passed is set to the number of those
+  // poses the flight passed, all of them when it returns REACHED.
+  Outcome follow_trajectory(const std::vector<geometry_msgs::msg::PoseStamped> &poses, size_t first,
+                            const std::shared_ptr<GoalHandleFollowWaypoints> goal_handle, size_t *passed)
+  {
     double x, y, z, w;
-    float err_x, err_y, err_z, err_dist;
-    double yaw_to_target;
-    double yaw_error;
-
-    // First correct the yaw        
-    pid_yaw->restart_control();
+    *passed = 0;
+    if (!read_position(&x, &y, &z, &w)) {
+      return Outcome::STOPPED;
+    }
 
-    do {
-      read_position(&x, &y, &z, &w);  // Current position according to tf2
+    std::vector<Trajectory::Point> points;
+    for (size_t i = first; i < poses.size(); i++) {
+      points.push_back(Trajectory::Point{{poses[i].pose.position.x, poses[i].pose.position.y, poses[i].pose.position.z}});
+    }
+    Segment segment;
+    segment.phase = Phase::TRACK;
+    segment.target_x = points.back()[0];
+    segment.target_y = points.back()[1];
+    segment.target_z = points.back()[2];
+    {
+      std::lock_guard<std::mutex> lock(control_mutex_);   // The control task is idle
+      double duration = trajectory_->plan(Trajectory::Point{{x, y, z}}, 0.0, points);
+      RCLCPP_INFO(this->get_logger(), "Following a trajectory through %zu waypoints, in %.1f s", points.size(), duration);
+    }
 
-      err_x = target_x_ - x; 
-      err_y = target_y_ - y;
-      
-      if ( sqrt(pow(err_x,2) + pow(err_y,2)) < yaw_control_limit_ ) {
-        break;
-      }
-      yaw_to_target = atan2(err_y, err_x);
-      
-      yaw_error = getDiff2Angles(yaw_to_target, w, M_PI);
-      pose_is_close_ = (fabs(yaw_error) < yaw_threshold_);
-      if (pose_is_close_) {
-        break;
-      }
-      setpoint.angular.z = pid_yaw->calculate(0, -yaw_error);         // correct yaw error down to zero  
-      
-      publisher_->publish(setpoint);
-      loop_rate.sleep();  // Give the drone time to move
-    } while (!pose_is_close_);  
-
-    // Now that we are ponting, keep on adjusting yaw, but include altitude and foreward velocity
-    pid_x->restart_control();
-    pid_y->restart_control();
-    pid_z->restart_control();
-    double last_v_x = 0.0;
-    double last_v_y = 0.0;
-    do {
-      read_position(&x, &y, &z, &w);  // Current position according to tf2
-
-      err_x = target_x_ - x; 
-      err_y = target_y_ - y;
-      err_z = target_z_ - z;
-
-      err_dist = sqrt(pow(err_x,2) + pow(err_y,2));        
-      waypoint_is_close_ = (err_dist < waypoint_radius_error_);
-
-      altitude_is_close_ = ( abs(err_z) < altitude_threshold_);
-      setpoint.linear.z = pid_z->calculate(0, -err_z);                // correct altitude
-      
-      if ( sqrt(pow(err_x,2) + pow(err_y,2)) < yaw_control_limit_ ) {
-        // Control via X and Y PID rather than yaw and thrust.
-        
-        setpoint.linear.x = pid_x->calculate(0, -err_x);              // fly
-        setpoint.linear.y = pid_y->calculate(0, -err_y);
-      } else {
-        // Control with yaw and thrust. 
-        yaw_to_target = atan2(err_y, err_x);      
-        yaw_error = getDiff2Angles(yaw_to_target, w, M_PI);
-        pose_is_close_ = (fabs(yaw_error) < yaw_threshold_);
-        
-        setpoint.angular.z = pid_yaw->calculate(0, -yaw_error);         // correct yaw error down to zero  
-        if( pose_is_close_ ) {
-          setpoint.linear.x = pid_x->calculate(0, -err_dist);              // fly
-        } else {
-          // Avoid flying in a doughnut.  First correct yaw.
-          setpoint.linear.x = 0.0;
-        }
-        setpoint.linear.y = 0.0;
-      }
-      
-      // Govern acceleration, and decellaration.  The latter should be governed by a well 
-      // tuned PID but then not all control is done via a PID.  Often velocity is forced
-      // to 0 which is an abrupt stop.
-      if (setpoint.linear.x > last_v_x ) {  // Acceleration
-        setpoint.linear.x = min(setpoint.linear.x, last_v_x + (max_accel_xy_ / freq_));
-      } else {                              // Decelleration
-        setpoint.linear.x = max(setpoint.linear.x, last_v_x - (max_accel_xy_ / freq_));
-      }
-      if (setpoint.linear.y > last_v_y ) {
-        setpoint.linear.y = min(setpoint.linear.y, last_v_y + (max_accel_xy_ / freq_));
-      } else {
-        setpoint.linear.y = max(setpoint.linear.y, last_v_y - (max_accel_xy_ / freq_));
-      }
-      last_v_x = setpoint.linear.x;
-      last_v_y = setpoint.linear.y;
-      
-      publisher_->publish(setpoint);
-      loop_rate.sleep();  // Give the drone time to move
-    }  while (!(waypoint_is_close_ && altitude_is_close_)); 
-    
-    return true;
+    Outcome outcome = run_segment(segment, goal_handle);
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    *passed = (outcome == Outcome::REACHED) ? points.size() : segment_.passed;
+    return outcome;
   }
   
-  bool correct_yaw(geometry_msgs::msg::PoseStamped wp) {
-  
-    rclcpp::Rate loop_rate(2);
-    
+  bool correct_yaw(geometry_msgs::msg::PoseStamped wp, const std::shared_ptr<GoalHandleFollowWaypoints> goal_handle) {
     // Orientation quaternion
     tf2::Quaternion q(
         wp.pose.orientation.x,
@@ -355,37 +404,306 @@ private:
     // Roll Pitch and Yaw from rotation matrix
     double roll, pitch, yaw; 
     m.getRPY(roll, pitch, yaw);
-         
-    bool  pose_is_close_;
-    
-    geometry_msgs::msg::Twist setpoint = geometry_msgs::msg::Twist();
-    setpoint.linear.x = 0.0;
-    setpoint.linear.y = 0.0;
-    setpoint.linear.z = 0.0;
-    setpoint.angular.x = 0.0;
-    setpoint.angular.y = 0.0;
-    setpoint.angular.z = 0.0;
+
+    Segment segment;
+    segment.phase = Phase::FINAL_YAW;
+    segment.target_yaw = yaw;
+    return run_segment(segment, goal_handle) == Outcome::REACHED;
+  }
+
+  // Hand the segment to the control task and wait till it is done, canceled, or the node stops
+  Outcome run_segment(const Segment &segment, const std::shared_ptr<GoalHandleFollowWaypoints> goal_handle)
+  {
+    std::unique_lock<std::mutex> lock(control_mutex_);
+    segment_ = segment;
+    segment_.outcome = Outcome::RUNNING;
+    pid_->restart_control(AXIS_YAW);
+    last_tick_ = std::chrono::steady_clock::time_point();
+    control_timer_->reset();
+
+    while (segment_.outcome == Outcome::RUNNING) {
+      control_cv_.wait_for(lock, std::chrono::milliseconds(100));
+      if ((segment_.outcome == Outcome::RUNNING) && (goal_handle->is_canceling() || !rclcpp::ok())) {
+        segment_.outcome = Outcome::STOPPED;
+      }
+    }
+    segment_.phase = Phase::IDLE;
+    control_timer_->cancel();
+    return segment_.outcome;
+  }
+
+  void finish_segment(Outcome outcome)   // Under control_mutex_
+  {
+    segment_.outcome = outcome;
+    segment_.phase = Phase::IDLE;
+    control_cv_.notify_all();
+  }
+
+  void start_fly(double x, double y, double z)   // Under control_mutex_
+  {
+    segment_.phase = Phase::FLY;
+    restart_flight(x, y, z);
+  }
+
+  void restart_flight(double x, double y, double z)   // Under control_mutex_
+  {
+    pid_->restart_control(AXIS_X);
+    pid_->restart_control(AXIS_Y);
+    pid_->restart_control(AXIS_Z);
+    last_position_ = ufo::math::Vector3(x, y, z);
+    last_stamp_ = rclcpp::Time(0, 0, RCL_ROS_TIME);
+    velocity_ = ufo::math::Vector3(0, 0, 0);
+    lookahead_known_ = 0.0;
+  }
+
+  void control_tick()
+  {
+    auto tick_time = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    if (segment_.phase == Phase::IDLE) {
+      return;
+    }
+
+    // The measured interval.  A tick later than half a period is a missed deadline.
+    const double period = 1.0 / freq_;
+    double dt = period;
+    if (last_tick_ != std::chrono::steady_clock::time_point()) {
+      dt = std::chrono::duration<double>(tick_time - last_tick_).count();
+      if (dt > 1.5 * period) {
+        deadline_misses_++;
+        RCLCPP_WARN_THROTTLE(this->get_logger(), steady_clock_, 1000,
+          "Control tick late by %.1f ms (%zu deadline misses)", (dt - period) * 1000.0, deadline_misses_);
+      }
+    }
+    last_tick_ = tick_time;
 
     double x, y, z, w;
+    rclcpp::Time stamp;
+    geometry_msgs::msg::Twist setpoint = geometry_msgs::msg::Twist();
+    if (!read_position(&x, &y, &z, &w, &stamp)) {
+      publisher_->publish(setpoint);   // Hold still until the pose is known
+      return;
+    }
+
+    float err_x = segment_.target_x - x;
+    float err_y = segment_.target_y - y;
     double yaw_error;
-      
-    pid_yaw->restart_control();
 
-    do {
-      read_position(&x, &y, &z, &w);  
-      
-      yaw_error = getDiff2Angles(yaw, w, M_PI);
-      pose_is_close_ = (fabs(yaw_error) < yaw_threshold_);
-      if (pose_is_close_) {
-        break;
+    switch (segment_.phase) {
+      case Phase::TURN:
+        // First correct the yaw
+        if ( sqrt(pow(err_x,2) + pow(err_y,2)) >= yaw_control_limit_ ) {
+          yaw_error = getDiff2Angles(atan2(err_y, err_x), w, M_PI);
+          if (fabs(yaw_error) >= yaw_threshold_) {
+            setpoint.angular.z = yaw_command(yaw_error, dt);   // correct yaw error down to zero
+            publisher_->publish(setpoint);
+            return;
+          }
+        }
+        // Now that we are ponting, keep on adjusting yaw, but include altitude and foreward velocity
+        start_fly(x, y, z);
+        fly_tick(x, y, z, w, stamp, dt);
+        return;
+
+      case Phase::FLY:
+        fly_tick(x, y, z, w, stamp, dt);
+        return;
+
+      case Phase::TRACK:
+        if (segment_.track_start == std::chrono::steady_clock::time_point()) {
+          segment_.track_start = tick_time;
+          restart_flight(x, y, z);
+        }
+        track_tick(x, y, z, w, stamp, std::chrono::duration<double>(tick_time - segment_.track_start).count(), dt);
+        return;
+
+      case Phase::FINAL_YAW:
+        yaw_error = getDiff2Angles(segment_.target_yaw, w, M_PI);
+        if (fabs(yaw_error) < yaw_threshold_) {
+          finish_segment(Outcome::REACHED);
+          return;
+        }
+        setpoint.angular.z = yaw_command(yaw_error, dt);         // correct yaw error down to zero
+        publisher_->publish(setpoint);
+        return;
+
+      default:
+        return;
+    }
+  }
+
+  // Yaw rate towards a yaw error of zero, the other axes hold still.  Under control_mutex_
+  double yaw_command(double yaw_error, double dt)
+  {
+    FlightPID::Values zero, error, command;
+    FlightPID::Mask active{{false, false, false, true}};
+    zero.fill(0.0);
+    error.fill(0.0);
+    error[AXIS_YAW] = -yaw_error;
+    pid_->calculate(zero, error, dt, command, active);
+    return command[AXIS_YAW];
+  }
+
+  // The velocity from pose to pose.  The pose cache may not have a new pose every tick.
+  void update_velocity(const ufo::math::Vector3 &position, const rclcpp::Time &stamp)   // Under control_mutex_
+  {
+    if (stamp != last_stamp_) {
+      if (last_stamp_.nanoseconds() > 0) {
+        double pose_dt = (stamp - last_stamp_).seconds();
+        if (pose_dt > 0.0) {
+          velocity_ = (position - last_position_) * (1.0 / pose_dt);
+        }
       }
-      setpoint.angular.z = pid_yaw->calculate(0, -yaw_error);         // correct yaw error down to zero  
-      
+      last_position_ = position;
+      last_stamp_ = stamp;
+    }
+  }
+
+  // The lookahead check, every tick.  False for an obstacle ahead.  Else clear_ahead is the length
+  // ahead known to be clear: infinite when all of the lookahead was probed, less when the budget ran
+  // out first.  Under control_mutex_
+  bool lookahead_clear(const ufo::math::Vector3 &position, const ufo::math::Vector3 &target, double &clear_ahead)
+  {
+    clear_ahead = std::numeric_limits<double>::infinity();
+    if (lookahead_time_ <= 0) {
+      return true;
+    }
+    auto deadline = std::chrono::steady_clock::now() +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(lookahead_budget_));
+    return isLookaheadClear(position, velocity_, target, deadline, clear_ahead);
+  }
+
+  // Scale the linear velocity of command down to what covers clear_ahead in lookahead_time, so the
+  // drone never flies into space that was not checked.  Before limitRate(), so it slows down smoothly.
+  void limit_speed(FlightPID::Values &command, double clear_ahead) const
+  {
+    if (!std::isfinite(clear_ahead)) return;
+    double speed = sqrt(pow(command[AXIS_X], 2) + pow(command[AXIS_Y], 2) + pow(command[AXIS_Z], 2));
+    double limit = clear_ahead / lookahead_time_;
+    if (speed > limit) {
+      double scale = limit / speed;
+      command[AXIS_X] *= scale;
+      command[AXIS_Y] *= scale;
+      command[AXIS_Z] *= scale;
+    }
+  }
+
+  // Follow the reference of trajectory_ at t seconds from the start.  The velocity of the
+  // reference is fed forward, the PIDs correct the position error, and the drone turns to where
+  // the reference is heading.  drone/cmd_vel is in the body frame, so X and Y are rotated by yaw.
+  void track_tick(double x, double y, double z, double w, const rclcpp::Time &stamp, double t, double dt)   // Under control_mutex_
+  {
+    geometry_msgs::msg::Twist setpoint = geometry_msgs::msg::Twist();
+    ufo::math::Vector3 position(x, y, z);
+    ufo::math::Vector3 target(segment_.target_x, segment_.target_y, segment_.target_z);
+
+    update_velocity(position, stamp);
+    double clear_ahead;
+    if (!lookahead_clear(position, target, clear_ahead)) {
+      RCLCPP_WARN(this->get_logger(), "Obstacle ahead of the drone at %.2f,%.2f,%.2f.  Stopping.", x, y, z);
       publisher_->publish(setpoint);
-      loop_rate.sleep();  // Give the drone time to move
-    } while (!pose_is_close_); 
-    
-    return true;
+      finish_segment(Outcome::BLOCKED);
+      return;
+    }
+
+    Trajectory::Point reference, reference_velocity;
+    trajectory_->sample(t, reference, reference_velocity);
+    segment_.passed = trajectory_->passed(t);
+
+    FlightPID::Values zero, error, feed_forward, command;
+    FlightPID::Mask active{{true, true, true, false}};
+    zero.fill(0.0);
+    error.fill(0.0);
+    feed_forward.fill(0.0);
+    error[AXIS_X] = x - reference[0];
+    error[AXIS_Y] = y - reference[1];
+    error[AXIS_Z] = z - reference[2];
+    feed_forward[AXIS_X] = reference_velocity[0];
+    feed_forward[AXIS_Y] = reference_velocity[1];
+    feed_forward[AXIS_Z] = reference_velocity[2];
+    if (hypot(reference_velocity[0], reference_velocity[1]) > 0.1) {
+      error[AXIS_YAW] = -getDiff2Angles(atan2(reference_velocity[1], reference_velocity[0]), w, M_PI);
+      active[AXIS_YAW] = true;
+    }
+    pid_->calculate(zero, error, feed_forward, dt, command, active);
+    limit_speed(command, clear_ahead);
+    pid_->limitRate(command, dt);
+
+    setpoint.linear.x = cos(w) * command[AXIS_X] + sin(w) * command[AXIS_Y];
+    setpoint.linear.y = -sin(w) * command[AXIS_X] + cos(w) * command[AXIS_Y];
+    setpoint.linear.z = command[AXIS_Z];
+    setpoint.angular.z = command[AXIS_YAW];
+    publisher_->publish(setpoint);
+
+    float err_dist = hypot(segment_.target_x - x, segment_.target_y - y);
+    if ((t >= trajectory_->duration()) && (err_dist < waypoint_radius_error_) &&
+        (fabs(segment_.target_z - z) < altitude_threshold_)) {
+      finish_segment(Outcome::REACHED);
+    }
+  }
+
+  void fly_tick(double x, double y, double z, double w, const rclcpp::Time &stamp, double dt)   // Under control_mutex_
+  {
+    geometry_msgs::msg::Twist setpoint = geometry_msgs::msg::Twist();
+    ufo::math::Vector3 position(x, y, z);
+    ufo::math::Vector3 target(segment_.target_x, segment_.target_y, segment_.target_z);
+
+    // Brake for obstacles that appeared ahead since the path was checked
+    update_velocity(position, stamp);
+    double clear_ahead;
+    if (!lookahead_clear(position, target, clear_ahead)) {
+      RCLCPP_WARN(this->get_logger(), "Obstacle ahead of the drone at %.2f,%.2f,%.2f.  Stopping.", x, y, z);
+      publisher_->publish(setpoint);
+      finish_segment(Outcome::BLOCKED);
+      return;
+    }
+
+    float err_x = segment_.target_x - x;
+    float err_y = segment_.target_y - y;
+    float err_z = segment_.target_z - z;
+
+    float err_dist = sqrt(pow(err_x,2) + pow(err_y,2));
+    bool waypoint_is_close_ = (err_dist < waypoint_radius_error_);
+    bool altitude_is_close_ = ( abs(err_z) < altitude_threshold_);
+    FlightPID::Values zero, error, command;
+    FlightPID::Mask active{{true, true, true, false}};
+    zero.fill(0.0);
+    error.fill(0.0);
+    error[AXIS_Z] = -err_z;                 // correct altitude
+      
+    if ( err_dist < yaw_control_limit_ ) {
+      // Control via X and Y PID rather than yaw and thrust.
+      error[AXIS_X] = -err_x;               // fly
+      error[AXIS_Y] = -err_y;
+    } else {
+      // Control with yaw and thrust. 
+      double yaw_error = getDiff2Angles(atan2(err_y, err_x), w, M_PI);
+      bool pose_is_close_ = (fabs(yaw_error) < yaw_threshold_);
+        
+      error[AXIS_YAW] = -yaw_error;         // correct yaw error down to zero  
+      error[AXIS_X] = -err_dist;            // fly
+      active[AXIS_YAW] = true;
+      // Avoid flying in a doughnut.  First correct yaw.
+      active[AXIS_X] = pose_is_close_;
+      active[AXIS_Y] = false;
+    }
+    pid_->calculate(zero, error, dt, command, active);
+    limit_speed(command, clear_ahead);
+      
+    // Govern acceleration, and decellaration.  The latter should be governed by a well 
+    // tuned PID but then not all control is done via a PID.  Often velocity is forced
+    // to 0 which is an abrupt stop.
+    pid_->limitRate(command, dt);
+
+    setpoint.linear.x = command[AXIS_X];
+    setpoint.linear.y = command[AXIS_Y];
+    setpoint.linear.z = command[AXIS_Z];
+    setpoint.angular.z = command[AXIS_YAW];
+      
+    publisher_->publish(setpoint);
+    if (waypoint_is_close_ && altitude_is_close_) {
+      finish_segment(Outcome::REACHED);
+    }
   }
 
   bool stop_movement() {
@@ -416,7 +734,7 @@ private:
   {
     RCLCPP_INFO(this->get_logger(), "Received request to follow %d waypoints", goal->poses.size());
     (void)uuid;
-    if(server_mutex.try_lock()) {
+    if(drone_busy_.tryClaim()) {
       return rclcpp_action::GoalResponse::ACCEPT_AND_EXECUTE;
     } else {
       RCLCPP_ERROR(this->get_logger(), "Another thread is commanding the drone now.  Rejecting request.");
@@ -434,13 +752,13 @@ private:
 
   void handle_accepted(const std::shared_ptr<GoalHandleFollowWaypoints> goal_handle)
   {
-    using namespace std::placeholders;
-    // this needs to return quickly to avoid blocking the executor, so spin up a new thread
-    std::thread{std::bind(&ControllerServer::execute, this, _1), goal_handle}.detach();
+    // this needs to return quickly to avoid blocking the executor, so hand it to the worker
+    goal_pool_->enqueue([this, goal_handle]() { execute(goal_handle); });
   }
 
   void execute(const std::shared_ptr<GoalHandleFollowWaypoints> goal_handle)
   {
+    BusyFlag::Release release(drone_busy_);   // Claimed in handle_goal
     const auto goal = goal_handle->get_goal();
     auto feedback = std::make_shared<FollowWaypoints::Feedback>();
     auto & current_waypoint = feedback->current_waypoint;
@@ -462,24 +780,29 @@ private:
         goal_handle->canceled(result);
         RCLCPP_INFO(this->get_logger(), "Goal canceled");
         stop_movement();
-        server_mutex.unlock();
         return;
       }
       
       // Optimistically search for a next waypoint that has a clear path from the current position
       unsigned int proposed_waypoint;
       bool found_valid_path = false;
-      for( size_t i = current_waypoint; i < goal->poses.size(); i++) {
-        geometry_msgs::msg::PoseStamped wp = goal->poses[i];
-      
-        if (isPathClear(wp.pose.position.x,
-                        wp.pose.position.y,
-                        wp.pose.position.z)) {
-           found_valid_path = true;
-           proposed_waypoint = i;
-        } else {
-          break;   // Found an obstacle, no need to search further.
-        }  
+      size_t clear = clearWaypoints(goal->poses, current_waypoint);
+      if (trajectory_mode_ && (clear > 0)) {
+        // Through all the remaining waypoints, without stopping
+        size_t passed;
+        Outcome outcome = follow_trajectory(goal->poses, current_waypoint, goal_handle, &passed);
+        if (passed > 0) {
+          last_reached_waypoint = current_waypoint + passed - 1;
+        }
+        current_waypoint += passed;
+        if ((outcome == Outcome::REACHED) || goal_handle->is_canceling()) {
+          continue;   // Done, or canceled in flight.  Handled at the top of the loop.
+        }
+        break;        // Stopped for an obstacle.  The rest is reported missed.
+      }
+      if (clear > 0) {
+        found_valid_path = true;
+        proposed_waypoint = current_waypoint + clear - 1;   // Up to the first obstacle
       }
       if (found_valid_path) {
         current_waypoint = proposed_waypoint;    
@@ -488,8 +811,13 @@ private:
         break;
       }
       
-      if (fly_to_waypoint( goal->poses[current_waypoint] ) ) {
+      if (fly_to_waypoint( goal->poses[current_waypoint], goal_handle ) ) {
         last_reached_waypoint = current_waypoint;
+      } else if (goal_handle->is_canceling()) {
+        continue;   // Canceled in flight.  Handled at the top of the loop.
+      } else {
+        // Stopped for an obstacle.  The rest is reported missed, so a new path gets planned.
+        break;
       }
       
       current_waypoint++; 
@@ -498,7 +826,7 @@ private:
     if (rclcpp::ok() ) { 
       if (last_reached_waypoint == ( goal->poses.size() - 1) ) {
         // Mission complete.  Turn the drone to the pose offered by the final waypoint
-        correct_yaw(goal->poses.back());
+        correct_yaw(goal->poses.back(), goal_handle);
       } else {
         //  Missed some goals, hence the route failed. (Could not find a clear path to next waypoint)
         for(size_t i = last_reached_waypoint + 1; i < goal->poses.size(); i++) {        
@@ -511,109 +839,105 @@ private:
       goal_handle->succeed(result);
     }
     
-    server_mutex.unlock();
+    {
+      std::lock_guard<std::mutex> lock(control_mutex_);
+      if (deadline_misses_ > 0) {
+        RCLCPP_INFO(this->get_logger(), "%zu control ticks missed their deadline", deadline_misses_);
+        deadline_misses_ = 0;
+      }
+    }
     RCLCPP_DEBUG(this->get_logger(), "ACTION EXECUTION COMPLETE");
   }
 
-  bool isInCollision(std::shared_ptr<ufo::map::OccupancyMap> map, 
-                   ufo::geometry::BoundingVar const& bounding_volume, 
-                   bool occupied_space = true, bool free_space = false,
-                   bool unknown_space = false, ufo::map::DepthType min_depth = 0)
+  // Clear of obstacles along the velocity, over lookahead_time and no further than the target.  The
+  // volume is probed in pieces of LOOKAHEAD_PIECE m, nearest first, which bounds the work past the
+  // deadline to one piece.  clear_ahead is left infinite when all pieces were probed, else set to
+  // the length of those that were.  Under control_mutex_
+  bool isLookaheadClear(const ufo::math::Vector3 &position, const ufo::math::Vector3 &velocity,
+                        const ufo::math::Vector3 &target, std::chrono::steady_clock::time_point deadline,
+                        double &clear_ahead)
   {
-    // Iterate through all leaf nodes that intersects the bounding volume
-    for (auto it = map->beginLeaves(bounding_volume, occupied_space, 
-                                   free_space, unknown_space, false, min_depth), 
-        it_end = map->endLeaves(); it != it_end; ++it) {
-      // Is in collision since a leaf node intersects the bounding volume.
+    double speed = velocity.norm();
+    if (speed < 0.05) {
+      return true;   // Hovering or turning.  The path was checked before the flight.
+    }
+    double length = std::min(std::max(speed * lookahead_time_, min_lookahead_), (double)(target - position).norm());
+    if (length <= 0.0) {
+      return true;
+    }
+    // Never wait for the map server.  While it writes the shared map, only what the last probe
+    // found clear, less the distance flown since, is known to be clear.
+    auto map = map_->tryGet();
+    if (!map) {
+      clear_ahead = std::max(0.0, lookahead_known_ - (double)(position - lookahead_from_).norm());
       return true;
     }
-    // No leaf node intersects the bounding volume.
-    return false;
+    ufo::math::Vector3 direction = velocity / speed;
+    lookahead_from_ = position;
+    for (double from = 0.0; from < length; from += LOOKAHEAD_PIECE) {
+      if ((from > 0.0) && (std::chrono::steady_clock::now() >= deadline)) {
+        clear_ahead = from;   // Out of time.  Only this much is known to be clear.
+        lookahead_known_ = from;
+        return true;
+      }
+      double to = std::min(from + LOOKAHEAD_PIECE, length);
+      CollisionQuery::Segment piece{position + direction * from, position + direction * to, drone_diameter_ / 2};
+      if (collision_query_->probe(*map, piece)) {
+        lookahead_known_ = from;
+        return false;
+      }
+    }
+    lookahead_known_ = length;
+    return true;
   }
-  
-  bool isPathClear(const float x, const float y, const float z)
+
+  // The number of waypoints, from first on, that can each be flown to in a straight line from the
+  // current position.  All are checked in one pass over the map, see CollisionQuery.
+  size_t clearWaypoints(const std::vector<geometry_msgs::msg::PoseStamped> &poses, size_t first)
   {
-  
     double cx, cy, cz, cw;
-    read_position(&cx, &cy, &cz, &cw);  // From tf2
-    
-    RCLCPP_DEBUG(this->get_logger(), "Drone at %.2f,%.2f,%.2f requested to move to %.2f,%.2f,%.2f ", cx, cy, cz, x, y, z);
-    
-    // Either fly horizontally, or fly vertically, but not both
-    /*
-    double err_x = cx - x; 
-    double err_y = cy - y;
-      
-    bool horizontal = sqrt(pow(err_x,2) + pow(err_y,2)) > waypoint_radius_error_;
-    bool vertical = fabs(cz - z) > altitude_threshold_;
-    if (vertical && horizontal) {
-      return false;
+    if (!read_position(&cx, &cy, &cz, &cw)) {
+      return 0;   // Position unknown
     }
-    */
-     
+    
     // The robot's current position
     ufo::math::Vector3 position(cx, cy, cz);
 
-    // The goal, where the robot wants to move
-    ufo::math::Vector3 goal( (int)x, (int)y, (int)z );
-
-    // The robot's size (radius)
-    double radius = drone_diameter_/2;
-
-    // Check if it is possible to move between the robot's current position and goal
-
-    // The direction from position to goal
-    ufo::math::Vector3 direction = goal - position;
-    // The center between position and goal
-    ufo::math::Vector3 center = position + (direction / 2.0);
-    // The distance between position and goal
-    double distance = direction.norm();
-    // Normalize direction
-    direction /= distance;
-
-    // Calculate yaw, pitch and roll for oriented bounding box
-    double yaw = -atan2(direction[1], direction[0]);
-    double pitch = -asin(direction[2]);
-    double roll = 0;  // TODO: Fix
-  
-    // Create an oriented bounding box between position and goal, with a size radius.
-    ufo::geometry::OBB obb(center, ufo::math::Vector3(distance / 2.0, radius, radius),
-		  	     ufo::math::Quaternion(roll, pitch, yaw));
-
-    // Check if the oriented bounding box collides with either occupied or unknown space,
-    // at depth 3 (16 cm)
-    if (isInCollision(map_, obb, true, false, false, 3)) {
-      return false;
-      //std::cout << "The path between position and goal is not clear" << std::endl;
-    } else {
-      //std::cout << "It is possible to move between position and goal in a straight line" << std::endl;
+    // The goals, where the robot may move.  A smoothed path has waypoints between the lattice points.
+    std::vector<CollisionQuery::Segment> candidates;
+    for (size_t i = first; i < poses.size(); i++) {
+      ufo::math::Vector3 goal( poses[i].pose.position.x, poses[i].pose.position.y, poses[i].pose.position.z );
+      candidates.push_back(CollisionQuery::Segment{position, goal, drone_diameter_ / 2});
     }
-    
-    return true;  
+
+    // Check if the oriented bounding boxes collide with occupied space.  The version is read before
+    // the map: the changes of a newer map are dropped from the cache by map_updated().
+    uint64_t version = collision_query_->version();
+    // On the action thread, between segments, so it may wait for the map server.  See tryGet().
+    size_t clear = collision_query_->clearPrefix(*map_->get(), version, candidates);
+    RCLCPP_DEBUG(this->get_logger(), "Drone at %.2f,%.2f,%.2f has a clear path to %zu of %zu waypoints",
+      cx, cy, cz, clear, candidates.size());
+    return clear;
   }
   
-  bool read_position(double *x, double *y, double *z, double *w)
+  bool read_position(double *x, double *y, double *z, double *w, rclcpp::Time *stamp = nullptr)
   {
-    std::string from_frame = "base_link_ned"; //map_frame_.c_str();
-    std::string to_frame = "map";
-    
     geometry_msgs::msg::TransformStamped transformStamped;
     
     // Look up for the transformation between map and base_link frames
     // and save the last position in the 'map' frame
-    try {
-      transformStamped = tf_buffer_->lookupTransform(
-        to_frame, from_frame,
-        tf2::TimePointZero);
-        *x = transformStamped.transform.translation.x;
-        *y = transformStamped.transform.translation.y;
-        *z = transformStamped.transform.translation.z;
-    } catch (tf2::TransformException & ex) {
+    if (!pose_cache_->latest(transformStamped)) {
       RCLCPP_DEBUG(
-        this->get_logger(), "Could not transform %s to %s: %s",
-        to_frame.c_str(), from_frame.c_str(), ex.what());
+        this->get_logger(), "No transform from %s to %s yet",
+        pose_cache_->sourceFrame().c_str(), pose_cache_->targetFrame().c_str());
       return false;  
     }
+    *x = transformStamped.transform.translation.x;
+    *y = transformStamped.transform.translation.y;
+    *z = transformStamped.transform.translation.z;
+    if (stamp != nullptr) {
+      *stamp = rclcpp::Time(transformStamped.header.stamp, RCL_ROS_TIME);
+    }
     
     // Orientation quaternion
     tf2::Quaternion q(
@@ -632,6 +956,8 @@ private:
 
     return true;
   }
+
+  std::unique_ptr<ThreadPool> goal_pool_;   // Last member: joined before the rest is destroyed
   
 };  // class ControllerServer
 
@@ -21,325 +21,374 @@
  * presentation and the explination slides by Ayorkor Mills-Tettey
  * https://www.cs.cmu.edu/~motionplanning/lecture/AppH-astar-dstar_howie.pdf
  *
- * NOTE: The occupancy map is a set size, with origin at 0,0,0 and all dimensions
- * in the positive.  In the true world the drone can fly to (-1, -1, 1).  To
- * accomodate this the half dimention of the occupancy map is added to all
- * coordinates entering this algorithm and subtracted before passing back.
+ * NOTE: The cost map is sparse and has no fixed size or origin.  A cell
+ * x, y, z covers the cube [x, x+1) x [y, y+1) x [z, z+1) in the map frame,
+ * negative coordinates included.  Nodes are only created for the cells the
+ * search visits, inside a box around the start and the goal (see setBounds).
  * ***********************************************************************/
  
 #include "navigation_lite/d_star_lite.h"
 
 // Utility Function ////////////////////////////////////////////////////////////////////////////////////////////
-bool compareNodes(shared_ptr<Node> n1, shared_ptr<Node> n2)
+static inline int floorDiv(int a, int b)
 {
-  return n1->rhsScore() > n2->rhsScore();
+  // Rounds towards -inf, also for negative coordinates
+  return (a >= 0) ? (a / b) : -((-a + b - 1) / b);
 }
 
 // Public Methods ///////////////////////////////////////////////////////////////////////////////////////////////////
-void DStarLite::setGoal(float x, float y, float z) {
-  goal.at(0) = (int)(x + ((float)dim_x / 2.0));  // See NOTE in header comments
-  goal.at(1) = (int)(y + ((float)dim_y / 2.0));
-  goal.at(2) = (int)z;
+template<class C, class M>
+void DStarLite<C, M>::setGoal(float x, float y, float z) {
+  goal.at(0) = (int)std::floor(x);  // See NOTE in header comments
+  goal.at(1) = (int)std::floor(y);
+  goal.at(2) = (int)std::floor(z);
 }
 
-void DStarLite::setStart(float x, float y, float z) {
-  start.at(0) = (int)(x + ((float)dim_x / 2.0));  // See NOTE in header comments
-  start.at(1) = (int)(y + ((float)dim_y / 2.0));
-  start.at(2) = (int)z;
+template<class C, class M>
+void DStarLite<C, M>::setStart(float x, float y, float z) {
+  start.at(0) = (int)std::floor(x);  // See NOTE in header comments
+  start.at(1) = (int)std::floor(y);
+  start.at(2) = (int)std::floor(z);
 }
 
-void DStarLite::setTestFunction( function<bool(float, float, float)> func )
+template<class C, class M>
+void DStarLite<C, M>::setOccupancyGrid(const OccupancyGrid *occupancy_grid)
 {
-  testFunction = func;
+  grid = occupancy_grid;
 }
 
-void DStarLite::initialize()
-{ 
+template<class C, class M>
+void DStarLite<C, M>::initialize()
+{
   // Start with a clean sheet
   clearCostmap();
-  
+  setBounds();
+  k_m = 0.0;
+
   // declare the first node at the position of the goal
-  cost_map(goal.at(0),goal.at(1),goal.at(2)) = make_shared<Node>( goal.at(0), goal.at(1), goal.at(2) );      
-  cost_map(start.at(0),start.at(1),start.at(2)) = make_shared<Node>( start.at(0), start.at(1), start.at(2) );      
-  
+  NodeId goal_node = getNode( goal.at(0), goal.at(1), goal.at(2) );
+  getNode( start.at(0), start.at(1), start.at(2) );
+
   // Set the first node rhs to 0. g = inf from birth
-  cost_map(goal.at(0),goal.at(1),goal.at(2))->setRhsScore(0.0, NULL);
-  
+  nodes.rhsScore(goal_node) = 0.0;
+
   // Put the goal on the open list because it is inconsistent
-  open_list.push_back( cost_map(goal.at(0),goal.at(1),goal.at(2)) );
+  open_list.push( goal_node, calculateKey(goal_node) );
+  initialized = true;
+}
+
+template<class C, class M>
+void DStarLite<C, M>::moveStart(float x, float y, float z) {
+  // Keep the search tree.  The keys on the open list were computed with the heuristic from the
+  // old start, so raise k_m by the distance moved to keep them as lower bounds.
+  array<int, 3> last_start = start;
+  setStart(x, y, z);
+  k_m += epsilon * heuristic(last_start);
+}
+
+template<class C, class M>
+void DStarLite<C, M>::setHeuristicWeight(float weight) {
+  weight = std::max(1.0f, weight);
+  if (weight == epsilon) return;
+
+  // Every key on the open list holds the old weight.  Queued nodes are exactly the inconsistent
+  // ones, so putting them in order for the new weight is all it takes to carry on searching.
+  epsilon = weight;
+  open_list.rekey([this](NodeId node) { return calculateKey(node); });
+}
+
+template<class C, class M>
+bool DStarLite<C, M>::isGoal(float x, float y, float z) const {
+  return (goal.at(0) == (int)std::floor(x)) && (goal.at(1) == (int)std::floor(y)) && (goal.at(2) == (int)std::floor(z));
 }
 
-int DStarLite::computeShortestPath() {
+template<class C, class M>
+bool DStarLite<C, M>::inSearchArea(float x, float y, float z) const {
+  return inMap((int)std::floor(x), (int)std::floor(y), (int)std::floor(z));
+}
+
+template<class C, class M>
+void DStarLite<C, M>::setCorridor(const SparseBitmap *cells, int scale) {
+  corridor = cells;
+  corridor_scale = std::max(1, scale);
+}
+
+template<class C, class M>
+int DStarLite<C, M>::computeShortestPath(const InterruptCheck &should_stop, int check_interval) {
 
   int count = 0;
-  
-  do {
-    // On entry, only the start node is in the list, hence it is sorted.  Every next iteration has been sorted before the loop repeats.  
-    // Pop the minimum item off the open list
-    shared_ptr<Node>  minimum_node = open_list.back();
-    open_list.pop_back();
-    if( minimum_node->isOverConsistent() ) {
-      minimum_node->setGScore(minimum_node->rhsScore());
-    }                          
-    
-    // Expand the popped node – call UpdateVertex() on all predecessors in the graph. 
-    // This computes rhs values for the predecessors and puts them on the open list if they become inconsistent.
-    expand( minimum_node );    
-    
-    // Sort the open_list
-    // sort( open_list.begin(), open_list.end(), [shared_ptr<Node>  n1, shared_ptr<Node>  n2](){ return n1->rhsScore() < n2->rhsScore(); })
-    sort( open_list.begin(), open_list.end(), compareNodes);    
+  interrupted = false;
+  NodeId start_node = getNode(start.at(0), start.at(1), start.at(2));
+
+  // Continue while the top key on the open list is less than the key of the start node,
+  // or while the start node is inconsistent.
+  while ( !open_list.empty() &&
+          ( (open_list.topKey() < calculateKey(start_node)) || !isConsistent(start_node) ) ) {
+
+    NodeId node = open_list.top();
+    Key k_old = open_list.topKey();
+    Key k_new = calculateKey(node);
+
+    if (k_old < k_new) {
+      // The key has gone stale (the start has moved since it was queued).  Requeue.
+      open_list.update(node, k_new);
+    } else if (isOverConsistent(node)) {
+      nodes.gScore(node) = nodes.rhsScore(node);
+      open_list.remove(node);
+      // Expand the popped node – call UpdateVertex() on all predecessors in the graph.
+      expand(node);
+    } else {
+      // Under consistent.  Raise g and let the predecessors (and the node itself) find a new route.
+      nodes.gScore(node) = INF;
+      updateVertex(node);
+      expand(node);
+    }
 
     count++;
-    
-  } while (!( (cost_map(start.at(0), start.at(1), start.at(2))->isConsistent()) &&
-           (open_list.back()->rhsScore() >= cost_map(start.at(0), start.at(1), start.at(2))->rhsScore()) ) );
-  
-  // If the start node is consistent AND top key on the open list is not less than the key of the start node
-  // So we have the optimal path and can break out of the loop.
-                   
-  // I can now read the shortest path and populate a response.
+    if (should_stop && (count % check_interval == 0) && should_stop()) {
+      interrupted = true;
+      return count;
+    }
+  }
+
+  // The start node is consistent AND the top key on the open list is not less than the key of the
+  // start node.  So we have the optimal path and can read it with extractPath().
   return count;
 }
 
-void DStarLite::replan(float point_x, float point_y, float point_z) {
-
-  shared_ptr<Node> node;
-  node = cost_map(
-     start.at((int) (point_x + ((float)dim_x / 2))), start.at((int) (point_y + ((float)dim_y / 2))), start.at((int)point_z)); // See NOTE in header comments
-  
-  if( node == NULL) return;
-  
-  // Consider the outgoing edges from node.  For each of these call updateVertex on the node.
-  // But the node is now occupied, thus rhs(SCORE) will be INF
-  node->setRhsScore(INF, NULL);  // The node is occupied!
-  
-  updateVertex(node);
-  if(!node->isConsistent()) {
-    // The node is inconsistent.  Add it to the open list;
-    bool found = false;
-    for(size_t i=0; i < open_list.size(); i++) {
-      found = (open_list.at(i) == node);
-      if (found) { break; }  
-    }
-    if (!found) {
-      open_list.push_back(node);
-    }
-  }  
+template<class C, class M>
+void DStarLite<C, M>::replan(float point_x, float point_y, float point_z) {
 
-  // Next, consider the incoming edges of node
-  array<int, 3> point;
-  node->getPoint(point);
-  
-  for(auto z = -1; z <= 1; z++) {
-    if ((point.at(2)+z < 0) || (point.at(2)+z >= (int)dim_z)) continue;  // Map only functions for dim_z >= z >=0
-    for(auto y = -1; y <= 1; y++) {
-      if ((point.at(1)+y < 0) || (point.at(1)+y >= (int)dim_y)) continue;  // Map only functions for dim_y >= y >=0
-      for(auto x = -1; x <= 1; x++) {
-        if ((point.at(0)+x < 0) || (point.at(0)+x >= (int)dim_x)) continue;  // Map only functions for dim_x >= x >=0
-        shared_ptr<Node> neighbor_node;
-        if( cost_map(point.at(0)+x, point.at(1)+y, point.at(2)+z) == NULL) {
-          // Instantiate a new object
-          neighbor_node = std::make_shared<Node>( point.at(0)+x, point.at(1)+y, point.at(2)+z );      
-          cost_map(point.at(0)+x, point.at(1)+y, point.at(2)+z) = neighbor_node;              
-        } else { 
-          neighbor_node = cost_map(point.at(0)+x, point.at(1)+y, point.at(2)+z);
-        }
-       
-        updateVertex(neighbor_node);
-        if (! neighbor_node->isConsistent() ) {
-          // The node is inconsistent.  Add it to the open list;
-          bool found = false;
-          for(size_t i=0; i < open_list.size(); i++) {
-          found = (open_list.at(i) == neighbor_node);
-            if (found) { break; }  
-          }
-          if (!found) {
-            open_list.push_back(neighbor_node);
-          }
-        }  
-      }  
-    }
-  }            
-  
+  int x = (int)std::floor(point_x);  // See NOTE in header comments
+  int y = (int)std::floor(point_y);
+  int z = (int)std::floor(point_z);
+
+  if (!inMap(x, y, z)) return;
+
+  NodeId node = nodes.find(x, y, z);
+  if (node == NodePool::NONE) return;  // Not part of the search graph, so nothing depends on it.
+
+  // The occupancy of this node has changed.  Because an occupied node can never be consistent with
+  // a finite g, recomputing its rhs is enough.  The change ripples through its predecessors when
+  // the node comes off the open list in the next computeShortestPath().
+  updateVertex(node);
 }
 
-int DStarLite::extractPath(vector<geometry_msgs::msg::PoseStamped> &waypoints) {
-  shared_ptr<Node> node;
-  node = cost_map(start.at(0), start.at(1), start.at(2));
+template<class C, class M>
+int DStarLite<C, M>::extractPath(vector<geometry_msgs::msg::PoseStamped> &waypoints) {
+  NodeId node = getNode(start.at(0), start.at(1), start.at(2));
+
+  if (nodes.rhsScore(node) == INF) {
+    return 0;  // No path to the goal exists
+  }
+
   array<int, 3> point;
   bool found = false;
   int count = 0;
-  do {    
-    node->getPoint(point);    
-    
+  const size_t max_steps = nodes.size();
+  do {
+    nodes.getPoint(node, point);
+
     geometry_msgs::msg::PoseStamped pose;
     // pose.header.stamp = this->now();
-    pose.header.frame_id = "map"; 
-    pose.pose.position.x = point.at(0) - ((double)dim_x / 2);  // See NOTE in header comments
-    pose.pose.position.y = point.at(1) - ((double)dim_y / 2);
+    pose.header.frame_id = "map";
+    pose.pose.position.x = point.at(0);  // See NOTE in header comments
+    pose.pose.position.y = point.at(1);
     pose.pose.position.z = point.at(2);
-  
+
     // Orientation is irrelevant, as the controller server will turn the drone as required.
-    pose.pose.orientation.x = 0; 
-    pose.pose.orientation.y = 0; 
-    pose.pose.orientation.z = 0; 
+    pose.pose.orientation.x = 0;
+    pose.pose.orientation.y = 0;
+    pose.pose.orientation.z = 0;
     pose.pose.orientation.w = 1; ;
-    
+
     if (count > 0) {   // Skip the start node.  We are there already!
       waypoints.push_back(pose);
     }
-    
-    count++;  
+
+    count++;
 
     found = (point.at(0) == goal.at(0)) && (point.at(1) == goal.at(1)) && (point.at(2) == goal.at(2));
     if (!found) {
-      node = node->nextStep();
+      node = nodes.nextStep(node);
     }
-  } while( !found );
-  
+  } while( !found && (node != NodePool::NONE) && ((size_t)count < max_steps) );
+
+  if (!found) {
+    waypoints.clear();  // The chain of nodes is broken.  Do not return half a path.
+    return 0;
+  }
+
   return count;
 }
 
-void DStarLite::clearCostmap() {
-  
-  for(auto z = 0; z < (int)dim_z; z++) {
-    for(auto y = 0; y < (int)dim_y; y++) {
-      for(auto x = 0; x < (int)dim_x; x++) {
-         cost_map(x, y, z) = NULL;   
-      }
-    }
-  }
-  
-  // Also clear the open_list;
+template<class C, class M>
+void DStarLite<C, M>::clearCostmap() {
+  initialized = false;
+
+  // Clear the open_list first, it still refers to the nodes of the current generation
   open_list.clear();
-  
-  // Smart pointers should free up any allocated memory :-)
+
+  // Every node from an older generation reads as a fresh node.  Nothing to free.
+  nodes.reset();
 }
 
 // Private Methods /////////////////////////////////////////////////////////////////////////////////////////////////////////
-bool DStarLite::isOccupied(int x, int y, int z) {
-  return testFunction( (float)x - ((float)dim_x/2.0) , (float)y -((float)dim_y/2.0), (float)z);  // See NOTE in header comments
+template<class C, class M>
+bool DStarLite<C, M>::inMap(int x, int y, int z) const {
+  // Only search inside the box set up by setBounds(), and inside the corridor if there is one
+  bool in_box = (x >= bound_min[0]) && (x <= bound_max[0]) &&
+                (y >= bound_min[1]) && (y <= bound_max[1]) &&
+                (z >= bound_min[2]) && (z <= bound_max[2]);
+  if (!in_box || (corridor == nullptr)) {
+    return in_box;
+  }
+  return corridor->test(floorDiv(x, corridor_scale), floorDiv(y, corridor_scale), floorDiv(z, corridor_scale));
+}
+
+template<class C, class M>
+void DStarLite<C, M>::setBounds() {
+  // The box holding start and goal, grown by the margin so the search can go around obstacles.
+  // Altitude is limited by the fixed floor and ceiling.
+  for(int i = 0; i < 2; i++) {
+    bound_min[i] = std::min(start[i], goal[i]) - margin;
+    bound_max[i] = std::max(start[i], goal[i]) + margin;
+  }
+  bound_min[2] = min_z;
+  bound_max[2] = max_z - 1;
+
+  // All neighbors of a node in the inner box are in the search box.  The corridor has no such
+  // box, so with a corridor every neighbor is tested.
+  if (corridor != nullptr) {
+    inner_min = {{0, 0, 0}};
+    inner_max = {{-1, -1, -1}};
+    return;
+  }
+  for(int i = 0; i < 3; i++) {
+    inner_min[i] = bound_min[i] + 1;
+    inner_max[i] = bound_max[i] - 1;
+  }
 }
 
-void DStarLite::expand(shared_ptr<Node> node) {
-  // Expand the popped node – call UpdateVertex() on all predecessors in the graph.
-  // KEY LEARNING - The predecessor has to be in "the graph".  i.e. It is not in the 
-  // graph of another node.
-  
-  // Calculate the 9+8+9 neighbors and confirm they are in the cost map.
+template<class C, class M>
+bool DStarLite<C, M>::inInnerBox(const array<int, 3> &point) const {
+  return (point[0] >= inner_min[0]) && (point[0] <= inner_max[0]) &&
+         (point[1] >= inner_min[1]) && (point[1] <= inner_max[1]) &&
+         (point[2] >= inner_min[2]) && (point[2] <= inner_max[2]);
+}
+
+template<class C, class M>
+typename DStarLite<C, M>::NodeId DStarLite<C, M>::getNode(int x, int y, int z) {
+  return nodes.id(x, y, z);  // g = rhs = inf from birth
+}
+
+template<class C, class M>
+float DStarLite<C, M>::heuristic(const array<int, 3> &point) const {
+  // From the start to this point
+  return M::heuristic(point[0] - start[0], point[1] - start[1], point[2] - start[2]);
+}
+
+template<class C, class M>
+Key DStarLite<C, M>::calculateKey(NodeId node) {
+  float g = nodes.gScore(node);
+  float rhs = nodes.rhsScore(node);
+  float score = std::min(g, rhs);
+  if (score == INF) {
+    return Key{INF, INF};
+  }
+
+  // As in Anytime D*, only over consistent nodes take the inflated heuristic.  An under consistent
+  // node (its route got worse) keeps the plain one, so it is repaired before the search stops at
+  // a start whose route runs through it.
+  float weight = (g > rhs) ? epsilon : 1.0f;
   array<int, 3> point;
-  node->getPoint(point);
-   
-  for(auto z = -1; z <= 1; z++) {
-    if ((point.at(2)+z < 0) || (point.at(2)+z >= (int)dim_z)) continue;  // Map only functions for dim_z >= z >=0
-    for(auto y = -1; y <= 1; y++) {
-      if ((point.at(1)+y < 0) || (point.at(1)+y >= (int)dim_y)) continue;  // Map only functions for dim_y >= y >=0
-      for(auto x = -1; x <= 1; x++) {
-        if ((point.at(0)+x < 0) || (point.at(0)+x >= (int)dim_x)) continue;  // Map only functions for dim_x >= x >=0
-        shared_ptr<Node> neighbor_node;
-
-        if ((x==0) && (y==0) && (z==0)) { continue; };  // Dont add the node to itself!
-
-        if( cost_map(point.at(0)+x, point.at(1)+y, point.at(2)+z) == NULL) {
-          // Instantiate a new object
-          neighbor_node = std::make_shared<Node>( point.at(0)+x, point.at(1)+y, point.at(2)+z );      
-          cost_map(point.at(0)+x, point.at(1)+y, point.at(2)+z) = neighbor_node;              
-        } else { 
-          neighbor_node = cost_map(point.at(0)+x, point.at(1)+y, point.at(2)+z);
-        }
-        
-        if( (neighbor_node->nextStep() == NULL) && (neighbor_node != node->nextStep()) && (! isOccupied(point.at(0)+x, point.at(1)+y, point.at(2)+z) ) ){
-
-          // For every predecessor, call UpdateVertex
-          updateVertex(neighbor_node);
-          if (! neighbor_node->isConsistent() ) {
-            // The node is inconsistent.  Add it to the open list;
-            bool found = false;
-            for(size_t i=0; i < open_list.size(); i++) {
-            found = (open_list.at(i) == neighbor_node);
-              if (found) { break; }  
-            }
-            if (!found) {
-              open_list.push_back(neighbor_node);
-            }
-          }
-        } 
-      }  
-    }
-  }            
+  nodes.getPoint(node, point);
+  return Key{score + weight * heuristic(point) + k_m, score};
 }
 
+template<class C, class M>
+void DStarLite<C, M>::expand(NodeId node) {
+  // Call UpdateVertex() on all predecessors in the graph.  Moving is symmetric, so the
+  // predecessors are the neighbors that fall inside the cost map.
+  array<int, 3> point;
+  nodes.getPoint(node, point);
+  const bool inner = inInnerBox(point);
 
-void DStarLite::updateVertex(shared_ptr<Node> node)
-{
+  for(int i = 0; i < C::SIZE; i++) {
+    const Step s = C::step(i);
+    int x = point[0] + s.dx;
+    int y = point[1] + s.dy;
+    int z = point[2] + s.dz;
+    if (!inner && !inMap(x, y, z)) { continue; }
 
-  shared_ptr<Node> best_candidate = NULL;
-  float best_score = INF;
-  
+    updateVertex( getNode(x, y, z) );
+  }
+}
+
+template<class C, class M>
+void DStarLite<C, M>::updateVertex(NodeId node)
+{
   array<int, 3> point;
-  node->getPoint(point);
-  
-  if ( isOccupied(point.at(0), point.at(1), point.at(2) ) ) { 
-    best_score = INF;
-    // possibly set the nextStep = NULL
-  } else {  
-    // Check every neighbor that is not NULL (had to be expanded at some stage
-    // Select the neighbor with the minimum g + transition + heuristic
-    // update node->rhs = neighbor.g + transition
-    
-    for(auto z = -1; z <= 1; z++) {
-      if ((point.at(2)+z < 0) || (point.at(2)+z >= (int)dim_z)) continue;  // Map only functions for dim_z >= z >=0
-      for(auto y = -1; y <= 1; y++) {
-        if ((point.at(1)+y < 0) || (point.at(1)+y >= (int)dim_y)) continue;  // Map only functions for dim_y >= y >=0
-        for(auto x = -1; x <= 1; x++) {
-          if ((point.at(0)+x < 0) || (point.at(0)+x >= (int)dim_x)) continue;  // Map only functions for dim_x >= x >=0
-          
-          shared_ptr<Node> neighbor_node;
-
-          if ((x==0) && (y==0) && (z==0)) { continue; };  // Dont add the node to itself!
-          
-          if( cost_map(point.at(0)+x, point.at(1)+y, point.at(2)+z) != NULL) {
-            neighbor_node = cost_map(point.at(0)+x, point.at(1)+y, point.at(2)+z);
-            
-            if(neighbor_node->gScore() == INF) { continue; };
-            
-            float transition_cost = 0.0;
-            
-            array<int, 3> neighbor_point;
-            neighbor_node->getPoint(neighbor_point);
-       
-            if((neighbor_point.at(0) == point.at(0)) || (neighbor_point.at(1) == point.at(1)) ) {  
-               transition_cost = 1.0;  // No diagonal movement
-            } else {                    
-              transition_cost = 1.4;  // Diagonal movement
-            }
-       
-            if (!(neighbor_point.at(2) == point.at(2))) {
-              transition_cost += 0.4;  // Vertical movement
-            }  
-            
-            // add a heuristic:  The hypotenuse of a right-angled triangle in 3D space
-            double xx = static_cast<double>(point.at(0) - goal.at(0));
-            double yy = static_cast<double>(point.at(1) - goal.at(1));
-            double zz = static_cast<double>(point.at(2) - goal.at(2));
-            double h = std::sqrt(xx*xx + yy*yy + zz*zz);
-            
-            if ((neighbor_node->gScore() + transition_cost + (float)h) < best_score) {
-              best_score = neighbor_node->gScore() + transition_cost + (float)h;
-              best_candidate = neighbor_node;
-            }
-               
-          }
+  nodes.getPoint(node, point);
+
+  bool is_goal = (point[0] == goal[0]) && (point[1] == goal[1]) && (point[2] == goal[2]);
+
+  if (!is_goal) {
+    NodeId best_candidate = NodePool::NONE;
+    float best_score = INF;
+
+    // An occupied node can not be entered, hence rhs = INF.  Occupied neighbors never get a finite
+    // g for the same reason, so only this node has to be tested against the map.
+    if ( !isOccupied(point[0], point[1], point[2]) ) {
+      const bool inner = inInnerBox(point);
+
+      // Select the neighbor (successor) with the minimum g + transition cost
+      for(int i = 0; i < C::SIZE; i++) {
+        const Step s = C::step(i);
+        int x = point[0] + s.dx;
+        int y = point[1] + s.dy;
+        int z = point[2] + s.dz;
+        if (!inner && !inMap(x, y, z)) { continue; }
+
+        NodeId neighbor_node = nodes.find(x, y, z);
+        if (neighbor_node == NodePool::NONE) { continue; };
+        float g = nodes.gScore(neighbor_node);
+        if (g == INF) { continue; };
+
+        float score = g + M::cost(s);
+        if (score < best_score) {
+          best_score = score;
+          best_candidate = neighbor_node;
         }
       }
     }
-    if(best_score < INF) {
-      node->setRhsScore( best_score, best_candidate );
+    nodes.rhsScore(node) = best_score;
+    nodes.nextStep(node) = best_candidate;
+  }
+
+  // Keep the open list in line with the consistency of the node
+  if (open_list.contains(node)) {
+    if (isConsistent(node)) {
+      open_list.remove(node);
+    } else {
+      open_list.update(node, calculateKey(node));
     }
-          
+  } else if (!isConsistent(node)) {
+    open_list.push(node, calculateKey(node));
+  }
+}
+
+// The searches the planner server can choose from
+template class DStarLite<Connect6, DistanceCost>;
+template class DStarLite<Connect18, DistanceCost>;
+template class DStarLite<Connect26, DistanceCost>;
+
+std::unique_ptr<PathSearch> makeDStarLite(int connectivity, int margin, int min_z, int max_z)
+{
+  switch (connectivity) {
+    case 6:  return std::unique_ptr<PathSearch>(new DStarLite<Connect6, DistanceCost>(margin, min_z, max_z));
+    case 18: return std::unique_ptr<PathSearch>(new DStarLite<Connect18, DistanceCost>(margin, min_z, max_z));
+    case 26: return std::unique_ptr<PathSearch>(new DStarLite<Connect26, DistanceCost>(margin, min_z, max_z));
+    default: return nullptr;
   }
-    
 }
-    
-    
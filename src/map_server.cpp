@@ -19,19 +19,31 @@
  * Publishes this map in a custom message type.
  * ***********************************************************************/
 
+#include <cmath>
 #include <functional>
 #include <future>
 #include <numeric>
 #include <memory>
 #include <string>
 #include <sstream>
+#include <algorithm>
+#include <vector>
+#include <map>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
 
 #include "sensor_msgs/msg/point_cloud2.hpp"
 #include "sensor_msgs/point_cloud2_iterator.hpp"
+#include "sensor_msgs/msg/range.hpp"
+#include "diagnostic_msgs/msg/diagnostic_array.hpp"
 
 #include <tf2/exceptions.h>
 #include <tf2_ros/transform_listener.h>
 #include <tf2_ros/buffer.h>
+#include <tf2/LinearMath/Transform.h>
 
 #include <ufo/map/occupancy_map.h>
 
@@ -40,11 +52,20 @@
 
 #include "navigation_lite/ufomap_ros_msgs_conversions.h"
 #include "navigation_lite/ufomap_ros_conversions.h"
+#include "navigation_lite/shared_map.h"
+#include "navigation_lite/point_cloud_filter.h"
+#include "navigation_lite/drop_oldest_queue.hpp"
+#include "navigation_lite/range_sensors.h"
+#include "navigation_lite/pose_cache.h"
+#include "navigation_lite/collision_query.h"
+#include "navigation_lite/map_snapshot.h"
+#include "navigation_lite/rolling_window.h"
 
 #include "navigation_interfaces/srv/save_map.hpp"
 #include "navigation_interfaces/srv/load_map.hpp"
 #include "navigation_interfaces/srv/reset.hpp"
 #include "navigation_interfaces/msg/ufo_map_stamped.hpp"
+#include "navigation_lite/srv/check_collision.hpp"
 
 using namespace std::chrono_literals;
 using namespace std::placeholders;
@@ -70,12 +91,61 @@ public:
     simple_ray_casting_ = this->declare_parameter<bool>("simple_ray_casting", false);  
     early_stopping_ = this->declare_parameter<int>("early_stopping", 0);  //Early Stopping
     async_ = this->declare_parameter<bool>("async", false);               // Async integration
+    // Keep one point per voxel of downsample_factor x map_resolution before integration, so the
+    // cost tracks the distinct voxels seen and not the raw point count.  0 disables the filter.
+    downsample_factor_ = this->declare_parameter<double>("downsample_factor", 0.0);
+    // Clouds are integrated on a thread of their own.  Of the clouds waiting, only the latest
+    // ingest_queue_size are kept, so the map never lags the sensor by more than that.
+    ingest_queue_size_ = std::max(1, (int)this->declare_parameter<int>("ingest_queue_size", 2));
+    // Beams of the range sensors listed in sensors, gathered for range_batch_ms and integrated
+    // as one cloud, with a single lookup of the robot pose.
+    range_batch_ms_ = std::max(1, (int)this->declare_parameter<int>("range_batch_ms", 100));
     
+    // Leave the points on the robot out of the clouds, see BodyFilter
     clear_robot_     = this->declare_parameter<bool>("clear_robot", false);
     robot_frame_id_  = this->declare_parameter<std::string>("robot_frame_id", "base_link");
     robot_height_    = this->declare_parameter<double>("robot_height", 0.4);    // Robot height(m)
     robot_radius_    = this->declare_parameter<double>("robot_radius", 0.5);    // Robot radius(m)
-    clearing_depth_  = this->declare_parameter<int>("clearing_depth", 0);       // Clearing depth
+
+    // Publish only what changed since the last message, with a full map (keyframe) every
+    // keyframe_interval messages.  Changes further than update_radius (m) from the robot wait
+    // for the next keyframe.  update_radius <= 0 publishes every change.
+    update_part_of_map_ = this->declare_parameter<bool>("update_part_of_map", true);
+    keyframe_interval_ = std::max(1, (int)this->declare_parameter<int>("keyframe_interval", 10));
+    update_radius_ = this->declare_parameter<double>("update_radius", 30.0);
+
+    // If the UFOMap should be compressed using LZ4.  Good if you are sending the UFOMap between computers.
+    compress_ = this->declare_parameter<bool>("compress", false);
+    compression_acceleration_level_ = this->declare_parameter<int>("compression_acceleration_level", 1);
+    compression_level_ = this->declare_parameter<int>("compression_level", 0);
+
+    // Lowest depth to publish, one topic per depth.  Higher value means less data to transfer.
+    // Depth 0 goes out on map_topic, depth d on map_topic_depth_d.  Many nodes do not require
+    // detailed maps, so each subscribes to the depth it queries.
+    publish_depths_ = this->declare_parameter<std::vector<int64_t>>("publish_depths", std::vector<int64_t>{0});
+
+    // Hand the map to the planner and controller in the same component container, see SharedMap.
+    // A depth with no subscribers is not serialized.
+    share_map_ = this->declare_parameter<bool>("share_map", true);
+
+    // Answer batched collision queries on nav_lite/check_collision from this map, at
+    // collision_depth, so other nodes need no map of their own.  See CollisionQuery.
+    collision_service_ = this->declare_parameter<bool>("collision_service", false);
+    collision_depth_ = this->declare_parameter<int>("collision_depth", 0);
+
+    // A map saved before, with the save_map service, to start from.  See map_snapshot.h
+    map_snapshot_file_ = this->declare_parameter<std::string>("map_snapshot_file", "");
+
+    // For long flights.  Every window_interval seconds, keep the map at full resolution only within
+    // window_radius of the robot, at far_depth out to keep_radius, and drop it further, or spill it
+    // to tiles of tile_size in tile_directory.  See RollingWindow.  save_map only saves what is kept.
+    rolling_window_ = this->declare_parameter<bool>("rolling_window", false);
+    window_radius_ = this->declare_parameter<double>("window_radius", 30.0);
+    far_depth_ = this->declare_parameter<int>("far_depth", 3);
+    keep_radius_ = this->declare_parameter<double>("keep_radius", 200.0);
+    tile_size_ = this->declare_parameter<double>("tile_size", 50.0);
+    tile_directory_ = this->declare_parameter<std::string>("tile_directory", "");
+    window_interval_ = std::max(1, (int)this->declare_parameter<int>("window_interval", 10));
     
     // Kick off a init routine
     this->init_timer_ = this->create_wall_timer( 
@@ -83,6 +153,17 @@ public:
       std::bind(&MapServer::init, this) );
   }
 
+  ~MapServer()
+  {
+    if (cloud_queue_) {
+      cloud_queue_->stop();
+      integration_thread_.join();
+    }
+    if (share_map_ && map_) {
+      SharedMap::instance().withdraw();
+    }
+  }
+
 private:
   // Parameters
   std::string map_frame_id_;
@@ -95,66 +176,194 @@ private:
   bool simple_ray_casting_;
   unsigned int early_stopping_;
   bool async_;
+  double downsample_factor_;
+  int ingest_queue_size_;
+  int range_batch_ms_;
   
   // Parameters for Clear Robot
   bool clear_robot_;
   std::string robot_frame_id_;
   double robot_height_, robot_radius_;
-  int clearing_depth_;
     
   // Parameters for Publishing
   bool compress_;
-	bool update_part_of_map_;
-	ufo::map::DepthType publish_depth_;
-	std::future<void> update_async_handler_;
+  int compression_acceleration_level_;
+  int compression_level_;
+  bool update_part_of_map_;
+  std::vector<int64_t> publish_depths_;
+  int keyframe_interval_;
+  double update_radius_;
+  bool share_map_;
+  bool collision_service_;
+  std::string map_snapshot_file_;
+  int collision_depth_;
+  bool rolling_window_;
+  double window_radius_;
+  int far_depth_;
+  double keep_radius_;
+  double tile_size_;
+  std::string tile_directory_;
+  int window_interval_;
+  std::future<void> update_async_handler_;
+
+  int messages_since_keyframe_ = 0;
+  bool keyframe_pending_ = true;    // The next message must hold the whole map
+  std::vector<size_t> subscribers_; // Per publisher, the subscribers that had a keyframe.  More now get one.
   
   rclcpp::TimerBase::SharedPtr init_timer_;
   rclcpp::TimerBase::SharedPtr pub_timer_;
+  rclcpp::TimerBase::SharedPtr window_timer_;
+  std::unique_ptr<RollingWindow> rolling_window_map_;
+
+  // On a multi-threaded executor, sensor messages are taken in while a map is being serialized,
+  // and TF is polled beside both.  The range subscriptions and their batch timer share a group,
+  // as they share range_beams_.  Publishing and the map services share the other.  Collision
+  // queries have a group of their own, so they are not held up by a map being serialized.
+  rclcpp::CallbackGroup::SharedPtr ingest_group_;
+  rclcpp::CallbackGroup::SharedPtr publish_group_;
+  rclcpp::CallbackGroup::SharedPtr tf_group_;
+  rclcpp::CallbackGroup::SharedPtr query_group_;
   
   std::shared_ptr<tf2_ros::TransformListener> transform_listener_{nullptr};
   std::unique_ptr<tf2_ros::Buffer> tf_buffer_;
+  std::unique_ptr<PoseCache> pose_cache_;                     // The robot in the map
+  std::map<std::string, tf2::Transform> sensor_mounts_;       // Sensor frames in the robot frame.  Integration thread only.
     
   rclcpp::Service<navigation_interfaces::srv::LoadMap>::SharedPtr load_service;
   rclcpp::Service<navigation_interfaces::srv::SaveMap>::SharedPtr save_service;
   rclcpp::Service<navigation_interfaces::srv::Reset>::SharedPtr   reset_service;
+  rclcpp::Service<navigation_lite::srv::CheckCollision>::SharedPtr collision_service;
+  std::unique_ptr<CollisionQuery> collision_query_;
   
   rclcpp::Subscription<sensor_msgs::msg::PointCloud2>::SharedPtr subscription_;
-  rclcpp::Publisher<navigation_interfaces::msg::UfoMapStamped>::SharedPtr map_publisher_;
+  std::vector< std::pair<ufo::map::DepthType, rclcpp::Publisher<navigation_interfaces::msg::UfoMapStamped>::SharedPtr> > map_publishers_;
     
   std::shared_ptr<ufo::map::OccupancyMap> map_;  
+  std::mutex map_mutex_;     // Between the integration thread and the executor
+  uint64_t map_version_ = 0; // Under map_mutex_.  Incremented on every change of the map, see map_changed().
+
+  // While roll_window() builds the new map from map_, map_ is only read: the inserts are deferred,
+  // and replayed into the new map before it replaces map_.  Under map_mutex_.
+  bool rolling_ = false;
+  std::vector< std::pair<ufo::math::Vector3, ufo::map::PointCloudColor> > deferred_inserts_;
+
+  // Integration pipeline.  Only the integration thread uses the cloud and the filter.
+  std::unique_ptr< DropOldestQueue<sensor_msgs::msg::PointCloud2::SharedPtr> > cloud_queue_;
+  std::thread integration_thread_;
+  ufo::map::PointCloudColor cloud_;
+  std::unique_ptr<VoxelFilter> voxel_filter_;
+  std::unique_ptr<BodyFilter> body_filter_;
+  std::atomic<uint64_t> integrated_count_{0};
+  std::atomic<double> integration_ms_{0.0};     // Duration of the last integration
+  rclcpp::Publisher<diagnostic_msgs::msg::DiagnosticArray>::SharedPtr diagnostics_publisher_;
+
+  // Range sensors.  The beams since the last batch, as end points in the robot base frame.
+  std::vector<RangeSensor> range_sensors_;
+  std::vector<rclcpp::Subscription<sensor_msgs::msg::Range>::SharedPtr> range_subscriptions_;
+  ufo::map::PointCloudColor range_beams_;
+  rclcpp::TimerBase::SharedPtr range_timer_;
   
   void init()
   {
     // run this timer only once
     init_timer_->cancel();
+
+    ingest_group_ = this->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+    publish_group_ = this->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+    tf_group_ = this->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+    query_group_ = this->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+    rclcpp::SubscriptionOptions ingest_options;
+    ingest_options.callback_group = ingest_group_;
   
     
-    // Initiate the publisher
-    map_publisher_ = this->create_publisher<navigation_interfaces::msg::UfoMapStamped>(map_topic_, 3);
+    // Initiate the publishers, one per depth
+    for (auto depth : publish_depths_) {
+      std::string topic = (depth == 0) ? map_topic_ : map_topic_ + "_depth_" + std::to_string(depth);
+      map_publishers_.emplace_back( (ufo::map::DepthType)depth,
+        this->create_publisher<navigation_interfaces::msg::UfoMapStamped>(topic, 3) );
+      subscribers_.push_back(0);
+      RCLCPP_INFO(this->get_logger(), "Publishing the map at depth %li on [%s]", (long)depth, topic.c_str());
+    }
     
     tf_buffer_ =
       std::make_unique<tf2_ros::Buffer>(this->get_clock());
     transform_listener_ =
       std::make_shared<tf2_ros::TransformListener>(*tf_buffer_);
+    pose_cache_ = std::make_unique<PoseCache>(*this, *tf_buffer_, map_frame_id_, robot_frame_id_, 50.0, tf_group_);
     
     // Setup the UFO map
     double resolution;   
     this->get_parameter("map_resolution", resolution);
     
     map_ = std::make_shared<ufo::map::OccupancyMap>(resolution); 
+    map_->enableMinMaxChangeDetection(true);   // Track the region changed between messages
+    if (!map_snapshot_file_.empty()) {
+      auto start = std::chrono::steady_clock::now();
+      if (readMapSnapshot(map_snapshot_file_, *map_)) {
+        map_changed(true);
+        RCLCPP_INFO(this->get_logger(), "Map snapshot [%s] loaded in %.1f ms", map_snapshot_file_.c_str(),
+          std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+      } else {
+        RCLCPP_WARN(this->get_logger(), "Could not load the map snapshot [%s].  Starting with an empty map.", map_snapshot_file_.c_str());
+      }
+    }
+    if (clear_robot_) {
+      body_filter_ = std::make_unique<BodyFilter>(robot_radius_, robot_height_);
+    }
+    if (downsample_factor_ > 0) {
+      voxel_filter_ = std::make_unique<VoxelFilter>(downsample_factor_ * resolution);
+    }
+    if (share_map_) {
+      SharedMap::instance().publish(map_);
+    }
         
-    // Start listening for pointcloud messages
+    // Start the integration thread, then listen for pointcloud messages
+    cloud_queue_ = std::make_unique< DropOldestQueue<sensor_msgs::msg::PointCloud2::SharedPtr> >(ingest_queue_size_);
+    integration_thread_ = std::thread(&MapServer::integration_loop, this);
+    diagnostics_publisher_ = this->create_publisher<diagnostic_msgs::msg::DiagnosticArray>("diagnostics", 1);
     subscription_ = this->create_subscription<sensor_msgs::msg::PointCloud2>(
-      pointcloud_topic_, 10, std::bind(&MapServer::topic_callback, this, std::placeholders::_1));  
+      pointcloud_topic_, rclcpp::QoS(ingest_queue_size_).best_effort(),
+      std::bind(&MapServer::topic_callback, this, std::placeholders::_1), ingest_options);  
+      
+    // Subscribe to the range sensors
+    range_sensors_ = readRangeSensors(*this);
+    for (size_t i = 0; i < range_sensors_.size(); i++) {
+      range_subscriptions_.push_back( this->create_subscription<sensor_msgs::msg::Range>(
+        range_sensors_[i].topic, rclcpp::SensorDataQoS(),
+        [this, i](const sensor_msgs::msg::Range::SharedPtr msg) { range_callback(i, msg); }, ingest_options) );
+      RCLCPP_INFO(this->get_logger(), "Integrating range sensor [%s] from [%s]",
+        range_sensors_[i].name.c_str(), range_sensors_[i].topic.c_str());
+    }
+    if (!range_sensors_.empty()) {
+      range_timer_ = this->create_wall_timer(
+        std::chrono::milliseconds(range_batch_ms_), std::bind(&MapServer::integrate_ranges, this), ingest_group_);
+    }
       
     pub_timer_ = this->create_wall_timer(
-      1000ms, std::bind(&MapServer::publish_map, this));  
+      1000ms, std::bind(&MapServer::publish_map, this), publish_group_);  
     //publish_map();  // Send the first map, and then only when it has been updated.
+    if (rolling_window_) {
+      rolling_window_map_ = std::make_unique<RollingWindow>(window_radius_, (ufo::map::DepthType)far_depth_,
+                                                            keep_radius_, tile_size_, tile_directory_);
+      window_timer_ = this->create_wall_timer(
+        std::chrono::seconds(window_interval_), std::bind(&MapServer::roll_window, this), publish_group_);
+      RCLCPP_INFO(this->get_logger(), "Rolling window of %.1f m, far map at depth %d out to %.1f m",
+        window_radius_, far_depth_, keep_radius_);
+    }
   
     // Create simple services
-    load_service = this->create_service<navigation_interfaces::srv::LoadMap>("nav_lite/load_map", std::bind(&MapServer::load_map, this, _1, _2));
-    save_service = this->create_service<navigation_interfaces::srv::SaveMap>("nav_lite/save_map", std::bind(&MapServer::save_map, this, _1, _2));
-    reset_service = this->create_service<navigation_interfaces::srv::Reset>("nav_lite/reset_map", std::bind(&MapServer::reset_map, this, _1, _2));
+    load_service = this->create_service<navigation_interfaces::srv::LoadMap>("nav_lite/load_map", std::bind(&MapServer::load_map, this, _1, _2),
+      rmw_qos_profile_services_default, publish_group_);
+    save_service = this->create_service<navigation_interfaces::srv::SaveMap>("nav_lite/save_map", std::bind(&MapServer::save_map, this, _1, _2),
+      rmw_qos_profile_services_default, publish_group_);
+    reset_service = this->create_service<navigation_interfaces::srv::Reset>("nav_lite/reset_map", std::bind(&MapServer::reset_map, this, _1, _2),
+      rmw_qos_profile_services_default, publish_group_);
+    if (collision_service_) {
+      collision_query_ = std::make_unique<CollisionQuery>((ufo::map::DepthType)collision_depth_);
+      collision_service = this->create_service<navigation_lite::srv::CheckCollision>("nav_lite/check_collision",
+        std::bind(&MapServer::check_collision, this, _1, _2), rmw_qos_profile_services_default, query_group_);
+      RCLCPP_INFO(this->get_logger(), "Answering collision queries on [nav_lite/check_collision] at depth %d", collision_depth_);
+    }
 
   }
 
@@ -162,26 +371,191 @@ private:
   {
     // Compose the map message and publish
     rclcpp::Time now = this->get_clock()->now();
-    
-    // If the UFOMap should be compressed using LZ4.
-    // Good if you are sending the UFOMap between computers.
-    bool compress = false;
-    
-    // Lowest depth to publish.
-    // Higher value means less data to transfer, good in
-    // situation where the data rate is low.
-    // Many nodes do not require detailed maps as well.    
-    ufo::map::DepthType pub_depth = 0;
-    
-    auto message = std::make_shared<navigation_interfaces::msg::UfoMapStamped>();
-    //navigation_interfaces::msg::UfoMapStamped::Ptr message(new navigation_interfaces::msg::UfoMapStamped);
-    //Convert UFOMap to ROS Message
-    if (ufomap_msgs::ufoToMsg(*map_, message->map, ufo::geometry::BoundingVolume(), compress, pub_depth, 1, 0)) {
-      message->header.stamp = now;
-      message->header.frame_id = map_frame_id_;    // Should be "map"
-      map_publisher_->publish(*message);
-      RCLCPP_DEBUG(this->get_logger(), "Map published");
-    }  
+    publish_diagnostics(now);
+
+    std::lock_guard<std::mutex> map_lock(map_mutex_);
+
+    // Readers of the shared map see every change in place.  Only tell them there is one, and where.
+    if (share_map_ && keyframe_pending_) {
+      SharedMap::instance().notifyChanged();
+    } else if (share_map_ && map_->validMinMaxChange()) {
+      SharedMap::instance().notifyChanged(map_->minChange(), map_->maxChange());
+    }
+
+    bool keyframe = !update_part_of_map_ || keyframe_pending_ ||
+                    (++messages_since_keyframe_ >= keyframe_interval_);
+
+    // The region that changed, for the deltas.  Without a keyframe or a delta, only the depths
+    // with a new subscriber get a message.
+    ufo::geometry::BoundingVolume delta;
+    bool has_delta = false;
+    if (!keyframe && map_->validMinMaxChange()) {
+      ufo::map::Point3 min_change = map_->minChange();
+      ufo::map::Point3 max_change = map_->maxChange();
+      if ((update_radius_ > 0) && !clipToRobot(min_change, max_change)) {
+        map_->resetMinMaxChangeDetection();   // Changes only far from the robot.  Sent with the next keyframe.
+      } else {
+        delta.add(ufo::geometry::AABB(min_change, max_change));
+        has_delta = true;
+      }
+    }
+
+    bool published = true;
+    for (size_t i = 0; i < map_publishers_.size(); i++) {
+      auto &publisher = map_publishers_[i];
+      size_t count = publisher.second->get_subscription_count();
+      if (count == 0) {
+        subscribers_[i] = 0;
+        continue;   // Nobody listening.  A new subscriber gets a keyframe of its own.
+      }
+      subscribers_[i] = std::min(subscribers_[i], count);   // Some left.  Those who come next need a keyframe.
+      // A subscriber that joined since the last keyframe of this depth has no map to patch
+      bool whole = keyframe || (count > subscribers_[i]);
+      if (!whole && !has_delta) {
+        continue;   // Nothing changed.  Subscribers are up to date.
+      }
+      auto message = std::make_shared<navigation_interfaces::msg::UfoMapStamped>();
+      //Convert UFOMap to ROS Message, the whole map with an empty bounding volume
+      if (ufomap_msgs::ufoToMsg(*map_, message->map, whole ? ufo::geometry::BoundingVolume() : delta, compress_,
+                                publisher.first, compression_acceleration_level_, compression_level_)) {
+        message->header.stamp = now;
+        message->header.frame_id = map_frame_id_;    // Should be "map"
+        publisher.second->publish(*message);
+        if (whole) {
+          subscribers_[i] = count;
+        }
+        RCLCPP_DEBUG(this->get_logger(), "Map %s at depth %i published", whole ? "keyframe" : "update", (int)publisher.first);
+      } else {
+        published = false;
+      }
+    }
+
+    if (published && (keyframe || has_delta)) {
+      map_->resetMinMaxChangeDetection();
+      if (keyframe) {
+        keyframe_pending_ = false;
+        messages_since_keyframe_ = 0;
+      }
+    }
+  }
+
+  // Rebuild the map around the robot, see RollingWindow.  UFOMap cannot prune a region to a coarser
+  // depth in place, so the map is replaced.  The new map is built without holding a lock: only the
+  // inserts wait, in deferred_inserts_, and readers go on with the old map.  The locks are held to
+  // replay the last few inserts and swap the maps.  Readers of the shared map keep the old one while
+  // they hold it, subscribers get a keyframe.
+  void roll_window()
+  {
+    geometry_msgs::msg::TransformStamped tf_trans;
+    if (!pose_cache_->latest(tf_trans)) {
+      return;   // Robot position unknown
+    }
+    ufo::math::Vector3 robot(tf_trans.transform.translation.x,
+                             tf_trans.transform.translation.y,
+                             tf_trans.transform.translation.z);
+
+    auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<ufo::map::OccupancyMap> source;
+    {
+      std::lock_guard<std::mutex> map_lock(map_mutex_);
+      rolling_ = true;    // From here on nobody writes map_.  The map services share this callback group.
+      source = map_;
+    }
+
+    RollingWindow::Stats stats;
+    auto rolled = rolling_window_map_->roll(*source, robot, stats);
+    rolled->enableMinMaxChangeDetection(true);
+
+    // Catch up with the inserts deferred meanwhile.  The last of them, if any, under the locks.
+    size_t replayed = 0;
+    while (true) {
+      std::vector< std::pair<ufo::math::Vector3, ufo::map::PointCloudColor> > inserts;
+      std::unique_lock<std::mutex> map_lock(map_mutex_);
+      inserts.swap(deferred_inserts_);
+      if (inserts.size() <= 1) {
+        auto write_lock = SharedMap::instance().lockForWriting();
+        for (auto &insert : inserts) {
+          rolled->insertPointCloudDiscrete(insert.first, insert.second, max_range_, insert_depth_,
+                                           simple_ray_casting_, early_stopping_, false);
+        }
+        replayed += inserts.size();
+        map_ = rolled;
+        rolling_ = false;
+        map_changed(true);
+        keyframe_pending_ = true;   // Subscribers need to drop what left the window
+        break;
+      }
+      map_lock.unlock();
+      for (auto &insert : inserts) {
+        rolled->insertPointCloudDiscrete(insert.first, insert.second, max_range_, insert_depth_,
+                                         simple_ray_casting_, early_stopping_, false);
+      }
+      replayed += inserts.size();
+    }
+    if (share_map_) {
+      SharedMap::instance().publish(map_);
+    }
+    if (stats.failed_tiles > 0) {
+      RCLCPP_WARN(this->get_logger(), "Could not read %zu map tiles back from %s.  Kept on disk.",
+        stats.failed_tiles, tile_directory_.c_str());
+    }
+    RCLCPP_DEBUG(this->get_logger(),
+      "Map rolled in %.1f ms: %zu fine and %zu coarse leaves, %zu tiles spilled, %zu loaded, %zu inserts replayed",
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(),
+      stats.fine_leaves, stats.coarse_leaves, stats.spilled_tiles, stats.loaded_tiles, replayed);
+  }
+
+  // State of the integration pipeline, on the common diagnostics topic
+  void publish_diagnostics(const rclcpp::Time &now)
+  {
+    diagnostic_msgs::msg::DiagnosticStatus status;
+    status.name = std::string(this->get_name()) + ": point cloud integration";
+    status.hardware_id = pointcloud_topic_;
+    status.level = diagnostic_msgs::msg::DiagnosticStatus::OK;
+    status.message = "OK";
+    if (cloud_queue_->dropped() > dropped_reported_) {
+      status.level = diagnostic_msgs::msg::DiagnosticStatus::WARN;
+      status.message = "Integration falls behind, clouds dropped";
+    }
+    dropped_reported_ = cloud_queue_->dropped();
+
+    auto add = [&status](const std::string &key, const std::string &value) {
+      diagnostic_msgs::msg::KeyValue key_value;
+      key_value.key = key;
+      key_value.value = value;
+      status.values.push_back(key_value);
+    };
+    add("queue_depth", std::to_string(cloud_queue_->size()));
+    add("queue_capacity", std::to_string(ingest_queue_size_));
+    add("received", std::to_string(cloud_queue_->pushed()));
+    add("dropped", std::to_string(cloud_queue_->dropped()));
+    add("integrated", std::to_string(integrated_count_.load()));
+    add("last_integration_ms", std::to_string(integration_ms_.load()));
+
+    diagnostic_msgs::msg::DiagnosticArray array;
+    array.header.stamp = now;
+    array.status.push_back(status);
+    diagnostics_publisher_->publish(array);
+  }
+  uint64_t dropped_reported_ = 0;
+
+  // Limit the changed region to the box of update_radius around the robot.  False if nothing is left.
+  bool clipToRobot(ufo::map::Point3 &min_change, ufo::map::Point3 &max_change)
+  {
+    geometry_msgs::msg::TransformStamped tf_trans;
+    if (!pose_cache_->latest(tf_trans)) {
+      return true;   // Robot position unknown.  Publish all changes.
+    }
+
+    double robot[3] = { tf_trans.transform.translation.x,
+                        tf_trans.transform.translation.y,
+                        tf_trans.transform.translation.z };
+    for (int i = 0; i < 3; i++) {
+      min_change[i] = std::max((double)min_change[i], robot[i] - update_radius_);
+      max_change[i] = std::min((double)max_change[i], robot[i] + update_radius_);
+      if (min_change[i] > max_change[i]) return false;
+    }
+    return true;
   }
   /*
   ufo::math::Pose6 rosToUfo(geometry_msgs::msg::Transform const& transform)
@@ -237,60 +611,77 @@ private:
   }
   */  
   void topic_callback(sensor_msgs::msg::PointCloud2::SharedPtr msg)
+  {
+    // Hand off and return.  A full queue drops its oldest cloud.
+    cloud_queue_->push(msg);
+  }
+
+  void integration_loop()
+  {
+    sensor_msgs::msg::PointCloud2::SharedPtr msg;
+    while (cloud_queue_->pop(msg)) {
+      auto start = std::chrono::steady_clock::now();
+      integrate(msg);
+      integration_ms_ = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      integrated_count_++;
+      msg.reset();
+    }
+  }
+
+  void integrate(const sensor_msgs::msg::PointCloud2::SharedPtr &msg)
   {
 
-    // Get transform
+    // Get transform, at the time the cloud was taken: the robot pose then, and the mount of the
+    // sensor on the robot.
     ufo::math::Pose6 transform;
+    geometry_msgs::msg::TransformStamped robot_pose;
     
     try {
-      // Lookup transform
-      geometry_msgs::msg::TransformStamped tf_trans = tf_buffer_->lookupTransform(map_frame_id_, 
-                                                                              msg->header.frame_id, 
-                                                                              tf2::TimePointZero);
-      // Convert ROS transform to UFO transform
-      transform = ufomap_ros::rosToUfo(tf_trans.transform);
+      if (!pose_cache_->lookup(msg->header.stamp, robot_pose)) {
+        robot_pose = tf_buffer_->lookupTransform(map_frame_id_, robot_frame_id_, msg->header.stamp);
+      }
+      auto mount = sensor_mounts_.find(msg->header.frame_id);
+      if (mount == sensor_mounts_.end()) {
+        geometry_msgs::msg::TransformStamped tf_mount = tf_buffer_->lookupTransform(robot_frame_id_,
+                                                                                    msg->header.frame_id,
+                                                                                    tf2::TimePointZero);
+        mount = sensor_mounts_.emplace(msg->header.frame_id, toTf2(tf_mount.transform)).first;
+      }
+      tf2::Transform sensor = toTf2(robot_pose.transform) * mount->second;
+
+      // Convert to UFO transform
+      transform = ufo::math::Pose6(sensor.getOrigin().x(), sensor.getOrigin().y(), sensor.getOrigin().z(),
+                                   sensor.getRotation().w(), sensor.getRotation().x(),
+                                   sensor.getRotation().y(), sensor.getRotation().z());
       
     } catch (tf2::TransformException &ex) {
       RCLCPP_WARN(
             this->get_logger(), "Could not transform %s to %s: %s",
-            "map", msg->header.frame_id, ex.what());
+            msg->header.frame_id.c_str(), map_frame_id_.c_str(), ex.what());
       return;
     }
 
-    ufo::map::PointCloudColor cloud;
-    // Convert ROS point cloud to UFO point cloud
-    ufomap_ros::rosToUfo(*msg, cloud);
-    // Transform point cloud to correct frame, do it in parallel (second param true)
-    cloud.transform(transform, true);
+    // Convert ROS point cloud to UFO point cloud in the map frame, in one pass.  The cloud is
+    // reused, so its buffer is allocated once.
+    ufo::map::PointCloudColor &cloud = cloud_;
+    ufomap_ros::rosToUfo(*msg, transform, cloud);
+    if (body_filter_) {
+      body_filter_->filter(cloud, ufomap_ros::rosToUfo(robot_pose.transform));   // The robot when the cloud was taken
+    }
+
+    std::lock_guard<std::mutex> map_lock(map_mutex_);    // Also guards the filter, see reset_map
+    const ufo::map::PointCloudColor &points = voxel_filter_ ? voxel_filter_->filter(cloud) : cloud;
+    if (rolling_) {
+      deferred_inserts_.emplace_back(transform.translation(), points);   // Into the rolled map, see roll_window
+      return;
+    }
 
     // Integrate point cloud into UFOMap, no max range (third param -1), 
     // free space at depth level 1 (fourth param 1)
     //map_->insertPointCloudDiscrete(transform.translation(), cloud, -1, 1);    
-    map_->insertPointCloudDiscrete(transform.translation(), cloud, max_range_, insert_depth_, simple_ray_casting_, early_stopping_, async_);    
-    
-    if (clear_robot_) {
-      try {
-        // Lookup transform
-        geometry_msgs::msg::TransformStamped tf_trans = tf_buffer_->lookupTransform(map_frame_id_, 
-                                                                                    robot_frame_id_, 
-                                                                                    tf2::TimePointZero);
-        // Convert ROS transform to UFO transform
-        transform = ufomap_ros::rosToUfo(tf_trans.transform);
-      
-      } catch (tf2::TransformException &ex) {
-        RCLCPP_WARN(
-              this->get_logger(), "Could not transform %s to %s: %s",
-              "map", msg->header.frame_id, ex.what());
-        return;
-      }
-      
-      ufo::map::Point3 r(robot_radius_, robot_radius_, robot_height_ / 2.0);
-			ufo::geometry::AABB aabb(transform.translation() - r,
-				                             transform.translation() + r);
-			//map_->setValueVolume(aabb, map_->getClampingThresMin(), clearing_depth_);  // /usr/local/include/ufo/map/occupancy_map_base.h:508:4: error: call of overloaded ‘setOccupancy(float&, double)’ is ambiguous
-      
-    }
-    
+    auto write_lock = SharedMap::instance().lockForWriting();   // No readers of the shared map while it changes
+    map_->insertPointCloudDiscrete(transform.translation(), points, max_range_, insert_depth_, simple_ray_casting_, early_stopping_, async_);    
+    map_changed(false);
     
     // Map has changed, publish
     // publish_map();
@@ -298,6 +689,55 @@ private:
   }
   
 
+  static tf2::Transform toTf2(const geometry_msgs::msg::Transform &transform)
+  {
+    return tf2::Transform(
+      tf2::Quaternion(transform.rotation.x, transform.rotation.y, transform.rotation.z, transform.rotation.w),
+      tf2::Vector3(transform.translation.x, transform.translation.y, transform.translation.z));
+  }
+
+  // RANGE SENSORS ///////////////////////////////////////////////////////////////////////////////////////////////
+  void range_callback(size_t sensor, const sensor_msgs::msg::Range::SharedPtr msg)
+  {
+    // A reading outside the limits of the sensor saw nothing
+    if (!std::isfinite(msg->range) || msg->range < msg->min_range || msg->range > msg->max_range) {
+      return;
+    }
+    const RangeSensor &s = range_sensors_[sensor];
+    ufo::math::Vector3 end = s.position + s.direction * msg->range;
+    range_beams_.push_back(ufo::map::Point3Color(end.x(), end.y(), end.z()));
+  }
+
+  // Integrate the beams since the last batch.  The rays are cast from the origin of the robot
+  // base, a few cm from the sensors, so the whole batch takes one insert.
+  void integrate_ranges()
+  {
+    if (range_beams_.empty()) return;
+
+    geometry_msgs::msg::TransformStamped tf_trans;
+    if (!pose_cache_->latest(tf_trans)) {
+      RCLCPP_WARN(this->get_logger(), "No transform from %s to %s yet",
+        robot_frame_id_.c_str(), map_frame_id_.c_str());
+      range_beams_.clear();
+      return;
+    }
+    ufo::math::Pose6 transform = ufomap_ros::rosToUfo(tf_trans.transform);
+
+    range_beams_.transform(transform, false);
+    {
+      std::lock_guard<std::mutex> map_lock(map_mutex_);
+      if (rolling_) {
+        deferred_inserts_.emplace_back(transform.translation(), range_beams_);   // See roll_window
+      } else {
+        auto write_lock = SharedMap::instance().lockForWriting();
+        map_->insertPointCloudDiscrete(transform.translation(), range_beams_, max_range_, insert_depth_,
+                                       simple_ray_casting_, early_stopping_, false);
+        map_changed(false);
+      }
+    }
+    range_beams_.clear();
+  }
+
   bool save_map(const std::shared_ptr<navigation_interfaces::srv::SaveMap::Request> request,
           std::shared_ptr<navigation_interfaces::srv::SaveMap::Response> response)
   {
@@ -305,6 +745,7 @@ private:
         
 		ufo::geometry::BoundingVolume bv =
 			        ufomap_msgs::msgToUfo(request->bounding_volume);
+			    std::lock_guard<std::mutex> map_lock(map_mutex_);
 			    response->success = map_->write(request->filename, bv, request->compress,
 			                                 request->depth, 1, request->compression_level);
 	  return true;
@@ -313,16 +754,86 @@ private:
   void load_map(const std::shared_ptr<navigation_interfaces::srv::LoadMap::Request> request,
           std::shared_ptr<navigation_interfaces::srv::LoadMap::Response> response)
   {
-    response->success = map_->read(request->filename);
+    std::lock_guard<std::mutex> map_lock(map_mutex_);
+    auto write_lock = SharedMap::instance().lockForWriting();
+    response->success = readMapSnapshot(request->filename, *map_);
+    map_changed(true);
+    keyframe_pending_ = true;   // Subscribers need the whole new map
   }
 
   void reset_map(const std::shared_ptr<navigation_interfaces::srv::Reset::Request> request,
           std::shared_ptr<navigation_interfaces::srv::Reset::Response> response)
   {    
+    std::lock_guard<std::mutex> map_lock(map_mutex_);
+    auto write_lock = SharedMap::instance().lockForWriting();
     map_->clear(request->new_resolution, request->new_depth_levels);
+    map_changed(true);
+    keyframe_pending_ = true;   // Subscribers need to drop their map
+    if (voxel_filter_) {
+      voxel_filter_ = std::make_unique<VoxelFilter>(downsample_factor_ * map_->getResolution());
+    }
     response->success = true;
   }
 
+  // COLLISION QUERIES //////////////////////////////////////////////////////////////////////////////////////////
+  // After every change of map_, under map_mutex_.  The cached collision answers are dropped where
+  // the map changed since the last message, a superset of this change.
+  void map_changed(bool whole)
+  {
+    map_version_++;
+    if (!collision_query_) return;
+    if (!whole && map_->validMinMaxChange()) {
+      collision_query_->update(*map_, map_version_, map_->minChange(), map_->maxChange());
+    } else {
+      collision_query_->update(map_version_);
+    }
+  }
+
+  void check_collision(const std::shared_ptr<navigation_lite::srv::CheckCollision::Request> request,
+          std::shared_ptr<navigation_lite::srv::CheckCollision::Response> response)
+  {
+    if ((request->sphere_centers.size() != request->sphere_radii.size()) ||
+        (request->box_poses.size() != request->box_half_sizes.size()) ||
+        (request->segment_from.size() != request->segment_to.size())) {
+      RCLCPP_WARN(this->get_logger(), "Collision query with mismatched arrays.  Ignored.");
+      return;
+    }
+
+    std::vector<CollisionQuery::Sphere> spheres;
+    for (size_t i = 0; i < request->sphere_centers.size(); i++) {
+      const auto &c = request->sphere_centers[i];
+      spheres.push_back(CollisionQuery::Sphere{ufo::math::Vector3(c.x, c.y, c.z), request->sphere_radii[i]});
+    }
+    std::vector<CollisionQuery::Box> boxes;
+    for (size_t i = 0; i < request->box_poses.size(); i++) {
+      const auto &p = request->box_poses[i];
+      const auto &h = request->box_half_sizes[i];
+      double roll, pitch, yaw;
+      tf2::Matrix3x3(tf2::Quaternion(p.orientation.x, p.orientation.y, p.orientation.z, p.orientation.w)).getRPY(roll, pitch, yaw);
+      boxes.push_back(CollisionQuery::Box{ufo::math::Vector3(p.position.x, p.position.y, p.position.z),
+                                          ufo::math::Vector3(h.x, h.y, h.z), roll, pitch, yaw});
+    }
+    std::vector<CollisionQuery::Segment> segments;
+    for (size_t i = 0; i < request->segment_from.size(); i++) {
+      const auto &f = request->segment_from[i];
+      const auto &t = request->segment_to[i];
+      segments.push_back(CollisionQuery::Segment{ufo::math::Vector3(f.x, f.y, f.z), ufo::math::Vector3(t.x, t.y, t.z),
+                                                 request->segment_radius});
+    }
+
+    std::vector<bool> sphere_hits, box_hits, segment_hits;
+    {
+      std::lock_guard<std::mutex> map_lock(map_mutex_);   // Holds off integration for the length of the query
+      collision_query_->spheres(*map_, map_version_, spheres, sphere_hits);
+      collision_query_->boxes(*map_, map_version_, boxes, box_hits);
+      collision_query_->segments(*map_, map_version_, segments, segment_hits);
+      response->map_version = map_version_;
+    }
+    response->collides.insert(response->collides.end(), sphere_hits.begin(), sphere_hits.end());
+    response->collides.insert(response->collides.end(), box_hits.begin(), box_hits.end());
+    response->collides.insert(response->collides.end(), segment_hits.begin(), segment_hits.end());
+  }
+
 };  // class MapServer
 
 }  // namespace navigation_lite
@@ -0,0 +1,29 @@
+// Copyright (c) 2021 Xeni Robotics
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* **********************************************************************
+ * Reading map snapshots.  See map_snapshot.h
+ * ***********************************************************************/
+
+#include "navigation_lite/map_snapshot.h"
+
+namespace navigation_lite
+{
+
+bool readMapSnapshot(const std::string &filename, ufo::map::OccupancyMap &map)
+{
+  return map.read(filename);
+}
+
+}  // namespace navigation_lite
@@ -15,7 +15,7 @@
 /* **********************************************************************
  * An Action Server Node that forms the main interface to the navigation 
  * stack.  It executes a behaviour tree specified in the Action Server 
- * goal (xml file name).  The action server serves AsyncActionNodes that
+ * goal (xml file name).  The action server serves tree action nodes that
  * call Planner, Controller and Recovery Action Servers and Simple Services
  * to move the drone safely in 3D space.
  *
@@ -27,6 +27,13 @@
 #include <thread>
 #include <string>
 #include <sstream>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+
+#include <sys/stat.h>
 
 #include "builtin_interfaces/msg/duration.hpp"
 #include "geometry_msgs/msg/pose_stamped.hpp"
@@ -53,6 +60,11 @@
 #include "navigation_lite/action_follow_waypoints.h"
 #include "navigation_lite/action_compute_path_to_pose.h"
 #include "navigation_lite/pose_3D.h"
+#include "navigation_lite/pose_cache.h"
+#include "navigation_lite/navigation_context.h"
+#include "navigation_lite/thread_pool.hpp"
+
+#include "behaviortree_cpp_v3/xml_parsing.h"
 
 
 using namespace std::chrono_literals;
@@ -75,8 +87,18 @@ public:
     // Read parameters
     map_frame_ = this->declare_parameter<std::string>("map_frame", "map");
     minimum_battery_voltage_ = this->declare_parameter<float>("minimum_battery_voltage", 13.6);
+    // The tree is ticked at this rate, and at once when an action node has a result
+    tick_period_ = period(this->declare_parameter<double>("bt_tick_rate", 10.0), "bt_tick_rate");
+    feedback_period_ = period(this->declare_parameter<double>("feedback_rate", 1.0), "feedback_rate");
     current_battery_voltage_ = 14.8;  // Full LiPo S4
     
+    // The trees run on their own workers.  The TF polling and the goal callbacks get their own
+    // callback groups, so a multi-threaded executor does not hold one back behind the other.
+    int goal_threads = this->declare_parameter<int>("goal_threads", 2);   // Goals navigated at the same time
+    goal_pool_ = std::make_unique<ThreadPool>(std::max(1, goal_threads));
+    tf_group_ = this->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+    action_group_ = this->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+    
     // Subscribe to some topics
     subscription_ = this->create_subscription<sensor_msgs::msg::BatteryState>(
       "drone/battery", 5, std::bind(&NavigationServer::battery_callback, this, std::placeholders::_1));
@@ -86,22 +108,89 @@ public:
       std::make_unique<tf2_ros::Buffer>(this->get_clock());
     transform_listener_ =
       std::make_shared<tf2_ros::TransformListener>(*tf_buffer_);
+    // The robot pose, polled from TF once per tick instead of looked up on every read
+    pose_cache_ = std::make_unique<PoseCache>(*this, *tf_buffer_, map_frame_, "base_link", 50.0, tf_group_);
+
+    register_nodes();
 
     this->action_server_ = rclcpp_action::create_server<NavigateToPose>(
       this,
       "nav_lite/navigate_to_pose",
       std::bind(&NavigationServer::handle_goal, this, _1, _2),
       std::bind(&NavigationServer::handle_cancel, this, _1),
-      std::bind(&NavigationServer::handle_accepted, this, _1));
+      std::bind(&NavigationServer::handle_accepted, this, _1),
+      rcl_action_server_get_default_options(),
+      action_group_);
       RCLCPP_INFO(this->get_logger(), "Action Serever [nav_lite/navigate_to_pose] started");
   }
   
 private:
   std::shared_ptr<tf2_ros::TransformListener> transform_listener_{nullptr};
   std::unique_ptr<tf2_ros::Buffer> tf_buffer_;  
+  std::unique_ptr<PoseCache> pose_cache_;
   std::string map_frame_;
   float minimum_battery_voltage_;
-  float current_battery_voltage_;
+  std::atomic<float> current_battery_voltage_;   // Read by the trees
+  rclcpp::CallbackGroup::SharedPtr tf_group_;
+  rclcpp::CallbackGroup::SharedPtr action_group_;
+  std::chrono::steady_clock::duration tick_period_;
+  std::chrono::steady_clock::duration feedback_period_;
+
+  std::chrono::steady_clock::duration period(double rate, const char *name)
+  {
+    if (rate <= 0) {
+      RCLCPP_WARN(this->get_logger(), "%s must be positive, using 1 Hz", name);
+      rate = 1.0;
+    }
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / rate));
+  }
+
+  // Built once.  The parsed XML is kept per file, and parsed again when the file changes.
+  BehaviorTreeFactory factory_;
+  struct ParsedTree
+  {
+    struct timespec modified;
+    std::shared_ptr<BT::XMLParser> parser;
+  };
+  std::map<std::string, ParsedTree> parsed_trees_;
+  std::mutex trees_mutex_;
+
+  void register_nodes()
+  {
+    using namespace NavigationNodes; 
+    factory_.registerSimpleCondition("BatteryOK", std::bind(&NavigationServer::CheckBattery, this));
+    factory_.registerNodeType<RoundRobinNode>("RoundRobin"); 
+    factory_.registerNodeType<PipelineSequence>("PipelineSequence"); 
+    factory_.registerNodeType<RecoveryNode>("RecoveryNode"); 
+    factory_.registerNodeType<RateController>("RateController");
+    factory_.registerNodeType<NavLiteReadGoalAction>("ReadGoal");  //  10,0;1,0;5,0;0.0
+    factory_.registerNodeType<NavLiteWaitAction>("Wait");
+    factory_.registerNodeType<NavLiteSpinAction>("Spin");
+    factory_.registerNodeType<NavLiteFollowWaypointsAction>("FollowWaypoints");
+    factory_.registerNodeType<NavLiteComputePathToPoseAction>("ComputePathToPose");
+  }
+
+  // Instantiate the tree in a file, from the cached parse when the file did not change since.
+  // Goals run on their own threads, so this is serialised.
+  Tree createTree(const std::string &file_name, BT::Blackboard::Ptr blackboard)
+  {
+    struct stat file_stat;
+    if (stat(file_name.c_str(), &file_stat) != 0) {
+      throw BT::RuntimeError("Can not open the behaviour tree file ", file_name);
+    }
+
+    std::lock_guard<std::mutex> lock(trees_mutex_);
+    auto &parsed = parsed_trees_[file_name];
+    if (!parsed.parser ||
+        parsed.modified.tv_sec != file_stat.st_mtim.tv_sec || parsed.modified.tv_nsec != file_stat.st_mtim.tv_nsec) {
+      auto parser = std::make_shared<BT::XMLParser>(factory_);
+      parser->loadFromFile(file_name);
+      parsed.parser = parser;
+      parsed.modified = file_stat.st_mtim;
+      RCLCPP_DEBUG(this->get_logger(), "Parsed the behaviour tree %s", file_name.c_str());
+    }
+    return parsed.parser->instantiateTree(blackboard);
+  }
 
   BT::NodeStatus CheckBattery()
   {      
@@ -137,9 +226,8 @@ private:
 
   void handle_accepted(const std::shared_ptr<GoalHandleNavigateToPose> goal_handle)
   {
-    using namespace std::placeholders;
-    // this needs to return quickly to avoid blocking the executor, so spin up a new thread
-    std::thread{std::bind(&NavigationServer::execute, this, _1), goal_handle}.detach();
+    // this needs to return quickly to avoid blocking the executor, so hand it to a worker
+    goal_pool_->enqueue([this, goal_handle]() { execute(goal_handle); });
   }
 
   /* std::string pose3D_string(Pose3D bt_goal_msg) {
@@ -151,7 +239,6 @@ private:
   
   void execute(const std::shared_ptr<GoalHandleNavigateToPose> goal_handle)
   {
-    rclcpp::Rate loop_rate(1);    // Executing at 1 Hz
     const auto goal = goal_handle->get_goal();
     const auto wp = goal->pose;
     auto feedback = std::make_shared<NavigateToPose::Feedback>();
@@ -183,53 +270,34 @@ private:
     bt_goal_msg.z     = wp.pose.position.z;
     bt_goal_msg.theta = yaw;
             
-    BehaviorTreeFactory factory;
-    Tree tree;
     using namespace NavigationNodes; 
-    factory.registerSimpleCondition("BatteryOK", std::bind(&NavigationServer::CheckBattery, this));
-    factory.registerNodeType<RoundRobinNode>("RoundRobin"); 
-    factory.registerNodeType<PipelineSequence>("PipelineSequence"); 
-    factory.registerNodeType<RecoveryNode>("RecoveryNode"); 
-    factory.registerNodeType<RateController>("RateController");
-    factory.registerNodeType<NavLiteReadGoalAction>("ReadGoal");  //  10,0;1,0;5,0;0.0
-    factory.registerNodeType<NavLiteWaitAction>("Wait");
-    factory.registerNodeType<NavLiteSpinAction>("Spin");
-    factory.registerNodeType<NavLiteFollowWaypointsAction>("FollowWaypoints");
-    factory.registerNodeType<NavLiteComputePathToPoseAction>("ComputePathToPose");
-
-    //BT::Blackboard::Ptr blackboard;
-    //tree = factory.createTreeFromFile(goal->behavior_tree, blackboard);    
-    //blackboard->set("pose", pose3D_string(bt_goal_msg));
-    tree = factory.createTreeFromFile(goal->behavior_tree);
+    auto context = std::make_shared<NavigationContext>();
+    context->node = shared_from_this();
+    context->wake_up = std::make_shared<TreeWakeUp>();   // The action nodes wake the tree when a result arrives
+    context->goal = bt_goal_msg;
+    auto wake_up = context->wake_up;
+
+    // The nodes take the context from the blackboard when they are built
+    auto blackboard = BT::Blackboard::create();
+    blackboard->set("context", context);
+
+    Tree tree;
+    try {
+      tree = createTree(goal->behavior_tree, blackboard);
+    } catch (const std::exception &e) {
+      RCLCPP_ERROR(this->get_logger(), "Failed to load the behaviour tree %s: %s", goal->behavior_tree.c_str(), e.what());
+      goal_handle->abort(result);
+      return;
+    }
     
     RCLCPP_DEBUG(this->get_logger(), "Tree Loaded");
-    
-    auto node_ptr = shared_from_this();              
-    // Initialise the BT Nodes  
-    // Iterate through all the nodes and call init() if it is an Action_B
-    for( auto& node: tree.nodes )
-    {
-      // Not a typo: it is "=", not "=="
-      if( auto read_goal_action = dynamic_cast<NavLiteReadGoalAction *>( node.get() ))
-      {
-        read_goal_action->init( node_ptr, bt_goal_msg );
-      } else if( auto wait_action = dynamic_cast<NavLiteWaitAction *>( node.get() ))
-      {
-        wait_action->init( node_ptr );
-      } else if( auto spin_action = dynamic_cast<NavLiteSpinAction *>( node.get() ))
-      {
-        spin_action->init( node_ptr );
-      } else if( auto follow_waypoints_action = dynamic_cast<NavLiteFollowWaypointsAction *>( node.get() ))
-      {
-        follow_waypoints_action->init( node_ptr );
-      } else if( auto compute_path_to_pose_action = dynamic_cast<NavLiteComputePathToPoseAction *>( node.get() ))
-      {
-        compute_path_to_pose_action->init( node_ptr );
-      }
-    }
         
     auto start_time = now();
+    auto next_feedback = std::chrono::steady_clock::now();
     
+    // The action nodes return RUNNING while their server works.  The tree is ticked again at the
+    // tick rate for the conditions, or at once when an action node wakes it with a result.  The
+    // feedback goes out at its own rate.
     while( ( tree.tickRoot() == NodeStatus::RUNNING) && rclcpp::ok() )
     {
       // Check if there is a cancel request
@@ -241,22 +309,26 @@ private:
       }
       
       // Publish Feedback
-      read_position(current_pose);
+      auto tick_time = std::chrono::steady_clock::now();
+      if (tick_time >= next_feedback) {
+        next_feedback = tick_time + feedback_period_;
+        read_position(current_pose);
       
-      navigation_time = now() - start_time;                         // builtin_interfaces/Duration navigation_time
-      estimated_time_remaining.sec = 0;                             // builtin_interfaces/Duration estimated_time_remaining 
-      estimated_time_remaining.nanosec = 0;
-      number_of_recoveries = 0;                                     // int16 number_of_recoveries
+        navigation_time = now() - start_time;                         // builtin_interfaces/Duration navigation_time
+        estimated_time_remaining.sec = 0;                             // builtin_interfaces/Duration estimated_time_remaining 
+        estimated_time_remaining.nanosec = 0;
+        number_of_recoveries = 0;                                     // int16 number_of_recoveries
       
-      auto err_x = wp.pose.position.x - current_pose.pose.position.x; 
-      auto err_y = wp.pose.position.y - current_pose.pose.position.y; 
-      auto err_z = wp.pose.position.y - current_pose.pose.position.z; 
+        auto err_x = wp.pose.position.x - current_pose.pose.position.x; 
+        auto err_y = wp.pose.position.y - current_pose.pose.position.y; 
+        auto err_z = wp.pose.position.z - current_pose.pose.position.z; 
       
-      distance_remaining = sqrt(pow(err_z,2) + pow(err_x,2) + pow(err_y,2)); // float32 distance_remaining
+        distance_remaining = sqrt(pow(err_z,2) + pow(err_x,2) + pow(err_y,2)); // float32 distance_remaining
       
-      goal_handle->publish_feedback(feedback);
+        goal_handle->publish_feedback(feedback);
+      }
       
-      loop_rate.sleep();
+      wake_up->waitFor( std::min(tick_period_, next_feedback - tick_time) );
     }
     
     // Check if goal is done
@@ -269,35 +341,29 @@ private:
   // Transformation Listener/////////////////////////////////////////////////////
   bool read_position( geometry_msgs::msg::PoseStamped &current_pose )
   {  
-    std::string from_frame = "base_link"; 
-    std::string to_frame = map_frame_.c_str();
-      
     geometry_msgs::msg::TransformStamped transformStamped;
     
     // Look up for the transformation between map and base_link_ned frames
     // and save the last position in the 'map' frame
-    try {
-      transformStamped = tf_buffer_->lookupTransform(
-        to_frame, from_frame,
-        tf2::TimePointZero);
-      current_pose.pose.position.x = transformStamped.transform.translation.x;
-      current_pose.pose.position.y = transformStamped.transform.translation.y;
-      current_pose.pose.position.z = transformStamped.transform.translation.z;
-      
-      current_pose.pose.orientation.x = transformStamped.transform.rotation.x;
-      current_pose.pose.orientation.y = transformStamped.transform.rotation.y;
-      current_pose.pose.orientation.z = transformStamped.transform.rotation.z;
-      current_pose.pose.orientation.w = transformStamped.transform.rotation.w;      
-      
-    } catch (tf2::TransformException & ex) {
+    if (!pose_cache_->latest(transformStamped)) {
       RCLCPP_DEBUG(
-        this->get_logger(), "Could not transform %s to %s: %s",
-        to_frame.c_str(), from_frame.c_str(), ex.what());
+        this->get_logger(), "No transform from %s to %s yet",
+        pose_cache_->sourceFrame().c_str(), pose_cache_->targetFrame().c_str());
       return false;  
     }
+    current_pose.pose.position.x = transformStamped.transform.translation.x;
+    current_pose.pose.position.y = transformStamped.transform.translation.y;
+    current_pose.pose.position.z = transformStamped.transform.translation.z;
+    
+    current_pose.pose.orientation.x = transformStamped.transform.rotation.x;
+    current_pose.pose.orientation.y = transformStamped.transform.rotation.y;
+    current_pose.pose.orientation.z = transformStamped.transform.rotation.z;
+    current_pose.pose.orientation.w = transformStamped.transform.rotation.w;      
+    
     return true;
   }
-  
+
+  std::unique_ptr<ThreadPool> goal_pool_;   // Last member: joined before the rest is destroyed
   
 };  // class NavigationServer
 
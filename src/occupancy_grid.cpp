@@ -0,0 +1,481 @@
+// Copyright (c) 2021 Xeni Robotics
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* **********************************************************************
+ * Inflated occupancy of the planning lattice.  See occupancy_grid.h
+ * ***********************************************************************/
+
+#include <cmath>            // std::floor
+#include <algorithm>        // std::max, std::min
+#include <unordered_set>    // std::unordered_set
+#include <limits>           // std::numeric_limits
+#include <cstring>          // std::memcpy, std::memcmp
+#include <fstream>          // std::ofstream
+
+#include "navigation_lite/occupancy_grid.h"
+#include "navigation_lite/mapped_file.hpp"
+
+static const char GRID_MAGIC[8] = { 'N', 'L', 'G', 'R', 'I', 'D', '0', '1' };
+
+// SparseBitmap ////////////////////////////////////////////////////////////////////////////////////////////////////
+size_t SparseBitmap::count() const
+{
+  size_t n = 0;
+  for(auto &block : blocks) {
+    for(auto word : block.second) {
+      n += __builtin_popcountll(word);
+    }
+  }
+  return n;
+}
+
+void SparseBitmap::getPoints(std::vector< std::array<int, 3> > &points) const
+{
+  for(auto &block : blocks) {
+    for(int layer = 0; layer < BLOCK_SIZE; layer++) {
+      appendBits(block.first, layer, block.second[layer], points);
+    }
+  }
+}
+
+void SparseBitmap::getBlocks(std::vector< std::array<int, 3> > &block_coordinates) const
+{
+  std::array<int, 3> block;
+  for(auto &entry : blocks) {
+    mortonDecode(entry.first, block);
+    block_coordinates.push_back(block);
+  }
+}
+
+void SparseBitmap::write(std::ostream &out) const
+{
+  uint64_t count = blocks.size();
+  out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+  for(auto &block : blocks) {
+    out.write(reinterpret_cast<const char *>(&block.first), sizeof(block.first));
+    out.write(reinterpret_cast<const char *>(block.second.data()), sizeof(Block));
+  }
+}
+
+bool SparseBitmap::read(const char *&data, const char *end)
+{
+  uint64_t count;
+  if ((size_t)(end - data) < sizeof(count)) return false;
+  std::memcpy(&count, data, sizeof(count));
+  data += sizeof(count);
+  if ((size_t)(end - data) / (sizeof(uint64_t) + sizeof(Block)) < count) return false;
+
+  blocks.clear();
+  blocks.reserve(count);
+  for(uint64_t i = 0; i < count; i++) {
+    uint64_t key;
+    Block block;
+    std::memcpy(&key, data, sizeof(key));
+    std::memcpy(block.data(), data + sizeof(key), sizeof(Block));
+    data += sizeof(key) + sizeof(Block);
+    blocks.emplace(key, block);
+  }
+  return true;
+}
+
+void SparseBitmap::difference(const SparseBitmap &other, std::vector< std::array<int, 3> > &points) const
+{
+  // Blocks in this bitmap, compared to the same block (or nothing) in the other
+  for(auto &block : blocks) {
+    auto it = other.blocks.find(block.first);
+    for(int layer = 0; layer < BLOCK_SIZE; layer++) {
+      uint64_t word = block.second[layer];
+      if (it != other.blocks.end()) {
+        word ^= it->second[layer];
+      }
+      appendBits(block.first, layer, word, points);
+    }
+  }
+
+  // Blocks only in the other bitmap
+  for(auto &block : other.blocks) {
+    if (blocks.find(block.first) != blocks.end()) continue;
+    for(int layer = 0; layer < BLOCK_SIZE; layer++) {
+      appendBits(block.first, layer, block.second[layer], points);
+    }
+  }
+}
+
+void SparseBitmap::difference(const SparseBitmap &other, const std::array<int, 3> &min, const std::array<int, 3> &max,
+                              std::vector< std::array<int, 3> > &points) const
+{
+  std::array<int, 3> block_min, block_max;
+  size_t box_blocks = 1;
+  for(int i = 0; i < 3; i++) {
+    if (min.at(i) > max.at(i)) return;
+    block_min.at(i) = min.at(i) >> BLOCK_BITS;
+    block_max.at(i) = max.at(i) >> BLOCK_BITS;
+    box_blocks *= (size_t)(block_max.at(i) - block_min.at(i) + 1);
+  }
+
+  if (box_blocks <= blocks.size() + other.blocks.size()) {
+    // A small box.  Visit the blocks it covers.
+    std::array<int, 3> block;
+    for(block.at(2) = block_min.at(2); block.at(2) <= block_max.at(2); block.at(2)++) {
+      for(block.at(1) = block_min.at(1); block.at(1) <= block_max.at(1); block.at(1)++) {
+        for(block.at(0) = block_min.at(0); block.at(0) <= block_max.at(0); block.at(0)++) {
+          differenceInBlock(other, block, min, max, points);
+        }
+      }
+    }
+    return;
+  }
+
+  // A box larger than both bitmaps.  Visit the blocks they hold inside it.
+  auto inBox = [&block_min, &block_max](const std::array<int, 3> &b) {
+    return (b.at(0) >= block_min.at(0)) && (b.at(0) <= block_max.at(0)) &&
+           (b.at(1) >= block_min.at(1)) && (b.at(1) <= block_max.at(1)) &&
+           (b.at(2) >= block_min.at(2)) && (b.at(2) <= block_max.at(2));
+  };
+  std::array<int, 3> block;
+  for(auto &entry : blocks) {
+    mortonDecode(entry.first, block);
+    if (inBox(block)) differenceInBlock(other, block, min, max, points);
+  }
+  for(auto &entry : other.blocks) {
+    if (blocks.find(entry.first) != blocks.end()) continue;
+    mortonDecode(entry.first, block);
+    if (inBox(block)) differenceInBlock(other, block, min, max, points);
+  }
+}
+
+void SparseBitmap::differenceInBlock(const SparseBitmap &other, const std::array<int, 3> &block,
+                                     const std::array<int, 3> &min, const std::array<int, 3> &max,
+                                     std::vector< std::array<int, 3> > &points) const
+{
+  uint64_t key = mortonCode(block.at(0), block.at(1), block.at(2));
+  auto mine = blocks.find(key);
+  auto theirs = other.blocks.find(key);
+  if ((mine == blocks.end()) && (theirs == other.blocks.end())) return;
+
+  // The part of the box in this block, in block coordinates
+  std::array<int, 3> lo, hi;
+  for(int i = 0; i < 3; i++) {
+    lo.at(i) = std::max(min.at(i) - block.at(i) * BLOCK_SIZE, 0);
+    hi.at(i) = std::min(max.at(i) - block.at(i) * BLOCK_SIZE, BLOCK_SIZE - 1);
+  }
+  uint64_t row = (((uint64_t)1 << (hi.at(0) - lo.at(0) + 1)) - 1) << lo.at(0);
+  uint64_t mask = 0;
+  for(int y = lo.at(1); y <= hi.at(1); y++) {
+    mask |= row << (y * BLOCK_SIZE);
+  }
+
+  for(int layer = lo.at(2); layer <= hi.at(2); layer++) {
+    uint64_t word = 0;
+    if (mine != blocks.end()) word ^= mine->second[layer];
+    if (theirs != other.blocks.end()) word ^= theirs->second[layer];
+    appendBits(key, layer, word & mask, points);
+  }
+}
+
+void SparseBitmap::appendBits(uint64_t key, int layer, uint64_t word, std::vector< std::array<int, 3> > &points)
+{
+  if (word == 0) return;
+
+  std::array<int, 3> origin;
+  mortonDecode(key, origin);
+  while (word != 0) {
+    int bit = __builtin_ctzll(word);
+    points.push_back( { origin.at(0) * BLOCK_SIZE + (bit & (BLOCK_SIZE - 1)),
+                        origin.at(1) * BLOCK_SIZE + (bit >> BLOCK_BITS),
+                        origin.at(2) * BLOCK_SIZE + layer } );
+    word &= word - 1;   // Clear the lowest set bit
+  }
+}
+
+// OccupancyGrid ///////////////////////////////////////////////////////////////////////////////////////////////////
+// The distance from lattice point p to the cell [p+o, p+o+1) along one axis is
+//   o      when the cell lies after p (o > 0)
+//   -o-1   when it lies before p (o < -1)
+//   0      when p is on the cell (o = -1 or o = 0)
+static int gap(int o)
+{
+  return std::max(0, std::max(o, -o - 1));
+}
+
+OccupancyGrid::OccupancyGrid(double radius, ThreadPool *pool)
+  : radius(radius)
+  , reach((int)std::floor(radius))
+  , pool(pool)
+{
+  for(int z = -1 - reach; z <= reach; z++) {
+    for(int y = -1 - reach; y <= reach; y++) {
+      for(int x = -1 - reach; x <= reach; x++) {
+        int gx = gap(x);
+        int gy = gap(y);
+        int gz = gap(z);
+        if ((double)(gx*gx + gy*gy + gz*gz) <= radius * radius) {
+          stencil.push_back( {x, y, z} );
+        }
+      }
+    }
+  }
+}
+
+void OccupancyGrid::clear()
+{
+  raw.clear();
+  inflated.clear();
+}
+
+void OccupancyGrid::update(const std::vector< std::array<int, 3> > &occupied_cells,
+                           std::vector< std::array<int, 3> > &changed_points)
+{
+  SparseBitmap new_raw;
+  for(auto &cell : occupied_cells) {
+    new_raw.set(cell.at(0), cell.at(1), cell.at(2));
+  }
+
+  std::vector< std::array<int, 3> > flipped;
+  new_raw.difference(raw, flipped);
+  raw.swap(new_raw);
+  if (flipped.empty()) return;
+
+  if (inflated.empty() || (flipped.size() * 2 > occupied_cells.size())) {
+    // Most of the map is new.  Dilating everything is cheaper than patching.
+    SparseBitmap new_inflated;
+    dilate(new_inflated);
+    new_inflated.difference(inflated, changed_points);
+    inflated.swap(new_inflated);
+    return;
+  }
+
+  patch(flipped, changed_points);
+}
+
+void OccupancyGrid::update(const std::array<int, 3> &min_cell, const std::array<int, 3> &max_cell,
+                           const std::vector< std::array<int, 3> > &occupied_cells,
+                           std::vector< std::array<int, 3> > &changed_points)
+{
+  SparseBitmap region;
+  for(auto &cell : occupied_cells) {
+    region.set(cell.at(0), cell.at(1), cell.at(2));
+  }
+
+  // Only the cells in the box are compared, so the cells of region outside it do not count
+  std::vector< std::array<int, 3> > flipped;
+  region.difference(raw, min_cell, max_cell, flipped);
+  if (flipped.empty()) return;
+  for(auto &cell : flipped) {
+    if (region.test(cell.at(0), cell.at(1), cell.at(2))) {
+      raw.set(cell.at(0), cell.at(1), cell.at(2));
+    } else {
+      raw.reset(cell.at(0), cell.at(1), cell.at(2));
+    }
+  }
+
+  if (inflated.empty()) {
+    dilate(inflated);
+    inflated.getPoints(changed_points);
+    return;
+  }
+  patch(flipped, changed_points);
+}
+
+// Test again the lattice points that can see a flipped cell
+void OccupancyGrid::patch(const std::vector< std::array<int, 3> > &flipped,
+                          std::vector< std::array<int, 3> > &changed_points)
+{
+  std::unordered_set<uint64_t> dirty;
+  for(auto &cell : flipped) {
+    for(auto &o : stencil) {
+      dirty.insert( mortonCode(cell.at(0) - o.at(0), cell.at(1) - o.at(1), cell.at(2) - o.at(2)) );
+    }
+  }
+
+  std::array<int, 3> p;
+  for(auto code : dirty) {
+    mortonDecode(code, p);
+    bool occupied = touchesOccupiedCell(p.at(0), p.at(1), p.at(2));
+    if (occupied == inflated.test(p.at(0), p.at(1), p.at(2))) continue;
+
+    if (occupied) {
+      inflated.set(p.at(0), p.at(1), p.at(2));
+    } else {
+      inflated.reset(p.at(0), p.at(1), p.at(2));
+    }
+    changed_points.push_back(p);
+  }
+}
+
+bool OccupancyGrid::save(const std::string &filename, uint64_t stamp) const
+{
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  if (!out) return false;
+  out.write(GRID_MAGIC, sizeof(GRID_MAGIC));
+  out.write(reinterpret_cast<const char *>(&stamp), sizeof(stamp));
+  out.write(reinterpret_cast<const char *>(&radius), sizeof(radius));
+  raw.write(out);
+  inflated.write(out);
+  return (bool)out;
+}
+
+bool OccupancyGrid::load(const std::string &filename, uint64_t stamp)
+{
+  MappedFile file(filename);
+  if (!file) return false;
+  const char *data = file.data();
+  const char *end = data + file.size();
+
+  uint64_t file_stamp;
+  double file_radius;
+  size_t header = sizeof(GRID_MAGIC) + sizeof(file_stamp) + sizeof(file_radius);
+  if (file.size() < header || std::memcmp(data, GRID_MAGIC, sizeof(GRID_MAGIC)) != 0) return false;
+  std::memcpy(&file_stamp, data + sizeof(GRID_MAGIC), sizeof(file_stamp));
+  std::memcpy(&file_radius, data + sizeof(GRID_MAGIC) + sizeof(file_stamp), sizeof(file_radius));
+  if ((file_stamp != stamp) || (file_radius != radius)) return false;   // Built from another map, or for another drone
+  data += header;
+
+  SparseBitmap new_raw, new_inflated;
+  if (!new_raw.read(data, end) || !new_inflated.read(data, end)) return false;
+  raw.swap(new_raw);
+  inflated.swap(new_inflated);
+  return true;
+}
+
+bool OccupancyGrid::touchesOccupiedCell(int x, int y, int z) const
+{
+  for(auto &o : stencil) {
+    if (raw.test(x + o.at(0), y + o.at(1), z + o.at(2))) return true;
+  }
+  return false;
+}
+
+void OccupancyGrid::dilate(SparseBitmap &result) const
+{
+  // The blocks of the result that can hold a set bit: those within reach of a raw block
+  std::vector< std::array<int, 3> > raw_blocks;
+  raw.getBlocks(raw_blocks);
+
+  int block_reach = (reach + 1 + SparseBitmap::BLOCK_SIZE - 1) / SparseBitmap::BLOCK_SIZE;
+  std::unordered_set<uint64_t> keys;
+  for(auto &block : raw_blocks) {
+    for(int z = -block_reach; z <= block_reach; z++) {
+      for(int y = -block_reach; y <= block_reach; y++) {
+        for(int x = -block_reach; x <= block_reach; x++) {
+          keys.insert( mortonCode(block.at(0) + x, block.at(1) + y, block.at(2) + z) );
+        }
+      }
+    }
+  }
+
+  std::vector< std::array<int, 3> > blocks;
+  blocks.reserve(keys.size());
+  std::array<int, 3> block;
+  for(auto key : keys) {
+    mortonDecode(key, block);
+    blocks.push_back(block);
+  }
+
+  // Every block only reads the raw layer, so they can be done in parallel
+  std::vector<SparseBitmap::Block> results(blocks.size());
+  auto work = [&](size_t i) { dilateBlock(blocks[i], results[i]); };
+  if (pool != nullptr) {
+    pool->parallelFor(blocks.size(), work);
+  } else {
+    for(size_t i = 0; i < blocks.size(); i++) work(i);
+  }
+
+  for(size_t i = 0; i < blocks.size(); i++) {
+    bool any = false;
+    for(auto word : results[i]) any |= (word != 0);
+    if (any) {
+      result.setBlock(blocks[i].at(0), blocks[i].at(1), blocks[i].at(2), results[i]);
+    }
+  }
+}
+
+void OccupancyGrid::dilateBlock(const std::array<int, 3> &block, SparseBitmap::Block &result) const
+{
+  // Squared distance, in the gap metric above, from every point of the block to the nearest raw
+  // cell.  Computed as three 1D min-convolutions, one per axis, over a window of the offsets
+  // -1-reach .. reach.  The raw cells are read from the block and a halo of reach+1 around it.
+  const int N = SparseBitmap::BLOCK_SIZE;
+  const int lo = -1 - reach;             // First offset
+  const int W = 2 * reach + 2;           // Window: offsets lo .. reach
+  const int E = N + W - 1;               // Block plus halo
+  const int FAR = std::numeric_limits<int>::max() / 4;
+
+  std::vector<int> g2(W);
+  for(int i = 0; i < W; i++) {
+    g2[i] = gap(lo + i) * gap(lo + i);
+  }
+
+  const int x0 = block.at(0) * N + lo;
+  const int y0 = block.at(1) * N + lo;
+  const int z0 = block.at(2) * N + lo;
+
+  // Pass z: nearest raw cell along z, for every column of the halo and every z of the block
+  std::vector<int> dz(E * E * N, FAR);
+  for(int x = 0; x < E; x++) {
+    for(int y = 0; y < E; y++) {
+      int px = x0 + x, py = y0 + y;
+      const SparseBitmap::Block *column = nullptr;
+      int column_bz = std::numeric_limits<int>::min();
+      for(int cz = 0; cz < E; cz++) {
+        int pz = z0 + cz;
+        int bz = pz >> SparseBitmap::BLOCK_BITS;
+        if (bz != column_bz) {
+          column = raw.findBlock(px >> SparseBitmap::BLOCK_BITS, py >> SparseBitmap::BLOCK_BITS, bz);
+          column_bz = bz;
+        }
+        if (column == nullptr) continue;
+        int bit = (px & (N - 1)) | ((py & (N - 1)) << SparseBitmap::BLOCK_BITS);
+        if (!(((*column)[pz & (N - 1)] >> bit) & 1)) continue;
+
+        // Raw cell at halo index cz.  It is at offset cz - z for the block point z.
+        for(int z = std::max(0, cz - W + 1); z <= std::min(N - 1, cz); z++) {
+          int &d = dz[(x * E + y) * N + z];
+          d = std::min(d, g2[cz - z]);
+        }
+      }
+    }
+  }
+
+  // Pass y
+  std::vector<int> dy(E * N * N, FAR);
+  for(int x = 0; x < E; x++) {
+    for(int y = 0; y < N; y++) {
+      for(int z = 0; z < N; z++) {
+        int best = FAR;
+        for(int o = 0; o < W; o++) {
+          best = std::min(best, dz[(x * E + y + o) * N + z] + g2[o]);
+        }
+        dy[(x * N + y) * N + z] = best;
+      }
+    }
+  }
+
+  // Pass x, and threshold on the radius
+  double r2 = radius * radius;
+  result.fill(0);
+  for(int x = 0; x < N; x++) {
+    for(int y = 0; y < N; y++) {
+      for(int z = 0; z < N; z++) {
+        int best = FAR;
+        for(int o = 0; o < W; o++) {
+          best = std::min(best, dy[((x + o) * N + y) * N + z] + g2[o]);
+        }
+        if ((double)best <= r2) {
+          result[z] |= (uint64_t)1 << (x | (y << SparseBitmap::BLOCK_BITS));
+        }
+      }
+    }
+  }
+}
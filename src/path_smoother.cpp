@@ -0,0 +1,169 @@
+// Copyright (c) 2021 Xeni Robotics
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* **********************************************************************
+ * Shortcutting and smoothing of planned paths.  See path_smoother.h
+ * ***********************************************************************/
+
+#include <cmath>          // std::floor, std::sqrt, std::ceil
+#include <algorithm>      // std::max
+
+#include "navigation_lite/path_smoother.h"
+
+static const double SAMPLE_STEP = 0.25;     // Along a segment, in cells
+static const double COLLINEAR_EPSILON = 1e-6;
+
+PathSmoother::PathSmoother(const OccupancyGrid *grid, int min_z, int max_z)
+  : grid(grid)
+  , min_z(min_z)
+  , max_z(max_z)
+{ }
+
+void PathSmoother::smooth(const Point &start, std::vector<Point> &path, double spline_spacing) const
+{
+  if (path.empty()) return;
+
+  std::vector<Point> points;
+  points.reserve(path.size() + 1);
+  points.push_back(start);
+  points.insert(points.end(), path.begin(), path.end());
+
+  shortcut(points);
+  pruneCollinear(points);
+  if (spline_spacing > 0) {
+    resample(points, spline_spacing);
+  }
+
+  path.assign(points.begin() + 1, points.end());
+}
+
+bool PathSmoother::isCellFree(int x, int y, int z) const
+{
+  for(int dz = 0; dz <= 1; dz++) {
+    if ((z + dz < min_z) || (z + dz >= max_z)) return false;
+    for(int dy = 0; dy <= 1; dy++) {
+      for(int dx = 0; dx <= 1; dx++) {
+        if (grid->isOccupied(x + dx, y + dy, z + dz)) return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool PathSmoother::lineOfSight(const Point &from, const Point &to) const
+{
+  double d[3] = { to[0] - from[0], to[1] - from[1], to[2] - from[2] };
+  double length = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+  int steps = std::max(1, (int)std::ceil(length / SAMPLE_STEP));
+
+  // A waypoint on a lattice point lies on the corner of up to eight cells.  Stepping inwards by a
+  // hair puts the ends in the cells the segment actually passes through.
+  int last[3] = { 0, 0, 0 };
+  bool first = true;
+  for(int i = 0; i <= steps; i++) {
+    double t = std::min(std::max((double)i / steps, 1e-6), 1.0 - 1e-6);
+    int cell[3];
+    for(int a = 0; a < 3; a++) {
+      cell[a] = (int)std::floor(from[a] + t * d[a]);
+    }
+    if (!first && (cell[0] == last[0]) && (cell[1] == last[1]) && (cell[2] == last[2])) continue;
+    if (!isCellFree(cell[0], cell[1], cell[2])) return false;
+    for(int a = 0; a < 3; a++) last[a] = cell[a];
+    first = false;
+  }
+  return true;
+}
+
+void PathSmoother::shortcut(std::vector<Point> &points) const
+{
+  std::vector<Point> kept;
+  kept.push_back(points.front());
+
+  size_t anchor = 0;
+  while (anchor < points.size() - 1) {
+    // Extend while in sight.  The next step of the path is always kept, as the planner found it free.
+    size_t next = anchor + 1;
+    while ((next + 1 < points.size()) && lineOfSight(points[anchor], points[next + 1])) {
+      next++;
+    }
+    kept.push_back(points[next]);
+    anchor = next;
+  }
+  points.swap(kept);
+}
+
+void PathSmoother::pruneCollinear(std::vector<Point> &points) const
+{
+  if (points.size() < 3) return;
+
+  std::vector<Point> kept;
+  kept.push_back(points.front());
+  for(size_t i = 1; i + 1 < points.size(); i++) {
+    const Point &a = kept.back();
+    const Point &b = points[i];
+    const Point &c = points[i + 1];
+    double u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+    double v[3] = { c[0] - b[0], c[1] - b[1], c[2] - b[2] };
+    double cross[3] = { u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0] };
+    double dot = u[0] * v[0] + u[1] * v[1] + u[2] * v[2];
+    bool collinear = (cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2] < COLLINEAR_EPSILON) && (dot > 0);
+    if (!collinear) {
+      kept.push_back(b);
+    }
+  }
+  kept.push_back(points.back());
+  points.swap(kept);
+}
+
+void PathSmoother::resample(std::vector<Point> &points, double spacing) const
+{
+  if (points.size() < 3) return;   // A straight line is as smooth as it gets
+
+  std::vector<Point> samples;
+  samples.push_back(points.front());
+  for(size_t k = 0; k + 1 < points.size(); k++) {
+    const Point &p0 = points[k > 0 ? k - 1 : k];
+    const Point &p1 = points[k];
+    const Point &p2 = points[k + 1];
+    const Point &p3 = points[k + 2 < points.size() ? k + 2 : k + 1];
+
+    double dx = p2[0] - p1[0], dy = p2[1] - p1[1], dz = p2[2] - p1[2];
+    int count = std::max(1, (int)std::ceil(std::sqrt(dx * dx + dy * dy + dz * dz) / spacing));
+
+    // Uniform Catmull-Rom between p1 and p2
+    std::vector<Point> span;
+    for(int i = 1; i <= count; i++) {
+      double t = (double)i / count, t2 = t * t, t3 = t2 * t;
+      Point q;
+      for(int a = 0; a < 3; a++) {
+        q[a] = 0.5 * ((2 * p1[a]) + (-p0[a] + p2[a]) * t + (2 * p0[a] - 5 * p1[a] + 4 * p2[a] - p3[a]) * t2 +
+                      (-p0[a] + 3 * p1[a] - 3 * p2[a] + p3[a]) * t3);
+      }
+      span.push_back(q);
+    }
+
+    bool clear = true;
+    Point previous = p1;
+    for(auto &q : span) {
+      clear = clear && lineOfSight(previous, q);
+      previous = q;
+    }
+    if (clear) {
+      samples.insert(samples.end(), span.begin(), span.end());
+    } else {
+      samples.push_back(p2);
+    }
+  }
+  points.swap(samples);
+}
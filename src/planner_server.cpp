@@ -13,7 +13,8 @@
 // limitations under the License.
 
 /* **********************************************************************
- * Action Server responding to navgation_interfaces/action/ComputePathToPose
+ * Action Server responding to navigation_lite/action/ComputePathToPose, the
+ *   action of navigation_interfaces with the suboptimality bound as feedback,
  *   called only by the Navigation Server
  * Subscribe to map server [navigation_interfaces/msg/ufo_map_stamped] to 
  *   receive a maintained octree global map.
@@ -27,13 +28,20 @@
 #include <chrono>
 #include <string>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <array>
+#include <cmath>
+#include <algorithm>
 
 #include "builtin_interfaces/msg/duration.hpp"
 #include "geometry_msgs/msg/pose_stamped.hpp"
 #include "nav_msgs/msg/path.hpp"
 
-#include "navigation_interfaces/action/compute_path_to_pose.hpp"
 #include "navigation_interfaces/msg/ufo_map_stamped.hpp"
+#include "navigation_lite/action/compute_path_to_pose.hpp"
+#include "navigation_lite/action/compute_path_through_poses.hpp"
 
 #include "drone_interfaces/srv/offboard.hpp"
 
@@ -44,6 +52,13 @@
 #include "navigation_lite/visibility_control.h"
 #include "navigation_lite/ufomap_ros_msgs_conversions.h"
 #include "navigation_lite/d_star_lite.h"
+#include "navigation_lite/occupancy_grid.h"
+#include "navigation_lite/path_smoother.h"
+#include "navigation_lite/thread_pool.hpp"
+#include "navigation_lite/map_buffer.h"
+#include "navigation_lite/map_snapshot.h"
+#include "navigation_lite/mapped_file.hpp"
+#include "navigation_lite/pose_cache.h"
 
 #include <tf2/exceptions.h>
 #include <tf2_ros/transform_listener.h>
@@ -59,8 +74,10 @@ namespace navigation_lite
 class PlannerServer : public rclcpp::Node
 {
 public:
-  using ComputePathToPose = navigation_interfaces::action::ComputePathToPose;
+  using ComputePathToPose = navigation_lite::action::ComputePathToPose;
   using GoalHandleComputePathToPose = rclcpp_action::ServerGoalHandle<ComputePathToPose>;
+  using ComputePathThroughPoses = navigation_lite::action::ComputePathThroughPoses;
+  using GoalHandleComputePathThroughPoses = rclcpp_action::ServerGoalHandle<ComputePathThroughPoses>;
 
   NAVIGATION_LITE_PUBLIC
   explicit PlannerServer(const rclcpp::NodeOptions & options = rclcpp::NodeOptions())
@@ -75,82 +92,348 @@ public:
       std::make_unique<tf2_ros::Buffer>(this->get_clock());
     transform_listener_ =
       std::make_shared<tf2_ros::TransformListener>(*tf_buffer_);
+    // Map messages, TF polling and goal callbacks each get a callback group, so on a multi-threaded
+    // executor a map message does not wait behind TF.  Plans are searched on a fixed set of workers.
+    map_group_ = this->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+    tf_group_ = this->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+    action_group_ = this->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+    int goal_threads = this->declare_parameter<int>("goal_threads", 2);
+    goal_pool_ = std::make_unique<ThreadPool>(std::max(1, goal_threads));
+
+    // The robot pose, polled from TF once per tick instead of looked up on every read
+    pose_cache_ = std::make_unique<PoseCache>(*this, *tf_buffer_, map_frame_, "base_link_ned", 50.0, tf_group_);
     
-    subscription_ = this->create_subscription<navigation_interfaces::msg::UfoMapStamped>(
-      "nav_lite/map", 10, std::bind(&PlannerServer::topic_callback, this, _1));
-     
     this->planning_action_server_ = rclcpp_action::create_server<ComputePathToPose>(
       this,
       "nav_lite/compute_path_to_pose",
       std::bind(&PlannerServer::handle_plan_goal, this, _1, _2),
       std::bind(&PlannerServer::handle_plan_cancel, this, _1),
-      std::bind(&PlannerServer::handle_plan_accepted, this, _1));
-      
-    // Build a UFO map
-    double resolution;   
-    resolution = this->declare_parameter<double>("map_resolution", 0.25);   // use resolution 0.25.  Can then query the map at 0.5 and 1.0
-    map_ = std::make_shared<ufo::map::OccupancyMap>(resolution); 
+      std::bind(&PlannerServer::handle_plan_accepted, this, _1),
+      rcl_action_server_get_default_options(),
+      action_group_);
 
+    // Multi-goal missions: every leg is searched at the same time, on a search of its own
+    this->batch_action_server_ = rclcpp_action::create_server<ComputePathThroughPoses>(
+      this,
+      "nav_lite/compute_path_through_poses",
+      std::bind(&PlannerServer::handle_batch_goal, this, _1, _2),
+      std::bind(&PlannerServer::handle_batch_cancel, this, _1),
+      std::bind(&PlannerServer::handle_batch_accepted, this, _1),
+      rcl_action_server_get_default_options(),
+      action_group_);
+      
     drone_diameter_ = this->declare_parameter<double>("drone_diameter", 0.80);   // 800 mm for my current craft.
-    e_size_ = this->declare_parameter<int>("e_w_size", 500);
-    n_size_ = this->declare_parameter<int>("n_s_size", 500);
+    // The cost map is sparse.  The search is limited to the box around start and goal grown by
+    // search_margin in east and north, and to 0 <= z < u_size.
+    search_margin_ = this->declare_parameter<int>("search_margin", 50);
     u_size_ = this->declare_parameter<int>("u_size", 10);
     
-    dsl = new DStarLite(e_size_, n_size_, u_size_);
+    // Neighbors of a node: 6 (faces only), 18 (faces and edges) or 26 (the full cube)
+    int connectivity = this->declare_parameter<int>("connectivity", 26);
+    dsl = makeDStarLite(connectivity, search_margin_, 0, u_size_);
+    if (!dsl) {
+      RCLCPP_WARN(this->get_logger(), "Connectivity must be 6, 18 or 26, not %i.  Using 26.", connectivity);
+      connectivity = 26;
+      dsl = makeDStarLite(connectivity, search_margin_, 0, u_size_);
+    }
+    connectivity_ = connectivity;
+    // Expansions between checks for a newer goal or a cancel
+    search_check_interval_ = std::max(1, (int)this->declare_parameter<int>("search_check_interval", 256));
+    // Anytime planning.  With a budget (seconds, 0 for none) the search starts with the heuristic
+    // inflated by heuristic_weight, and lowers the weight by heuristic_weight_step after every
+    // path found, until the weight is 1 or the budget runs out.  The last path found is returned.
+    planning_time_budget_ = this->declare_parameter<double>("planning_time_budget", 0.0);
+    heuristic_weight_ = std::max(1.0, this->declare_parameter<double>("heuristic_weight", 2.5));
+    heuristic_weight_step_ = std::max(0.01, this->declare_parameter<double>("heuristic_weight_step", 0.5));
     
-    // Set the lookup function to check the UFO map for occupancy
-    auto fn = bind( &PlannerServer::isOccupied, this, _1, _2, _3 );
-    dsl->setTestFunction( fn );
+    // The planner tests occupancy against the inflated grid, maintained from the UFO map.  A full
+    // rebuild of the grid (after a map load or reset) is shared out over a pool of workers.
+    int threads = this->declare_parameter<int>("planner_threads", 0);   // 0: one per core
+    if (threads <= 0) {
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    worker_pool_ = std::make_unique<ThreadPool>(threads - 1);   // The calling thread also works
+    grid_ = std::make_unique<OccupancyGrid>(drone_diameter_ / 2, worker_pool_.get());
+    dsl->setOccupancyGrid( grid_.get() );
+
+    // Hierarchical planning.  A first search runs on the occupancy of the map at coarse_depth
+    // (2^(coarse_depth-2) m cells at the 0.25 m resolution).  The planning search is then limited
+    // to the coarse cells within corridor_width of the coarse path.  If there is no path in the
+    // corridor, the whole search area is searched after all.
+    hierarchical_planning_ = this->declare_parameter<bool>("hierarchical_planning", false);
+    coarse_depth_ = std::max(3, (int)this->declare_parameter<int>("coarse_depth", 4));
+    corridor_width_ = std::max(1, (int)this->declare_parameter<int>("corridor_width", 1));
+    coarse_scale_ = 1 << (coarse_depth_ - 2);
+    if (hierarchical_planning_) {
+      coarse_grid_ = std::make_unique<OccupancyGrid>(drone_diameter_ / 2 / coarse_scale_);
+      coarse_dsl_ = makeDStarLite(connectivity, search_margin_ / coarse_scale_ + 1,
+                                  0, (u_size_ + coarse_scale_ - 1) / coarse_scale_);
+      coarse_dsl_->setOccupancyGrid( coarse_grid_.get() );
+    }
+
+    // Shortcut the path on the grid and drop the waypoints on straight lines.  With a spacing > 0,
+    // the corners are smoothed out with a spline sampled at that spacing (m).
+    smooth_path_ = this->declare_parameter<bool>("smooth_path", true);
+    spline_spacing_ = this->declare_parameter<double>("path_spline_spacing", 0.0);
+    smoother_ = std::make_unique<PathSmoother>(grid_.get(), 0, u_size_);
+
+    // Build a UFO map.  Maps are decoded off the executor, and the occupancy grid is brought up to
+    // date on the same background thread.
+    double resolution;   
+    resolution = this->declare_parameter<double>("map_resolution", 0.25);   // use resolution 0.25.  Can then query the map at 0.5 and 1.0
+    // With use_shared_map, the map server runs in the same component container and its map is
+    // read in place.  Otherwise subscribe to the map at the depth this node queries, see
+    // publish_depths of the map server.
+    bool use_shared_map = this->declare_parameter<bool>("use_shared_map", false);
+    // With a map snapshot, the occupancy grids are ready before the first map arrives
+    std::string map_snapshot_file = this->declare_parameter<std::string>("map_snapshot_file", "");
+    if (!map_snapshot_file.empty()) {
+      warmStart(map_snapshot_file, resolution);
+    }
+    map_ = std::make_unique<MapBuffer>(resolution, this->get_logger(),
+      std::bind(&PlannerServer::updateOccupancyGrid, this, _1), use_shared_map);
+    if (!use_shared_map) {
+      std::string map_topic = this->declare_parameter<std::string>("map_topic", "nav_lite/map");
+      rclcpp::SubscriptionOptions map_options;
+      map_options.callback_group = map_group_;
+      subscription_ = this->create_subscription<navigation_interfaces::msg::UfoMapStamped>(
+        map_topic, 10, std::bind(&PlannerServer::topic_callback, this, _1), map_options);
+    }
     
-    RCLCPP_INFO(this->get_logger(), "Action Server [nav_lite/compute_path_to_pose] started");
+    RCLCPP_INFO(this->get_logger(), "Action Servers [nav_lite/compute_path_to_pose] and [nav_lite/compute_path_through_poses] started");
   }
 
 private:
   rclcpp_action::Server<ComputePathToPose>::SharedPtr planning_action_server_;
-  std::shared_ptr<ufo::map::OccupancyMap> map_;
+  rclcpp_action::Server<ComputePathThroughPoses>::SharedPtr batch_action_server_;
   std::string map_frame_;
   std::shared_ptr<tf2_ros::TransformListener> transform_listener_{nullptr};
   std::unique_ptr<tf2_ros::Buffer> tf_buffer_;
+  std::unique_ptr<PoseCache> pose_cache_;
+  rclcpp::CallbackGroup::SharedPtr map_group_;
+  rclcpp::CallbackGroup::SharedPtr tf_group_;
+  rclcpp::CallbackGroup::SharedPtr action_group_;
   double drone_diameter_;
-  DStarLite *dsl;
-  int e_size_, n_size_, u_size_;
+  std::unique_ptr<PathSearch> dsl;
+  int search_margin_, u_size_;
+  int connectivity_;
+  int search_check_interval_;
+  double planning_time_budget_, heuristic_weight_, heuristic_weight_step_;
   bool bypass_planning_;
+  std::mutex planner_mutex_;
+  // Planning is single flight: every accepted goal takes a new number, and a search for an older
+  // number stops at its next interrupt check.  Only the newest goal gets a path.
+  std::atomic<uint64_t> latest_goal_{0};
+
+  // Inflated occupancy of the planning nodes, and the nodes whose occupancy changed since the last
+  // plan.  Filled by the map subscription, consumed by execute_plan.  Both under planner_mutex_.
+  std::unique_ptr<ThreadPool> worker_pool_;
+  std::unique_ptr<OccupancyGrid> grid_;
+  std::vector< std::array<int, 3> > changed_cells_;
+
+  // The coarse search of hierarchical planning, and the corridor it leaves for dsl.  All under
+  // planner_mutex_.
+  bool hierarchical_planning_;
+  int coarse_depth_, corridor_width_, coarse_scale_;
+  std::unique_ptr<OccupancyGrid> coarse_grid_;
+  std::unique_ptr<PathSearch> coarse_dsl_;
+  SparseBitmap corridor_;
+  bool corridor_active_ = false;
+
+  bool smooth_path_;
+  double spline_spacing_;
+  std::unique_ptr<PathSmoother> smoother_;   // On grid_, under planner_mutex_
+  std::unique_ptr<MapBuffer> map_;     // After the grid, so its decoder thread stops first
   
   bool read_position(float *x, float *y, float *z)
   {  
-    std::string from_frame = "base_link_ned"; 
-    std::string to_frame = map_frame_.c_str();
-      
     geometry_msgs::msg::TransformStamped transformStamped;
     
     // Look up for the transformation between map and base_link_ned frames
     // and returns the last position in the 'map' frame
-    try {
-      transformStamped = tf_buffer_->lookupTransform(
-        to_frame, from_frame,
-        tf2::TimePointZero);
-        *x = transformStamped.transform.translation.x;
-        *y = transformStamped.transform.translation.y;
-        *z = transformStamped.transform.translation.z;
-    } catch (tf2::TransformException & ex) {
+    if (!pose_cache_->latest(transformStamped)) {
       RCLCPP_DEBUG(
-        this->get_logger(), "Could not transform %s to %s: %s",
-        to_frame.c_str(), from_frame.c_str(), ex.what());
+        this->get_logger(), "No transform from %s to %s yet",
+        pose_cache_->sourceFrame().c_str(), pose_cache_->targetFrame().c_str());
       return false;  
     }
+    *x = transformStamped.transform.translation.x;
+    *y = transformStamped.transform.translation.y;
+    *z = transformStamped.transform.translation.z;
     return true;
   }
   
   // MAP SUBSCRIPTION ////////////////////////////////////////////////////////////////////////////////////////////////
-  void topic_callback(const navigation_interfaces::msg::UfoMapStamped::SharedPtr msg) const
+  void topic_callback(const navigation_interfaces::msg::UfoMapStamped::SharedPtr msg)
   {
-    // Convert ROS message to a UFOmap
-    if (ufomap_msgs::msgToUfo(msg->map, map_)) {
-      RCLCPP_DEBUG(this->get_logger(), "UFO Map Conversion successfull.");
+    // Decoded into a UFOmap on the map buffer thread
+    map_->submit(msg);
+  }
+
+  // One waypoint per grid step down to a few.  Called under planner_mutex_.
+  void smoothPath(float x, float y, float z, std::vector<geometry_msgs::msg::PoseStamped> &poses)
+  {
+    std::vector<PathSmoother::Point> points;
+    for (auto &pose : poses) {
+      points.push_back( {pose.pose.position.x, pose.pose.position.y, pose.pose.position.z} );
+    }
+    size_t steps = points.size();
+    smoother_->smooth( {x, y, z}, points, spline_spacing_ );
+    RCLCPP_DEBUG(this->get_logger(), "Path smoothed from %zu to %zu waypoints", steps, points.size());
+
+    geometry_msgs::msg::PoseStamped pose;
+    pose.header.frame_id = "map";
+    pose.pose.orientation.w = 1;   // Orientation is irrelevant, as the controller turns the drone
+    poses.clear();
+    for (auto &point : points) {
+      pose.pose.position.x = point.at(0);
+      pose.pose.position.y = point.at(1);
+      pose.pose.position.z = point.at(2);
+      poses.push_back(pose);
+    }
+  }
+
+  // Collect the unit cells holding an occupied leaf of the new map and bring the occupancy grid up
+  // to date.  After a delta, only the cells of the region it changed are collected and compared.
+  // The planning nodes whose occupancy flipped are queued for PathSearch::replan().
+  void updateOccupancyGrid(MapBuffer::Snapshot map)
+  {
+    ufo::math::Vector3 min_change, max_change;
+    bool partial = map.changedRegion(min_change, max_change);
+    std::array<int, 3> min_cell, max_cell, coarse_min_cell, coarse_max_cell;
+    std::vector< std::array<int, 3> > occupied;
+    std::vector< std::array<int, 3> > coarse_occupied;
+    if (partial) {
+      cellBox(min_change, max_change, 1.0, min_cell, max_cell);
+      collectOccupiedCells(map, 2, 1.0, min_cell, max_cell, occupied);
+      if (hierarchical_planning_) {
+        cellBox(min_change, max_change, coarse_scale_, coarse_min_cell, coarse_max_cell);
+        collectOccupiedCells(map, coarse_depth_, coarse_scale_, coarse_min_cell, coarse_max_cell, coarse_occupied);
+      }
+    } else {
+      collectOccupiedCells(map, 2, 1.0, occupied);   // Use resolution of 0->0.25m, 1->0.5m 2->1.0m
+      if (hierarchical_planning_) {
+        // An inner node of the octree is occupied when any of its children is
+        collectOccupiedCells(map, coarse_depth_, coarse_scale_, coarse_occupied);
+      }
+    }
+    map = MapBuffer::Snapshot();   // A shared map is read locked while held.  Let the map server on.
+
+    std::lock_guard<std::mutex> lock(planner_mutex_);
+    if (hierarchical_planning_) {
+      std::vector< std::array<int, 3> > unused;   // The coarse search starts afresh for every plan
+      if (partial) {
+        coarse_grid_->update(coarse_min_cell, coarse_max_cell, coarse_occupied, unused);
+      } else {
+        coarse_grid_->update(coarse_occupied, unused);
+      }
+    }
+    size_t queued = changed_cells_.size();
+    std::vector< std::array<int, 3> > unused;
+    auto &changed = dsl->isInitialized() ? changed_cells_ : unused;   // Without a search, nothing to repair
+    if (partial) {
+      grid_->update(min_cell, max_cell, occupied, changed);
     } else {
-      RCLCPP_WARN(this->get_logger(), "UFO Map Conversion failed.");
+      grid_->update(occupied, changed);
     }
+    RCLCPP_DEBUG(this->get_logger(), "%zu planning nodes changed occupancy%s", changed_cells_.size() - queued,
+      partial ? " in the changed region" : "");
   }
+
+  // Fill the occupancy grids from a map snapshot.  The planner layers stored beside the snapshot are
+  // read when they were built from this snapshot for this drone.  Only when one is missing is the
+  // snapshot parsed, and the missing layers built and stored.
+  void warmStart(const std::string &snapshot, double resolution)
+  {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t stamp = MappedFile::stamp(snapshot);
+    std::string layer = plannerLayerFile(snapshot);
+    std::string coarse_layer = plannerCoarseLayerFile(snapshot, coarse_depth_);
+    bool layer_read = (stamp != 0) && grid_->load(layer, stamp);
+    bool coarse_read = !hierarchical_planning_ || ((stamp != 0) && coarse_grid_->load(coarse_layer, stamp));
+
+    if (!layer_read || !coarse_read) {
+      auto map = std::make_shared<ufo::map::OccupancyMap>(resolution);
+      if (!readMapSnapshot(snapshot, *map)) {
+        RCLCPP_WARN(this->get_logger(), "Could not load the map snapshot [%s]", snapshot.c_str());
+        return;
+      }
+      MapBuffer::Snapshot snapshot_map(map);
+      std::vector< std::array<int, 3> > occupied, unused;   // No search to repair yet
+      if (!layer_read) {
+        collectOccupiedCells(snapshot_map, 2, 1.0, occupied);
+        grid_->update(occupied, unused);
+        if (!grid_->save(layer, stamp)) {
+          RCLCPP_WARN(this->get_logger(), "Could not store the planner layer in [%s]", layer.c_str());
+        }
+      }
+      if (!coarse_read) {
+        occupied.clear();
+        collectOccupiedCells(snapshot_map, coarse_depth_, coarse_scale_, occupied);
+        coarse_grid_->update(occupied, unused);
+        if (!coarse_grid_->save(coarse_layer, stamp)) {
+          RCLCPP_WARN(this->get_logger(), "Could not store the planner layer in [%s]", coarse_layer.c_str());
+        }
+      }
+    }
+    RCLCPP_INFO(this->get_logger(), "Occupancy grid from the map snapshot [%s] in %.1f ms (planner layers %s)",
+      snapshot.c_str(), std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(),
+      (layer_read && coarse_read) ? "read" : "built");
+  }
+
+  // The cells of cell_size (m) that hold an occupied node of the map at depth
+  void collectOccupiedCells(const MapBuffer::Snapshot &map, int depth, double cell_size,
+                            std::vector< std::array<int, 3> > &cells)
+  {
+    for (auto it = map->beginLeaves(true, false, false, false, depth),
+              it_end = map->endLeaves(); it != it_end; ++it) {
+      leafCells(it.getCenter(), it.getHalfSize(), cell_size, cells);
+    }
+  }
+
+  // The same, only for the leaves that overlap the cells from min_cell to max_cell.  A leaf can
+  // reach out of the box, so cells outside it can be among the cells collected.
+  void collectOccupiedCells(const MapBuffer::Snapshot &map, int depth, double cell_size,
+                            const std::array<int, 3> &min_cell, const std::array<int, 3> &max_cell,
+                            std::vector< std::array<int, 3> > &cells)
+  {
+    ufo::geometry::BoundingVolume bv;
+    bv.add(ufo::geometry::AABB(
+      ufo::math::Vector3(min_cell.at(0) * cell_size, min_cell.at(1) * cell_size, min_cell.at(2) * cell_size),
+      ufo::math::Vector3((max_cell.at(0) + 1) * cell_size, (max_cell.at(1) + 1) * cell_size, (max_cell.at(2) + 1) * cell_size)));
+    for (auto it = map->beginLeaves(bv, true, false, false, false, depth),
+              it_end = map->endLeaves(); it != it_end; ++it) {
+      leafCells(it.getCenter(), it.getHalfSize(), cell_size, cells);
+    }
+  }
+
+  // A leaf can be larger than a cell.  Mark all the cells it overlaps.
+  static void leafCells(const ufo::math::Vector3 &center, double half_size, double cell_size,
+                        std::vector< std::array<int, 3> > &cells)
+  {
+    int min_x = (int)std::floor((center.x() - half_size) / cell_size), max_x = (int)std::ceil((center.x() + half_size) / cell_size);
+    int min_y = (int)std::floor((center.y() - half_size) / cell_size), max_y = (int)std::ceil((center.y() + half_size) / cell_size);
+    int min_z = (int)std::floor((center.z() - half_size) / cell_size), max_z = (int)std::ceil((center.z() + half_size) / cell_size);
+    for (int z = min_z; z < max_z; z++) {
+      for (int y = min_y; y < max_y; y++) {
+        for (int x = min_x; x < max_x; x++) {
+          cells.push_back( {x, y, z} );
+        }
+      }
+    }
+  }
+
+  // The cells of cell_size (m) holding the box from min to max, and one more on every side, so the
+  // cells the box only grazes are compared as well
+  static void cellBox(const ufo::math::Vector3 &min, const ufo::math::Vector3 &max, double cell_size,
+                      std::array<int, 3> &min_cell, std::array<int, 3> &max_cell)
+  {
+    min_cell = { (int)std::floor(min.x() / cell_size) - 1, (int)std::floor(min.y() / cell_size) - 1,
+                 (int)std::floor(min.z() / cell_size) - 1 };
+    max_cell = { (int)std::floor(max.x() / cell_size) + 1, (int)std::floor(max.y() / cell_size) + 1,
+                 (int)std::floor(max.z() / cell_size) + 1 };
+  }
+
   rclcpp::Subscription<navigation_interfaces::msg::UfoMapStamped>::SharedPtr subscription_;
   
   // PLANNER ACTION SERVER ///////////////////////////////////////////////////////////////////////////////////////////
@@ -162,12 +445,11 @@ private:
     RCLCPP_DEBUG(this->get_logger(), "Received goal request for path to [%.2f;%.2f;%.2f]", goal->goal.pose.position.x, goal->goal.pose.position.y, goal->goal.pose.position.z);
     (void)uuid;
     
-    if ( ((goal->goal.pose.position.x < (-e_size_ / 2)) || (goal->goal.pose.position.x > (e_size_ / 2))) ||
-         ((goal->goal.pose.position.y < (-n_size_ / 2)) || (goal->goal.pose.position.y > (n_size_ / 2))) ||
-         ((goal->goal.pose.position.z < 0) || (goal->goal.pose.position.z > u_size_)) ) {
-      RCLCPP_ERROR(this->get_logger(), "Goal of [%.2f;%.2f;%.2f] is outside map range. [%i;%i;%i]", 
+    // There is no limit in east and north.  Only the altitude is bounded.
+    if ((goal->goal.pose.position.z < 0) || (goal->goal.pose.position.z >= u_size_)) {
+      RCLCPP_ERROR(this->get_logger(), "Goal of [%.2f;%.2f;%.2f] is outside altitude range. [0;%i]", 
         goal->goal.pose.position.x, goal->goal.pose.position.y, goal->goal.pose.position.z,
-        e_size_, n_size_, u_size_);
+        u_size_);
       return rclcpp_action::GoalResponse::REJECT;
     }     
     
@@ -184,11 +466,13 @@ private:
 
   void handle_plan_accepted(const std::shared_ptr<GoalHandleComputePathToPose> goal_handle)
   {
-    // this needs to return quickly to avoid blocking the executor, so spin up a new thread
-    std::thread{std::bind(&PlannerServer::execute_plan, this, _1), goal_handle}.detach();
+    // this needs to return quickly to avoid blocking the executor, so hand it to a worker.  The
+    // search running now, if any, gives way to this goal.
+    uint64_t goal_number = ++latest_goal_;
+    goal_pool_->enqueue([this, goal_handle, goal_number]() { execute_plan(goal_handle, goal_number); });
   }
 
-  void execute_plan(const std::shared_ptr<GoalHandleComputePathToPose> goal_handle)
+  void execute_plan(const std::shared_ptr<GoalHandleComputePathToPose> goal_handle, uint64_t goal_number)
   {
     RCLCPP_DEBUG(this->get_logger(), "Executing goal");
     rclcpp::Rate loop_rate(1);
@@ -218,25 +502,87 @@ private:
     } else {
         
       // # If false, use current robot pose as path start, if true, use start above instead
+      float x, y, z;
       if(goal->use_start == true) {
-        RCLCPP_DEBUG(this->get_logger(), "Planning a path from %.2f, %.2f, %.2f",
-          goal->start.pose.position.x, 
-          goal->start.pose.position.y, 
-          goal->start.pose.position.z);
-        dsl->setStart((int)goal->start.pose.position.x, (int)goal->start.pose.position.y, (int)goal->start.pose.position.z);  
+        x = goal->start.pose.position.x;
+        y = goal->start.pose.position.y;
+        z = goal->start.pose.position.z;
+        RCLCPP_DEBUG(this->get_logger(), "Planning a path from %.2f, %.2f, %.2f", x, y, z);
       } else {
         // use the current robot position.
-        float x, y, z;
-        read_position(&x, &y, &z);  // From tf2      
-        dsl->setStart(x, y, z);
+        if (!read_position(&x, &y, &z)) {  // From tf2
+          RCLCPP_ERROR(this->get_logger(), "The robot position is unknown.  Cannot plan a path from it.");
+          if (rclcpp::ok()) {
+            goal_handle->abort(result);
+          }
+          return;
+        }
         RCLCPP_INFO(this->get_logger(), "Planning a path from %.2f, %.2f, %.2f", x, y, z);
       }
-   
-      dsl->setGoal((int)goal->goal.pose.position.x, (int)goal->goal.pose.position.y, (int)goal->goal.pose.position.z);    
-      dsl->initialize();   
-      dsl->computeShortestPath();
-    
-      dsl->extractPath(result->path.poses); 
+
+      std::lock_guard<std::mutex> lock(planner_mutex_);   // The search tree is kept between requests
+
+      // A newer goal, or a cancel, ends the search.  The partial search is kept for the next goal.
+      auto should_stop = [this, goal_handle, goal_number]() {
+        return (goal_number != latest_goal_.load()) || goal_handle->is_canceling() || !rclcpp::ok();
+      };
+      if (should_stop()) {
+        stop_plan(goal_handle, result);   // Superseded while waiting for the planner
+        return;
+      }
+      if (isBlocked("start", x, y, z) ||
+          isBlocked("goal", goal->goal.pose.position.x, goal->goal.pose.position.y, goal->goal.pose.position.z)) {
+        if (rclcpp::ok()) {
+          goal_handle->abort(result);
+        }
+        return;
+      }
+
+      // The navigation server asks for a new plan to the same goal every few seconds while the
+      // drone moves.  Then the search tree can be reused.  Only the start has moved, and the nodes
+      // that saw a change in the map have to be updated.
+      if ( dsl->isInitialized() &&
+           dsl->isGoal(goal->goal.pose.position.x, goal->goal.pose.position.y, goal->goal.pose.position.z) &&
+           dsl->inSearchArea(x, y, z) ) {
+        dsl->moveStart(x, y, z);
+        for (auto &cell : changed_cells_) {
+          dsl->replan(cell.at(0), cell.at(1), cell.at(2));
+        }
+        RCLCPP_DEBUG(this->get_logger(), "Repairing the search for %zu changed nodes", changed_cells_.size());
+      } else {
+        if (!planCorridor(x, y, z, goal->goal.pose.position.x, goal->goal.pose.position.y,
+                          goal->goal.pose.position.z, should_stop)) {
+          stop_plan(goal_handle, result);
+          return;
+        }
+        dsl->setStart(x, y, z);
+        dsl->setGoal(goal->goal.pose.position.x, goal->goal.pose.position.y, goal->goal.pose.position.z);
+        dsl->initialize();
+      }
+      changed_cells_.clear();
+
+      float bound;
+      if (!searchPath(*dsl, result->path.poses, should_stop, bound)) {
+        stop_plan(goal_handle, result);
+        return;
+      }
+      if (result->path.poses.empty() && corridor_active_ && !dsl->wasInterrupted()) {
+        // The corridor of the coarse path was too narrow.  Search the whole area.
+        RCLCPP_INFO(this->get_logger(), "No path inside the corridor.  Searching the whole area.");
+        corridor_active_ = false;
+        dsl->setCorridor(nullptr, 1);
+        dsl->initialize();
+        if (!searchPath(*dsl, result->path.poses, should_stop, bound)) {
+          stop_plan(goal_handle, result);
+          return;
+        }
+      }
+      auto feedback = std::make_shared<ComputePathToPose::Feedback>();
+      feedback->suboptimality_bound = bound;
+      goal_handle->publish_feedback(feedback);
+      if (smooth_path_) {
+        smoothPath(x, y, z, result->path.poses);
+      }
       if (result->path.poses.size() > 0) {
         // Overwrite the pose on the goal step
         result->path.poses.back().pose.orientation.x = goal->goal.pose.orientation.x;
@@ -255,38 +601,286 @@ private:
     }
   }
 
-  // MAPPING UTILITY FUNCTIONS //////////////////////////////////////////////////////////////////////
+  // True, with an error logged, when the cell of x, y, z is occupied or within the drone radius of
+  // an obstacle.  No path may start or end there: the search seeds the goal whatever its occupancy,
+  // and would return a path into the obstacle.  Called under planner_mutex_.
+  bool isBlocked(const char *what, double x, double y, double z)
+  {
+    if (!grid_->isOccupied((int)std::floor(x), (int)std::floor(y), (int)std::floor(z))) {
+      return false;
+    }
+    RCLCPP_ERROR(this->get_logger(), "The %s [%.2f;%.2f;%.2f] is inside an obstacle", what, x, y, z);
+    return true;
+  }
 
-  bool isOccupied(const float x, float y, float z)
+  // Plan on the coarse grid, and limit the next search of dsl to the corridor around the coarse
+  // path.  Without hierarchical planning, or without a coarse path, dsl searches the whole area.
+  // Returns false when should_stop ended the search.  Called under planner_mutex_.
+  bool planCorridor(float x, float y, float z, float goal_x, float goal_y, float goal_z,
+                    const PathSearch::InterruptCheck &should_stop)
   {
-    // Would it be better to see if the robot can travel between current position (tf_listener)
-    // and the target posiiton ina straight line.  Then the granularity of my d*lite algoritm and
-    // the UFO map changes a bit.
-    
-    // The robot's target position
-    ufo::math::Vector3 position((double)x, double(y), (double)z);
+    corridor_active_ = false;
+    dsl->setCorridor(nullptr, 1);
+    if (!hierarchical_planning_) return true;
 
-    // The robot's size (radius)
-    double radius = drone_diameter_ / 2;
+    const float scale = coarse_scale_;
+    coarse_dsl_->setHeuristicWeight(1.0);
+    coarse_dsl_->setStart(x / scale, y / scale, z / scale);
+    coarse_dsl_->setGoal(goal_x / scale, goal_y / scale, goal_z / scale);
+    coarse_dsl_->initialize();
+    int expansions = coarse_dsl_->computeShortestPath(should_stop, search_check_interval_);
+    if (coarse_dsl_->wasInterrupted()) return false;
 
-    // Sphere with center at position and radius radius.
-    ufo::geometry::Sphere sphere(position, radius);
+    std::vector<geometry_msgs::msg::PoseStamped> coarse_path;
+    coarse_dsl_->extractPath(coarse_path);
+    if (coarse_path.empty()) {
+      // The coarse cells are occupied when any part is.  Narrow passages may only show up fine.
+      RCLCPP_DEBUG(this->get_logger(), "No coarse path (%i nodes expanded).  Searching the whole area.", expansions);
+      return true;
+    }
 
-    // Check if the robot will be in collision with occupied space 
-    // at the finest map resolution.
+    // The coarse cells of the path, grown by the corridor width
+    std::vector< std::array<int, 3> > cells;
+    cells.push_back( {(int)std::floor(x / scale), (int)std::floor(y / scale), (int)std::floor(z / scale)} );
+    for (auto &pose : coarse_path) {
+      cells.push_back( {(int)pose.pose.position.x, (int)pose.pose.position.y, (int)pose.pose.position.z} );
+    }
+    corridor_.clear();
+    for (auto &cell : cells) {
+      for (int dz = -corridor_width_; dz <= corridor_width_; dz++) {
+        for (int dy = -corridor_width_; dy <= corridor_width_; dy++) {
+          for (int dx = -corridor_width_; dx <= corridor_width_; dx++) {
+            corridor_.set(cell.at(0) + dx, cell.at(1) + dy, cell.at(2) + dz);
+          }
+        }
+      }
+    }
+    dsl->setCorridor(&corridor_, coarse_scale_);
+    corridor_active_ = true;
+    RCLCPP_DEBUG(this->get_logger(), "Coarse path of %zu steps (%i nodes expanded)", coarse_path.size(), expansions);
+    return true;
+  }
 
-    // Iterate through all leaf nodes that intersects the bounding volume
-    for (auto it = map_->beginLeaves(sphere, true, 
-                                 false, false, false, 2),            // Use resolution of 0->0.25m, 1->0.5m 2->1.0m
-                                 it_end = map_->endLeaves(); it != it_end; ++it) {
-      // Is in collision since a leaf node intersects the bounding volume.
+  // Run the search, and extract the path.  Returns false when should_stop ended the search.
+  // Without a time budget the path is optimal.  With one, the search runs with a decreasing
+  // heuristic weight, and the path is the one found with the lowest weight inside the budget.
+  // No path is found if the budget runs out even before the first one.  bound is set to the
+  // suboptimality bound of the path found, 1 for an optimal path, 0 without a path.
+  bool searchPath(PathSearch &search, std::vector<geometry_msgs::msg::PoseStamped> &poses,
+                  const PathSearch::InterruptCheck &should_stop, float &bound)
+  {
+    bound = 0.0;
+    if (planning_time_budget_ <= 0.0) {
+      search.setHeuristicWeight(1.0);
+      int expansions = search.computeShortestPath(should_stop, search_check_interval_);
+      RCLCPP_DEBUG(this->get_logger(), "Path search expanded %i nodes", expansions);
+      if (search.wasInterrupted()) return false;
+      search.extractPath(poses);
+      bound = poses.empty() ? 0.0 : 1.0;
       return true;
     }
-    // No leaf node intersects the bounding volume.
-    return false;
-        
+
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                      std::chrono::duration<double>(planning_time_budget_));
+    bool out_of_time = false;
+    auto stop_or_deadline = [&should_stop, &out_of_time, deadline]() {
+      if (should_stop()) return true;
+      out_of_time = (std::chrono::steady_clock::now() >= deadline);
+      return out_of_time;
+    };
+
+    int expansions = 0;
+    float weight = heuristic_weight_;
+    while (true) {
+      search.setHeuristicWeight(weight);
+      expansions += search.computeShortestPath(stop_or_deadline, search_check_interval_);
+      if (search.wasInterrupted()) {
+        if (!out_of_time) return false;
+        break;                             // Keep the path of the last weight
+      }
+
+      poses.clear();
+      search.extractPath(poses);
+      bound = poses.empty() ? 0.0 : search.heuristicWeight();
+      if (poses.empty() || (bound <= 1.0)) {
+        break;                             // No path exists, or the path is optimal
+      }
+      weight = std::max(1.0, weight - heuristic_weight_step_);
+    }
+
+    if (poses.empty()) {
+      RCLCPP_WARN(this->get_logger(), "No path found in %.3f seconds (%i nodes expanded)",
+        planning_time_budget_, expansions);
+    } else {
+      RCLCPP_INFO(this->get_logger(), "Path found with a cost of at most %.2f times the optimal (%i nodes expanded)",
+        bound, expansions);
+    }
+    return true;
   }
-  
+
+  // BATCH PLANNER ACTION SERVER /////////////////////////////////////////////////////////////////////////////////////
+
+  rclcpp_action::GoalResponse handle_batch_goal(
+    const rclcpp_action::GoalUUID & uuid,
+    std::shared_ptr<const ComputePathThroughPoses::Goal> goal)
+  {
+    RCLCPP_DEBUG(this->get_logger(), "Received goal request for a path through %zu poses", goal->goals.size());
+    (void)uuid;
+
+    if (goal->goals.empty()) {
+      RCLCPP_ERROR(this->get_logger(), "Goal request without poses");
+      return rclcpp_action::GoalResponse::REJECT;
+    }
+    for (auto &pose : goal->goals) {
+      if ((pose.pose.position.z < 0) || (pose.pose.position.z >= u_size_)) {
+        RCLCPP_ERROR(this->get_logger(), "Goal of [%.2f;%.2f;%.2f] is outside altitude range. [0;%i]",
+          pose.pose.position.x, pose.pose.position.y, pose.pose.position.z, u_size_);
+        return rclcpp_action::GoalResponse::REJECT;
+      }
+    }
+
+    return rclcpp_action::GoalResponse::ACCEPT_AND_EXECUTE;
+  }
+
+  rclcpp_action::CancelResponse handle_batch_cancel(
+    const std::shared_ptr<GoalHandleComputePathThroughPoses> goal_handle)
+  {
+    RCLCPP_INFO(this->get_logger(), "Received request to cancel goal");
+    (void)goal_handle;
+    return rclcpp_action::CancelResponse::ACCEPT;
+  }
+
+  void handle_batch_accepted(const std::shared_ptr<GoalHandleComputePathThroughPoses> goal_handle)
+  {
+    // this needs to return quickly to avoid blocking the executor, so hand it to a worker
+    goal_pool_->enqueue([this, goal_handle]() { execute_batch(goal_handle); });
+  }
+
+  void execute_batch(const std::shared_ptr<GoalHandleComputePathThroughPoses> goal_handle)
+  {
+    RCLCPP_DEBUG(this->get_logger(), "Executing batch goal");
+    const auto goal = goal_handle->get_goal();
+    auto result = std::make_shared<ComputePathThroughPoses::Result>();
+    auto start_time = this->now();
+    result->path.header.frame_id = "map";
+
+    // The start of every leg: the start of the mission, then each goal but the last
+    std::vector< std::array<float, 3> > starts;
+    float x, y, z;
+    if (goal->use_start == true) {
+      x = goal->start.pose.position.x;
+      y = goal->start.pose.position.y;
+      z = goal->start.pose.position.z;
+    } else if (!read_position(&x, &y, &z)) {  // From tf2
+      RCLCPP_ERROR(this->get_logger(), "The robot position is unknown.  Cannot plan a path from it.");
+      if (rclcpp::ok()) {
+        goal_handle->abort(result);
+      }
+      return;
+    }
+    starts.push_back( {x, y, z} );
+    for (size_t i = 0; i + 1 < goal->goals.size(); i++) {
+      auto &p = goal->goals[i].pose.position;
+      starts.push_back( {(float)p.x, (float)p.y, (float)p.z} );
+    }
+    const size_t legs = goal->goals.size();
+    std::vector< std::vector<geometry_msgs::msg::PoseStamped> > leg_paths(legs);
+
+    if (bypass_planning_) {
+      RCLCPP_WARN(this->get_logger(), "Bypassing path planning.");
+      for (size_t i = 0; i < legs; i++) {
+        leg_paths[i].push_back(goal->goals[i]);
+      }
+    } else {
+      std::lock_guard<std::mutex> lock(planner_mutex_);   // The grid is not changed while the legs are planned
+      RCLCPP_INFO(this->get_logger(), "Planning a path through %zu poses from %.2f, %.2f, %.2f", legs, x, y, z);
+
+      bool blocked = isBlocked("start", x, y, z);
+      for (size_t i = 0; i < legs; i++) {
+        auto &target = goal->goals[i].pose.position;
+        blocked = isBlocked("goal", target.x, target.y, target.z) || blocked;
+      }
+      if (blocked) {
+        if (rclcpp::ok()) {
+          goal_handle->abort(result);
+        }
+        return;
+      }
+
+      // Every leg has a search of its own.  They only read the grid, so they can run side by side.
+      // The bound of every leg is sent as feedback as soon as the leg is planned.
+      auto should_stop = [goal_handle]() { return goal_handle->is_canceling() || !rclcpp::ok(); };
+      std::vector<char> stopped(legs, 0);
+      auto feedback = std::make_shared<ComputePathThroughPoses::Feedback>();
+      feedback->leg_bounds.assign(legs, 0.0);
+      std::mutex feedback_mutex;
+      worker_pool_->parallelFor(legs, [&](size_t i) {
+        auto search = makeDStarLite(connectivity_, search_margin_, 0, u_size_);
+        auto &target = goal->goals[i].pose.position;
+        search->setOccupancyGrid( grid_.get() );
+        search->setStart(starts[i].at(0), starts[i].at(1), starts[i].at(2));
+        search->setGoal(target.x, target.y, target.z);
+        search->initialize();
+        float bound;
+        if (!searchPath(*search, leg_paths[i], should_stop, bound)) {
+          stopped[i] = 1;
+          return;
+        }
+        std::lock_guard<std::mutex> lock(feedback_mutex);
+        feedback->leg_bounds[i] = bound;
+        feedback->suboptimality_bound = std::max(feedback->suboptimality_bound, bound);
+        goal_handle->publish_feedback(feedback);
+      });
+
+      if (std::find(stopped.begin(), stopped.end(), 1) != stopped.end()) {
+        stop_plan(goal_handle, result);
+        return;
+      }
+      for (size_t i = 0; i < legs; i++) {
+        if (leg_paths[i].empty()) {
+          RCLCPP_ERROR(this->get_logger(), "No path for leg %zu of %zu", i + 1, legs);
+          if (rclcpp::ok()) {
+            goal_handle->abort(result);
+          }
+          return;
+        }
+        if (smooth_path_) {
+          smoothPath(starts[i].at(0), starts[i].at(1), starts[i].at(2), leg_paths[i]);
+        }
+      }
+    }
+
+    // Join the legs.  The last pose of a leg turns the drone to the goal orientation.
+    for (size_t i = 0; i < legs; i++) {
+      leg_paths[i].back().pose.orientation = goal->goals[i].pose.orientation;
+      result->path.poses.insert(result->path.poses.end(), leg_paths[i].begin(), leg_paths[i].end());
+      result->leg_ends.push_back(result->path.poses.size() - 1);
+    }
+
+    if (rclcpp::ok()) {
+      result->planning_time = this->now() - start_time;
+      goal_handle->succeed(result);
+      RCLCPP_DEBUG(this->get_logger(), "Goal succeeded");
+    }
+  }
+
+  // End a goal whose search was stopped, without a path
+  template<class GoalHandleT, class ResultT>
+  void stop_plan(const std::shared_ptr<GoalHandleT> goal_handle, std::shared_ptr<ResultT> result)
+  {
+    if (!rclcpp::ok()) return;
+    if (goal_handle->is_canceling()) {
+      goal_handle->canceled(result);
+      RCLCPP_INFO(this->get_logger(), "Planning canceled");
+    } else {
+      goal_handle->abort(result);
+      RCLCPP_INFO(this->get_logger(), "Planning preempted by a newer goal");
+    }
+  }
+
+  std::unique_ptr<ThreadPool> goal_pool_;   // Last member: joined before the rest is destroyed
+
 };  // class PlannerServer
 
 }  // namespace navigation_lite
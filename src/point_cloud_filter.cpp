@@ -0,0 +1,65 @@
+// Copyright (c) 2021 Xeni Robotics
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* **********************************************************************
+ * Voxel grid downsampling of a point cloud, and removal of the robot
+ * from it.  See point_cloud_filter.h
+ * ***********************************************************************/
+
+#include <cmath>            // std::floor, std::abs
+#include <algorithm>        // std::remove_if
+
+#include "navigation_lite/point_cloud_filter.h"
+#include "navigation_lite/morton.h"
+
+VoxelFilter::VoxelFilter(double voxel_size)
+  : voxel_size(voxel_size)
+  , inverse_size(1.0 / voxel_size)
+{ }
+
+const ufo::map::PointCloudColor & VoxelFilter::filter(const ufo::map::PointCloudColor &cloud_in)
+{
+  seen.clear();                    // Keeps the buckets
+  seen.reserve(cloud_in.size());
+  cloud_out.clear();
+  cloud_out.reserve(cloud_in.size());
+
+  for(auto &point : cloud_in) {
+    uint64_t key = mortonCode( (int)std::floor(point[0] * inverse_size),
+                               (int)std::floor(point[1] * inverse_size),
+                               (int)std::floor(point[2] * inverse_size) );
+    if (seen.insert(key).second) {
+      cloud_out.push_back(point);
+    }
+  }
+  return cloud_out;
+}
+
+BodyFilter::BodyFilter(double radius, double height)
+  : radius_squared(radius * radius)
+  , half_height(height / 2.0)
+{ }
+
+size_t BodyFilter::filter(ufo::map::PointCloudColor &cloud, const ufo::math::Pose6 &robot) const
+{
+  // Into the robot frame, where the test is on the coordinates
+  ufo::math::Pose6 to_robot = robot.inversed();
+  auto end = std::remove_if(cloud.begin(), cloud.end(), [this, &to_robot](const ufo::map::Point3Color &point) {
+    ufo::math::Vector3 p = to_robot.transform(point);
+    return (std::abs(p.z()) <= half_height) && ((p.x() * p.x() + p.y() * p.y()) <= radius_squared);
+  });
+  size_t removed = cloud.end() - end;
+  cloud.resize(cloud.size() - removed);
+  return removed;
+}
@@ -0,0 +1,160 @@
+// Copyright (c) 2021 Xeni Robotics
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* **********************************************************************
+ * Ring of recent poses, filled from TF.  See pose_cache.h
+ * ***********************************************************************/
+
+#include <chrono>       // std::chrono
+#include <functional>   // std::bind
+
+#include <tf2/exceptions.h>
+#include <tf2/LinearMath/Quaternion.h>
+
+#include "navigation_lite/pose_cache.h"
+
+PoseCache::PoseCache(rclcpp::Node &node, tf2_ros::Buffer &buffer,
+                     const std::string &target_frame, const std::string &source_frame, double rate,
+                     rclcpp::CallbackGroup::SharedPtr callback_group)
+  : buffer(buffer)
+  , target_frame(target_frame)
+  , source_frame(source_frame)
+{
+  for(auto &slot : ring) {
+    for(auto &value : slot.value) value.store(0.0, std::memory_order_relaxed);
+  }
+  timer = node.create_wall_timer(
+    std::chrono::duration<double>(1.0 / rate), std::bind(&PoseCache::poll, this), callback_group);
+}
+
+void PoseCache::poll()
+{
+  geometry_msgs::msg::TransformStamped msg;
+  try {
+    msg = buffer.lookupTransform(target_frame, source_frame, tf2::TimePointZero);
+  } catch (tf2::TransformException &) {
+    return;   // Not yet available.  Readers see the last pose, or none.
+  }
+
+  std::array<double, FIELDS> pose;
+  pose[STAMP] = rclcpp::Time(msg.header.stamp).seconds();
+
+  std::array<double, FIELDS> last;
+  uint64_t n = count.load(std::memory_order_relaxed);
+  if ((n > 0) && read(n - 1, last) && (last[STAMP] >= pose[STAMP])) {
+    return;   // Nothing new
+  }
+
+  pose[X] = msg.transform.translation.x;
+  pose[Y] = msg.transform.translation.y;
+  pose[Z] = msg.transform.translation.z;
+  pose[QX] = msg.transform.rotation.x;
+  pose[QY] = msg.transform.rotation.y;
+  pose[QZ] = msg.transform.rotation.z;
+  pose[QW] = msg.transform.rotation.w;
+  write(pose);
+}
+
+void PoseCache::write(const std::array<double, FIELDS> &pose)
+{
+  uint64_t n = count.load(std::memory_order_relaxed);
+  Slot &slot = ring[n % HISTORY];
+
+  uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+  slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for(int i = 0; i < FIELDS; i++) {
+    slot.value[i].store(pose[i], std::memory_order_relaxed);
+  }
+  slot.sequence.store(sequence + 2, std::memory_order_release);
+  count.store(n + 1, std::memory_order_release);
+}
+
+bool PoseCache::read(uint64_t index, std::array<double, FIELDS> &pose) const
+{
+  const Slot &slot = ring[index % HISTORY];
+  while (true) {
+    if (count.load(std::memory_order_acquire) > index + HISTORY - 1) {
+      return false;   // Overwritten, or about to be
+    }
+    uint32_t before = slot.sequence.load(std::memory_order_acquire);
+    if (before & 1) continue;
+    for(int i = 0; i < FIELDS; i++) {
+      pose[i] = slot.value[i].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) == before) return true;
+  }
+}
+
+bool PoseCache::latest(geometry_msgs::msg::TransformStamped &msg) const
+{
+  std::array<double, FIELDS> pose;
+  uint64_t n = count.load(std::memory_order_acquire);
+  if ((n == 0) || !read(n - 1, pose)) {
+    return false;
+  }
+  toMsg(pose, msg);
+  return true;
+}
+
+bool PoseCache::lookup(const rclcpp::Time &stamp, geometry_msgs::msg::TransformStamped &msg) const
+{
+  double t = stamp.seconds();
+  uint64_t n = count.load(std::memory_order_acquire);
+  if (n == 0) return false;
+
+  // Walk back from the newest pose to the first one at or before t
+  std::array<double, FIELDS> after, before;
+  if (!read(n - 1, after)) return false;
+  if (t >= after[STAMP]) {
+    toMsg(after, msg);
+    return true;
+  }
+  for(uint64_t i = n - 1; (i > 0) && (i + HISTORY > n); i--) {
+    if (!read(i - 1, before)) return false;
+    if (before[STAMP] <= t) {
+      double f = (t - before[STAMP]) / (after[STAMP] - before[STAMP]);
+      std::array<double, FIELDS> pose;
+      pose[STAMP] = t;
+      for(int j = X; j <= Z; j++) {
+        pose[j] = before[j] + f * (after[j] - before[j]);
+      }
+      tf2::Quaternion q = tf2::Quaternion(before[QX], before[QY], before[QZ], before[QW]).slerp(
+                          tf2::Quaternion(after[QX], after[QY], after[QZ], after[QW]), f);
+      pose[QX] = q.x();
+      pose[QY] = q.y();
+      pose[QZ] = q.z();
+      pose[QW] = q.w();
+      toMsg(pose, msg);
+      return true;
+    }
+    after = before;
+  }
+  return false;
+}
+
+void PoseCache::toMsg(const std::array<double, FIELDS> &pose, geometry_msgs::msg::TransformStamped &msg) const
+{
+  msg.header.stamp = rclcpp::Time((int64_t)(pose[STAMP] * 1e9));
+  msg.header.frame_id = target_frame;
+  msg.child_frame_id = source_frame;
+  msg.transform.translation.x = pose[X];
+  msg.transform.translation.y = pose[Y];
+  msg.transform.translation.z = pose[Z];
+  msg.transform.rotation.x = pose[QX];
+  msg.transform.rotation.y = pose[QY];
+  msg.transform.rotation.z = pose[QZ];
+  msg.transform.rotation.w = pose[QW];
+}
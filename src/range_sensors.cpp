@@ -0,0 +1,106 @@
+// Copyright (c) 2021 Xeni Robotics
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* **********************************************************************
+ * Single beam range sensors from the parameters.  See range_sensors.h
+ * The sensors are read from the parameter overrides, and not declared,
+ * as an angle is a number or a deg() string, depending on the entry.
+ * ***********************************************************************/
+
+#include <cmath>        // std::cos, std::sin, M_PI
+#include <map>          // std::map
+#include <stdexcept>    // std::invalid_argument
+
+#include "navigation_lite/range_sensors.h"
+
+double parseAngle(const rclcpp::ParameterValue &value)
+{
+  switch (value.get_type()) {
+    case rclcpp::ParameterType::PARAMETER_DOUBLE:
+      return value.get<double>();
+    case rclcpp::ParameterType::PARAMETER_INTEGER:
+      return (double)value.get<int64_t>();
+    case rclcpp::ParameterType::PARAMETER_STRING:
+    {
+      std::string text = value.get<std::string>();
+      bool degrees = false;
+      if (text.compare(0, 4, "deg(") == 0 && text.back() == ')') {
+        text = text.substr(4, text.size() - 5);
+        degrees = true;
+      }
+      size_t used = 0;
+      double angle = std::stod(text, &used);     // Throws std::invalid_argument
+      if (used != text.size()) {
+        throw std::invalid_argument("trailing characters in angle");
+      }
+      return degrees ? angle * M_PI / 180.0 : angle;
+    }
+    default:
+      throw std::invalid_argument("angle is not a number");
+  }
+}
+
+std::vector<RangeSensor> readRangeSensors(rclcpp::Node &node)
+{
+  std::vector<RangeSensor> sensors;
+  const std::map<std::string, rclcpp::ParameterValue> &overrides =
+    node.get_node_parameters_interface()->get_parameter_overrides();
+
+  auto list = overrides.find("sensors");
+  if (list == overrides.end() || list->second.get_type() != rclcpp::ParameterType::PARAMETER_STRING_ARRAY) {
+    return sensors;
+  }
+
+  auto number = [&overrides](const std::string &name, bool angle) -> double {
+    auto entry = overrides.find(name);
+    if (entry == overrides.end()) return 0.0;
+    if (angle) return parseAngle(entry->second);
+    if (entry->second.get_type() == rclcpp::ParameterType::PARAMETER_INTEGER) {
+      return (double)entry->second.get<int64_t>();
+    }
+    return entry->second.get<double>();
+  };
+  auto text = [&overrides](const std::string &name) -> std::string {
+    auto entry = overrides.find(name);
+    if (entry == overrides.end() || entry->second.get_type() != rclcpp::ParameterType::PARAMETER_STRING) return "";
+    return entry->second.get<std::string>();
+  };
+
+  for (auto &name : list->second.get<std::vector<std::string>>()) {
+    RangeSensor sensor;
+    sensor.name = name;
+    sensor.topic = text(name + ".topic");
+    if (sensor.topic.empty()) {
+      RCLCPP_WARN(node.get_logger(), "Range sensor [%s] has no topic, skipped", name.c_str());
+      continue;
+    }
+    try {
+      std::string prefix = name + ".transform.";
+      sensor.frame = text(prefix + "frame");
+      sensor.position = ufo::math::Vector3(number(prefix + "posX", false),
+                                           number(prefix + "posY", false),
+                                           number(prefix + "posZ", false));
+      double pitch = number(prefix + "pitch", true);
+      double yaw = number(prefix + "yaw", true);     // Roll turns the beam about itself
+      sensor.direction = ufo::math::Vector3(std::cos(pitch) * std::cos(yaw),
+                                            std::cos(pitch) * std::sin(yaw),
+                                            -std::sin(pitch));
+    } catch (std::exception &ex) {
+      RCLCPP_WARN(node.get_logger(), "Range sensor [%s] has a bad transform (%s), skipped", name.c_str(), ex.what());
+      continue;
+    }
+    sensors.push_back(sensor);
+  }
+  return sensors;
+}
@@ -26,6 +26,10 @@
  * Maintains original position (x,y,z,yaw) through the use of PID 
  *   controllers for a set time.
  *
+ * Both check the space within the drone radius against the map, before
+ *  and while they run, and abort when an obstacle is in it.  With
+ *  use_shared_map the map of the map server is read in place.
+ *
  * A Mutex lock governs that only one action server can control the drone
  *  at a time.  Who knows what would happen if another node starts sending 
  *  out cmd_vel messages?
@@ -33,6 +37,8 @@
  * ***********************************************************************/
 #include <functional>
 #include <memory>
+#include <string>
+#include <vector>
 #include <thread>
 #include <mutex>
 
@@ -53,9 +59,16 @@
 #include <tf2_ros/transform_listener.h>
 #include <tf2_ros/buffer.h>
 
+#include <ufo/map/occupancy_map.h>
+
 #include "navigation_lite/visibility_control.h"
 #include "navigation_lite/pid.hpp"
 #include "navigation_lite/holddown_timer.hpp"
+#include "navigation_lite/busy_flag.hpp"
+#include "navigation_lite/thread_pool.hpp"
+#include "navigation_lite/pose_cache.h"
+#include "navigation_lite/map_buffer.h"
+#include "navigation_lite/collision_query.h"
 
 static const float DEFAULT_MAX_SPEED_XY = 2.0;          // Maximum horizontal speed, in m/s
 static const float DEFAULT_MAX_ACCEL_XY = 0.2; 
@@ -98,7 +111,7 @@ public:
   }
     
 private:    
-  std::mutex server_mutex;   // Only allow one Action Server to address the drone at a time
+  BusyFlag drone_busy_;   // Only allow one Action Server to address the drone at a time
   
   // Node Parameters
   float max_yaw_speed_;
@@ -111,22 +124,32 @@ private:
   int holddown_;
   double freq_;
   double yaw_control_limit_;
+  double drone_diameter_;
   
   // Clock
   rclcpp::Clock steady_clock_{RCL_STEADY_TIME};
 
   rclcpp::TimerBase::SharedPtr one_off_timer_;
 
+  // TF polling runs beside the goal callbacks of both action servers on a multi-threaded executor
+  rclcpp::CallbackGroup::SharedPtr tf_group_;
+  rclcpp::CallbackGroup::SharedPtr action_group_;
+  rclcpp::CallbackGroup::SharedPtr map_group_;
+
   rclcpp::TimerBase::SharedPtr timer_{nullptr};
   rclcpp::Publisher<geometry_msgs::msg::Twist>::SharedPtr publisher_{nullptr};
   std::shared_ptr<tf2_ros::TransformListener> transform_listener_{nullptr};
   std::unique_ptr<tf2_ros::Buffer> tf_buffer_;
+  std::unique_ptr<PoseCache> pose_cache_;
+
+  // UFO Map, to check the space around the drone
+  std::unique_ptr<CollisionQuery> collision_query_;   // Before map_, whose thread updates it
+  std::unique_ptr<MapBuffer> map_;
+  rclcpp::Subscription<navigation_interfaces::msg::UfoMapStamped>::SharedPtr subscription_;
 
-  // PID Controllers  
-  std::shared_ptr<PID> pid_x;
-  std::shared_ptr<PID> pid_y;
-  std::shared_ptr<PID> pid_z;
-  std::shared_ptr<PID> pid_yaw;
+  // PID Controllers, one per axis of the velocity command.  Shared by spin, wait and the flight
+  // to a waypoint.  The acceleration in X and Y is governed by the rate limit of the axes.
+  std::unique_ptr<FlightPID> pid_;
   
   // Holddown Timer
   std::shared_ptr<HolddownTimer> holddown_timer;
@@ -139,11 +162,15 @@ private:
     
     // Only run this once.  Stop the timer that triggered this.
     this->one_off_timer_->cancel();
+
+    tf_group_ = this->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+    action_group_ = this->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+    map_group_ = this->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
        
     // Declare and read some node parameters    
     freq_ = this->declare_parameter("frequency", 10.0);     // Control frequency in Hz.  Must be bigger than 2 Hz
     
-    max_yaw_speed_ = this->declare_parameter<float>("max_speed_xy", DEFAULT_MAX_SPEED_XY);
+    max_speed_xy_  = this->declare_parameter<float>("max_speed_xy", DEFAULT_MAX_SPEED_XY);
     max_accel_xy_ = this->declare_parameter<float>("max_accel_xy", DEFAULT_MAX_ACCEL_XY);
     max_speed_z_   = this->declare_parameter<float>("max_speed_z", DEFAULT_MAX_SPEED_Z);
     max_yaw_speed_ = this->declare_parameter<float>("max_yaw_speed", DEFAULT_MAX_YAW_SPEED);
@@ -160,24 +187,46 @@ private:
     this->declare_parameter("pid_xy", std::vector<double>{0.7, 0.0, 0.0});
     rclcpp::Parameter pid_xy_settings_param = this->get_parameter("pid_xy");
     std::vector<double> pid_xy_settings = pid_xy_settings_param.as_double_array(); 
-    pid_x   = std::make_shared<PID>(1.0 / freq_ , max_speed_xy_, -max_speed_xy_, (float)pid_xy_settings[0], (float)pid_xy_settings[1], (float)pid_xy_settings[2]);
-    pid_y   = std::make_shared<PID>(1.0 / freq_ , max_speed_xy_, -max_speed_xy_, (float)pid_xy_settings[0], (float)pid_xy_settings[1], (float)pid_xy_settings[2]);
+    pid_ = std::make_unique<FlightPID>(1.0 / freq_);
+    pid_->setAxis(AXIS_X, max_speed_xy_, -max_speed_xy_, (float)pid_xy_settings[0], (float)pid_xy_settings[1], (float)pid_xy_settings[2]);
+    pid_->setAxis(AXIS_Y, max_speed_xy_, -max_speed_xy_, (float)pid_xy_settings[0], (float)pid_xy_settings[1], (float)pid_xy_settings[2]);
+    pid_->setRateLimit(AXIS_X, max_accel_xy_);
+    pid_->setRateLimit(AXIS_Y, max_accel_xy_);
 
     this->declare_parameter("pid_z", std::vector<double>{0.7, 0.0, 0.0});
     rclcpp::Parameter pid_z_settings_param = this->get_parameter("pid_z");
     std::vector<double> pid_z_settings = pid_z_settings_param.as_double_array(); 
-    pid_z   = std::make_shared<PID>(1.0 / freq_, max_speed_z_, -max_speed_z_, (float)pid_z_settings[0], (float)pid_z_settings[1], (float)pid_z_settings[2]);
+    pid_->setAxis(AXIS_Z, max_speed_z_, -max_speed_z_, (float)pid_z_settings[0], (float)pid_z_settings[1], (float)pid_z_settings[2]);
 
     this->declare_parameter("pid_yaw", std::vector<double>{0.7, 0.0, 0.0});  
     rclcpp::Parameter pid_yaw_settings_param = this->get_parameter("pid_yaw");
     std::vector<double> pid_yaw_settings = pid_yaw_settings_param.as_double_array(); 
-    pid_yaw   = std::make_shared<PID>(1.0 / freq_, max_yaw_speed_, -max_yaw_speed_, (float)pid_yaw_settings[0], (float)pid_yaw_settings[1], (float)pid_yaw_settings[2]);
+    pid_->setAxis(AXIS_YAW, max_yaw_speed_, -max_yaw_speed_, (float)pid_yaw_settings[0], (float)pid_yaw_settings[1], (float)pid_yaw_settings[2]);
     
     // Create a transform listener
     tf_buffer_ =
       std::make_unique<tf2_ros::Buffer>(this->get_clock());
     transform_listener_ =
       std::make_shared<tf2_ros::TransformListener>(*tf_buffer_);
+    // The robot pose, polled from TF once per tick instead of looked up on every read
+    pose_cache_ = std::make_unique<PoseCache>(*this, *tf_buffer_, "map", "base_link_ned", 50.0, tf_group_);
+
+    // The map, as for the controller: read in place with use_shared_map, else decoded from
+    // map_topic.  The space within the drone radius is checked at depth 3 (16 cm).
+    drone_diameter_ = this->declare_parameter<double>("drone_diameter", 0.80);
+    double resolution = this->declare_parameter<double>("map_resolution", 0.25);
+    bool use_shared_map = this->declare_parameter<bool>("use_shared_map", false);
+    collision_query_ = std::make_unique<CollisionQuery>(3);
+    map_ = std::make_unique<MapBuffer>(resolution, this->get_logger(),
+      std::bind(&RecoveryServer::map_updated, this, _1), use_shared_map);
+    if (!use_shared_map) {
+      std::string map_topic = this->declare_parameter<std::string>("map_topic", "nav_lite/map");
+      rclcpp::SubscriptionOptions map_options;
+      map_options.callback_group = map_group_;
+      subscription_ = this->create_subscription<navigation_interfaces::msg::UfoMapStamped>(
+        map_topic, 10, [this](const navigation_interfaces::msg::UfoMapStamped::SharedPtr msg) { map_->submit(msg); },
+        map_options);
+    }
 
     // Set up the hoddown timer
     holddown_timer = std::make_shared<HolddownTimer>(holddown_);
@@ -186,13 +235,17 @@ private:
     publisher_ =
       this->create_publisher<geometry_msgs::msg::Twist>("drone/cmd_vel", 1);
 
-    // Create the two action servers     
+    // Create the two action servers.  Only one goal commands the drone at a time, see drone_busy_,
+    // so one worker executes the goals of both.
+    goal_pool_ = std::make_unique<ThreadPool>(1);
     this->spin_action_server_ = rclcpp_action::create_server<Spin>(
       this,
       "nav_lite/spin",
       std::bind(&RecoveryServer::spin_handle_goal, this, _1, _2),
       std::bind(&RecoveryServer::spin_handle_cancel, this, _1),
-      std::bind(&RecoveryServer::spin_handle_accepted, this, _1));
+      std::bind(&RecoveryServer::spin_handle_accepted, this, _1),
+      rcl_action_server_get_default_options(),
+      action_group_);
     RCLCPP_INFO(this->get_logger(), "Action Server [nav_lite/spin] started");
   
     this->wait_action_server_ = rclcpp_action::create_server<Wait>(
@@ -200,14 +253,48 @@ private:
       "nav_lite/wait",
       std::bind(&RecoveryServer::wait_handle_goal, this, _1, _2),
       std::bind(&RecoveryServer::wait_handle_cancel, this, _1),
-      std::bind(&RecoveryServer::wait_handle_accepted, this, _1));   
+      std::bind(&RecoveryServer::wait_handle_accepted, this, _1),
+      rcl_action_server_get_default_options(),
+      action_group_);
     RCLCPP_INFO(this->get_logger(), "Action Server [nav_lite/wait] started");
-    
-    server_mutex.unlock();
 
    }   
     
+  // MAP ///////////////////////////////////////////////////////////////////////////////////////////////////////////
+  // On the map buffer thread, after every new map.  Drops the checks the change touched.
+  void map_updated(MapBuffer::Snapshot map)
+  {
+    ufo::math::Vector3 min, max;
+    if (map && map.changedRegion(min, max)) {
+      collision_query_->update(*map, collision_query_->version() + 1, min, max);
+    } else {
+      collision_query_->update(collision_query_->version() + 1);
+    }
+  }
+
+  // No occupied space within the drone radius of x, y, z.  Until a map arrives, all is clear.
+  bool is_clear(double x, double y, double z)
+  {
+    uint64_t version = collision_query_->version();   // Before the map, see CollisionQuery
+    std::vector<bool> collides;
+    collision_query_->spheres(*map_->get(), version,
+      { CollisionQuery::Sphere{ufo::math::Vector3(x, y, z), drone_diameter_ / 2} }, collides);
+    return !collides[0];
+  }
+
   // FLIGHT CONTROL ////////////////////////////////////////////////////////////////////////////////////////////////
+  // Yaw rate towards a yaw error of zero, the other axes hold still
+  double yaw_command(double yaw_error)
+  {
+    FlightPID::Values zero, error, command;
+    FlightPID::Mask active{{false, false, false, true}};
+    zero.fill(0.0);
+    error.fill(0.0);
+    error[AXIS_YAW] = -yaw_error;
+    pid_->calculate(zero, error, 1.0 / freq_, command, active);
+    return command[AXIS_YAW];
+  }
+
   bool fly_to_waypoint(geometry_msgs::msg::PoseStamped wp) {
     rclcpp::Rate loop_rate( freq_ );
 
@@ -233,10 +320,13 @@ private:
    
 
     // First correct the yaw        
-    pid_yaw->restart_control();
+    pid_->restart_control(AXIS_YAW);
 
     do {
-      read_position(&x, &y, &z, &w);  // Current position according to tf2
+      if (!read_position(&x, &y, &z, &w)) {  // Current position according to tf2
+        stop_movement();
+        return false;
+      }
 
       err_x = target_x_ - x; 
       err_y = target_y_ - y;
@@ -251,20 +341,23 @@ private:
       if (pose_is_close_) {
         break;
       }
-      setpoint.angular.z = pid_yaw->calculate(0, -yaw_error);         // correct yaw error down to zero  
+      setpoint.angular.z = yaw_command(yaw_error);         // correct yaw error down to zero  
       
       publisher_->publish(setpoint);
       loop_rate.sleep();  // Give the drone time to move
     } while (!pose_is_close_);  
 
     // Now that we are ponting, keep on adjusting yaw, but include altitude and foreward velocity
-    pid_x->restart_control();
-    pid_y->restart_control();
-    pid_z->restart_control();
-    double last_v_x = 0.0;
-    double last_v_y = 0.0;
+    pid_->restart_control(AXIS_X);
+    pid_->restart_control(AXIS_Y);
+    pid_->restart_control(AXIS_Z);
+    FlightPID::Values zero, error, command;
+    zero.fill(0.0);
     do {
-      read_position(&x, &y, &z, &w);  // Current position according to tf2
+      if (!read_position(&x, &y, &z, &w)) {  // Current position according to tf2
+        stop_movement();
+        return false;
+      }
 
       err_x = target_x_ - x; 
       err_y = target_y_ - y;
@@ -274,44 +367,39 @@ private:
       waypoint_is_close_ = (err_dist < waypoint_radius_error_);
 
       altitude_is_close_ = ( abs(err_z) < altitude_threshold_);
-      setpoint.linear.z = pid_z->calculate(0, -err_z);                // correct altitude
+      FlightPID::Mask active{{true, true, true, false}};
+      error.fill(0.0);
+      error[AXIS_Z] = -err_z;               // correct altitude
       
       if ( sqrt(pow(err_x,2) + pow(err_y,2)) < yaw_control_limit_ ) {
         // Control via X and Y PID rather than yaw and thrust.
         
-        setpoint.linear.x = pid_x->calculate(0, -err_x);              // fly
-        setpoint.linear.y = pid_y->calculate(0, -err_y);
+        error[AXIS_X] = -err_x;             // fly
+        error[AXIS_Y] = -err_y;
       } else {
         // Control with yaw and thrust. 
         yaw_to_target = atan2(err_y, err_x);      
         yaw_error = getDiff2Angles(yaw_to_target, w, M_PI);
         pose_is_close_ = (fabs(yaw_error) < yaw_threshold_);
         
-        setpoint.angular.z = pid_yaw->calculate(0, -yaw_error);         // correct yaw error down to zero  
-        if( pose_is_close_ ) {
-          setpoint.linear.x = pid_x->calculate(0, -err_dist);              // fly
-        } else {
-          // Avoid flying in a doughnut.  First correct yaw.
-          setpoint.linear.x = 0.0;
-        }
-        setpoint.linear.y = 0.0;
+        error[AXIS_YAW] = -yaw_error;       // correct yaw error down to zero  
+        error[AXIS_X] = -err_dist;          // fly
+        active[AXIS_YAW] = true;
+        // Avoid flying in a doughnut.  First correct yaw.
+        active[AXIS_X] = pose_is_close_;
+        active[AXIS_Y] = false;
       }
+      pid_->calculate(zero, error, 1.0 / freq_, command, active);
       
       // Govern acceleration, and decellaration.  The latter should be governed by a well 
       // tuned PID but then not all control is done via a PID.  Often velocity is forced
       // to 0 which is an abrupt stop.
-      if (setpoint.linear.x > last_v_x ) {  // Acceleration
-        setpoint.linear.x = min(setpoint.linear.x, last_v_x + (max_accel_xy_ / freq_));
-      } else {                              // Decelleration
-        setpoint.linear.x = max(setpoint.linear.x, last_v_x - (max_accel_xy_ / freq_));
-      }
-      if (setpoint.linear.y > last_v_y ) {
-        setpoint.linear.y = min(setpoint.linear.y, last_v_y + (max_accel_xy_ / freq_));
-      } else {
-        setpoint.linear.y = max(setpoint.linear.y, last_v_y - (max_accel_xy_ / freq_));
-      }
-      last_v_x = setpoint.linear.x;
-      last_v_y = setpoint.linear.y;
+      pid_->limitRate(command, 1.0 / freq_);
+
+      setpoint.linear.x = command[AXIS_X];
+      setpoint.linear.y = command[AXIS_Y];
+      setpoint.linear.z = command[AXIS_Z];
+      setpoint.angular.z = command[AXIS_YAW];
       
       publisher_->publish(setpoint);
       loop_rate.sleep();  // Give the drone time to move
@@ -352,17 +440,20 @@ private:
     double x, y, z, w;
     double yaw_error;
       
-    pid_yaw->restart_control();
+    pid_->restart_control(AXIS_YAW);
 
     do {
-      read_position(&x, &y, &z, &w);  
+      if (!read_position(&x, &y, &z, &w)) {
+        stop_movement();
+        return false;
+      }
       
       yaw_error = getDiff2Angles(yaw, w, M_PI);
       pose_is_close_ = (fabs(yaw_error) < yaw_threshold_);
       if (pose_is_close_) {
         break;
       }
-      setpoint.angular.z = pid_yaw->calculate(0, -yaw_error);         // correct yaw error down to zero  
+      setpoint.angular.z = yaw_command(yaw_error);         // correct yaw error down to zero  
       
       publisher_->publish(setpoint);
       loop_rate.sleep();  // Give the drone time to move
@@ -400,7 +491,7 @@ private:
   {
     RCLCPP_DEBUG(this->get_logger(), "Received request to rotate to %.2f radians", goal->target_yaw);
     (void)uuid;
-    if(server_mutex.try_lock()) {
+    if(drone_busy_.tryClaim()) {
       return rclcpp_action::GoalResponse::ACCEPT_AND_EXECUTE;
     } else {
       RCLCPP_ERROR(this->get_logger(), "Another thread is commanding the drone now.  Rejecting Spin request.");
@@ -418,13 +509,13 @@ private:
 
   void spin_handle_accepted(const std::shared_ptr<GoalHandleSpin> goal_handle)
   {
-    using namespace std::placeholders;
-    // this needs to return quickly to avoid blocking the executor, so spin up a new thread
-    std::thread{std::bind(&RecoveryServer::spin_execute, this, _1), goal_handle}.detach();
+    // this needs to return quickly to avoid blocking the executor, so hand it to the worker
+    goal_pool_->enqueue([this, goal_handle]() { spin_execute(goal_handle); });
   }
 
   void spin_execute(const std::shared_ptr<GoalHandleSpin> goal_handle)
   {
+    BusyFlag::Release release(drone_busy_);   // Claimed in spin_handle_goal
     RCLCPP_DEBUG(this->get_logger(), "Executing goal");
     const auto goal = goal_handle->get_goal();
     auto feedback = std::make_shared<Spin::Feedback>();
@@ -442,10 +533,21 @@ private:
 
     double x, y, z, w, start_w;
     double yaw_error;
-    read_position(&x, &y, &z, &start_w);
-    
-    pid_yaw->restart_control();
     auto start_time = steady_clock_.now();
+    if (!read_position(&x, &y, &z, &start_w)) {
+      RCLCPP_ERROR(this->get_logger(), "The robot position is unknown.  Cannot spin.");
+      result->total_elapsed_time = steady_clock_.now() - start_time;
+      goal_handle->abort(result);
+      return;
+    }
+    if (!is_clear(x, y, z)) {
+      RCLCPP_ERROR(this->get_logger(), "An obstacle is within the drone radius.  Cannot spin.");
+      result->total_elapsed_time = steady_clock_.now() - start_time;
+      goal_handle->abort(result);
+      return;
+    }
+    
+    pid_->restart_control(AXIS_YAW);
     
     bool  pose_is_close_;
     do {
@@ -455,11 +557,23 @@ private:
         result->total_elapsed_time = steady_clock_.now() - start_time;      
         goal_handle->canceled(result);
         RCLCPP_DEBUG(this->get_logger(), "Goal canceled");
-        server_mutex.unlock();
         return;
       }
 
-      read_position(&x, &y, &z, &w);  
+      if (!read_position(&x, &y, &z, &w)) {
+        stop_movement();
+        RCLCPP_ERROR(this->get_logger(), "Lost the robot position while spinning");
+        result->total_elapsed_time = steady_clock_.now() - start_time;
+        goal_handle->abort(result);
+        return;
+      }
+      if (!is_clear(x, y, z)) {
+        stop_movement();
+        RCLCPP_ERROR(this->get_logger(), "An obstacle came within the drone radius while spinning");
+        result->total_elapsed_time = steady_clock_.now() - start_time;
+        goal_handle->abort(result);
+        return;
+      }
       
       yaw_error = getDiff2Angles(goal->target_yaw, w, M_PI);
       pose_is_close_ = (fabs(yaw_error) < yaw_threshold_);
@@ -467,7 +581,7 @@ private:
       if (pose_is_close_) {
         break;
       }
-      setpoint.angular.z = pid_yaw->calculate(0, -yaw_error);         // correct yaw error down to zero  
+      setpoint.angular.z = yaw_command(yaw_error);         // correct yaw error down to zero  
       
       publisher_->publish(setpoint);
       // Publish some feedback
@@ -478,7 +592,6 @@ private:
     } while (!pose_is_close_); 
 
     stop_movement();
-    server_mutex.unlock();
     
     // Mark goal as done
     if (rclcpp::ok()) {
@@ -499,7 +612,7 @@ private:
   {
     RCLCPP_DEBUG(this->get_logger(), "Received request to wait for %d seconds and %d nanoeconds", goal->time.sec, goal->time.nanosec);
     (void)uuid;
-    if(server_mutex.try_lock()) {
+    if(drone_busy_.tryClaim()) {
       return rclcpp_action::GoalResponse::ACCEPT_AND_EXECUTE;
     } else {
       RCLCPP_ERROR(this->get_logger(), "Another thread is commanding the drone now.  Rejecting Wait request.");
@@ -517,13 +630,13 @@ private:
 
   void wait_handle_accepted(const std::shared_ptr<GoalHandleWait> goal_handle)
   {
-    using namespace std::placeholders;
-    // this needs to return quickly to avoid blocking the executor, so spin up a new thread
-    std::thread{std::bind(&RecoveryServer::wait_execute, this, _1), goal_handle}.detach();
+    // this needs to return quickly to avoid blocking the executor, so hand it to the worker
+    goal_pool_->enqueue([this, goal_handle]() { wait_execute(goal_handle); });
   }
 
   void wait_execute(const std::shared_ptr<GoalHandleWait> goal_handle)
   {
+    BusyFlag::Release release(drone_busy_);   // Claimed in wait_handle_goal
     const auto goal = goal_handle->get_goal();
     auto feedback = std::make_shared<Wait::Feedback>();
     auto & time_left = feedback->time_left;
@@ -531,7 +644,19 @@ private:
     
     // Read the current position using tf2
     double cx, cy, cz, cw;
-    read_position(&cx, &cy, &cz, &cw);
+    auto start_time = steady_clock_.now();    
+    if (!read_position(&cx, &cy, &cz, &cw)) {
+      RCLCPP_ERROR(this->get_logger(), "The robot position is unknown.  Cannot hold it while waiting.");
+      result->total_elapsed_time = steady_clock_.now() - start_time;
+      goal_handle->abort(result);
+      return;
+    }
+    if (!is_clear(cx, cy, cz)) {
+      RCLCPP_ERROR(this->get_logger(), "An obstacle is within the drone radius.  Cannot hold the position.");
+      result->total_elapsed_time = steady_clock_.now() - start_time;
+      goal_handle->abort(result);
+      return;
+    }
     
     geometry_msgs::msg::PoseStamped wp;
     
@@ -546,7 +671,6 @@ private:
     wp.pose.orientation.z = q.z();
     wp.pose.orientation.w = q.w();
             
-    auto start_time = steady_clock_.now();    
     bool keep_on_waiting = true;
     while (rclcpp::ok() && keep_on_waiting ) {
           
@@ -555,7 +679,6 @@ private:
         result->total_elapsed_time = steady_clock_.now() - start_time;      
         goal_handle->canceled(result);
         RCLCPP_INFO(this->get_logger(), "Goal canceled");
-        server_mutex.unlock();
         return;
       }
       
@@ -564,12 +687,24 @@ private:
       goal_handle->publish_feedback(feedback);
       RCLCPP_DEBUG(this->get_logger(), "Time left %d sec %d nanosec", time_left.sec, time_left.nanosec);      
       keep_on_waiting = ((time_left.sec > 0) && (time_left.nanosec > 500000));  // remember a loop_rate.sleep() still comes!
+
+      if (!is_clear(cx, cy, cz)) {
+        stop_movement();
+        RCLCPP_ERROR(this->get_logger(), "An obstacle came within the drone radius while waiting");
+        result->total_elapsed_time = steady_clock_.now() - start_time;
+        goal_handle->abort(result);
+        return;
+      }
       
-      fly_to_waypoint( wp );
+      if (!fly_to_waypoint( wp )) {
+        RCLCPP_ERROR(this->get_logger(), "Lost the robot position while waiting");
+        result->total_elapsed_time = steady_clock_.now() - start_time;
+        goal_handle->abort(result);
+        return;
+      }
     };
 
     stop_movement();
-    server_mutex.unlock();
     
     // Check if goal is done
     if (rclcpp::ok()) {
@@ -581,26 +716,19 @@ private:
   
   bool read_position(double *x, double *y, double *z, double *w)
   {
-    std::string from_frame = "base_link_ned"; //map_frame_.c_str();
-    std::string to_frame = "map";
-    
     geometry_msgs::msg::TransformStamped transformStamped;
     
     // Look up for the transformation between map and base_link frames
     // and save the last position in the 'map' frame
-    try {
-      transformStamped = tf_buffer_->lookupTransform(
-        to_frame, from_frame,
-        tf2::TimePointZero);
-        *x = transformStamped.transform.translation.x;
-        *y = transformStamped.transform.translation.y;
-        *z = transformStamped.transform.translation.z;
-    } catch (tf2::TransformException & ex) {
+    if (!pose_cache_->latest(transformStamped)) {
       RCLCPP_DEBUG(
-        this->get_logger(), "Could not transform %s to %s: %s",
-        to_frame.c_str(), from_frame.c_str(), ex.what());
+        this->get_logger(), "No transform from %s to %s yet",
+        pose_cache_->sourceFrame().c_str(), pose_cache_->targetFrame().c_str());
       return false;  
     }
+    *x = transformStamped.transform.translation.x;
+    *y = transformStamped.transform.translation.y;
+    *z = transformStamped.transform.translation.z;
     
     // Orientation quaternion
     tf2::Quaternion q(
@@ -619,7 +747,8 @@ private:
 
     return true;
   }
- 
+
+  std::unique_ptr<ThreadPool> goal_pool_;   // Last member: joined before the rest is destroyed
   
 };  // class RecoveryServer
 
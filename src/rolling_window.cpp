@@ -0,0 +1,168 @@
+// Copyright (c) 2021 Xeni Robotics
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* **********************************************************************
+ * Rolling window over the map.  See rolling_window.h
+ * ***********************************************************************/
+
+#include <cmath>        // std::floor, std::ceil, std::sqrt
+#include <cstdio>       // std::remove
+#include <algorithm>    // std::max
+#include <vector>       // std::vector
+
+#include <ufo/geometry/aabb.h>
+#include <ufo/geometry/bounding_volume.h>
+
+#include "navigation_lite/rolling_window.h"
+#include "navigation_lite/map_snapshot.h"
+
+static const double HALF_HEIGHT = 10000.0;   // The window and the tiles span every height
+
+// Copy the known leaves of from in bv, at depth, into to.  Returns the number copied.
+static size_t copyLeaves(const ufo::map::OccupancyMap &from, ufo::map::OccupancyMap &to,
+                         const ufo::geometry::BoundingVolume &bv, ufo::map::DepthType depth)
+{
+  size_t count = 0;
+  for (auto it = from.beginLeaves(bv, true, true, false, false, depth), it_end = from.endLeaves();
+       it != it_end; ++it) {
+    to.setOccupancy(it.getCenter(), from.getOccupancy(*it), it.getDepth());
+    count++;
+  }
+  return count;
+}
+
+RollingWindow::RollingWindow(double window_radius, ufo::map::DepthType far_depth, double keep_radius,
+                             double tile_size, const std::string &tile_directory)
+  : window_radius(window_radius)
+  , far_depth(far_depth)
+  , keep_radius(std::max(keep_radius, window_radius))
+  , tile_size(tile_size)
+  , tile_directory(tile_directory)
+{ }
+
+RollingWindow::Tile RollingWindow::tileOf(double x, double y) const
+{
+  return Tile((int)std::floor(x / tile_size), (int)std::floor(y / tile_size));
+}
+
+bool RollingWindow::isFar(const Tile &tile, const ufo::math::Vector3 &position) const
+{
+  // The horizontal distance from the position to the nearest point of the tile
+  double dx = std::max({tile.first * tile_size - position.x(), 0.0, position.x() - (tile.first + 1) * tile_size});
+  double dy = std::max({tile.second * tile_size - position.y(), 0.0, position.y() - (tile.second + 1) * tile_size});
+  return std::sqrt(dx * dx + dy * dy) > keep_radius;
+}
+
+ufo::geometry::AABB RollingWindow::tileBox(const Tile &tile) const
+{
+  return ufo::geometry::AABB(ufo::math::Vector3(tile.first * tile_size, tile.second * tile_size, -HALF_HEIGHT),
+                             ufo::math::Vector3((tile.first + 1) * tile_size, (tile.second + 1) * tile_size, HALF_HEIGHT));
+}
+
+std::string RollingWindow::tileFile(const Tile &tile) const
+{
+  return tile_directory + "/tile_" + std::to_string(tile.first) + "_" + std::to_string(tile.second) + ".um";
+}
+
+std::shared_ptr<ufo::map::OccupancyMap> RollingWindow::roll(const ufo::map::OccupancyMap &map,
+                                                            const ufo::math::Vector3 &position, Stats &stats)
+{
+  stats = Stats();
+  auto rolled = std::make_shared<ufo::map::OccupancyMap>(map.getResolution(), map.getTreeDepthLevels());
+
+  // The window, grown to whole nodes at far_depth
+  double node_size = map.getResolution() * (double)(1u << far_depth);
+  ufo::math::Vector3 window_min(std::floor((position.x() - window_radius) / node_size) * node_size,
+                                std::floor((position.y() - window_radius) / node_size) * node_size, -HALF_HEIGHT);
+  ufo::math::Vector3 window_max(std::ceil((position.x() + window_radius) / node_size) * node_size,
+                                std::ceil((position.y() + window_radius) / node_size) * node_size, HALF_HEIGHT);
+  auto inWindow = [&window_min, &window_max](const ufo::math::Vector3 &p) {
+    return (p.x() > window_min.x()) && (p.x() < window_max.x()) &&
+           (p.y() > window_min.y()) && (p.y() < window_max.y());
+  };
+
+  // Outside the window, at far_depth.  Nodes in far tiles are left out, and their tiles spilled.
+  std::set<Tile> far_tiles;
+  for (auto it = map.beginLeaves(true, true, false, false, far_depth), it_end = map.endLeaves();
+       it != it_end; ++it) {
+    ufo::math::Vector3 center = it.getCenter();
+    if ((it.getDepth() <= far_depth) && inWindow(center)) {
+      continue;                                    // Copied at full resolution below
+    }
+    Tile tile = tileOf(center.x(), center.y());
+    if (isFar(tile, position)) {
+      far_tiles.insert(tile);
+      continue;
+    }
+    rolled->setOccupancy(center, map.getOccupancy(*it), it.getDepth());
+    stats.coarse_leaves++;
+  }
+
+  for (auto &tile : far_tiles) {
+    if (tile_directory.empty()) {
+      continue;                                    // Dropped
+    }
+    ufo::geometry::BoundingVolume bv;
+    bv.add(tileBox(tile));
+    bool written = false;
+    if (spilled.count(tile)) {
+      // Spilled before, and mapped again from afar.  Merge the new leaves into the file.  A file that
+      // cannot be read is left as it is, rather than overwritten with only the new leaves.
+      ufo::map::OccupancyMap merged(map.getResolution(), map.getTreeDepthLevels());
+      if (navigation_lite::readMapSnapshot(tileFile(tile), merged)) {
+        copyLeaves(map, merged, bv, 0);
+        written = merged.write(tileFile(tile), bv, false, 0, 1, 0);
+      } else {
+        stats.failed_tiles++;
+      }
+    } else {
+      written = map.write(tileFile(tile), bv, false, 0, 1, 0);
+    }
+    if (written) {
+      spilled.insert(tile);
+      stats.spilled_tiles++;
+    } else {
+      // Keep what could not be stored
+      stats.coarse_leaves += copyLeaves(map, *rolled, bv, far_depth);
+    }
+  }
+
+  // Spilled tiles close again come back, outside the window at far_depth.  The file is only removed
+  // once it has been read; one that cannot be read stays spilled, and is tried again next time.
+  ufo::geometry::BoundingVolume window;
+  window.add(ufo::geometry::AABB(window_min, window_max));
+  std::vector<Tile> returned;
+  for (auto &tile : spilled) {
+    if (isFar(tile, position)) continue;
+    ufo::map::OccupancyMap stored(map.getResolution(), map.getTreeDepthLevels());
+    if (!navigation_lite::readMapSnapshot(tileFile(tile), stored)) {
+      stats.failed_tiles++;
+      continue;
+    }
+    ufo::geometry::BoundingVolume bv;
+    bv.add(tileBox(tile));
+    stats.coarse_leaves += copyLeaves(stored, *rolled, bv, far_depth);
+    stats.fine_leaves += copyLeaves(stored, *rolled, window, 0);
+    stats.loaded_tiles++;
+    std::remove(tileFile(tile).c_str());
+    returned.push_back(tile);
+  }
+  for (auto &tile : returned) {
+    spilled.erase(tile);
+  }
+
+  // The window last, so the newest map overrides the coarse nodes and the stored tiles
+  stats.fine_leaves += copyLeaves(map, *rolled, window, 0);
+  return rolled;
+}
@@ -0,0 +1,147 @@
+// Copyright (c) 2021 Xeni Robotics
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* **********************************************************************
+ * Process wide handle on the map of the map server.  See shared_map.h
+ * ***********************************************************************/
+
+#include <algorithm>    // std::min, std::max
+
+#include "navigation_lite/shared_map.h"
+
+namespace navigation_lite
+{
+
+SharedMap & SharedMap::instance()
+{
+  static SharedMap shared_map;
+  return shared_map;
+}
+
+void SharedMap::publish(std::shared_ptr<ufo::map::OccupancyMap> map)
+{
+  {
+    std::lock_guard<std::mutex> lock(handle_mutex_);
+    map_ = map;
+    version_++;
+    addChange(true, ufo::math::Vector3(), ufo::math::Vector3());
+  }
+  changed_cv_.notify_all();
+}
+
+void SharedMap::withdraw()
+{
+  std::unique_lock<std::shared_timed_mutex> write_lock(map_mutex_);   // Wait for the readers to finish
+  std::lock_guard<std::mutex> lock(handle_mutex_);
+  map_.reset();
+}
+
+void SharedMap::notifyChanged()
+{
+  {
+    std::lock_guard<std::mutex> lock(handle_mutex_);
+    version_++;
+    addChange(true, ufo::math::Vector3(), ufo::math::Vector3());
+  }
+  changed_cv_.notify_all();
+}
+
+void SharedMap::notifyChanged(const ufo::math::Vector3 &min, const ufo::math::Vector3 &max)
+{
+  {
+    std::lock_guard<std::mutex> lock(handle_mutex_);
+    version_++;
+    addChange(false, min, max);
+  }
+  changed_cv_.notify_all();
+}
+
+void SharedMap::addChange(bool whole, const ufo::math::Vector3 &min, const ufo::math::Vector3 &max)
+{
+  changes_.push_back( {version_, whole, min, max} );
+  if (changes_.size() > CHANGE_HISTORY) {
+    changes_.pop_front();
+  }
+}
+
+bool SharedMap::changedSince(uint64_t version, ufo::math::Vector3 &min, ufo::math::Vector3 &max) const
+{
+  std::lock_guard<std::mutex> lock(handle_mutex_);
+  if (version >= version_) return false;                                     // Not a version seen
+  if (changes_.empty() || (changes_.front().version > version + 1)) return false;   // Too old
+
+  bool any = false;
+  for (auto &change : changes_) {
+    if (change.version <= version) continue;
+    if (change.whole) return false;
+    if (!any) {
+      min = change.min;
+      max = change.max;
+      any = true;
+    } else {
+      min = ufo::math::Vector3(std::min(min.x(), change.min.x()), std::min(min.y(), change.min.y()),
+                               std::min(min.z(), change.min.z()));
+      max = ufo::math::Vector3(std::max(max.x(), change.max.x()), std::max(max.y(), change.max.y()),
+                               std::max(max.z(), change.max.z()));
+    }
+  }
+  return any;
+}
+
+bool SharedMap::available() const
+{
+  std::lock_guard<std::mutex> lock(handle_mutex_);
+  return (bool)map_;
+}
+
+MapSnapshot SharedMap::read() const
+{
+  // Take the read lock first, so the map can not be withdrawn while the snapshot is held
+  auto read_lock = std::make_shared< std::shared_lock<std::shared_timed_mutex> >(map_mutex_);
+
+  std::lock_guard<std::mutex> lock(handle_mutex_);
+  if (!map_) {
+    return MapSnapshot();
+  }
+  return MapSnapshot(map_, read_lock);
+}
+
+MapSnapshot SharedMap::tryRead() const
+{
+  auto read_lock = std::make_shared< std::shared_lock<std::shared_timed_mutex> >(map_mutex_, std::try_to_lock);
+  if (!read_lock->owns_lock()) {
+    return MapSnapshot();   // The map server is writing
+  }
+
+  std::lock_guard<std::mutex> lock(handle_mutex_);
+  if (!map_) {
+    return MapSnapshot();
+  }
+  return MapSnapshot(map_, read_lock);
+}
+
+uint64_t SharedMap::version() const
+{
+  std::lock_guard<std::mutex> lock(handle_mutex_);
+  return version_;
+}
+
+uint64_t SharedMap::waitForChange(uint64_t last_version, std::chrono::milliseconds timeout) const
+{
+  std::unique_lock<std::mutex> lock(handle_mutex_);
+  changed_cv_.wait_for(lock, timeout, [this, last_version] { return version_ != last_version; });
+  return version_;
+}
+
+}  // namespace navigation_lite
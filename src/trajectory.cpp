@@ -0,0 +1,180 @@
+// Copyright (c) 2021 Xeni Robotics
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* **********************************************************************
+ * Time parameterization of a path.  See trajectory.h
+ * ***********************************************************************/
+
+#include <cmath>          // std::sqrt, std::fabs
+#include <algorithm>      // std::min, std::max
+#include <limits>         // std::numeric_limits
+
+#include "navigation_lite/trajectory.h"
+
+static const double MIN_SPAN = 1e-3;         // Shorter spans are dropped, in m
+static const double MIN_ACCEL = 1e-3;        // In m/s/s
+
+Trajectory::Trajectory(double max_speed_xy, double max_speed_z, double max_accel)
+  : max_speed_xy(max_speed_xy)
+  , max_speed_z(max_speed_z)
+  , max_accel(std::max(max_accel, MIN_ACCEL))
+  , point_count(0)
+{ }
+
+double Trajectory::plan(const Point &start, double start_speed, const std::vector<Point> &points)
+{
+  spans.clear();
+  point_count = points.size();
+
+  Point from = start;
+  for (size_t i = 0; i < points.size(); i++) {
+    Point delta{{points[i][0] - from[0], points[i][1] - from[1], points[i][2] - from[2]}};
+    double length = std::sqrt(delta[0]*delta[0] + delta[1]*delta[1] + delta[2]*delta[2]);
+    if (length < MIN_SPAN) continue;
+
+    Span span;
+    span.from = from;
+    span.direction = Point{{delta[0] / length, delta[1] / length, delta[2] / length}};
+    span.length = length;
+    span.v_peak = spanSpeedLimit(span.direction);
+    span.point = i;
+    spans.push_back(span);
+    from = points[i];
+  }
+  if (spans.empty()) return 0.0;
+
+  // The speed at every waypoint, v[i] at the start of span i, v[n] at the end
+  size_t n = spans.size();
+  std::vector<double> v(n + 1);
+  v[0] = std::min(std::max(start_speed, 0.0), spans[0].v_peak);
+  for (size_t i = 1; i < n; i++) {
+    const Point &a = spans[i - 1].direction;
+    const Point &b = spans[i].direction;
+    double cos_turn = a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+    v[i] = std::min(spans[i - 1].v_peak, spans[i].v_peak) * std::max(cos_turn, 0.0);
+  }
+  v[n] = 0.0;
+
+  for (size_t i = 0; i < n; i++) {
+    v[i + 1] = std::min(v[i + 1], std::sqrt(v[i]*v[i] + 2 * max_accel * spans[i].length));
+  }
+  for (size_t i = n; i > 0; i--) {
+    v[i - 1] = std::min(v[i - 1], std::sqrt(v[i]*v[i] + 2 * max_accel * spans[i - 1].length));
+  }
+
+  double t = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    spans[i].v_start = v[i];
+    spans[i].v_end = v[i + 1];
+    spans[i].t_start = t;
+    profile(spans[i]);
+    t += spans[i].t_accel + spans[i].t_cruise + spans[i].t_decel;
+  }
+  return t;
+}
+
+double Trajectory::duration() const
+{
+  if (spans.empty()) return 0.0;
+  const Span &last = spans.back();
+  return last.t_start + last.t_accel + last.t_cruise + last.t_decel;
+}
+
+// The fastest speed the span allows in its direction
+double Trajectory::spanSpeedLimit(const Point &direction) const
+{
+  double horizontal = std::sqrt(direction[0]*direction[0] + direction[1]*direction[1]);
+  double vertical = std::fabs(direction[2]);
+  double limit = std::numeric_limits<double>::max();
+  if (horizontal > 0.0) limit = std::min(limit, max_speed_xy / horizontal);
+  if (vertical > 0.0) limit = std::min(limit, max_speed_z / vertical);
+  return limit;
+}
+
+// Accelerate from v_start to the peak, cruise, and decelerate to v_end.  A span too short to
+// reach the speed limit has a lower peak, and no cruise.
+void Trajectory::profile(Span &span) const
+{
+  double a = max_accel;
+  double v0 = span.v_start;
+  double v1 = span.v_end;
+  double peak = std::sqrt((2 * a * span.length + v0*v0 + v1*v1) / 2);
+  span.v_peak = std::max(std::min(span.v_peak, peak), std::max(v0, v1));
+
+  double d_accel = (span.v_peak*span.v_peak - v0*v0) / (2 * a);
+  double d_decel = (span.v_peak*span.v_peak - v1*v1) / (2 * a);
+  double d_cruise = std::max(span.length - d_accel - d_decel, 0.0);
+
+  span.t_accel = (span.v_peak - v0) / a;
+  span.t_decel = (span.v_peak - v1) / a;
+  span.t_cruise = (span.v_peak > 0.0) ? d_cruise / span.v_peak : 0.0;
+}
+
+void Trajectory::sample(double t, Point &position, Point &velocity) const
+{
+  velocity = Point{{0.0, 0.0, 0.0}};
+  if (spans.empty()) {
+    position = Point{{0.0, 0.0, 0.0}};
+    return;
+  }
+  if (t <= 0.0) {
+    position = spans.front().from;
+    return;
+  }
+
+  // The span t is in.  Few spans are passed per call, so a linear search will do.
+  size_t i = 0;
+  while ((i + 1 < spans.size()) && (t >= spans[i + 1].t_start)) i++;
+  const Span &span = spans[i];
+
+  double a = max_accel;
+  double tau = t - span.t_start;
+  double s, speed;
+  if (tau < span.t_accel) {
+    s = span.v_start * tau + 0.5 * a * tau * tau;
+    speed = span.v_start + a * tau;
+  } else if (tau < span.t_accel + span.t_cruise) {
+    double d_accel = span.v_start * span.t_accel + 0.5 * a * span.t_accel * span.t_accel;
+    s = d_accel + span.v_peak * (tau - span.t_accel);
+    speed = span.v_peak;
+  } else {
+    double d = std::min(tau - span.t_accel - span.t_cruise, span.t_decel);
+    s = span.length - span.v_end * (span.t_decel - d)
+        - 0.5 * a * (span.t_decel - d) * (span.t_decel - d);
+    speed = span.v_peak - a * d;
+  }
+  s = std::min(std::max(s, 0.0), span.length);
+
+  for (int k = 0; k < 3; k++) {
+    position[k] = span.from[k] + span.direction[k] * s;
+    velocity[k] = span.direction[k] * speed;
+  }
+  if (t >= duration()) {
+    velocity = Point{{0.0, 0.0, 0.0}};
+  }
+}
+
+size_t Trajectory::passed(double t) const
+{
+  if (spans.empty()) return point_count;   // All points at the start
+
+  // The points before the end of the first span are where the trajectory starts
+  size_t count = spans.front().point;
+  for (const Span &span : spans) {
+    if (t < span.t_start + span.t_accel + span.t_cruise + span.t_decel) break;
+    count = span.point + 1;
+  }
+  if (t >= duration()) count = point_count;
+  return count;
+}
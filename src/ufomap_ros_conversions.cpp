@@ -42,6 +42,11 @@
 // UFO ROS
 #include "navigation_lite/ufomap_ros_conversions.h"
 
+// STL
+#include <algorithm>
+#include <cstring>
+#include <string>
+
 // ROS
 #include "sensor_msgs/point_cloud2_iterator.hpp"
 
@@ -138,6 +143,74 @@ void rosToUfo(sensor_msgs::msg::PointCloud2 const& cloud_in,
 	}
 }
 
+// Byte offset of a float32 field, or -1
+static int getFloatField(sensor_msgs::msg::PointCloud2 const& cloud, std::string const& name)
+{
+	for (auto const& field : cloud.fields) {
+		if (name == field.name) {
+			if (sensor_msgs::msg::PointField::FLOAT32 != field.datatype || 1 != field.count) {
+				return -1;
+			}
+			return field.offset;
+		}
+	}
+	return -1;
+}
+
+void rosToUfo(sensor_msgs::msg::PointCloud2 const& cloud_in, ufo::math::Pose6 const& transform,
+              ufo::map::PointCloudColor& cloud_out)
+{
+	cloud_out.clear();
+
+	size_t const step = cloud_in.point_step;
+	if (0 == step) {
+		return;  // No points, and the iterators would never reach the end
+	}
+
+	// Fields that do not fit in a point are a malformed cloud, left to the checked iterators
+	int off_x = getFloatField(cloud_in, "x");
+	int off_y = getFloatField(cloud_in, "y");
+	int off_z = getFloatField(cloud_in, "z");
+	auto fits = [step](int offset) { return 0 <= offset && (size_t)offset + sizeof(float) <= step; };
+	if (!fits(off_x) || !fits(off_y) || !fits(off_z) || cloud_in.is_bigendian ||
+	    cloud_in.row_step != cloud_in.width * cloud_in.point_step) {
+		rosToUfo(cloud_in, cloud_out);
+		cloud_out.transform(transform, true);
+		return;
+	}
+
+	// Rotation matrix of the (unit) quaternion, so every point costs 9 multiplications
+	auto const& q = transform.rotation();
+	float const w = q.w(), qx = q.x(), qy = q.y(), qz = q.z();
+	float const r00 = 1 - 2 * (qy * qy + qz * qz), r01 = 2 * (qx * qy - w * qz), r02 = 2 * (qx * qz + w * qy);
+	float const r10 = 2 * (qx * qy + w * qz), r11 = 1 - 2 * (qx * qx + qz * qz), r12 = 2 * (qy * qz - w * qx);
+	float const r20 = 2 * (qx * qz - w * qy), r21 = 2 * (qy * qz + w * qx), r22 = 1 - 2 * (qx * qx + qy * qy);
+	float const tx = transform.translation().x(), ty = transform.translation().y(),
+	            tz = transform.translation().z();
+
+	// Every point is transformed into place, without a branch, and the NaN points are dropped after
+	size_t const count = cloud_in.data.size() / step;
+	cloud_out.resize(count);
+
+	uint8_t const* data = cloud_in.data.data();
+	for (size_t i = 0; i < count; ++i, data += step) {
+		float x, y, z;
+		std::memcpy(&x, data + off_x, sizeof(float));
+		std::memcpy(&y, data + off_y, sizeof(float));
+		std::memcpy(&z, data + off_z, sizeof(float));
+		cloud_out[i] = ufo::map::Point3Color(r00 * x + r01 * y + r02 * z + tx,
+		                                     r10 * x + r11 * y + r12 * z + ty,
+		                                     r20 * x + r21 * y + r22 * z + tz);
+	}
+
+	// A NaN coordinate makes the sum NaN, the only value not equal to itself
+	auto last = std::remove_if(cloud_out.begin(), cloud_out.end(), [](ufo::map::Point3Color const& p) {
+		float const sum = p.x() + p.y() + p.z();
+		return sum != sum;
+	});
+	cloud_out.resize(last - cloud_out.begin());
+}
+
 void ufoToRos(ufo::map::PointCloud const& cloud_in, sensor_msgs::msg::PointCloud2& cloud_out)
 {
 	bool has_x, has_y, has_z, has_rgb;